@@ -3119,8 +3119,27 @@ string CFlyServerInfo::getMediaInfoAsText(const TTHValue& p_tth, int64_t p_file_
 	return l_Infrom;
 }
 //=========================================================================================
-string g_cur_mediainfo_file;
-string g_cur_mediainfo_file_tth;
+// TTH of the file being parsed, for the hash progress dialog - written by the hasher's MediaInfo threads
+static FastCriticalSection g_cur_mediainfo_cs;
+static string g_cur_mediainfo_file_tth;
+static void setCurMediainfoTTH(const string& p_tth)
+{
+	CFlyFastLock(g_cur_mediainfo_cs);
+	g_cur_mediainfo_file_tth = p_tth;
+}
+static void resetCurMediainfoTTH(const string& p_tth)
+{
+	CFlyFastLock(g_cur_mediainfo_cs);
+	if (g_cur_mediainfo_file_tth == p_tth) // another thread may have started a newer file
+	{
+		g_cur_mediainfo_file_tth.clear();
+	}
+}
+string getCurMediainfoTTH()
+{
+	CFlyFastLock(g_cur_mediainfo_cs);
+	return g_cur_mediainfo_file_tth;
+}
 //=========================================================================================
 static void getExtMediaInfo(const string& p_file_ext_wo_dot,
                             int64_t p_size,
@@ -3240,9 +3259,11 @@ bool getMediaInfo(const string& p_name, CFlyMediaInfo& p_media, int64_t p_size,
 	//CFlyCrashReportInformer l_crash_info(L"MediainfoTTH",Text::toT(p_tth.toBase32()).c_str());
 	const auto l_doctor_dump_key = L"Mediainfo";
 #endif
+	string l_cur_mediainfo_file;
 	try
 	{
-		static MediaInfoLib::MediaInfo g_media_info_lib;
+		// one instance per thread - HashManager parses media files on several threads
+		static thread_local MediaInfoLib::MediaInfo g_media_info_lib;
 		if (p_size < SETTING(MIN_MEDIAINFO_SIZE) * 1024 * 1024) // TODO: p_size?
 			return false;
 		const string l_file_ext = Text::toLower(Util::getFileExtWithoutDot(p_name));
@@ -3253,12 +3274,13 @@ bool getMediaInfo(const string& p_name, CFlyMediaInfo& p_media, int64_t p_size,
 		char l_size[22];
 		l_size[0] = 0;
 		_snprintf(l_size, _countof(l_size), "%I64d", p_size);
-		g_cur_mediainfo_file_tth = p_tth.toBase32();
-		g_cur_mediainfo_file = p_name + "\r\n TTH = " + g_cur_mediainfo_file_tth + "\r\n File size = " + string(l_size);
-		Util::setRegistryValueString(FLYLINKDC_REGISTRY_MEDIAINFO_FREEZE_KEY, Text::toT(g_cur_mediainfo_file));
+		const string l_tth = p_tth.toBase32();
+		l_cur_mediainfo_file = p_name + "\r\n TTH = " + l_tth + "\r\n File size = " + string(l_size);
+		setCurMediainfoTTH(l_tth);
+		Util::setRegistryValueString(FLYLINKDC_REGISTRY_MEDIAINFO_FREEZE_KEY, Text::toT(l_cur_mediainfo_file));
 #ifndef _DEBUG
-		g_crashRpt.AddUserInfoToReport(l_doctor_dump_key, Text::toT(g_cur_mediainfo_file).c_str());
-		g_crashRpt.SetCustomInfo(Text::toT(g_cur_mediainfo_file_tth).c_str());
+		g_crashRpt.AddUserInfoToReport(l_doctor_dump_key, Text::toT(l_cur_mediainfo_file).c_str());
+		g_crashRpt.SetCustomInfo(Text::toT(l_tth).c_str());
 #endif
 
 		if (g_media_info_lib.Open(Text::toT(File::formatPath(p_name))))
@@ -3428,8 +3450,7 @@ bool getMediaInfo(const string& p_name, CFlyMediaInfo& p_media, int64_t p_size,
 			}
 			g_media_info_lib.Close();
 		}
-		g_cur_mediainfo_file_tth.clear();
-		g_cur_mediainfo_file.clear();
+		resetCurMediainfoTTH(l_tth);
 		Util::deleteRegistryValue(FLYLINKDC_REGISTRY_MEDIAINFO_FREEZE_KEY);
 #ifndef _DEBUG
 		g_crashRpt.RemoveUserInfoFromReport(l_doctor_dump_key);
@@ -3439,7 +3460,8 @@ bool getMediaInfo(const string& p_name, CFlyMediaInfo& p_media, int64_t p_size,
 	}
 	catch (std::exception& e)
 	{
-		const string l_error = g_cur_mediainfo_file + " TTH:" + p_tth.toBase32() + " MediaInfo-error: " + string(e.what());
+		resetCurMediainfoTTH(p_tth.toBase32());
+		const string l_error = l_cur_mediainfo_file + " TTH:" + p_tth.toBase32() + " MediaInfo-error: " + string(e.what());
 		CFlyServerJSON::pushError(15, "error getmediainfo:" + l_error);
 		Util::setRegistryValueString(FLYLINKDC_REGISTRY_MEDIAINFO_CRASH_KEY, Text::toT(l_error));
 		Util::deleteRegistryValue(FLYLINKDC_REGISTRY_MEDIAINFO_FREEZE_KEY);
@@ -3451,10 +3473,11 @@ bool getMediaInfo(const string& p_name, CFlyMediaInfo& p_media, int64_t p_size,
 	}
 	catch (...)
 	{
+		resetCurMediainfoTTH(p_tth.toBase32());
 		// TODO     SEH -    
 		Util::deleteRegistryValue(FLYLINKDC_REGISTRY_MEDIAINFO_FREEZE_KEY);
-		Util::setRegistryValueString(FLYLINKDC_REGISTRY_MEDIAINFO_CRASH_KEY, Text::toT(g_cur_mediainfo_file + " catch(...) "));
-		CFlyServerJSON::pushError(15, "error getmediainfo[2] " + g_cur_mediainfo_file + " TTH:" + p_tth.toBase32() + " catch(...)");
+		Util::setRegistryValueString(FLYLINKDC_REGISTRY_MEDIAINFO_CRASH_KEY, Text::toT(l_cur_mediainfo_file + " catch(...) "));
+		CFlyServerJSON::pushError(15, "error getmediainfo[2] " + l_cur_mediainfo_file + " TTH:" + p_tth.toBase32() + " catch(...)");
 		throw;
 	}
 #ifndef _DEBUG
@@ -42,6 +42,8 @@ namespace sel {
 class SearchResult;
 
 bool getMediaInfo(const string& p_name, CFlyMediaInfo& p_media, int64_t p_size, const TTHValue& p_tth, bool p_force = false);
+/** TTH of the file getMediaInfo is parsing now (empty - none) */
+string getCurMediainfoTTH();
 //=======================================================================
 #ifdef FLYLINKDC_USE_MEDIAINFO_SERVER
 //=======================================================================
@@ -21,17 +21,17 @@
 
 #include "ClientManager.h"
 
-AdcCommand::AdcCommand(uint32_t aCmd, char aType /* = TYPE_CLIENT */) : m_cmdInt(aCmd), m_from(0), m_type(aType), m_to(0)
+AdcCommand::AdcCommand(uint32_t aCmd, char aType /* = TYPE_CLIENT */) : m_cmdInt(aCmd), m_from(0), m_type(aType), m_to(0), m_is_materialized(false), m_has_spans(false)
 {
 	dcassert(m_cmd[3] == 0);
 	m_cmd[3] = 0;
 }
-AdcCommand::AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType) : m_cmdInt(aCmd), m_from(0), m_to(aTarget), m_type(aType)
+AdcCommand::AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType) : m_cmdInt(aCmd), m_from(0), m_to(aTarget), m_type(aType), m_is_materialized(false), m_has_spans(false)
 {
 	dcassert(m_cmd[3] == 0);
 	m_cmd[3] = 0;
 }
-AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /* = TYPE_CLIENT */) : m_cmdInt(CMD_STA), m_from(0), m_type(aType), m_to(0)
+AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /* = TYPE_CLIENT */) : m_cmdInt(CMD_STA), m_from(0), m_type(aType), m_to(0), m_is_materialized(false), m_has_spans(false)
 {
 	addParam((sev == SEV_SUCCESS && err == SUCCESS) ? "000" : Util::toString(sev * 100 + err));
 	addParam(desc);
@@ -39,7 +39,7 @@ AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /
 	m_cmd[3] = 0;
 }
 
-AdcCommand::AdcCommand(const string& aLine, bool nmdc /* = false */) : m_cmdInt(0), m_type(TYPE_CLIENT)
+AdcCommand::AdcCommand(const string& aLine, bool nmdc /* = false */) : m_cmdInt(0), m_type(TYPE_CLIENT), m_is_materialized(false), m_has_spans(false)
 {
 	parse(aLine, nmdc);
 	dcassert(m_cmd[3] == 0);
@@ -82,10 +82,19 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */)
 		m_from = HUB_SID;
 	}
 	
-	string::size_type len = aLine.length();
+	parameters.clear();
+	m_spans.clear();
+	m_is_materialized = false;
+	m_has_spans = true;
+	
+	const string::size_type len = aLine.length();
 	const char* buf = aLine.c_str();
-	string cur;
-	cur.reserve(128);
+	// Parameters are unescaped in the same pass and written back to back into one buffer
+	// (unescaping never makes a token longer, so the line length is enough).
+	m_buffer.resize(len + 1);
+	char* out = &m_buffer[0];
+	uint32_t l_start = 0;
+	uint32_t l_pos = 0;
 	
 	bool toSet = false;
 	bool featureSet = false;
@@ -100,100 +109,31 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */)
 				if (i == len)
 					throw ParseException("Escape at eol");
 				if (buf[i] == 's')
-					cur += ' ';
+					out[l_pos++] = ' ';
 				else if (buf[i] == 'n')
-					cur += '\n';
+					out[l_pos++] = '\n';
 				else if (buf[i] == '\\')
-					cur += '\\';
+					out[l_pos++] = '\\';
 				else if (buf[i] == ' ' && nmdc) // $ADCGET escaping, leftover from old specs
-					cur += ' ';
+					out[l_pos++] = ' ';
 				else
 					throw ParseException("Unknown escape");
 				break;
 			case ' ':
 				// New parameter...
-			{
-				if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
-				{
-					if (cur.length() != 4)
-					{
-						throw ParseException("Invalid SID length");
-					}
-					m_from = toSID(cur);
-					fromSet = true;
-				}
-				else if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet)
-				{
-					if (cur.length() != 4)
-					{
-						throw ParseException("Invalid SID length");
-					}
-					m_to = toSID(cur);
-					toSet = true;
-				}
-				else if (m_type == TYPE_FEATURE && !featureSet)
-				{
-					if (cur.length() % 5 != 0)
-					{
-						throw ParseException("Invalid feature length");
-					}
-					// Skip...
-					featureSet = true;
-				}
-				else
-				{
-					parameters.push_back(cur);
-					/*
-					if (cur.size() > 2 && cur[0] == 'I' && cur[1] == 'D')
-					{
-					    if (cur.size() == 41)
-					    {
-					        m_CID = CID(cur.substr(2));
-					    }
-					}
-					*/
-				}
-				cur.clear();
-			}
-			break;
+				out[l_pos] = 0;
+				parseToken(l_start, l_pos - l_start, fromSet, toSet, featureSet);
+				l_start = ++l_pos;
+				break;
 			default:
-				cur += buf[i];
+				out[l_pos++] = buf[i];
 		}
 		++i;
 	}
-	if (!cur.empty())
+	if (l_pos != l_start)
 	{
-		if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
-		{
-			if (cur.length() != 4)
-			{
-				throw ParseException("Invalid SID length");
-			}
-			m_from = toSID(cur);
-			fromSet = true;
-		}
-		else if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet)
-		{
-			if (cur.length() != 4)
-			{
-				throw ParseException("Invalid SID length");
-			}
-			m_to = toSID(cur);
-			toSet = true;
-		}
-		else if (m_type == TYPE_FEATURE && !featureSet)
-		{
-			if (cur.length() % 5 != 0)
-			{
-				throw ParseException("Invalid feature length");
-			}
-			// Skip...
-			featureSet = true;
-		}
-		else
-		{
-			parameters.push_back(cur);
-		}
+		out[l_pos] = 0;
+		parseToken(l_start, l_pos - l_start, fromSet, toSet, featureSet);
 	}
 	
 	if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
@@ -212,119 +152,217 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */)
 	}
 }
 
+void AdcCommand::parseToken(uint32_t p_pos, uint32_t p_len, bool& p_fromSet, bool& p_toSet, bool& p_featureSet)
+{
+	const char* l_token = m_buffer.data() + p_pos;
+	if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !p_fromSet)
+	{
+		if (p_len != 4)
+		{
+			throw ParseException("Invalid SID length");
+		}
+		m_from = *reinterpret_cast<const uint32_t*>(l_token);
+		p_fromSet = true;
+	}
+	else if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !p_toSet)
+	{
+		if (p_len != 4)
+		{
+			throw ParseException("Invalid SID length");
+		}
+		m_to = *reinterpret_cast<const uint32_t*>(l_token);
+		p_toSet = true;
+	}
+	else if (m_type == TYPE_FEATURE && !p_featureSet)
+	{
+		if (p_len % 5 != 0)
+		{
+			throw ParseException("Invalid feature length");
+		}
+		// Skip...
+		p_featureSet = true;
+	}
+	else
+	{
+		const ParamSpan l_span = { p_pos, p_len, uint16_t(p_len >= 2 ? toCode(l_token) : 0) };
+		m_spans.push_back(l_span);
+	}
+}
+
+void AdcCommand::materialize() const
+{
+	dcassert(m_has_spans);
+	parameters.clear();
+	parameters.reserve(m_spans.size());
+	for (auto i = m_spans.cbegin(); i != m_spans.cend(); ++i)
+	{
+		parameters.push_back(string(m_buffer.data() + i->m_pos, i->m_len));
+	}
+	m_is_materialized = true;
+}
+
 string AdcCommand::toString(const CID& aCID, bool nmdc /* = false */) const
 {
-	return getHeaderString(aCID) + getParamString(nmdc);
+	string tmp;
+	serialize(tmp, aCID, nmdc);
+	return tmp;
 }
 
 string AdcCommand::toString(uint32_t sid /* = 0 */, bool nmdc /* = false */) const
 {
-	return getHeaderString(sid, nmdc) + getParamString(nmdc);
+	string tmp;
+	serialize(tmp, sid, nmdc);
+	return tmp;
+}
+
+void AdcCommand::serialize(string& p_out, uint32_t sid, bool nmdc /* = false */) const
+{
+	p_out.reserve(p_out.size() + estimateSize());
+	appendHeader(p_out, sid, nmdc);
+	appendParams(p_out, nmdc);
+}
+
+void AdcCommand::serialize(string& p_out, const CID& aCID, bool nmdc /* = false */) const
+{
+	dcassert(m_type == TYPE_UDP);
+	p_out.reserve(p_out.size() + estimateSize() + 40);
+	p_out += getType();
+	p_out += m_cmdChar;
+	p_out += ' ';
+	p_out += aCID.toBase32();
+	appendParams(p_out, nmdc);
+}
+
+size_t AdcCommand::estimateSize() const
+{
+	// header + separators + a little room for the escapes
+	size_t l_size = 16 + features.size();
+	const size_t l_count = getParamCount();
+	for (size_t i = 0; i < l_count; ++i)
+	{
+		l_size += getParamView(i).size() + 1;
+	}
+	return l_size + l_size / 16;
 }
 
 string AdcCommand::escape(const string& str, bool old)
 {
-	string tmp = str;
-	string::size_type i = 0;
-	while ((i = tmp.find_first_of(" \n\\", i)) != string::npos)
+	if (str.find_first_of(" \n\\") == string::npos)
 	{
+		return str;
+	}
+	string tmp;
+	tmp.reserve(str.size() + 16);
+	appendEscaped(tmp, str.data(), str.size(), old);
+	return tmp;
+}
+
+void AdcCommand::appendEscaped(string& p_out, const char* p_data, size_t p_len, bool old)
+{
+	const char* l_end = p_data + p_len;
+	const char* l_plain = p_data;
+	for (const char* i = p_data; i != l_end; ++i)
+	{
+		const char c = *i;
+		if (c != ' ' && c != '\n' && c != '\\')
+		{
+			continue;
+		}
+		p_out.append(l_plain, i);
+		l_plain = i + 1;
+		p_out += '\\';
 		if (old)
 		{
-			tmp.insert(i, "\\");
+			p_out += c;
 		}
 		else
 		{
-			switch (tmp[i])
-			{
-				case ' ':
-					tmp.replace(i, 1, "\\s");
-					break;
-				case '\n':
-					tmp.replace(i, 1, "\\n");
-					break;
-				case '\\':
-					tmp.replace(i, 1, "\\\\");
-					break;
-			}
+			p_out += c == ' ' ? 's' : c == '\n' ? 'n' : '\\';
 		}
-		i += 2;
 	}
-	return tmp;
+	p_out.append(l_plain, l_end);
 }
 
-string AdcCommand::getHeaderString(uint32_t sid, bool nmdc) const
+void AdcCommand::appendHeader(string& p_out, uint32_t sid, bool nmdc) const
 {
-	string tmp;
 	if (nmdc)
 	{
-		tmp += "$ADC";
+		p_out += "$ADC";
 	}
 	else
 	{
-		tmp += getType();
+		p_out += getType();
 	}
 	
-	tmp += m_cmdChar;
+	p_out += m_cmdChar;
 	
 	if (m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE)
 	{
-		tmp += ' ';
-		tmp += fromSID(sid);
+		p_out += ' ';
+		p_out.append(reinterpret_cast<const char*>(&sid), sizeof(sid));
 	}
 	
 	if (m_type == TYPE_DIRECT || m_type == TYPE_ECHO)
 	{
-		tmp += ' ';
-		tmp += fromSID(m_to);
+		p_out += ' ';
+		p_out.append(reinterpret_cast<const char*>(&m_to), sizeof(m_to));
 	}
 	
 	if (m_type == TYPE_FEATURE)
 	{
-		tmp += ' ';
-		tmp += features;
+		p_out += ' ';
+		p_out += features;
 	}
-	return tmp;
 }
 
-string AdcCommand::getHeaderString(const CID& cid) const
+void AdcCommand::appendParams(string& p_out, bool nmdc) const
 {
-	dcassert(m_type == TYPE_UDP);
-	string tmp;
-	tmp.reserve(44);
-	tmp += getType();
-	tmp += m_cmdChar;
-	tmp += ' ';
-	tmp += cid.toBase32();
-	return tmp;
-}
-
-string AdcCommand::getParamString(bool nmdc) const
-{
-	string tmp;
-	tmp.reserve(65);
-	for (auto i = getParameters().cbegin(); i != getParameters().cend(); ++i)
+	const size_t l_count = getParamCount();
+	for (size_t i = 0; i < l_count; ++i)
 	{
-		tmp += ' ';
-		tmp += escape(*i, nmdc);
+		const auto l_param = getParamView(i);
+		p_out += ' ';
+		appendEscaped(p_out, l_param.data(), l_param.size(), nmdc);
 	}
 	if (nmdc)
 	{
-		tmp += '|';
+		p_out += '|';
 	}
 	else
 	{
-		tmp += '\n';
+		p_out += '\n';
 	}
+}
+
+string AdcCommand::getParamString(bool nmdc) const
+{
+	string tmp;
+	tmp.reserve(estimateSize());
+	appendParams(tmp, nmdc);
 	return tmp;
 }
 
 bool AdcCommand::getParam(const char* name, size_t start, string& ret) const
 {
-	for (string::size_type i = start; i < getParameters().size(); ++i)
+	const uint16_t l_code = toCode(name);
+	if (m_has_spans)
 	{
-		if (toCode(name) == toCode(getParameters()[i].c_str()))
+		for (size_t i = start; i < m_spans.size(); ++i)
 		{
-			ret = getParameters()[i].substr(2);
+			const auto& l_span = m_spans[i];
+			if (l_span.m_code == l_code)
+			{
+				ret.assign(m_buffer.data() + l_span.m_pos + 2, l_span.m_len - 2);
+				return true;
+			}
+		}
+		return false;
+	}
+	for (string::size_type i = start; i < parameters.size(); ++i)
+	{
+		if (l_code == toCode(parameters[i].c_str()))
+		{
+			ret = parameters[i].substr(2);
 			return true;
 		}
 	}
@@ -333,11 +371,24 @@ bool AdcCommand::getParam(const char* name, size_t start, string& ret) const
 
 bool AdcCommand::hasFlag(const char* name, size_t start) const
 {
-	for (string::size_type i = start; i < getParameters().size(); ++i)
+	const uint16_t l_code = toCode(name);
+	if (m_has_spans)
+	{
+		for (size_t i = start; i < m_spans.size(); ++i)
+		{
+			const auto& l_span = m_spans[i];
+			if (l_span.m_code == l_code && l_span.m_len == 3 && m_buffer[l_span.m_pos + 2] == '1')
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	for (string::size_type i = start; i < parameters.size(); ++i)
 	{
-		if (toCode(name) == toCode(getParameters()[i].c_str()) &&
-		        getParameters()[i].size() == 3 &&
-		        getParameters()[i][2] == '1')
+		if (l_code == toCode(parameters[i].c_str()) &&
+		        parameters[i].size() == 3 &&
+		        parameters[i][2] == '1')
 		{
 			return true;
 		}
@@ -165,33 +165,109 @@ class AdcCommand
 			return *this;
 		}
 		
+		/** Read-only window into a parameter of the parsed line: no allocation, data is always '\0' terminated */
+		class ParamView
+		{
+			public:
+				ParamView(const char* p_data, size_t p_len) : m_data(p_data), m_len(p_len)
+				{
+				}
+				const char* c_str() const
+				{
+					return m_data;
+				}
+				const char* data() const
+				{
+					return m_data;
+				}
+				size_t length() const
+				{
+					return m_len;
+				}
+				size_t size() const
+				{
+					return m_len;
+				}
+				bool empty() const
+				{
+					return m_len == 0;
+				}
+				char operator[](size_t p_pos) const
+				{
+					dcassert(p_pos <= m_len);
+					return m_data[p_pos];
+				}
+				string substr(size_t p_pos) const
+				{
+					dcassert(p_pos <= m_len);
+					return p_pos < m_len ? string(m_data + p_pos, m_len - p_pos) : Util::emptyString;
+				}
+				string str() const
+				{
+					return string(m_data, m_len);
+				}
+				bool isCode(const char* p_name) const
+				{
+					return m_len >= 2 && m_data[0] == p_name[0] && m_data[1] == p_name[1];
+				}
+			private:
+				const char* m_data;
+				size_t m_len;
+		};
+		
+		/** Parameters of a parsed command are kept as offsets into one buffer.
+		    The non-const getParameters() converts them into a StringList (it can be changed by the caller). */
 		StringList& getParameters()
 		{
+			detach();
 			return parameters;
 		}
 		const StringList& getParameters() const
 		{
+			if (m_has_spans && !m_is_materialized)
+			{
+				materialize();
+			}
 			return parameters;
 		}
+		size_t getParamCount() const
+		{
+			return m_has_spans ? m_spans.size() : parameters.size();
+		}
+		ParamView getParamView(size_t n) const
+		{
+			dcassert(getParamCount() > n);
+			if (m_has_spans)
+			{
+				const auto& l_span = m_spans[n];
+				return ParamView(m_buffer.data() + l_span.m_pos, l_span.m_len);
+			}
+			return ParamView(parameters[n].c_str(), parameters[n].size());
+		}
 		
 		string toString(const CID& aCID, bool nmdc = false) const;
 		string toString(uint32_t sid, bool nmdc = false) const;
+		/** Appends the whole command to p_out (the buffer can be reused between calls) */
+		void serialize(string& p_out, uint32_t sid, bool nmdc = false) const;
+		void serialize(string& p_out, const CID& aCID, bool nmdc = false) const;
 		
 		AdcCommand& addParam(const string& name, const string& value)
 		{
+			detach();
 			parameters.push_back(name);
 			parameters.back() += value;
 			return *this;
 		}
 		AdcCommand& addParam(const string& str)
 		{
+			detach();
 			parameters.push_back(str);
 			return *this;
 		}
 		const string getParam(size_t n) const //   -  .
 		{
-			dcassert(getParameters().size() > n);
-			return getParameters().size() > n ? getParameters()[n] : Util::emptyString;
+			dcassert(getParamCount() > n);
+			return getParamCount() > n ? getParamView(n).str() : Util::emptyString;
 		}
 		/** Return a named parameter where the name is a two-letter code */
 		bool getParam(const char* name, size_t start, string& ret) const;
@@ -207,6 +283,7 @@ class AdcCommand
 		}
 		
 		static string escape(const string& str, bool old);
+		static void appendEscaped(string& p_out, const char* p_data, size_t p_len, bool old);
 		uint32_t getTo() const
 		{
 			return m_to;
@@ -245,9 +322,35 @@ class AdcCommand
 		string getParamString(bool nmdc) const;
 		
 	private:
-		string getHeaderString(const CID& cid) const;
-		string getHeaderString(uint32_t sid, bool nmdc) const;
-		StringList parameters;
+		void appendHeader(string& p_out, uint32_t sid, bool nmdc) const;
+		void appendParams(string& p_out, bool nmdc) const;
+		size_t estimateSize() const;
+		void parseToken(uint32_t p_pos, uint32_t p_len, bool& p_fromSet, bool& p_toSet, bool& p_featureSet);
+		void materialize() const;
+		void detach()
+		{
+			if (m_has_spans)
+			{
+				if (!m_is_materialized)
+				{
+					materialize();
+				}
+				m_has_spans = false;
+				m_spans.clear();
+				m_buffer.clear();
+			}
+		}
+		struct ParamSpan
+		{
+			uint32_t m_pos;
+			uint32_t m_len;
+			uint16_t m_code; // first two chars - for getParam(name) / hasFlag(name)
+		};
+		std::vector<ParamSpan> m_spans;
+		string m_buffer; // unescaped parameters of the parsed line, every one is '\0' terminated
+		mutable StringList parameters;
+		mutable bool m_is_materialized;
+		bool m_has_spans;
 		string features;
 		union
 		{
@@ -233,7 +233,7 @@ void AdcHub::clearUsers()
 
 void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 	{
 		dcassert(0);
 		return;
@@ -292,70 +292,72 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 	PROFILE_THREAD_SCOPED_DESC("getParameters")
 	string l_ip4;
 	string l_ip6;
-	for (auto i = c.getParameters().cbegin(); i != c.getParameters().cend(); ++i)
+	const size_t l_count = c.getParamCount();
+	for (size_t j = 0; j < l_count; ++j)
 	{
-		if (i->length() < 2)
+		const AdcCommand::ParamView l_param = c.getParamView(j);
+		if (l_param.length() < 2)
 		{
 			dcassert(0);
 			continue;
 		}
 		// [+] brain-ripper
-		switch (*(short*)i->c_str())
+		switch (*(short*)l_param.c_str())
 		{
 			case TAG('S', 'L'):
 			{
-				id.setSlots(Util::toInt(i->c_str() + 2));
+				id.setSlots(Util::toInt(l_param.c_str() + 2));
 				break;
 			}
 			case TAG('F', 'S'):
 			{
-				id.setFreeSlots(Util::toInt(i->c_str() + 2));
+				id.setFreeSlots(Util::toInt(l_param.c_str() + 2));
 				break;
 			}
 			case TAG('S', 'S'):
 			{
-				changeBytesSharedL(id, Util::toInt64(i->c_str() + 2));
+				changeBytesSharedL(id, Util::toInt64(l_param.c_str() + 2));
 				break;
 			}
 			// [+] IRainman fix.
 			case TAG('S', 'U'):
 			{
-				AdcSupports::setSupports(id, i->substr(2));
+				AdcSupports::setSupports(id, l_param.substr(2));
 				break;
 			}
 			case TAG('S', 'F'):
 			{
-				id.setSharedFiles(Util::toInt(i->c_str() + 2));
+				id.setSharedFiles(Util::toInt(l_param.c_str() + 2));
 				break;
 			}
 			case TAG('I', '4'):
 			{
-				l_ip4 = i->substr(2);
+				l_ip4 = l_param.substr(2);
 				break;
 			}
 			case TAG('U', '4'):
 			{
-				id.setUdpPort(Util::toInt(i->substr(2)));
+				id.setUdpPort(Util::toInt(l_param.substr(2)));
 				break;
 			}
 			case TAG('I', '6'):
 			{
-				l_ip6 = i->substr(2);
+				l_ip6 = l_param.substr(2);
 				break;
 			}
 			case TAG('U', '6'):
 			{
-				id.setUdpPort(Util::toInt(i->substr(2)));
+				id.setUdpPort(Util::toInt(l_param.substr(2)));
 				break;
 			}
 			case TAG('E', 'M'):
 			{
-				id.setEmail(i->substr(2));
+				id.setEmail(l_param.substr(2));
 				break;
 			}
 			case TAG('D', 'E'):
 			{
-				id.setDescription(i->substr(2));
+				id.setDescription(l_param.substr(2));
 				break;
 			}
 			case TAG('C', 'O'):
@@ -371,7 +373,7 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 			}
 			case TAG('D', 'S'):
 			{
-				id.setDownloadSpeed(Util::toUInt32(i->c_str() + 2));
+				id.setDownloadSpeed(Util::toUInt32(l_param.c_str() + 2));
 				break;
 			}
 			case TAG('O', 'P'):
@@ -383,32 +385,32 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 			// [~] IRainman fix.
 			case TAG('C', 'T'):
 			{
-				id.setClientType(Util::toInt(i->c_str() + 2));
+				id.setClientType(Util::toInt(l_param.c_str() + 2));
 				break;
 			}
 			case TAG('U', 'S'):
 			{
-				id.setLimit(Util::toUInt32(i->c_str() + 2));
+				id.setLimit(Util::toUInt32(l_param.c_str() + 2));
 				break;
 			}
 			case TAG('H', 'N'):
 			{
-				id.setHubNormal(i->c_str() + 2);
+				id.setHubNormal(l_param.c_str() + 2);
 				break;
 			}
 			case TAG('H', 'R'):
 			{
-				id.setHubRegister(i->c_str() + 2);
+				id.setHubRegister(l_param.c_str() + 2);
 				break;
 			}
 			case TAG('H', 'O'):
 			{
-				id.setHubOperator(i->c_str() + 2);
+				id.setHubOperator(l_param.c_str() + 2);
 				break;
 			}
 			case TAG('N', 'I'):
 			{
-				id.setNick(i->substr(2));
+				id.setNick(l_param.substr(2));
 				break;
 			}
 			case TAG('A', 'W'): // [+] IRainman fix: away mode.
@@ -419,18 +421,18 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 #ifdef _DEBUG
 			case TAG('V', 'E'):
 			{
-				id.setStringParam("VE", i->substr(2));
+				id.setStringParam("VE", l_param.substr(2));
 				break;
 			}
 			case TAG('A', 'P'):
 			{
-				id.setStringParam("AP", i->substr(2));
+				id.setStringParam("AP", l_param.substr(2));
 				break;
 			}
 #endif
 			default:
 			{
-				id.setStringParam(i->c_str(), i->substr(2));
+				id.setStringParam(l_param.c_str(), l_param.substr(2));
 			}
 		}
 	}
@@ -473,18 +475,19 @@ void AdcHub::handle(AdcCommand::SUP, const AdcCommand& c) noexcept
 		return;
 	bool baseOk = false;
 	bool tigrOk = false;
-	for (auto i = c.getParameters().cbegin(); i != c.getParameters().cend(); ++i)
+	for (size_t i = 0; i < c.getParamCount(); ++i)
 	{
-		if (*i == AdcSupports::BAS0_SUPPORT)
+		const auto l_param = c.getParamView(i);
+		if (AdcSupports::BAS0_SUPPORT.compare(0, string::npos, l_param.data(), l_param.size()) == 0)
 		{
 			baseOk = true;
 			tigrOk = true;
 		}
-		else if (*i == AdcSupports::BASE_SUPPORT)
+		else if (AdcSupports::BASE_SUPPORT.compare(0, string::npos, l_param.data(), l_param.size()) == 0)
 		{
 			baseOk = true;
 		}
-		else if (*i == AdcSupports::TIGR_SUPPORT)
+		else if (AdcSupports::TIGR_SUPPORT.compare(0, string::npos, l_param.data(), l_param.size()) == 0)
 		{
 			tigrOk = true;
 		}
@@ -512,7 +515,7 @@ void AdcHub::handle(AdcCommand::SID, const AdcCommand& c) noexcept
 		return;
 	}
 	
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 		
 	m_sid = AdcCommand::toSID(c.getParam(0));
@@ -528,7 +531,7 @@ void AdcHub::handle(AdcCommand::MSG, const AdcCommand& c) noexcept
 		return;
 	}
 	
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 	auto l_user = findUser(c.getFrom());
 	if (!l_user)
@@ -571,7 +574,7 @@ void AdcHub::handle(AdcCommand::MSG, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::GPA, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 	m_salt = c.getParam(0);
 	state = STATE_VERIFY;
@@ -648,7 +651,7 @@ void AdcHub::handle(AdcCommand::CTM, const AdcCommand& c) noexcept
 	OnlineUserPtr ou = findUser(c.getFrom()); // [!] IRainman fix.
 	if (isMeCheck(ou))
 		return;
-	if (c.getParameters().size() < 3)
+	if (c.getParamCount() < 3)
 		return;
 		
 	const string& protocol = c.getParam(0);
@@ -695,7 +698,7 @@ void AdcHub::handle(AdcCommand::ZON, const AdcCommand& /*c*/) noexcept
 
 void AdcHub::handle(AdcCommand::RCM, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 2)
+	if (c.getParamCount() < 2)
 	{
 		return;
 	}
@@ -740,7 +743,7 @@ void AdcHub::handle(AdcCommand::RCM, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::CMD, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 1)
+	if (c.getParamCount() < 1)
 		return;
 	const string& l_name = c.getParam(0);
 	bool rem = c.hasFlag("RM", 1);
@@ -813,7 +816,7 @@ void AdcHub::sendUDP(const AdcCommand& cmd) noexcept
 
 void AdcHub::handle(AdcCommand::STA, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 2)
+	if (c.getParamCount() < 2)
 		return;
 		
 	OnlineUserPtr ou;
@@ -928,9 +931,9 @@ void AdcHub::handle(AdcCommand::PSR, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::GET, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 5)
+	if (c.getParamCount() < 5)
 	{
-		if (!c.getParameters().empty())
+		if (c.getParamCount() != 0)
 		{
 			if (c.getParam(0) == "blom")
 			{
@@ -1006,7 +1009,7 @@ void AdcHub::handle(AdcCommand::NAT, const AdcCommand& c) noexcept
 		return;
 		
 	OnlineUserPtr ou = findUser(c.getFrom()); // [!] IRainman fix.
-	if (isMeCheck(ou) || c.getParameters().size() < 3) // [!] IRainman fix.
+	if (isMeCheck(ou) || c.getParamCount() < 3) // [!] IRainman fix.
 		return;
 		
 	const string& protocol = c.getParam(0);
@@ -1047,7 +1050,7 @@ void AdcHub::handle(AdcCommand::RNT, const AdcCommand& c) noexcept
 		return;
 		
 	OnlineUserPtr ou = findUser(c.getFrom()); // [!] IRainman fix.
-	if (isMeCheck(ou) || c.getParameters().size() < 3)// [!] IRainman fix.
+	if (isMeCheck(ou) || c.getParamCount() < 3)// [!] IRainman fix.
 		return;
 		
 	const string& protocol = c.getParam(0);
@@ -1341,6 +1344,7 @@ void AdcHub::search_token(const SearchParamToken& p_search_param)
 	
 	//dcassert(aToken);
 	cmd.addParam("TO", Util::toString(p_search_param.m_token));
+	SearchManager::getInstance()->onSearchSent(p_search_param.m_token);
 	
 	if (p_search_param.m_file_type == Search::TYPE_TTH)
 	{
@@ -1673,7 +1677,7 @@ void AdcHub::info(bool p_force)
 	
 	addParam(c, "SU", su);
 	
-	if (!c.getParameters().empty())
+	if (c.getParamCount() != 0)
 	{
 		send(c);
 	}
@@ -34,6 +34,7 @@
 #include "DebugManager.h"
 #include "SSLSocket.h"
 #include "UserConnection.h"
+#include "CFlyLineFramer.h"
 #include "../FlyFeatures/flyServer.h"
 
 // Polling is used for tasks...should be fixed...
@@ -292,21 +293,22 @@ void BufferedSocket::threadAccept()
 	}
 }
 
-bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separator, const string& p_line,
+bool BufferedSocket::all_search_parser(const string& p_buf, string::size_type p_start, string::size_type p_len,
                                        CFlySearchArrayTTH& p_tth_search,
                                        CFlySearchArrayFile& p_file_search)
 {
 	// dcassert(m_is_disconnecting == false);
 	if (m_is_disconnecting == true)
 		return false;
-	if (p_line.size() < 8)
+	if (p_len < 8)
 		return false;
-	if (p_line.compare(0, 2, "$S", 2) != 0)
+	const char* l_line = p_buf.c_str() + p_start;
+	if (l_line[0] != '$' || l_line[1] != 'S')
 		return false;
 	if (ShareManager::g_is_initial == true)
 	{
 #ifdef _DEBUG
-		LogManager::message("[ShareManager::g_is_initial] BufferedSocket::all_search_parser p_line = " + p_line);
+		LogManager::message("[ShareManager::g_is_initial] BufferedSocket::all_search_parser p_line = " + p_buf.substr(p_start, p_len));
 #endif
 		return true;
 	}
@@ -314,12 +316,12 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	{
 		return true;
 	}
-	if (p_line.compare(2, 6, "earch ", 6) == 0)
+	if (memcmp(l_line + 2, "earch ", 6) == 0)
 	{
 #ifndef _DEBUG
 		const
 #endif
-		string l_line_item = p_line.substr(0, p_pos_next_separator);
+		string l_line_item = p_buf.substr(p_start, p_len);
 		auto l_marker_tth = l_line_item.find("?0?9?TTH:");
 		// TODO      
 		// "x.x.x.x:yyy T?F?57671680?9?TTH:A3VSWSWKCVC4N6EP2GX47OEMGT5ZL52BOS2LAHA"
@@ -471,16 +473,16 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	}
 	else
 	{
-		if (p_line.size() >= 45 && p_line[3] == ' ' && (p_line[2] == 'P' || p_line[2] == 'A') && p_line[43] == ' ')
+		if (p_len >= 44 && l_line[3] == ' ' && (l_line[2] == 'P' || l_line[2] == 'A') && l_line[43] == ' ')
 		{
-			const TTHValue l_tth(p_line.c_str() + 4, 39);
+			const TTHValue l_tth(l_line + 4, 39);
 			if (ShareManager::isUnknownTTH(l_tth) == false)
 			{
-				const auto l_end_cmd = p_line.find('|', 43);
-				if (l_end_cmd != string::npos)
+				const auto l_end_cmd = p_buf.find('|', p_start + 43);
+				if (l_end_cmd != string::npos && l_end_cmd <= p_start + p_len)
 				{
-					string l_search_str = p_line.substr(44, l_end_cmd - 44);
-					if (p_line[2] == 'P')
+					string l_search_str = p_buf.substr(p_start + 44, l_end_cmd - p_start - 44);
+					if (l_line[2] == 'P')
 						l_search_str = "Hub:" + l_search_str;
 					dcassert(l_search_str.size() > 4);
 					if (l_search_str.size() > 4)
@@ -491,7 +493,7 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 			}
 			else
 			{
-				string l_line_item = p_line.substr(0, p_pos_next_separator);
+				const string l_line_item = p_buf.substr(p_start, p_len);
 				COMMAND_DEBUG("[TTHS][FastSkip]" + l_line_item, DebugTask::HUB_IN, getServerAndPort());
 #ifdef _DEBUG
 				//  LogManager::message("BufferedSocket::all_search_parser Skip unknown TTH = " + l_tth.toBase32());
@@ -503,10 +505,11 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	}
 	return false;
 }
-void BufferedSocket::all_myinfo_parser(const string::size_type p_pos_next_separator, const string& p_line, StringList& p_all_myInfo, bool p_is_zon)
+void BufferedSocket::all_myinfo_parser(const string& p_buf, string::size_type p_start, string::size_type p_len, StringList& p_all_myInfo, bool p_is_zon)
 {
-	const bool l_is_MyINFO = m_is_all_my_info_loaded == false ? p_line.compare(0, 8, "$MyINFO ", 8) == 0 : false;
-	const string l_line_item = l_is_MyINFO ? p_line.substr(8, p_pos_next_separator - 8) : p_line.substr(0, p_pos_next_separator);
+	const bool l_is_MyINFO = m_is_all_my_info_loaded == false ? p_len >= 8 && p_buf.compare(p_start, 8, "$MyINFO ", 8) == 0 : false;
+	// the only copy of the command
+	const string l_line_item = l_is_MyINFO ? p_buf.substr(p_start + 8, p_len - 8) : p_buf.substr(p_start, p_len);
 	if (m_is_all_my_info_loaded == false)
 	{
 		if (l_is_MyINFO)
@@ -647,7 +650,6 @@ void BufferedSocket::threadRead()
 			throw SocketException(STRING(CONNECTION_CLOSED));
 		}
 		
-		string::size_type l_pos = 0;
 		// always uncompressed data
 		string l;
 		int l_bufpos = 0;
@@ -667,7 +669,6 @@ void BufferedSocket::threadRead()
 				{
 					const int BUF_SIZE = 1024;
 					// Special to autodetect nmdc connections...
-					string::size_type l_zpos = 0; //  warning C6246: Local declaration of 'pos' hides declaration of the same name in outer scope.
 					std::unique_ptr<char[]> buffer(new char[BUF_SIZE]);
 					l = m_line;
 					// decompress all input data and store in l.
@@ -698,17 +699,16 @@ void BufferedSocket::threadRead()
 						StringList l_all_myInfo;
 						CFlySearchArrayTTH l_tth_search;
 						CFlySearchArrayFile l_file_search;
-						while ((l_zpos = l.find(m_separator)) != string::npos)
+						string::size_type l_line_start = 0;
+						CFlyLineFramer::split(l, m_separator, l_line_start, [&](string::size_type p_start, string::size_type p_len) -> bool
 						{
-							if (l_zpos > 0) // check empty (only pipe) command and don't waste cpu with it ;o)
+							if (all_search_parser(l, p_start, p_len, l_tth_search, l_file_search) == false)
 							{
-								if (all_search_parser(l_zpos, l, l_tth_search, l_file_search) == false)
-								{
-									all_myinfo_parser(l_zpos, l, l_all_myInfo, true);
-								}
+								all_myinfo_parser(l, p_start, p_len, l_all_myInfo, true);
 							}
-							l.erase(0, l_zpos + 1 /* separator char */); //[3] https://www.box.net/shared/74efa5b96079301f7194
-						}
+							return true;
+						});
+						l.erase(0, l_line_start); //[3] https://www.box.net/shared/74efa5b96079301f7194
 						parseMyINfo(l_all_myInfo);
 						parseSearch(l_tth_search, l_file_search);
 #else
@@ -752,59 +752,47 @@ void BufferedSocket::threadRead()
 					//   -    
 					//   -   UDP (  ?)
 					//======================================================================
-					l = m_line + string((char*)& m_inbuf[l_bufpos], l_left);
+					l.swap(m_line);
+					l.append((char*)& m_inbuf[l_bufpos], l_left);
 					//dcassert(isalnum(l[0]) || isalpha(l[0]) || isascii(l[0]));
-#if 0
-					int l_count_separator = 0;
-#endif
 #ifdef _DEBUG
 					//LogManager::message("MODE_LINE . m_line = " + m_line);
 					//LogManager::message("MODE_LINE = " + l);
 #endif
+					bool l_is_mode_changed = false;
 					if (!ClientManager::isBeforeShutdown())
 					{
 						StringList l_all_myInfo;
 						CFlySearchArrayTTH l_tth_search;
 						CFlySearchArrayFile l_file_search;
-						while ((l_pos = l.find(m_separator)) != string::npos)
+						string::size_type l_line_start = 0;
+						l_is_mode_changed = !CFlyLineFramer::split(l, m_separator, l_line_start, [&](string::size_type p_start, string::size_type p_len) -> bool
 						{
-#if 0
-							if (l_count_separator++ && l.length() > 0 && BOOLSETTING(LOG_PROTOCOL))
-							{
-								StringMap params;
-								const string l_log = "MODE_LINE l_count_separator = " + Util::toString(l_count_separator) + " l_left = " + Util::toString(l_left) + " l.length()=" + Util::toString(l.length()) + " l = " + l;
-								LogManager::message(l_log);
-							}
-#endif
 							if (ClientManager::isBeforeShutdown())
 							{
 								m_line.clear();
 								throw SocketException(STRING(COMMAND_SHUTDOWN_IN_PROGRESS));
 							}
-							if (l_pos > 0) // check empty (only pipe) command and don't waste cpu with it ;o)
-							{
-								if (all_search_parser(l_pos, l, l_tth_search, l_file_search) == false)
-								{
-									all_myinfo_parser(l_pos, l, l_all_myInfo, false);
-								}
-							}
-							l.erase(0, l_pos + 1 /* separator char */);
-							// TODO - erase  .
-							if (l.length() < (size_t)l_left)
+							if (all_search_parser(l, p_start, p_len, l_tth_search, l_file_search) == false)
 							{
-								l_left = l.length();
+								all_myinfo_parser(l, p_start, p_len, l_all_myInfo, false);
 							}
-							//dcassert(mode == MODE_LINE);
-							if (m_mode != MODE_LINE)
+							const size_t l_rest = l.length() - (p_start + p_len + 1 /* separator char */);
+							if (l_rest < (size_t)l_left)
 							{
-								// dcassert(mode == MODE_LINE);
-								// TOOD ? m_myInfoStop = true;
-								// we changed mode; remainder of l is invalid.
-								l.clear();
-								l_bufpos = l_total - l_left;
-								break;
+								l_left = int(l_rest);
 							}
+							return m_mode == MODE_LINE;
+						});
+						if (l_is_mode_changed)
+						{
+							// TOOD ? m_myInfoStop = true;
+							// we changed mode; remainder of l is invalid.
+							l.clear();
+							l_line_start = 0;
+							l_bufpos = l_total - l_left;
 						}
+						l.erase(0, l_line_start);
 						parseMyINfo(l_all_myInfo);
 						parseSearch(l_tth_search, l_file_search);
 					}
@@ -817,16 +805,15 @@ void BufferedSocket::threadRead()
 						l.clear();
 						l_bufpos = l_total - l_left;
 						l_left = 0;
-						l_pos = string::npos;
 						m_line.clear();
 						throw SocketException(STRING(COMMAND_SHUTDOWN_IN_PROGRESS));
 					}
 					
-					if (l_pos == string::npos)
+					if (!l_is_mode_changed)
 					{
 						l_left = 0;
 					}
-					m_line = l;
+					m_line.swap(l);
 					break;
 				}
 				case MODE_DATA:
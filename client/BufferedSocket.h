@@ -206,8 +206,9 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 			return getIp() + ':' + Util::toString(getPort());
 		}
 		
-		void all_myinfo_parser(const string::size_type p_pos_next_separator, const string& p_line, StringList& p_all_myInfo, bool p_is_zon);
-		bool all_search_parser(const string::size_type p_pos_next_separator, const string& p_line,
+		/** The command is p_buf[p_start, p_start + p_len), the separator follows it (see CFlyLineFramer) */
+		void all_myinfo_parser(const string& p_buf, string::size_type p_start, string::size_type p_len, StringList& p_all_myInfo, bool p_is_zon);
+		bool all_search_parser(const string& p_buf, string::size_type p_start, string::size_type p_len,
 		                       CFlySearchArrayTTH& p_tth_search,
 		                       CFlySearchArrayFile& p_file_search);
 		char m_separator;
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_BANDWIDTH_SPLIT_H
+#define CFLY_BANDWIDTH_SPLIT_H
+
+#include <algorithm>
+#include <stdint.h>
+
+/**
+ * Splits a speed limit between DC and BitTorrent (ThrottleManager::rebalance).
+ * Each side is guaranteed its weighted share. Half of the part of a share a side does not use is lent
+ * to the other side, the other half is the headroom the lender needs to speed up - the next rebalance
+ * takes the loan back as its speed grows. The limits never add up to more than the budget
+ * (except the MIN_LIMIT floors of a budget below 2 * MIN_LIMIT).
+ */
+class CFlyBandwidthSplit
+{
+	public:
+		enum
+		{
+			MIN_LIMIT = 1024 // 0 means "unlimited" for libtorrent and "no tokens" for us
+		};
+		static void split(int64_t p_budget, int p_torrent_weight, int64_t p_dc_speed, int64_t p_torrent_speed, int64_t& p_dc_limit, int64_t& p_torrent_limit)
+		{
+			if (p_budget <= 0)
+			{
+				p_dc_limit = 0;
+				p_torrent_limit = 0;
+				return;
+			}
+			const int64_t l_torrent_share = p_budget * p_torrent_weight / 100;
+			const int64_t l_dc_share = p_budget - l_torrent_share;
+			const int64_t l_dc_lent = std::max<int64_t>(l_dc_share - p_dc_speed, 0) / 2;
+			const int64_t l_torrent_lent = std::max<int64_t>(l_torrent_share - p_torrent_speed, 0) / 2;
+			p_dc_limit = l_dc_share - l_dc_lent + l_torrent_lent;
+			p_torrent_limit = l_torrent_share - l_torrent_lent + l_dc_lent;
+			// the floor of one side is paid by the other one
+			if (p_dc_limit < MIN_LIMIT)
+			{
+				p_torrent_limit -= MIN_LIMIT - p_dc_limit;
+				p_dc_limit = MIN_LIMIT;
+			}
+			if (p_torrent_limit < MIN_LIMIT)
+			{
+				p_dc_limit = std::max<int64_t>(p_dc_limit - (MIN_LIMIT - p_torrent_limit), MIN_LIMIT);
+				p_torrent_limit = MIN_LIMIT;
+			}
+		}
+};
+
+#endif // CFLY_BANDWIDTH_SPLIT_H
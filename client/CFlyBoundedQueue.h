@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_BOUNDED_QUEUE_H
+#define CFLY_BOUNDED_QUEUE_H
+
+#include <memory>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+/**
+ * Bounded lock-free queue for many producers and many consumers
+ * (D. Vyukov's array based algorithm). Capacity is rounded up to a power of two.
+ * push() never blocks - it returns false when the queue is full so the caller decides what to drop.
+ */
+template<typename T>
+class CFlyBoundedQueue : boost::noncopyable
+{
+	public:
+		explicit CFlyBoundedQueue(size_t p_capacity) : m_mask(roundCapacity(p_capacity) - 1), m_cells(new Cell[m_mask + 1]), m_enqueue_pos(0), m_dequeue_pos(0)
+		{
+			for (size_t i = 0; i <= m_mask; ++i)
+			{
+				m_cells[i].m_sequence.store(i, boost::memory_order_relaxed);
+			}
+		}
+
+		bool push(T&& p_value)
+		{
+			Cell* l_cell;
+			size_t l_pos = m_enqueue_pos.load(boost::memory_order_relaxed);
+			for (;;)
+			{
+				l_cell = &m_cells[l_pos & m_mask];
+				const size_t l_seq = l_cell->m_sequence.load(boost::memory_order_acquire);
+				const intptr_t l_dif = intptr_t(l_seq) - intptr_t(l_pos);
+				if (l_dif == 0)
+				{
+					if (m_enqueue_pos.compare_exchange_weak(l_pos, l_pos + 1, boost::memory_order_relaxed))
+						break;
+				}
+				else if (l_dif < 0)
+				{
+					return false; // full
+				}
+				else
+				{
+					l_pos = m_enqueue_pos.load(boost::memory_order_relaxed);
+				}
+			}
+			l_cell->m_data = std::move(p_value);
+			l_cell->m_sequence.store(l_pos + 1, boost::memory_order_release);
+			return true;
+		}
+
+		bool pop(T& p_value)
+		{
+			Cell* l_cell;
+			size_t l_pos = m_dequeue_pos.load(boost::memory_order_relaxed);
+			for (;;)
+			{
+				l_cell = &m_cells[l_pos & m_mask];
+				const size_t l_seq = l_cell->m_sequence.load(boost::memory_order_acquire);
+				const intptr_t l_dif = intptr_t(l_seq) - intptr_t(l_pos + 1);
+				if (l_dif == 0)
+				{
+					if (m_dequeue_pos.compare_exchange_weak(l_pos, l_pos + 1, boost::memory_order_relaxed))
+						break;
+				}
+				else if (l_dif < 0)
+				{
+					return false; // empty
+				}
+				else
+				{
+					l_pos = m_dequeue_pos.load(boost::memory_order_relaxed);
+				}
+			}
+			p_value = std::move(l_cell->m_data);
+			l_cell->m_data = T();
+			l_cell->m_sequence.store(l_pos + m_mask + 1, boost::memory_order_release);
+			return true;
+		}
+
+		size_t capacity() const
+		{
+			return m_mask + 1;
+		}
+		/** @return Approximate number of queued items (exact only when there is no concurrent access) */
+		size_t size() const
+		{
+			const size_t l_head = m_dequeue_pos.load(boost::memory_order_relaxed);
+			const size_t l_tail = m_enqueue_pos.load(boost::memory_order_relaxed);
+			return l_tail > l_head ? l_tail - l_head : 0;
+		}
+		bool empty() const
+		{
+			return size() == 0;
+		}
+
+	private:
+		static size_t roundCapacity(size_t p_capacity)
+		{
+			size_t l_result = 2;
+			while (l_result < p_capacity)
+				l_result <<= 1;
+			return l_result;
+		}
+		struct Cell
+		{
+			boost::atomic<size_t> m_sequence;
+			T m_data;
+		};
+		// keep producers and consumers on separate cache lines
+		typedef char CacheLinePad[64];
+
+		const size_t m_mask;
+		std::unique_ptr<Cell[]> m_cells;
+		CacheLinePad m_pad0;
+		boost::atomic<size_t> m_enqueue_pos;
+		CacheLinePad m_pad1;
+		boost::atomic<size_t> m_dequeue_pos;
+		CacheLinePad m_pad2;
+};
+
+#endif // CFLY_BOUNDED_QUEUE_H
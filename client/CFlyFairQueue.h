@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_FAIR_QUEUE_H
+#define CFLY_FAIR_QUEUE_H
+
+#include <map>
+#include <stdint.h>
+#include <boost/unordered/unordered_map.hpp>
+#include "CFlyThread.h"
+
+/**
+ * Grant order of the upload slot queue (WaitingUserQueue).
+ * Users are ordered by {lane, served bytes, arrival}: the fast lane (lane 0) goes first,
+ * then the least served user, the arrival number breaks ties. A user pushed with p_by_served == false
+ * keeps 0 served bytes in the key (FIFO policy).
+ * The served bytes are counted from any thread under their own lock; the keys of the queued users
+ * are recalculated lazily by the next front() / getPosition() after they changed (an upload finished
+ * or the history was halved), so the order always follows the current served bytes.
+ * The queue itself is not thread safe - the owner guards it (UploadManager::m_csQueue).
+ * getPosition() walks the order and is O(n), everything else is O(log n) or O(1).
+ */
+template<class TUser, class THash = boost::hash<TUser> >
+class CFlyFairQueue
+{
+	public:
+		CFlyFairQueue() : m_is_served_changed(false), m_seq(0)
+		{
+		}
+		size_t size() const
+		{
+			return m_index.size();
+		}
+		bool empty() const
+		{
+			return m_index.empty();
+		}
+		bool contains(const TUser& p_user) const
+		{
+			return m_index.find(p_user) != m_index.end();
+		}
+		void push(const TUser& p_user, uint8_t p_lane, bool p_by_served)
+		{
+			dcassert(!contains(p_user));
+			Entry l_entry;
+			l_entry.m_by_served = p_by_served;
+			l_entry.m_key.m_lane = p_lane;
+			l_entry.m_key.m_served = p_by_served ? getServedBytes(p_user) : 0;
+			l_entry.m_key.m_seq = ++m_seq;
+			m_order.insert(std::make_pair(l_entry.m_key, p_user));
+			m_index.insert(std::make_pair(p_user, l_entry));
+		}
+		/** Changes the lane / policy of a queued user, the arrival number is kept so that the user does not lose his turn */
+		void update(const TUser& p_user, uint8_t p_lane, bool p_by_served)
+		{
+			const auto i = m_index.find(p_user);
+			dcassert(i != m_index.end());
+			if (i != m_index.end())
+			{
+				Key l_key = i->second.m_key;
+				l_key.m_lane = p_lane;
+				l_key.m_served = p_by_served ? getServedBytes(p_user) : 0;
+				i->second.m_by_served = p_by_served;
+				rekey(*i, l_key);
+			}
+		}
+		void erase(const TUser& p_user)
+		{
+			const auto i = m_index.find(p_user);
+			if (i != m_index.end())
+			{
+				m_order.erase(i->second.m_key);
+				m_index.erase(i);
+			}
+		}
+		void clear()
+		{
+			m_order.clear();
+			m_index.clear();
+		}
+		/** @return The user who will be granted the next free slot */
+		const TUser& front() const
+		{
+			dcassert(!m_order.empty());
+			refresh();
+			return m_order.begin()->second;
+		}
+		/** @return Position of the user in the grant order (1-based), O(n) */
+		size_t getPosition(const TUser& p_user) const
+		{
+			refresh();
+			const auto i = m_index.find(p_user);
+			dcassert(i != m_index.end());
+			if (i == m_index.end())
+				return m_index.size();
+			return std::distance(m_order.begin(), m_order.find(i->second.m_key)) + 1;
+		}
+
+		/** Accounting of uploaded bytes, may be called without the owner's lock */
+		void addServedBytes(const TUser& p_user, int64_t p_bytes)
+		{
+			if (p_bytes > 0)
+			{
+				CFlyFastLock(m_csServed);
+				m_served[p_user] += p_bytes;
+				m_is_served_changed = true;
+			}
+		}
+		/** Halves the served bytes history so that old transfers are forgotten gradually */
+		void decayServedBytes()
+		{
+			CFlyFastLock(m_csServed);
+			for (auto i = m_served.begin(); i != m_served.end();)
+			{
+				i->second >>= 1;
+				if (i->second == 0)
+					i = m_served.erase(i);
+				else
+					++i;
+			}
+			m_is_served_changed = true;
+		}
+		uint64_t getServedBytes(const TUser& p_user) const
+		{
+			CFlyFastLock(m_csServed);
+			const auto i = m_served.find(p_user);
+			return i != m_served.end() ? i->second : 0;
+		}
+
+	private:
+		struct Key
+		{
+			uint8_t m_lane;
+			uint64_t m_served;
+			uint64_t m_seq;
+			bool operator<(const Key& p_key) const
+			{
+				if (m_lane != p_key.m_lane)
+					return m_lane < p_key.m_lane;
+				if (m_served != p_key.m_served)
+					return m_served < p_key.m_served;
+				return m_seq < p_key.m_seq;
+			}
+		};
+		struct Entry
+		{
+			Key m_key;
+			bool m_by_served;
+		};
+		typedef boost::unordered_map<TUser, Entry, THash> UserIndex;
+		typedef std::map<Key, TUser> OrderIndex;
+		typedef boost::unordered_map<TUser, uint64_t, THash> ServedMap;
+
+		void rekey(typename UserIndex::value_type& p_entry, const Key& p_key) const
+		{
+			if (p_key < p_entry.second.m_key || p_entry.second.m_key < p_key)
+			{
+				m_order.erase(p_entry.second.m_key);
+				m_order.insert(std::make_pair(p_key, p_entry.first));
+				p_entry.second.m_key = p_key;
+			}
+		}
+		void refresh() const
+		{
+			CFlyFastLock(m_csServed);
+			if (!m_is_served_changed)
+				return;
+			m_is_served_changed = false;
+			for (auto i = m_index.begin(); i != m_index.end(); ++i)
+			{
+				if (i->second.m_by_served)
+				{
+					const auto l_served = m_served.find(i->first);
+					Key l_key = i->second.m_key;
+					l_key.m_served = l_served != m_served.end() ? l_served->second : 0;
+					rekey(*i, l_key);
+				}
+			}
+		}
+
+		mutable UserIndex m_index;
+		mutable OrderIndex m_order;
+		ServedMap m_served;
+		mutable FastCriticalSection m_csServed;
+		mutable bool m_is_served_changed;
+		uint64_t m_seq;
+};
+
+#endif // CFLY_FAIR_QUEUE_H
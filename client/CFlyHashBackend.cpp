@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include <chrono>
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+#include "CFlyHashBackend.h"
+#include "TigerHash.h"
+#include "MD5Calc.h"
+#ifndef _CONSOLE
+#include "CompatibilityManager.h"
+#include "SettingsManager.h"
+#include "LogManager.h"
+#endif
+
+static void md5Builtin(const void* p_data, size_t p_len, uint8_t* p_digest)
+{
+	MD5Calc l_md5;
+	l_md5.MD5Init(false);
+	// MD5Update takes unsigned - feed the data in 1 GiB parts
+	const unsigned char* l_data = static_cast<const unsigned char*>(p_data);
+	while (p_len)
+	{
+		const size_t l_part = std::min<size_t>(p_len, 1 << 30);
+		l_md5.MD5Update(const_cast<unsigned char*>(l_data), unsigned(l_part));
+		l_data += l_part;
+		p_len -= l_part;
+	}
+	l_md5.MD5Final(p_digest);
+}
+
+static void md5OpenSSL(const void* p_data, size_t p_len, uint8_t* p_digest)
+{
+	MD5_CTX l_ctx;
+	MD5_Init(&l_ctx);
+	MD5_Update(&l_ctx, p_data, p_len);
+	MD5_Final(p_digest, &l_ctx);
+}
+
+static void tigerBuiltin(const void* p_data, size_t p_len, uint8_t* p_digest)
+{
+	TigerHash l_tiger;
+	l_tiger.update(p_data, p_len);
+	memcpy(p_digest, l_tiger.finalize(), TigerHash::BYTES);
+}
+
+static void sha1OpenSSL(const void* p_data, size_t p_len, uint8_t* p_digest)
+{
+	SHA_CTX l_ctx;
+	SHA1_Init(&l_ctx);
+	SHA1_Update(&l_ctx, p_data, p_len);
+	SHA1_Final(p_digest, &l_ctx);
+}
+
+// the first backend of an algorithm is the reference for the others, g_backends[1] is the one isOpenSSLMD5() checks
+CFlyHashBackend::Backend CFlyHashBackend::g_backends[] =
+{
+	{ "md5", "builtin", &md5Builtin, MD5_DIGEST_LENGTH, "900150983CD24FB0D6963F7D28E17F72", false },
+	{ "md5", "openssl", &md5OpenSSL, MD5_DIGEST_LENGTH, "900150983CD24FB0D6963F7D28E17F72", false },
+	{ "tiger", "builtin", &tigerBuiltin, TigerHash::BYTES, "2AAB1484E8C158F2BFB8C5FF41B57A525129131C957B5F93", false },
+	{ "sha1", "openssl", &sha1OpenSSL, SHA_DIGEST_LENGTH, "A9993E364706816ABA3E25717850C26C9CD0D89D", false },
+};
+
+static string toHex(const uint8_t* p_digest, size_t p_size)
+{
+	static const char g_hex[] = "0123456789ABCDEF";
+	string l_result;
+	l_result.reserve(p_size * 2);
+	for (size_t i = 0; i < p_size; ++i)
+	{
+		l_result += g_hex[p_digest[i] >> 4];
+		l_result += g_hex[p_digest[i] & 0x0F];
+	}
+	return l_result;
+}
+
+bool CFlyHashBackend::check(const Backend& p_backend)
+{
+	uint8_t l_digest[64];
+	dcassert(p_backend.m_digest_size <= sizeof(l_digest));
+	p_backend.m_hash("abc", 3, l_digest);
+	return toHex(l_digest, p_backend.m_digest_size) == p_backend.m_abc_digest;
+}
+
+bool CFlyHashBackend::init()
+{
+	bool l_is_valid = true;
+	for (auto i = std::begin(g_backends); i != std::end(g_backends); ++i)
+	{
+		i->m_is_valid = check(*i);
+		if (!i->m_is_valid)
+		{
+			l_is_valid = false;
+#ifndef _CONSOLE
+			LogManager::message(string("Hash backend ") + i->m_algorithm + '=' + i->m_name + " failed the self-test and is disabled");
+#endif
+		}
+	}
+	return l_is_valid;
+}
+
+bool CFlyHashBackend::isOpenSSLMD5()
+{
+#ifdef _CONSOLE
+	return g_backends[1].m_is_valid;
+#else
+	return BOOLSETTING(MD5_USE_OPENSSL) && g_backends[1].m_is_valid;
+#endif
+}
+
+string CFlyHashBackend::benchmark(size_t p_size)
+{
+	std::vector<uint8_t> l_data(p_size);
+	uint32_t l_seed = 0x12345678;
+	for (size_t i = 0; i < p_size; ++i)
+	{
+		l_seed = l_seed * 1103515245 + 12345;
+		l_data[i] = uint8_t(l_seed >> 16);
+	}
+	string l_result;
+#ifndef _CONSOLE
+	l_result = "CPU: " + CompatibilityManager::CPUInfo() + "\r\n";
+#endif
+	const Backend* l_reference = nullptr;
+	string l_reference_digest;
+	for (auto i = std::begin(g_backends); i != std::end(g_backends); ++i)
+	{
+		l_result += string(i->m_algorithm) + '=' + i->m_name;
+		if (!i->m_is_valid)
+		{
+			l_result += ": self-test failed\r\n";
+			continue;
+		}
+		uint8_t l_digest[64];
+		const auto l_start = std::chrono::steady_clock::now();
+		i->m_hash(l_data.data(), l_data.size(), l_digest);
+		const auto l_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - l_start).count();
+		l_result += ": " + Util::toString(l_time ? double(p_size) * 1000000 / 1024 / 1024 / l_time : 0.0) + " MB/s";
+		const string l_hex = toHex(l_digest, i->m_digest_size);
+		if (!l_reference || strcmp(l_reference->m_algorithm, i->m_algorithm) != 0)
+		{
+			l_reference = i;
+			l_reference_digest = l_hex;
+		}
+		else if (l_hex != l_reference_digest)
+		{
+			l_result += string(", differs from ") + l_reference->m_name;
+		}
+		if (strcmp(i->m_algorithm, "md5") == 0 && (i != std::begin(g_backends)) == isOpenSSLMD5())
+		{
+			l_result += " (selected)";
+		}
+		l_result += "\r\n";
+	}
+	return l_result;
+}
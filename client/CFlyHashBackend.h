@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_HASH_BACKEND_H
+#define CFLY_HASH_BACKEND_H
+
+#include "typedefs.h"
+
+/**
+ * The hash implementations of the client, each one is checked against the known answer for "abc" once in init().
+ * MD5 has two: our MD5Calc code and MD5 of OpenSSL (OpenSSL selects its SSE / AVX code itself at run time),
+ * MD5Calc uses OpenSSL only if it passed and BOOLSETTING(MD5_USE_OPENSSL) is set. The setting is read in every
+ * MD5Calc::MD5Init, a change applies to the next file.
+ * Tiger (TTH, TigerHash) and SHA-1 (OpenSSL, the one libtorrent uses as well) have one implementation each:
+ * they are only checked and measured by benchmark(), there is nothing to switch.
+ * test-console links this file without the settings (_CONSOLE): there MD5 goes to OpenSSL whenever it passed the check.
+ */
+class CFlyHashBackend
+{
+	public:
+		typedef void (*HashFunction)(const void* p_data, size_t p_len, uint8_t* p_digest);
+		struct Backend
+		{
+			const char* m_algorithm;
+			const char* m_name;
+			HashFunction m_hash;
+			size_t m_digest_size;
+			const char* m_abc_digest; // hex
+			bool m_is_valid;
+		};
+		
+		/** @return false if any backend failed the self-test */
+		static bool init();
+		static bool isOpenSSLMD5();
+		/** Speed of every backend on p_size bytes, the digests of one algorithm are compared with each other */
+		static string benchmark(size_t p_size);
+		
+	private:
+		static bool check(const Backend& p_backend);
+		static Backend g_backends[];
+};
+
+#endif // CFLY_HASH_BACKEND_H
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_IP_RANGE_INDEX_H
+#define CFLY_IP_RANGE_INDEX_H
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+/**
+ * Immutable "IPv4 range -> value" lookup table (GeoIP / locations / P2P Guard).
+ * Ranges are kept sorted by start in plain arrays, find() is a branchless binary search
+ * for the last range starting at or below the address - the same rule the
+ * "where start_ip <= ? order by start_ip desc limit 1" SQL used.
+ * Filled once with add() + build(), afterwards it is only read (no locking needed).
+ */
+class CFlyIPRangeIndex
+{
+	public:
+		void reserve(size_t p_count)
+		{
+			m_items.reserve(p_count);
+		}
+		void add(uint32_t p_start_ip, uint32_t p_stop_ip, uint32_t p_value)
+		{
+			const Item l_item = { p_start_ip, p_stop_ip, p_value };
+			m_items.push_back(l_item);
+		}
+		void build()
+		{
+			std::stable_sort(m_items.begin(), m_items.end(), [](const Item & a, const Item & b)
+			{
+				return a.m_start < b.m_start;
+			});
+			m_start.resize(m_items.size());
+			m_stop.resize(m_items.size());
+			m_value.resize(m_items.size());
+			for (size_t i = 0; i < m_items.size(); ++i)
+			{
+				m_start[i] = m_items[i].m_start;
+				m_stop[i] = m_items[i].m_stop;
+				m_value[i] = m_items[i].m_value;
+			}
+			std::vector<Item>().swap(m_items);
+		}
+		/** @return value of the range holding p_ip (stop address is inclusive) or 0 */
+		uint32_t find(uint32_t p_ip) const
+		{
+			size_t l_count = m_start.size();
+			if (l_count == 0 || m_start[0] > p_ip)
+				return 0;
+			const uint32_t* l_base = m_start.data();
+			while (l_count > 1)
+			{
+				const size_t l_half = l_count / 2;
+				l_base = l_base[l_half] <= p_ip ? l_base + l_half : l_base; // cmov
+				l_count -= l_half;
+			}
+			const size_t l_pos = l_base - m_start.data();
+			return m_stop[l_pos] >= p_ip ? m_value[l_pos] : 0;
+		}
+		size_t size() const
+		{
+			return m_start.size();
+		}
+		
+	private:
+		struct Item
+		{
+			uint32_t m_start;
+			uint32_t m_stop;
+			uint32_t m_value;
+		};
+		std::vector<Item> m_items; // only while filling
+		std::vector<uint32_t> m_start;
+		std::vector<uint32_t> m_stop;
+		std::vector<uint32_t> m_value;
+};
+
+#endif // CFLY_IP_RANGE_INDEX_H
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_LINE_FRAMER_H
+#define CFLY_LINE_FRAMER_H
+
+#include <string>
+
+/**
+ * Command framing of BufferedSocket::threadRead (MODE_LINE / MODE_ZPIPE): the buffer is walked by offset
+ * and the caller drops the processed part once per read - erasing every command from the front was quadratic.
+ * The commands are not copied: the parsers get the buffer and the position of the command.
+ */
+class CFlyLineFramer
+{
+	public:
+		/**
+		 * p_line(p_start, p_len) gets every non-empty command of p_buf, p_len without the separator
+		 * (p_buf[p_start + p_len] is the separator); empty (only separator) commands are skipped.
+		 * p_line returns false to stop after the current command (the socket left the line mode).
+		 * @param p_offset In: where to start, out: the first byte which was not processed
+		 * @return false if p_line stopped the walk
+		 */
+		template<class TLine>
+		static bool split(const std::string& p_buf, char p_separator, std::string::size_type& p_offset, TLine p_line)
+		{
+			std::string::size_type l_pos;
+			while ((l_pos = p_buf.find(p_separator, p_offset)) != std::string::npos)
+			{
+				const std::string::size_type l_start = p_offset;
+				p_offset = l_pos + 1;
+				if (l_pos > l_start && !p_line(l_start, l_pos - l_start))
+					return false;
+			}
+			return true;
+		}
+};
+
+#endif // CFLY_LINE_FRAMER_H
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_PACKED_STRING_MAP_H
+#define CFLY_PACKED_STRING_MAP_H
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+#include "debug.h"
+
+/**
+ * Small map "two-letter tag -> string" packed into one buffer:
+ * every record is [tag:2][length:4][bytes]. Meant for the handful of string fields
+ * of an online user - a single allocation (none while it fits the SSO buffer)
+ * instead of a hash table with a node and a heap string per field.
+ * Lookup is a linear walk.
+ */
+class CFlyPackedStringMap
+{
+	public:
+		enum { HEADER_SIZE = 6 };
+		
+		class const_iterator
+		{
+			public:
+				explicit const_iterator(const char* p_pos) : m_pos(p_pos)
+				{
+				}
+				uint16_t code() const
+				{
+					return readUInt16(m_pos);
+				}
+				const char* data() const
+				{
+					return m_pos + HEADER_SIZE;
+				}
+				size_t size() const
+				{
+					return readUInt32(m_pos + 2);
+				}
+				std::string value() const
+				{
+					return std::string(data(), size());
+				}
+				const_iterator& operator++()
+				{
+					m_pos += HEADER_SIZE + size();
+					return *this;
+				}
+				bool operator==(const const_iterator& p_rhs) const
+				{
+					return m_pos == p_rhs.m_pos;
+				}
+				bool operator!=(const const_iterator& p_rhs) const
+				{
+					return m_pos != p_rhs.m_pos;
+				}
+			private:
+				const char* m_pos;
+		};
+		
+		const_iterator cbegin() const
+		{
+			return const_iterator(m_data.data());
+		}
+		const_iterator cend() const
+		{
+			return const_iterator(m_data.data() + m_data.size());
+		}
+		const_iterator find(uint16_t p_code) const
+		{
+			const auto l_end = cend();
+			for (auto i = cbegin(); i != l_end; ++i)
+			{
+				if (i.code() == p_code)
+					return i;
+			}
+			return l_end;
+		}
+		bool empty() const
+		{
+			return m_data.empty();
+		}
+		/** @return Bytes used by the records (heap usage is this rounded up by the allocator) */
+		size_t getDataSize() const
+		{
+			return m_data.size();
+		}
+		void clear()
+		{
+			std::string().swap(m_data);
+		}
+		void erase(uint16_t p_code)
+		{
+			const auto i = find(p_code);
+			if (i != cend())
+			{
+				const size_t l_pos = i.data() - HEADER_SIZE - m_data.data();
+				rebuild(l_pos, HEADER_SIZE + i.size(), 0, nullptr, 0);
+			}
+		}
+		/** An empty value removes the tag */
+		void set(uint16_t p_code, const std::string& p_value)
+		{
+			if (p_value.empty())
+			{
+				erase(p_code);
+				return;
+			}
+			const size_t l_size = p_value.size();
+			dcassert(l_size <= UINT32_MAX);
+			const auto i = find(p_code);
+			if (i != cend())
+			{
+				const size_t l_pos = i.data() - HEADER_SIZE - m_data.data();
+				if (i.size() == l_size)
+				{
+					m_data.replace(l_pos + HEADER_SIZE, l_size, p_value.data(), l_size);
+					return;
+				}
+				rebuild(l_pos, HEADER_SIZE + i.size(), p_code, p_value.data(), l_size);
+			}
+			else
+			{
+				rebuild(m_data.size(), 0, p_code, p_value.data(), l_size);
+			}
+		}
+		
+	private:
+		static uint16_t readUInt16(const char* p_pos)
+		{
+			uint16_t l_value;
+			memcpy(&l_value, p_pos, sizeof(l_value));
+			return l_value;
+		}
+		static uint32_t readUInt32(const char* p_pos)
+		{
+			uint32_t l_value;
+			memcpy(&l_value, p_pos, sizeof(l_value));
+			return l_value;
+		}
+		template<typename T> static void append(std::string& p_out, T p_value)
+		{
+			p_out.append(reinterpret_cast<const char*>(&p_value), sizeof(p_value));
+		}
+		// Copies the buffer into an exactly sized one, dropping [p_pos, p_pos + p_removed) and appending the new record (if any)
+		void rebuild(size_t p_pos, size_t p_removed, uint16_t p_code, const char* p_value, size_t p_size)
+		{
+			std::string l_data;
+			l_data.reserve(m_data.size() - p_removed + (p_value ? HEADER_SIZE + p_size : 0));
+			l_data.append(m_data, 0, p_pos);
+			l_data.append(m_data, p_pos + p_removed, std::string::npos);
+			if (p_value)
+			{
+				append(l_data, p_code);
+				append(l_data, uint32_t(p_size));
+				l_data.append(p_value, p_size);
+			}
+			m_data.swap(l_data);
+		}
+		
+		std::string m_data;
+};
+
+#endif // CFLY_PACKED_STRING_MAP_H
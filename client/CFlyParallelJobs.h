@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_PARALLEL_JOBS_H
+#define CFLY_PARALLEL_JOBS_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <boost/atomic.hpp>
+#include "CFlyThread.h"
+
+/**
+ * Runs p_job(i) for every i < p_count on up to p_max_threads threads, every thread takes the next not yet started index.
+ * The calling thread finishes whatever is left (a single job or the threads could not be started).
+ * p_is_stop() is checked before every job. ShareManager::buildTreesParallelL scans the share roots with it.
+ */
+class CFlyParallelJobs
+{
+	public:
+		typedef std::function<void(size_t)> Job;
+		typedef std::function<bool()> StopCheck;
+		/** @return Number of the threads which did the work */
+		static size_t run(size_t p_count, size_t p_max_threads, const Job& p_job, const StopCheck& p_is_stop, const char* p_name)
+		{
+			boost::atomic<size_t> l_next(0);
+			size_t l_thread_count = 1;
+			if (std::min(p_count, p_max_threads) > 1)
+			{
+				std::vector<std::unique_ptr<Worker>> l_threads;
+				for (size_t i = 0; i < std::min(p_count, p_max_threads); ++i)
+				{
+					std::unique_ptr<Worker> l_thread(new Worker(l_next, p_count, p_job, p_is_stop));
+					try
+					{
+						l_thread->start(0, p_name);
+						l_threads.push_back(std::move(l_thread));
+					}
+					catch (const ThreadException&)
+					{
+						break;
+					}
+				}
+				for (auto i = l_threads.cbegin(); i != l_threads.cend(); ++i)
+				{
+					(*i)->join();
+				}
+				l_thread_count = std::max(size_t(1), l_threads.size());
+			}
+			for (size_t i = l_next++; i < p_count && !p_is_stop(); i = l_next++)
+			{
+				p_job(i);
+			}
+			return l_thread_count;
+		}
+		
+	private:
+		class Worker : public Thread
+		{
+			public:
+				Worker(boost::atomic<size_t>& p_next, size_t p_count, const Job& p_job, const StopCheck& p_is_stop) :
+					m_next(p_next), m_count(p_count), m_job(p_job), m_is_stop(p_is_stop)
+				{
+				}
+			private:
+				int run()
+				{
+					for (size_t i = m_next++; i < m_count && !m_is_stop(); i = m_next++)
+					{
+						m_job(i);
+					}
+					return 0;
+				}
+				boost::atomic<size_t>& m_next;
+				const size_t m_count;
+				const Job& m_job;
+				const StopCheck& m_is_stop;
+		};
+};
+
+#endif // CFLY_PARALLEL_JOBS_H
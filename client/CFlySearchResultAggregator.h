@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_SEARCH_RESULT_AGGREGATOR_H
+#define CFLY_SEARCH_RESULT_AGGREGATOR_H
+
+#include <boost/unordered/unordered_map.hpp>
+#include <boost/unordered/unordered_set.hpp>
+#include "CFlyThread.h"
+#include "HashValue.h"
+#include "CID.h"
+
+struct SearchResultGroup
+{
+	SearchResultGroup() : m_size(0), m_sources(0), m_free_slots(0)
+	{
+	}
+	TTHValue m_tth;
+	int64_t m_size;
+	string m_file_name; // of the first result
+	uint32_t m_sources;
+	uint32_t m_free_slots; // of all sources
+};
+typedef std::vector<SearchResultGroup> SearchResultGroupList;
+
+/**
+ * Streaming aggregation of the search results of our own ADC searches (NMDC and auto search results have no own token).
+ * A token gets its state only when our search with it is sent (addToken), the results with any other token pass through,
+ * so a flood of results with random tokens allocates nothing.
+ * Drops the results which were already seen for the token: same TTH, user and full path (the same result comes once per hub
+ * the user shares with us), the search window does the same check but only after every listener handled the result.
+ * The rest is grouped by TTH with source counters, the top groups by sources / free slots are kept up to date
+ * and the changed groups are collected so they can be delivered once a second as one batch.
+ * Every token state is bounded: MAX_SOURCES sources, MAX_GROUPS groups, TOP_COUNT top groups.
+ */
+class CFlySearchResultAggregator
+#ifdef _DEBUG
+	: boost::noncopyable
+#endif
+{
+	public:
+		enum
+		{
+			TOP_COUNT = 100,
+			MAX_SOURCES = 256 * 1024, // per token, the newer results are passed through if the limit is reached
+			MAX_GROUPS = 64 * 1024, // per token, the results of the newer TTHs are passed through without a group
+			EXPIRE_TIME = 10 * 60 * 1000 // ms without results
+		};
+		typedef std::vector<std::pair<uint32_t, SearchResultGroupList>> DeltaList;
+		
+		/** Our search with p_token was sent - its results are aggregated from now on */
+		void addToken(uint32_t p_token, uint64_t p_tick)
+		{
+			if (p_token == 0 || p_token == uint32_t(-1)) // auto search / NMDC
+				return;
+			CFlyFastLock(m_cs);
+			m_tokens[p_token].m_last_tick = p_tick;
+		}
+		
+		/**
+		 * @param p_file full path of the file
+		 * @return false if the result is a duplicate
+		 */
+		bool add(uint32_t p_token, const TTHValue& p_tth, const CID& p_cid, const string& p_file, int64_t p_size, uint32_t p_free_slots, uint64_t p_tick)
+		{
+			CFlyFastLock(m_cs);
+			const auto i = m_tokens.find(p_token);
+			if (i == m_tokens.end())
+				return true;
+			TokenState& l_state = i->second;
+			l_state.m_last_tick = p_tick;
+			if (l_state.m_sources.size() >= MAX_SOURCES)
+				return true;
+			if (!l_state.m_sources.insert(SourceKey(p_tth, p_cid, p_file)).second)
+				return false;
+			auto l_group_it = l_state.m_groups.find(p_tth);
+			if (l_group_it == l_state.m_groups.end())
+			{
+				if (l_state.m_groups.size() >= MAX_GROUPS)
+					return true;
+				l_group_it = l_state.m_groups.insert(std::make_pair(p_tth, Group())).first;
+				Group& l_group = l_group_it->second;
+				l_group.m_tth = p_tth;
+				l_group.m_size = p_size;
+				l_group.m_file_name = p_file.substr(p_file.find_last_of("\\/") + 1);
+			}
+			Group& l_group = l_group_it->second;
+			++l_group.m_sources;
+			l_group.m_free_slots += p_free_slots;
+			if (!l_group.m_is_changed)
+			{
+				l_group.m_is_changed = true;
+				l_state.m_changed.push_back(&l_group);
+			}
+			l_state.updateTop(&l_group);
+			return true;
+		}
+		
+		/** Moves the groups changed since the previous call to p_deltas and forgets the tokens without results for EXPIRE_TIME */
+		void flush(uint64_t p_tick, DeltaList& p_deltas)
+		{
+			CFlyFastLock(m_cs);
+			for (auto i = m_tokens.begin(); i != m_tokens.end();)
+			{
+				TokenState& l_state = i->second;
+				if (p_tick > l_state.m_last_tick + EXPIRE_TIME)
+				{
+					i = m_tokens.erase(i);
+					continue;
+				}
+				if (!l_state.m_changed.empty())
+				{
+					p_deltas.push_back(std::make_pair(i->first, SearchResultGroupList()));
+					SearchResultGroupList& l_list = p_deltas.back().second;
+					l_list.reserve(l_state.m_changed.size());
+					for (auto j = l_state.m_changed.cbegin(); j != l_state.m_changed.cend(); ++j)
+					{
+						(*j)->m_is_changed = false;
+						l_list.push_back(**j);
+					}
+					l_state.m_changed.clear();
+				}
+				++i;
+			}
+		}
+		
+		/** @return The best groups of the token, most sources first */
+		void getTopGroups(uint32_t p_token, SearchResultGroupList& p_groups) const
+		{
+			CFlyFastLock(m_cs);
+			const auto i = m_tokens.find(p_token);
+			if (i != m_tokens.end())
+			{
+				p_groups.reserve(i->second.m_top.size());
+				for (auto j = i->second.m_top.cbegin(); j != i->second.m_top.cend(); ++j)
+				{
+					p_groups.push_back(**j);
+				}
+			}
+		}
+		
+		size_t getTokenCount() const
+		{
+			CFlyFastLock(m_cs);
+			return m_tokens.size();
+		}
+		
+		void clear()
+		{
+			CFlyFastLock(m_cs);
+			m_tokens.clear();
+		}
+		
+		static uint64_t getScore(const SearchResultGroup& p_group)
+		{
+			return (uint64_t(p_group.m_sources) << 32) | p_group.m_free_slots;
+		}
+		
+	private:
+		struct SourceKey
+		{
+			SourceKey(const TTHValue& p_tth, const CID& p_cid, const string& p_file) : m_tth(p_tth), m_cid(p_cid), m_file(p_file)
+			{
+			}
+			bool operator==(const SourceKey& p_key) const
+			{
+				return m_tth == p_key.m_tth && m_cid == p_key.m_cid && m_file == p_key.m_file;
+			}
+			TTHValue m_tth;
+			CID m_cid;
+			string m_file;
+		};
+		struct SourceKeyHash
+		{
+			size_t operator()(const SourceKey& p_key) const
+			{
+				size_t l_hash = p_key.m_tth.toHash();
+				boost::hash_combine(l_hash, p_key.m_cid.toHash());
+				boost::hash_combine(l_hash, p_key.m_file);
+				return l_hash;
+			}
+		};
+		struct Group : public SearchResultGroup
+		{
+			Group() : m_is_changed(false), m_is_top(false)
+			{
+			}
+			bool m_is_changed;
+			bool m_is_top;
+		};
+		struct TokenState
+		{
+			TokenState() : m_last_tick(0)
+			{
+			}
+			void updateTop(Group* p_group)
+			{
+				const uint64_t l_score = getScore(*p_group);
+				if (!p_group->m_is_top)
+				{
+					if (m_top.size() < TOP_COUNT)
+					{
+						m_top.push_back(p_group);
+					}
+					else if (getScore(*m_top.back()) < l_score)
+					{
+						m_top.back()->m_is_top = false;
+						m_top.back() = p_group;
+					}
+					else
+					{
+						return;
+					}
+					p_group->m_is_top = true;
+				}
+				// the score only grows - move the group up to its place
+				auto i = std::find(m_top.begin(), m_top.end(), p_group);
+				dcassert(i != m_top.end());
+				while (i != m_top.begin() && getScore(**(i - 1)) < l_score)
+				{
+					std::iter_swap(i, i - 1);
+					--i;
+				}
+			}
+			boost::unordered_set<SourceKey, SourceKeyHash> m_sources;
+			boost::unordered_map<TTHValue, Group> m_groups; // node based - the pointers below stay valid
+			std::vector<Group*> m_top;
+			std::vector<Group*> m_changed;
+			uint64_t m_last_tick;
+		};
+		
+		boost::unordered_map<uint32_t, TokenState> m_tokens;
+		mutable FastCriticalSection m_cs;
+};
+
+#endif // CFLY_SEARCH_RESULT_AGGREGATOR_H
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_SEGMENT_SIZE_H
+#define CFLY_SEGMENT_SIZE_H
+
+#include <algorithm>
+#include <stdint.h>
+
+/**
+ * Segment size of a download source (UserConnection::updateChunkSize).
+ * No state of its own - the chunk size and the speed estimation stay in the connection,
+ * so the segment simulator of test-console runs exactly the same code.
+ */
+class CFlySegmentSize
+{
+	public:
+		enum
+		{
+			SEGMENT_TIME = 120 * 1000, // # ms we should aim for per segment
+			MIN_CHUNK_SIZE = 64 * 1024,
+			MAX_INITIAL_CHUNK_SIZE = 1024 * 1024,
+			MAX_GROWTH = 4 // per segment
+		};
+		
+		/**
+		 * @param p_chunk_size Current chunk size of the source, 0 before its first segment
+		 * @param p_speed EWMA download speed of the source (bytes/s), updated
+		 * @return The size of the next segment
+		 */
+		static int64_t next(int64_t p_chunk_size, int64_t& p_speed, int64_t p_leaf_size, int64_t p_last_chunk, uint64_t p_ticks)
+		{
+			// the first segment of the source has the size of the first block
+			const int64_t l_chunk_size = p_chunk_size != 0 ? p_chunk_size :
+			                             std::max<int64_t>(MIN_CHUNK_SIZE, std::min<int64_t>(p_last_chunk, MAX_INITIAL_CHUNK_SIZE));
+			if (p_ticks <= 10)
+			{
+				// Can't rely on such fast transfers - double
+				return p_chunk_size == 0 ? l_chunk_size : p_chunk_size * 2;
+			}
+			
+			// Smooth the speed of this source over the last segments (EWMA) so a single stall or burst doesn't flip the size
+			const double l_alpha = 0.3; // weight of the last finished segment
+			const double l_last_speed = (1000. * p_last_chunk) / p_ticks;
+			p_speed = p_speed == 0 ? static_cast<int64_t>(l_last_speed) : static_cast<int64_t>(l_alpha * l_last_speed + (1. - l_alpha) * p_speed);
+			
+			// Size the next segment so it takes about SEGMENT_TIME with the estimated speed,
+			// but don't grow faster than 4x per segment, the estimation is based on small chunks at the beginning
+			int64_t l_target_size = std::min(static_cast<int64_t>(double(p_speed) * SEGMENT_TIME / 1000), l_chunk_size * MAX_GROWTH);
+			if (p_leaf_size > 0 && l_target_size > p_leaf_size)
+			{
+				l_target_size -= l_target_size % p_leaf_size;
+			}
+			return std::max<int64_t>(MIN_CHUNK_SIZE, l_target_size);
+		}
+};
+
+#endif // CFLY_SEGMENT_SIZE_H
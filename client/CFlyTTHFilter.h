@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_TTH_FILTER_H
+#define CFLY_TTH_FILTER_H
+
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+/**
+ * Bloom filter over TTH keys (CFlyLevelDB: "the TTH has no status" without touching LevelDB).
+ * TTH is a cryptographic hash already - its first two words are used as the two hashes.
+ * Not thread safe, the owner guards it.
+ */
+class CFlyTTHFilter
+{
+	public:
+		CFlyTTHFilter() : m_count(0)
+		{
+		}
+		/** ~32 bits per key, at least 1M bits, a power of two: the key count can double (16 bits per key,
+		    ~0.1% false positives with 5 hashes) before isFull() asks for a rebuild */
+		void init(size_t p_key_count)
+		{
+			size_t l_bits = 1 << 20;
+			while (l_bits < p_key_count * 32)
+				l_bits <<= 1;
+			m_bits.assign(l_bits / 64, 0);
+			m_count = 0;
+		}
+		void add(const uint8_t* p_tth)
+		{
+			uint64_t l_h1, l_h2;
+			getHash(p_tth, l_h1, l_h2);
+			const uint64_t l_mask = uint64_t(m_bits.size()) * 64 - 1;
+			bool l_is_new = false;
+			for (unsigned i = 0; i < HASH_COUNT; ++i)
+			{
+				const uint64_t l_bit = (l_h1 + i * l_h2) & l_mask;
+				uint64_t& l_word = m_bits[size_t(l_bit >> 6)];
+				const uint64_t l_flag = uint64_t(1) << (l_bit & 63);
+				l_is_new |= (l_word & l_flag) == 0;
+				l_word |= l_flag;
+			}
+			if (l_is_new) // a key which is already there (or a false positive) does not make the filter fuller
+			{
+				++m_count;
+			}
+		}
+		bool contains(const uint8_t* p_tth) const
+		{
+			uint64_t l_h1, l_h2;
+			getHash(p_tth, l_h1, l_h2);
+			const uint64_t l_mask = uint64_t(m_bits.size()) * 64 - 1;
+			for (unsigned i = 0; i < HASH_COUNT; ++i)
+			{
+				const uint64_t l_bit = (l_h1 + i * l_h2) & l_mask;
+				if ((m_bits[size_t(l_bit >> 6)] & (uint64_t(1) << (l_bit & 63))) == 0)
+					return false;
+			}
+			return true;
+		}
+		bool empty() const
+		{
+			return m_bits.empty();
+		}
+		/** The key count has doubled since init() - false positives grow, a bigger one should be built */
+		bool isFull() const
+		{
+			return m_count * 16 > m_bits.size() * 64;
+		}
+		size_t getByteSize() const
+		{
+			return m_bits.size() * sizeof(uint64_t);
+		}
+		void swap(CFlyTTHFilter& p_filter)
+		{
+			m_bits.swap(p_filter.m_bits);
+			std::swap(m_count, p_filter.m_count);
+		}
+		
+	private:
+		enum
+		{
+			HASH_COUNT = 5
+		};
+		static void getHash(const uint8_t* p_tth, uint64_t& p_h1, uint64_t& p_h2)
+		{
+			memcpy(&p_h1, p_tth, sizeof(p_h1));
+			memcpy(&p_h2, p_tth + sizeof(p_h1), sizeof(p_h2));
+			p_h2 |= 1;
+		}
+		std::vector<uint64_t> m_bits;
+		size_t m_count; // keys which have set at least one new bit
+};
+
+#endif // CFLY_TTH_FILTER_H
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_TIGER_TREE_CACHE_H
+#define CFLY_TIGER_TREE_CACHE_H
+
+#include <list>
+#include <memory>
+#include <boost/atomic.hpp>
+#include <boost/unordered/unordered_map.hpp>
+#include "MerkleTree.h"
+#include "CFlyThread.h"
+
+/**
+ * TigerTree cache keyed by TTH with LRU eviction by the memory the leaves take.
+ * Entries are shared and never changed, so the tree requests of popular files
+ * are answered without the database and without copying the tree under the lock.
+ */
+class CFlyTigerTreeCache
+#ifdef _DEBUG
+	: boost::noncopyable
+#endif
+{
+	public:
+		typedef std::shared_ptr<const TigerTree> TreePtr;
+		
+		explicit CFlyTigerTreeCache(size_t p_limit) : m_limit(p_limit), m_bytes(0), m_hits(0), m_misses(0), m_db_fetches(0), m_db_fetch_us(0)
+		{
+		}
+		
+		TreePtr find(const TTHValue& p_root)
+		{
+			CFlyFastLock(m_cs);
+			const auto i = m_index.find(p_root);
+			if (i == m_index.end())
+			{
+				++m_misses;
+				return TreePtr();
+			}
+			++m_hits;
+			m_lru.splice(m_lru.begin(), m_lru, i->second);
+			return i->second->second;
+		}
+		void insert(const TTHValue& p_root, const TreePtr& p_tree)
+		{
+			const size_t l_size = getTreeSize(*p_tree);
+			CFlyFastLock(m_cs);
+			if (l_size > m_limit / 4)
+				return; // would push out too much
+			eraseL(p_root);
+			while (m_bytes + l_size > m_limit && !m_lru.empty())
+			{
+				eraseL(m_lru.back().first);
+			}
+			m_lru.push_front(std::make_pair(p_root, p_tree));
+			m_index[p_root] = m_lru.begin();
+			m_bytes += l_size;
+		}
+		void erase(const TTHValue& p_root)
+		{
+			CFlyFastLock(m_cs);
+			eraseL(p_root);
+		}
+		void clear()
+		{
+			CFlyFastLock(m_cs);
+			m_lru.clear();
+			m_index.clear();
+			m_bytes = 0;
+		}
+		void setLimit(size_t p_limit)
+		{
+			CFlyFastLock(m_cs);
+			m_limit = p_limit;
+		}
+		size_t getLimit() const
+		{
+			CFlyFastLock(m_cs);
+			return m_limit;
+		}
+		/** Accounts one database read of a tree (lock wait included) */
+		void addFetch(uint64_t p_us)
+		{
+			++m_db_fetches;
+			m_db_fetch_us += p_us;
+		}
+		
+		size_t size() const
+		{
+			CFlyFastLock(m_cs);
+			return m_index.size();
+		}
+		size_t getBytes() const
+		{
+			CFlyFastLock(m_cs);
+			return m_bytes;
+		}
+		unsigned getHitRate() const
+		{
+			const uint64_t l_hits = m_hits;
+			const uint64_t l_total = l_hits + m_misses;
+			return l_total ? unsigned(l_hits * 100 / l_total) : 0;
+		}
+		uint64_t getAvgFetchTime() const
+		{
+			const uint64_t l_count = m_db_fetches;
+			return l_count ? m_db_fetch_us / l_count : 0;
+		}
+		
+	private:
+		static size_t getTreeSize(const TigerTree& p_tree)
+		{
+			return sizeof(TigerTree) + p_tree.getLeaves().size() * TigerTree::BYTES;
+		}
+		void eraseL(const TTHValue& p_root)
+		{
+			const auto i = m_index.find(p_root);
+			if (i != m_index.end())
+			{
+				m_bytes -= getTreeSize(*i->second->second);
+				m_lru.erase(i->second);
+				m_index.erase(i);
+			}
+		}
+		
+		typedef std::list<std::pair<TTHValue, TreePtr>> LRUList;
+		LRUList m_lru; // most recently used first
+		boost::unordered_map<TTHValue, LRUList::iterator> m_index;
+		size_t m_limit;
+		size_t m_bytes;
+		boost::atomic<uint64_t> m_hits;
+		boost::atomic<uint64_t> m_misses;
+		boost::atomic<uint64_t> m_db_fetches;
+		boost::atomic<uint64_t> m_db_fetch_us;
+		mutable FastCriticalSection m_cs;
+};
+
+#endif // CFLY_TIGER_TREE_CACHE_H
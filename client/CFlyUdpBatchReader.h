@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_UDP_BATCH_READER_H
+#define CFLY_UDP_BATCH_READER_H
+
+#include <stdint.h>
+
+/**
+ * Receive step of SearchManager::run: after the socket has signalled data, everything it already has
+ * (up to BATCH_SIZE datagrams) is read without waiting, so the parsers get the whole batch at once.
+ * recvmmsg does not exist on Windows - the batch is built by polling the socket with a zero timeout.
+ * TSocket is Socket (test-console drives the same code with a plain socket wrapper):
+ * int read(void*, int, sockaddr_in&), int wait(uint64_t, int) and WAIT_READ.
+ */
+class CFlyUdpBatchReader
+{
+	public:
+		enum
+		{
+			BUF_SIZE = 8192,
+			BATCH_SIZE = 64
+		};
+		/**
+		 * p_add(const uint8_t* p_data, int p_len, const sockaddr_in& p_from) gets every datagram longer than 4 bytes.
+		 * @return false if read() failed and the socket has to be recreated
+		 */
+		template<class TSocket, class TAdd>
+		static bool drain(TSocket& p_socket, uint8_t* p_buf, const volatile bool& p_stop, TAdd p_add)
+		{
+			size_t l_count = 0;
+			do
+			{
+				if (p_stop)
+					return true;
+				sockaddr_in l_from = { 0 };
+				const int l_len = p_socket.read(p_buf, BUF_SIZE, l_from);
+				if (l_len <= 0)
+					return false;
+				if (l_len > 4)
+				{
+					p_add(p_buf, l_len, l_from);
+					++l_count;
+				}
+			}
+			while (l_count < BATCH_SIZE && p_socket.wait(0, TSocket::WAIT_READ) == TSocket::WAIT_READ);
+			return true;
+		}
+};
+
+#endif // CFLY_UDP_BATCH_READER_H
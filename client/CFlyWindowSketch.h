@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2011-2017 FlylinkDC++ Team http://flylinkdc.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#ifndef CFLY_WINDOW_SKETCH_H
+#define CFLY_WINDOW_SKETCH_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered/unordered_map.hpp>
+#include "CFlyThread.h"
+
+/**
+ * Sliding window event counter with constant memory (count-min sketch split into time buckets).
+ * The window is divided into BUCKETS slices, every slice is a DEPTH x WIDTH table of saturating 8-bit counters.
+ * add() and estimate() cost O(DEPTH * BUCKETS) regardless of how many distinct keys are seen;
+ * the estimate never undercounts, collisions can only overcount - so it may only be used as a pre-filter,
+ * a decision that hurts a key (ban, drop) has to be confirmed exactly (CFlyFloodGuard).
+ */
+class CFlyWindowSketch
+#ifdef _DEBUG
+	: boost::noncopyable
+#endif
+{
+	public:
+		enum { DEPTH = 4, BUCKETS = 8 };
+
+		explicit CFlyWindowSketch(uint32_t p_width = 8192) : m_width(p_width), m_window(0), m_bucket_size(1), m_current_slice(0),
+			m_counters(size_t(BUCKETS) * DEPTH * p_width)
+		{
+		}
+
+		/** 64-bit FNV-1a, also in 32-bit builds (boost::hash is size_t) */
+		static uint64_t getHash(const void* p_data, size_t p_len, uint64_t p_hash = 0xCBF29CE484222325ULL)
+		{
+			const uint8_t* l_data = static_cast<const uint8_t*>(p_data);
+			for (size_t i = 0; i < p_len; ++i)
+			{
+				p_hash ^= l_data[i];
+				p_hash *= 0x100000001B3ULL;
+			}
+			return p_hash;
+		}
+		static uint64_t getHash(const std::string& p_key)
+		{
+			return getHash(p_key.data(), p_key.size());
+		}
+
+		/** Registers one event and @return how many events with this key were seen during the last p_window ms (this one included) */
+		uint32_t add(uint64_t p_hash, uint64_t p_tick, uint64_t p_window)
+		{
+			CFlyFastLock(m_cs);
+			roll(p_tick, p_window);
+			const size_t l_bucket = size_t(m_current_slice % BUCKETS);
+			uint32_t l_result = UINT32_MAX;
+			for (unsigned l_row = 0; l_row < DEPTH; ++l_row)
+			{
+				const size_t l_col = getColumn(p_hash, l_row);
+				uint8_t& l_counter = cell(l_bucket, l_row, l_col);
+				if (l_counter != UINT8_MAX)
+					++l_counter;
+				l_result = std::min(l_result, sumColumn(l_row, l_col));
+			}
+			return l_result;
+		}
+
+		uint32_t estimate(uint64_t p_hash, uint64_t p_tick, uint64_t p_window)
+		{
+			CFlyFastLock(m_cs);
+			roll(p_tick, p_window);
+			uint32_t l_result = UINT32_MAX;
+			for (unsigned l_row = 0; l_row < DEPTH; ++l_row)
+			{
+				l_result = std::min(l_result, sumColumn(l_row, getColumn(p_hash, l_row)));
+			}
+			return l_result;
+		}
+
+		void clear()
+		{
+			CFlyFastLock(m_cs);
+			std::fill(m_counters.begin(), m_counters.end(), 0);
+		}
+
+	private:
+		uint8_t& cell(size_t p_bucket, unsigned p_row, size_t p_col)
+		{
+			return m_counters[(p_bucket * DEPTH + p_row) * m_width + p_col];
+		}
+		size_t getColumn(uint64_t p_hash, unsigned p_row) const
+		{
+			// splitmix64 finalizer with a different seed per row
+			uint64_t z = p_hash + 0x9E3779B97F4A7C15ULL * (p_row + 1);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			z ^= z >> 31;
+			return size_t(z % m_width);
+		}
+		uint32_t sumColumn(unsigned p_row, size_t p_col)
+		{
+			uint32_t l_sum = 0;
+			for (size_t l_bucket = 0; l_bucket < BUCKETS; ++l_bucket)
+			{
+				l_sum += cell(l_bucket, p_row, p_col);
+			}
+			return l_sum;
+		}
+		void roll(uint64_t p_tick, uint64_t p_window)
+		{
+			if (p_window != m_window)
+			{
+				// the limits were changed (fly-server config) - start from scratch
+				m_window = p_window;
+				m_bucket_size = std::max<uint64_t>(1, p_window / BUCKETS);
+				m_current_slice = p_tick / m_bucket_size;
+				std::fill(m_counters.begin(), m_counters.end(), 0);
+				return;
+			}
+			const uint64_t l_slice = p_tick / m_bucket_size;
+			if (l_slice <= m_current_slice)
+				return;
+			// forget the slices which went out of the window
+			const uint64_t l_expired = std::min<uint64_t>(l_slice - m_current_slice, BUCKETS);
+			for (uint64_t i = 1; i <= l_expired; ++i)
+			{
+				const size_t l_bucket = size_t((m_current_slice + i) % BUCKETS);
+				std::fill(m_counters.begin() + l_bucket * DEPTH * m_width, m_counters.begin() + (l_bucket + 1) * DEPTH * m_width, 0);
+			}
+			m_current_slice = l_slice;
+		}
+
+		const uint32_t m_width;
+		uint64_t m_window;
+		uint64_t m_bucket_size;
+		uint64_t m_current_slice;
+		std::vector<uint8_t> m_counters;
+		FastCriticalSection m_cs;
+};
+
+/**
+ * Map with a fixed capacity: when it is full, the key inserted first is dropped.
+ * Not thread safe - the owner locks it.
+ */
+template<class TKey, class TValue, class THash = boost::hash<TKey> >
+class CFlyBoundedKeyMap
+{
+	public:
+		explicit CFlyBoundedKeyMap(size_t p_capacity) : m_capacity(p_capacity)
+		{
+		}
+		/** @return The value of the key, p_default is inserted if the key is missing */
+		TValue& get(const TKey& p_key, const TValue& p_default, bool& p_is_new)
+		{
+			const auto i = m_map.find(p_key);
+			p_is_new = i == m_map.end();
+			if (!p_is_new)
+				return i->second;
+			if (m_map.size() >= m_capacity)
+			{
+				m_map.erase(m_order.front());
+				m_order.pop_front();
+			}
+			m_order.push_back(p_key);
+			return m_map.insert(std::make_pair(p_key, p_default)).first->second;
+		}
+		const TValue* find(const TKey& p_key) const
+		{
+			const auto i = m_map.find(p_key);
+			return i != m_map.end() ? &i->second : nullptr;
+		}
+		size_t size() const
+		{
+			return m_map.size();
+		}
+		void clear()
+		{
+			m_map.clear();
+			m_order.clear();
+		}
+	private:
+		boost::unordered_map<TKey, TValue, THash> m_map;
+		std::deque<TKey> m_order;
+		const size_t m_capacity;
+};
+
+/**
+ * Repeated events counted exactly per 64-bit fingerprint (duplicate searches).
+ * A false positive needs a collision of two 64-bit fingerprints among at most CAPACITY recent ones (~1e-11);
+ * when more keys arrive in one window the oldest are forgotten, so a flood can only let a duplicate through.
+ */
+class CFlyRepeatCounter
+#ifdef _DEBUG
+	: boost::noncopyable
+#endif
+{
+	public:
+		explicit CFlyRepeatCounter(size_t p_capacity) : m_keys(p_capacity)
+		{
+		}
+		/** Registers one event and @return how many events with this key were seen during p_window ms after the first one (this one included) */
+		uint32_t add(uint64_t p_hash, uint64_t p_tick, uint64_t p_window)
+		{
+			CFlyFastLock(m_cs);
+			bool l_is_new;
+			Counter& l_counter = m_keys.get(p_hash, Counter(p_tick), l_is_new);
+			if (!l_is_new && p_tick - l_counter.m_first_tick >= p_window)
+			{
+				l_counter = Counter(p_tick);
+			}
+			return ++l_counter.m_count;
+		}
+		void clear()
+		{
+			CFlyFastLock(m_cs);
+			m_keys.clear();
+		}
+	private:
+		struct Counter
+		{
+			explicit Counter(uint64_t p_tick = 0) : m_first_tick(p_tick), m_count(0) { }
+			uint64_t m_first_tick;
+			uint32_t m_count;
+		};
+		CFlyBoundedKeyMap<uint64_t, Counter> m_keys;
+		FastCriticalSection m_cs;
+};
+
+/**
+ * Connect flood protection: the sketch counts every target in constant memory and only nominates candidates,
+ * a candidate is then counted exactly by its name and banned when the exact count in one window reaches the limit.
+ * Collisions in the sketch never ban a target; the exact count starts when the sketch has reached the limit,
+ * so a real flood is banned at most one limit of connects later than by an exact counter of every target.
+ * Candidates and bans are bounded by p_capacity each.
+ */
+class CFlyFloodGuard
+#ifdef _DEBUG
+	: boost::noncopyable
+#endif
+{
+	public:
+		CFlyFloodGuard(uint32_t p_width, size_t p_capacity) : m_sketch(p_width), m_counters(p_capacity), m_bans(p_capacity)
+		{
+		}
+		/**
+		 * Registers one connect to p_key.
+		 * @return The exact count of the current window of a candidate (0 while the sketch is under the limit);
+		 * the target is banned for p_ban_time when it reaches p_limit
+		 */
+		uint32_t add(const std::string& p_key, uint64_t p_tick, uint64_t p_window, uint32_t p_limit, uint64_t p_ban_time)
+		{
+			if (m_sketch.add(CFlyWindowSketch::getHash(p_key), p_tick, p_window) < p_limit)
+				return 0;
+			CFlyFastLock(m_cs);
+			bool l_is_new;
+			Counter& l_counter = m_counters.get(p_key, Counter(p_tick), l_is_new);
+			if (p_tick - l_counter.m_first_tick >= p_window)
+			{
+				l_counter = Counter(p_tick);
+			}
+			if (++l_counter.m_count >= p_limit)
+			{
+				m_bans.get(p_key, 0, l_is_new) = p_tick + p_ban_time;
+			}
+			return l_counter.m_count;
+		}
+		bool isBanned(const std::string& p_key, uint64_t p_tick) const
+		{
+			CFlyFastLock(m_cs);
+			const uint64_t* l_until = m_bans.find(p_key);
+			return l_until && *l_until > p_tick;
+		}
+		void clear()
+		{
+			m_sketch.clear();
+			CFlyFastLock(m_cs);
+			m_counters.clear();
+			m_bans.clear();
+		}
+	private:
+		struct Counter
+		{
+			explicit Counter(uint64_t p_tick = 0) : m_first_tick(p_tick), m_count(0) { }
+			uint64_t m_first_tick;
+			uint32_t m_count;
+		};
+		CFlyWindowSketch m_sketch;
+		CFlyBoundedKeyMap<std::string, Counter> m_counters;
+		CFlyBoundedKeyMap<std::string, uint64_t> m_bans;
+		mutable FastCriticalSection m_cs;
+};
+
+#endif // CFLY_WINDOW_SKETCH_H
@@ -11,6 +11,7 @@
 #include "ConnectionManager.h"
 #include "CompatibilityManager.h"
 #include "../FlyFeatures/flyServer.h"
+#include <chrono>
 #include <boost/algorithm/string.hpp>
 #include "FinishedManager.h"
 
@@ -36,9 +37,7 @@ int64_t g_SQLiteDBSize = 0;
 int32_t CFlylinkDBManager::g_count_queue_source = 0;
 int32_t CFlylinkDBManager::g_count_queue_files = 0;
 
-boost::unordered_map<TTHValue, TigerTree> CFlylinkDBManager::g_tiger_tree_cache;
-FastCriticalSection CFlylinkDBManager::g_tth_cache_cs;
-unsigned CFlylinkDBManager::g_tth_cache_limit = 500;
+CFlyTigerTreeCache CFlylinkDBManager::g_tiger_tree_cache(32 * 1024 * 1024);
 
 FastCriticalSection  CFlylinkDBManager::g_resume_torrents_cs;
 std::unordered_set<libtorrent::sha1_hash> CFlylinkDBManager::g_resume_torrents;
@@ -1487,17 +1486,35 @@ void CFlylinkDBManager::save_location(const CFlyLocationIPArray& p_geo_ip)
 			++m_count_fly_location_ip_record;
 		}
 		l_trans.commit();
-		{
-			CFlyFastLock(m_cache_location_cs);
-			m_location_cache_array.clear();
-			m_ip_info_cache.clear();
-		}
+#ifdef FLYLINKDC_USE_GEO_IP
+		load_geo_indexL();
+#endif
 	}
 	catch (const database_error& e)
 	{
 		errorDB("SQLite - save_location: " + e.getError());
 	}
 }
+//========================================================================================================
+uint32_t CFlylinkDBManager::get_location_desc_index(vector<CFlyLocationDesc>& p_cache, CFlyLocationDescIndex& p_index, const string& p_description, uint16_t p_flag_index)
+{
+	// m_cache_location_cs must be locked
+	const auto l_key = std::make_pair(p_description, p_flag_index);
+	const auto l_find = p_index.find(l_key);
+	if (l_find != p_index.end())
+	{
+		return l_find->second;
+	}
+	CFlyLocationDesc l_location;
+	l_location.m_start_ip = 0;
+	l_location.m_stop_ip = 0;
+	l_location.m_flag_index = p_flag_index;
+	l_location.m_description = Text::toT(p_description);
+	p_cache.push_back(l_location);
+	const uint32_t l_index = uint32_t(p_cache.size());
+	p_index.insert(std::make_pair(l_key, l_index));
+	return l_index;
+}
 #ifdef FLYLINKDC_USE_GEO_IP
 //========================================================================================================
 __int64 CFlylinkDBManager::get_dic_country_id(const string& p_country)
@@ -1506,169 +1523,130 @@ __int64 CFlylinkDBManager::get_dic_country_id(const string& p_country)
 	return get_dic_idL(p_country, e_DIC_COUNTRY, true);
 }
 //========================================================================================================
-bool CFlylinkDBManager::find_cache_country(uint32_t p_ip, uint16_t& p_index)
+void CFlylinkDBManager::load_geo_rangesL(const char* p_sql, vector<CFlyLocationDesc>& p_cache, CFlyLocationDescIndex& p_cache_index,
+                                         uint32_t p_max_desc_index, CFlyIPRangeIndex& p_ranges)
 {
-	CFlyFastLock(m_cache_location_cs);
-	dcassert(p_ip);
-	p_index = 0;
-	const auto l_result = m_ip_info_cache.find(p_ip);
-	if (m_ip_info_cache.find(p_ip) != m_ip_info_cache.end())
+	// m_cs must be locked
+	// The rows are read without m_cache_location_cs (the UI takes it in get_*_from_cache),
+	// only the distinct descriptions are resolved under it.
+	struct CFlyGeoRange
 	{
-		const auto& l_record = l_result->second;
-		p_index = l_record.m_country_cache_index;
-		return true;
-	}
-	dcassert(m_country_cache.size() <= 0xFFFF);
-	for (auto i =  m_country_cache.begin(); i !=  m_country_cache.end(); ++i)
+		uint32_t m_start_ip;
+		uint32_t m_stop_ip;
+		uint32_t m_key;
+	};
+	std::vector<CFlyGeoRange> l_ranges;
+	std::vector<std::pair<string, uint16_t>> l_keys;
+	CFlyLocationDescIndex l_key_index;
 	{
-		++p_index;
-		if (p_ip >= i->m_start_ip && p_ip < i->m_stop_ip)
+		std::unique_ptr<sqlite3_command> l_sql(new sqlite3_command(m_flySQLiteDB, p_sql));
+		sqlite3_reader l_q = l_sql->executereader();
+		while (l_q.read())
 		{
-			return true;
+			const auto l_key = l_key_index.insert(std::make_pair(std::make_pair(l_q.getstring(2), uint16_t(l_q.getint(3))), uint32_t(l_keys.size())));
+			if (l_key.second)
+			{
+				l_keys.push_back(l_key.first->first);
+			}
+			const CFlyGeoRange l_range = { uint32_t(l_q.getint64(0)), uint32_t(l_q.getint64(1)), l_key.first->second };
+			l_ranges.push_back(l_range);
 		}
 	}
-	p_index = 0;
-	return false;
-}
-//========================================================================================================
-bool CFlylinkDBManager::find_cache_location(uint32_t p_ip, uint32_t& p_location_index, uint16_t& p_flag_location_index)
-{
-	CFlyFastLock(m_cache_location_cs);
-	p_location_index = 0;
-	p_flag_location_index = 0;
-	const auto l_result = m_ip_info_cache.find(p_ip);
-	if (m_ip_info_cache.find(p_ip) != m_ip_info_cache.end())
-	{
-		const auto& l_record = l_result->second;
-		p_location_index = l_record.m_location_cache_index;
-		p_flag_location_index = l_record.m_flag_location_index;
-		return true;
-	}
-	for (auto i = m_location_cache_array.cbegin(); i != m_location_cache_array.cend(); ++i, ++p_location_index)
+	std::vector<uint32_t> l_desc_index(l_keys.size());
 	{
-		if (p_ip >= i->m_start_ip && p_ip < i->m_stop_ip)
+		CFlyFastLock(m_cache_location_cs);
+		for (size_t i = 0; i < l_keys.size(); ++i)
 		{
-			++p_location_index;
-			p_flag_location_index = i->m_flag_index;
-			return true;
+			l_desc_index[i] = get_location_desc_index(p_cache, p_cache_index, l_keys[i].first, l_keys[i].second);
 		}
 	}
-	return false;
-}
-//========================================================================================================
-void CFlylinkDBManager::get_country_and_location(uint32_t p_ip, uint16_t& p_country_index, uint32_t& p_location_index, bool p_is_use_only_cache)
-{
-	dcassert(p_ip);
-	uint16_t l_flag_location_index = 0; // TODO ?
-	const bool l_is_find_country   = Util::isPrivateIp(p_ip) || find_cache_country(p_ip, p_country_index);
-	const bool l_is_find_location = find_cache_location(p_ip, p_location_index, l_flag_location_index);
-	if (p_is_use_only_cache == false)
+	p_ranges.reserve(l_ranges.size());
+	for (auto i = l_ranges.cbegin(); i != l_ranges.cend(); ++i)
 	{
-		if (l_is_find_country == false || l_is_find_location == false)
+		const uint32_t l_index = l_desc_index[i->m_key];
+		dcassert(l_index <= p_max_desc_index);
+		if (l_index <= p_max_desc_index)
 		{
-			load_country_locations_p2p_guard_from_db(p_ip, p_location_index, p_country_index);
+			p_ranges.add(i->m_start_ip, i->m_stop_ip, l_index);
 		}
 	}
 }
 //========================================================================================================
-string CFlylinkDBManager::load_country_locations_p2p_guard_from_db(uint32_t p_ip, uint32_t& p_location_cache_index, uint16_t& p_country_cache_index)
+void CFlylinkDBManager::load_geo_indexL()
 {
-	dcassert(p_ip);
-	CFlyLock(m_cs); //    -
-	string l_p2p_guard_text;
+	// m_cs must be locked
+	auto l_index = std::make_shared<CFlyGeoIndex>();
 	try
 	{
-		// http://www.sql.ru/forum/783621/faq-nahozhdenie-zapisey-gde-zadannoe-znachenie-nahoditsya-mezhdu-znacheniyami-poley
-		// http://habrahabr.ru/post/138067/
-		
-		// TODO - optimisation if(!Util::isPrivateIp(p_ip))
-		// TODO -     
-		//    p2p    
-		m_select_country_and_location.init(m_flySQLiteDB,
-		                                   "select country,flag_index,start_ip,stop_ip,0 from "
-		                                   "(select country,flag_index,start_ip,stop_ip from location_db.fly_country_ip where start_ip <=? order by start_ip desc limit 1) "
-		                                   "where stop_ip >=?"
-		                                   "\nunion all\n"
-		                                   "select location,flag_index,start_ip,stop_ip,1 from "
-		                                   "(select location,flag_index,start_ip,stop_ip from location_db.fly_location_ip where start_ip <=? order by start_ip desc limit 1) "
-		                                   "where stop_ip >=?"
-		                                   "\nunion all\n"
-		                                   "select note,0,start_ip,stop_ip,2 from "
-		                                   "(select note,start_ip,stop_ip from location_db.fly_p2pguard_ip where start_ip <=? order by start_ip desc limit 1) "
-		                                   "where stop_ip >=?");
-		m_select_country_and_location->bind(1, p_ip);
-		m_select_country_and_location->bind(2, p_ip);
-		m_select_country_and_location->bind(3, p_ip);
-		m_select_country_and_location->bind(4, p_ip);
-		m_select_country_and_location->bind(5, p_ip);
-		m_select_country_and_location->bind(6, p_ip);
-		sqlite3_reader l_q = m_select_country_and_location->executereader();
-		CFlyLocationDesc l_location;
-		p_location_cache_index = 0;
-		p_country_cache_index = 0;
-		l_location.m_flag_index = 0;
-		unsigned l_count_country = 0;
-		CFlyCacheIPInfo* l_ip_cahe_item = nullptr;
-		{
-			CFlyFastLock(m_cache_location_cs);
-			l_ip_cahe_item = &m_ip_info_cache[p_ip];
-		}
-		while (l_q.read())
+		CFlyBusy l_disable_log(g_DisableSQLtrace);
+		// get_country_from_cache() takes uint16_t
+		load_geo_rangesL("select start_ip,stop_ip,country,flag_index from location_db.fly_country_ip order by start_ip",
+		                 m_country_cache, m_country_cache_index, 0xFFFF, l_index->m_country);
+		load_geo_rangesL("select start_ip,stop_ip,location,flag_index from location_db.fly_location_ip order by start_ip",
+		                 m_location_cache_array, m_location_cache_index, UINT32_MAX, l_index->m_location);
 		{
-			const unsigned l_id = l_q.getint(4);
-			dcassert(l_id < 3)
-			const string l_description = l_q.getstring(0);
-			l_location.m_description = Text::toT(l_description);
-			l_location.m_flag_index = l_q.getint(1);
-			l_location.m_start_ip = l_q.getint(2);
-			l_location.m_stop_ip = l_q.getint(3);
-			switch (l_q.getint(4))
+			std::unique_ptr<sqlite3_command> l_sql(new sqlite3_command(m_flySQLiteDB,
+			                                                           "select start_ip,stop_ip,note from location_db.fly_p2pguard_ip order by start_ip"));
+			sqlite3_reader l_q = l_sql->executereader();
+			boost::unordered_map<string, uint32_t> l_notes;
+			while (l_q.read())
 			{
-				case 0:
+				const auto l_note = l_notes.insert(std::make_pair(l_q.getstring(2), uint32_t(l_index->m_p2p_guard_notes.size() + 1)));
+				if (l_note.second)
 				{
-					l_count_country++;
-					{
-						CFlyFastLock(m_cache_location_cs);
-						m_country_cache.push_back(l_location);
-						p_country_cache_index = uint16_t(m_country_cache.size());
-						l_ip_cahe_item->m_country_cache_index = p_country_cache_index;
-						l_ip_cahe_item->m_flag_location_index = l_location.m_flag_index;
-					}
-					break;
-				}
-				case 1:
-				{
-					CFlyFastLock(m_cache_location_cs);
-					m_location_cache_array.push_back(l_location);
-					p_location_cache_index = m_location_cache_array.size();
-					l_ip_cahe_item->m_location_cache_index = p_location_cache_index;
-					l_ip_cahe_item->m_flag_location_index = l_location.m_flag_index;
-					break;
-				}
-				case 2:
-				{
-					{
-						CFlyFastLock(m_cache_location_cs);
-						l_ip_cahe_item->m_description_p2p_guard = l_description;
-					}
-					if (!l_p2p_guard_text.empty())
-					{
-						l_p2p_guard_text += " + ";
-					}
-					l_p2p_guard_text += l_description;
-					continue;
+					l_index->m_p2p_guard_notes.push_back(l_note.first->first);
 				}
-				default:
-					dcassert(0);
+				l_index->m_p2p_guard.add(uint32_t(l_q.getint64(0)), uint32_t(l_q.getint64(1)), l_note.first->second);
 			}
 		}
-		dcassert(l_count_country <= 1); //    GeoIPCountryWhois.csv   !
+		l_index->m_country.build();
+		l_index->m_location.build();
+		l_index->m_p2p_guard.build();
+		dcdebug("CFlylinkDBManager::load_geo_indexL country = %u location = %u p2p_guard = %u\n",
+		        unsigned(l_index->m_country.size()), unsigned(l_index->m_location.size()), unsigned(l_index->m_p2p_guard.size()));
 	}
 	catch (const database_error& e)
 	{
-		errorDB("SQLite - load_country_locations_p2p_guard_from_db: " + e.getError());
+		errorDB("SQLite - load_geo_indexL: " + e.getError());
+	}
+	std::atomic_store(&m_geo_index, CFlyGeoIndexPtr(l_index));
+}
+//========================================================================================================
+void CFlylinkDBManager::reset_geo_index()
+{
+	std::atomic_store(&m_geo_index, CFlyGeoIndexPtr());
+}
+//========================================================================================================
+CFlylinkDBManager::CFlyGeoIndexPtr CFlylinkDBManager::get_geo_index(bool p_is_use_only_cache)
+{
+	auto l_index = std::atomic_load(&m_geo_index);
+	if (!l_index && !p_is_use_only_cache)
+	{
+		CFlyLock(m_cs);
+		l_index = std::atomic_load(&m_geo_index);
+		if (!l_index)
+		{
+			load_geo_indexL();
+			l_index = std::atomic_load(&m_geo_index);
+		}
+	}
+	return l_index;
+}
+//========================================================================================================
+void CFlylinkDBManager::get_country_and_location(uint32_t p_ip, uint16_t& p_country_index, uint32_t& p_location_index, bool p_is_use_only_cache)
+{
+	dcassert(p_ip);
+	p_country_index = 0;
+	p_location_index = 0;
+	const auto l_index = get_geo_index(p_is_use_only_cache);
+	if (l_index)
+	{
+		if (!Util::isPrivateIp(p_ip))
+		{
+			p_country_index = uint16_t(l_index->m_country.find(p_ip));
+		}
+		p_location_index = l_index->m_location.find(p_ip);
 	}
-	return l_p2p_guard_text;
 }
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 //========================================================================================================
@@ -1695,15 +1673,15 @@ string CFlylinkDBManager::is_p2p_guard(const uint32_t& p_ip)
 	string l_p2p_guard_text;
 	if (p_ip && p_ip != INADDR_NONE)
 	{
+		const auto l_index = get_geo_index(false);
+		if (l_index)
 		{
-			CFlyFastLock(m_cache_location_cs);
-			const auto l_p2p = m_ip_info_cache.find(p_ip);
-			if (l_p2p != m_ip_info_cache.end())
-				return l_p2p->second.m_description_p2p_guard;
+			const uint32_t l_note = l_index->m_p2p_guard.find(p_ip);
+			if (l_note)
+			{
+				l_p2p_guard_text = l_index->m_p2p_guard_notes[l_note - 1];
+			}
 		}
-		uint16_t l_country_index;
-		uint32_t l_location_index;
-		l_p2p_guard_text = load_country_locations_p2p_guard_from_db(p_ip, l_location_index, l_country_index);
 	}
 	return l_p2p_guard_text;
 }
@@ -1721,6 +1699,7 @@ void CFlylinkDBManager::remove_manual_p2p_guard(const string& p_ip)
 		
 			m_delete_manual_p2p_guard->bind(1, l_ip_boost.to_ulong());
 			m_delete_manual_p2p_guard->executenonquery();
+			reset_geo_index();
 		}
 	}
 	catch (const database_error& e)
@@ -1754,10 +1733,6 @@ void CFlylinkDBManager::save_p2p_guard(const CFlyP2PGuardArray& p_p2p_guard_ip,
 	CFlyLock(m_cs);
 	try
 	{
-		{
-			CFlyFastLock(m_cache_location_cs);
-			m_ip_info_cache.clear();
-		}
 		CFlyBusy l_disable_log(g_DisableSQLtrace);
 		sqlite3_transaction l_trans(m_flySQLiteDB);
 		if (p_manual_marker.empty())
@@ -1777,6 +1752,7 @@ void CFlylinkDBManager::save_p2p_guard(const CFlyP2PGuardArray& p_p2p_guard_ip,
 			m_insert_p2p_guard->executenonquery();
 		}
 		l_trans.commit();
+		load_geo_indexL();
 	}
 	catch (const database_error& e)
 	{
@@ -1804,6 +1780,7 @@ void CFlylinkDBManager::save_geoip(const CFlyLocationIPArray& p_geo_ip)
 			m_insert_geoip->executenonquery();
 		}
 		l_trans.commit();
+		load_geo_indexL();
 	}
 	catch (const database_error& e)
 	{
@@ -2393,13 +2370,18 @@ void CFlylinkDBManager::load_torrent_resume(libtorrent::session& p_session)
 void CFlylinkDBManager::delete_torrent_resume(const libtorrent::sha1_hash& p_sha1)
 {
 	CFlyLock(m_cs);
+	bool l_is_pending;
+	{
+		CFlyFastLock(m_cache_torrent_resume_cs);
+		l_is_pending = m_cache_torrent_resume.erase(p_sha1) != 0;
+	}
 	try
 	{
 		m_delete_resume_torrent.init(m_flySQLiteDB,
 		                             "delete from queue_db.fly_queue_torrent where sha1=?");
 		m_delete_resume_torrent->bind(1, p_sha1.data(), p_sha1.size(), SQLITE_STATIC);
 		m_delete_resume_torrent->executenonquery();
-		if (m_delete_resume_torrent.sqlite3_changes() == 1)
+		if (m_delete_resume_torrent.sqlite3_changes() == 1 || l_is_pending)
 		{
 			CFlyFastLock(g_delete_torrents_cs);
 			g_delete_torrents.insert(p_sha1);
@@ -2417,57 +2399,98 @@ void CFlylinkDBManager::delete_torrent_resume(const libtorrent::sha1_hash& p_sha
 //========================================================================================================
 void CFlylinkDBManager::save_torrent_resume(const libtorrent::sha1_hash& p_sha1, const std::string& p_name, const std::vector<char>& p_resume)
 {
-	CFlyLock(m_cs);
+	// Called on the libtorrent network thread - don't touch the database here.
+	// Repeated resume data of the same torrent replaces the pending one.
+	CFlyFastLock(m_cache_torrent_resume_cs);
+	auto& l_item = m_cache_torrent_resume[p_sha1];
+	l_item.m_name = p_name;
+	l_item.m_resume = p_resume;
+}
+//========================================================================================================
+void CFlylinkDBManager::flush_torrent_resume()
+{
+	{
+		CFlyFastLock(m_cache_torrent_resume_cs);
+		if (m_cache_torrent_resume.empty())
+		{
+			return;
+		}
+	}
+	CFlyLock(m_cs); // delete_torrent_resume() can't run between the swap and the write
+	CFlyTorrentResumeMap l_local_map;
+	{
+		CFlyFastLock(m_cache_torrent_resume_cs);
+		l_local_map.swap(m_cache_torrent_resume);
+	}
+	if (l_local_map.empty())
+	{
+		return;
+	}
 	try
 	{
-		m_check_resume_torrent.init(m_flySQLiteDB,
-		                            "select resume,id from queue_db.fly_queue_torrent where sha1=?");
-		m_check_resume_torrent->bind(1, p_sha1.data(), p_sha1.size(), SQLITE_STATIC);
-		bool l_is_need_update = true;
-		__int64 l_ID = 0;
+		sqlite3_transaction l_trans(m_flySQLiteDB, l_local_map.size() > 1);
+		for (auto i = l_local_map.cbegin(); i != l_local_map.cend(); ++i)
 		{
-			sqlite3_reader l_q_check = m_check_resume_torrent->executereader();
-			while (l_q_check.read())
-			{
-				l_ID = l_q_check.getint64(1);
-				vector<uint8_t> l_resume;
-				l_q_check.getblob(0, l_resume);
-				//dcassert(!l_resume.empty());
-				if (!l_resume.empty() && l_resume.size() == p_resume.size())
-				{
-					l_is_need_update = !memcmp(&p_resume[0], &l_resume[0], l_resume.size());
-				}
-			}
+			save_torrent_resumeL(i->first, i->second.m_name, i->second.m_resume);
 		}
-		if (l_is_need_update)
+		l_trans.commit();
+	}
+	catch (const database_error& e)
+	{
+		errorDB("SQLite - flush_torrent_resume: " + e.getError());
+	}
+}
+//========================================================================================================
+void CFlylinkDBManager::save_torrent_resumeL(const libtorrent::sha1_hash& p_sha1, const std::string& p_name, const std::vector<char>& p_resume)
+{
+	dcassert(!p_resume.empty());
+	if (p_resume.empty())
+	{
+		return;
+	}
+	m_check_resume_torrent.init(m_flySQLiteDB,
+	                            "select resume,id from queue_db.fly_queue_torrent where sha1=?");
+	m_check_resume_torrent->bind(1, p_sha1.data(), p_sha1.size(), SQLITE_STATIC);
+	bool l_is_need_update = true;
+	__int64 l_ID = 0;
+	{
+		sqlite3_reader l_q_check = m_check_resume_torrent->executereader();
+		while (l_q_check.read())
 		{
-			if (l_ID == 0)
-			{
-				m_insert_resume_torrent.init(m_flySQLiteDB,
-				                             "insert or replace into queue_db.fly_queue_torrent (day,stamp,sha1,resume,name) "
-				                             "values(strftime('%s','now','localtime')/60/60/24,strftime('%s','now','localtime'),?,?,?)");
-				m_insert_resume_torrent->bind(1, p_sha1.data(), p_sha1.size(), SQLITE_STATIC);
-				m_insert_resume_torrent->bind(2, &p_resume[0], p_resume.size(), SQLITE_STATIC);
-				m_insert_resume_torrent->bind(3, p_name, SQLITE_STATIC);
-				m_insert_resume_torrent->executenonquery();
-			}
-			else
+			l_ID = l_q_check.getint64(1);
+			vector<uint8_t> l_resume;
+			l_q_check.getblob(0, l_resume);
+			//dcassert(!l_resume.empty());
+			if (!l_resume.empty() && l_resume.size() == p_resume.size())
 			{
-				m_update_resume_torrent.init(m_flySQLiteDB,
-				                             "update queue_db.fly_queue_torrent set day = strftime('%s','now','localtime')/60/60/24,\n"
-				                             "stamp = strftime('%s','now','localtime'),\n"
-				                             "resume = ?,\n"
-				                             "name = ? where id = ?");
-				m_update_resume_torrent->bind(1, &p_resume[0], p_resume.size(), SQLITE_STATIC);
-				m_update_resume_torrent->bind(2, p_name, SQLITE_STATIC);
-				m_update_resume_torrent->bind(3, l_ID);
-				m_update_resume_torrent->executenonquery();
+				l_is_need_update = memcmp(&p_resume[0], &l_resume[0], l_resume.size()) != 0;
 			}
 		}
 	}
-	catch (const database_error& e)
+	if (l_is_need_update)
 	{
-		errorDB("SQLite - save_torrent_resume: " + e.getError());
+		if (l_ID == 0)
+		{
+			m_insert_resume_torrent.init(m_flySQLiteDB,
+			                             "insert or replace into queue_db.fly_queue_torrent (day,stamp,sha1,resume,name) "
+			                             "values(strftime('%s','now','localtime')/60/60/24,strftime('%s','now','localtime'),?,?,?)");
+			m_insert_resume_torrent->bind(1, p_sha1.data(), p_sha1.size(), SQLITE_STATIC);
+			m_insert_resume_torrent->bind(2, &p_resume[0], p_resume.size(), SQLITE_STATIC);
+			m_insert_resume_torrent->bind(3, p_name, SQLITE_STATIC);
+			m_insert_resume_torrent->executenonquery();
+		}
+		else
+		{
+			m_update_resume_torrent.init(m_flySQLiteDB,
+			                             "update queue_db.fly_queue_torrent set day = strftime('%s','now','localtime')/60/60/24,\n"
+			                             "stamp = strftime('%s','now','localtime'),\n"
+			                             "resume = ?,\n"
+			                             "name = ? where id = ?");
+			m_update_resume_torrent->bind(1, &p_resume[0], p_resume.size(), SQLITE_STATIC);
+			m_update_resume_torrent->bind(2, p_name, SQLITE_STATIC);
+			m_update_resume_torrent->bind(3, l_ID);
+			m_update_resume_torrent->executenonquery();
+		}
 	}
 }
 //========================================================================================================
@@ -2480,10 +2503,7 @@ void CFlylinkDBManager::save_transfer_history(bool p_is_torrent, eTypeTransfer p
 	{
 		l_name = Text::toLower(Util::getFileName(p_item->getTarget()));
 		l_path = Text::toLower(Util::getFilePath(p_item->getTarget()));
-		{
-			CFlyFastLock(g_tth_cache_cs);
-			g_tiger_tree_cache.erase(p_item->getTTH());
-		}
+		g_tiger_tree_cache.erase(p_item->getTTH());
 	}
 	CFlyLock(m_cs);
 	try
@@ -3591,6 +3611,7 @@ void CFlylinkDBManager::update_last_ip_and_message_count(uint32_t p_hub_id, cons
 //========================================================================================================
 void CFlylinkDBManager::flush()
 {
+	flush_torrent_resume();
 	flush_all_last_ip_and_message_count();
 }
 //========================================================================================================
@@ -4292,6 +4313,7 @@ void CFlylinkDBManager::sweep_files(__int64 p_path_id, const CFlyDirMap& p_sweep
 //========================================================================================================
 void CFlylinkDBManager::load_dir(__int64 p_path_id, CFlyDirMap& p_dir_map, bool p_is_no_mediainfo)
 {
+	CFlyLock(m_cs); // ShareManager scans several roots in parallel
 	try
 	{
 		sqlite3_command* l_sql;
@@ -4480,72 +4502,72 @@ unsigned __int64 CFlylinkDBManager::get_block_size_sql(const TTHValue& p_root, _
 //========================================================================================================
 bool CFlylinkDBManager::get_tree(const TTHValue& p_root, TigerTree& p_tt, __int64& p_block_size)
 {
-	dcassert(p_root != TTHValue());
 	p_block_size = 0;
+	const auto l_tree = get_tree_ptr(p_root);
+	if (!l_tree)
+		return false;
+	p_tt = *l_tree;
+	p_block_size = l_tree->getBlockSize();
+	return true;
+}
+//========================================================================================================
+CFlyTigerTreeCache::TreePtr CFlylinkDBManager::get_tree_ptr(const TTHValue& p_root)
+{
+	dcassert(p_root != TTHValue());
+	CFlyTigerTreeCache::TreePtr l_tree = g_tiger_tree_cache.find(p_root);
+	if (l_tree)
+	{
+		return l_tree;
+	}
+	const auto l_start = std::chrono::steady_clock::now();
 	try
 	{
-		{
-			CFlyFastLock(g_tth_cache_cs);
-			const auto& l_cache_tt = g_tiger_tree_cache.find(p_root);
-			if (l_cache_tt != g_tiger_tree_cache.end())
-			{
-#ifdef _DEBUG
-				// LogManager::message("[!] Cache! bingo! CFlylinkDBManager::getTree TTH Root = " + p_root.toBase32());
-#endif
-				p_tt = l_cache_tt->second;
-				return true;
-			}
-		}
-		CFlyLock(m_cs); // TODO -     -    
+		CFlyLock(m_cs);
 		m_get_tree.init(m_flySQLiteDB, "select tiger_tree,file_size,block_size from fly_hash_block where tth=?");
 		m_get_tree->bind(1, p_root.data, 24, SQLITE_STATIC);
 		sqlite3_reader l_q = m_get_tree->executereader();
 		if (l_q.read())
 		{
 			const __int64 l_file_size = l_q.getint64(1);
-			p_block_size = l_q.getint64(2);
-			if (p_block_size == 0)
-				p_block_size = TigerTree::getMaxBlockSize(l_file_size);
+			__int64 l_block_size = l_q.getint64(2);
+			if (l_block_size == 0)
+				l_block_size = TigerTree::getMaxBlockSize(l_file_size);
 				
 			if (l_file_size <= MIN_BLOCK_SIZE) // TODO -     .
 			{
-				CFlyFastLock(g_tth_cache_cs);
-				p_tt = TigerTree(l_file_size, p_block_size, p_root);
-				g_tiger_tree_cache.insert(make_pair(p_root, p_tt));
-				dcassert(p_tt.getRoot() == p_root);
-				const auto l_result = p_tt.getRoot() == p_root;
-				return l_result;
+				l_tree = std::make_shared<TigerTree>(l_file_size, l_block_size, p_root);
 			}
-			vector<uint8_t> l_buf;
-			l_q.getblob(0, l_buf);
-			if (!l_buf.empty())
+			else
 			{
-				p_tt = TigerTree(l_file_size, p_block_size, &l_buf[0], l_buf.size());
-				dcassert(p_tt.getRoot() == p_root);
-				const auto l_result = p_tt.getRoot() == p_root;
-				if (l_result)
+				vector<uint8_t> l_buf;
+				l_q.getblob(0, l_buf);
+				if (!l_buf.empty())
 				{
-					CFlyFastLock(g_tth_cache_cs);
-					if (g_tiger_tree_cache.size() > g_tth_cache_limit)
+					auto l_db_tree = std::make_shared<TigerTree>(l_file_size, l_block_size, &l_buf[0], l_buf.size());
+					dcassert(l_db_tree->getRoot() == p_root);
+					if (l_db_tree->getRoot() == p_root)
 					{
-						clear_and_reset_capacity(g_tiger_tree_cache);
+						l_tree = l_db_tree;
 					}
-					g_tiger_tree_cache.insert(make_pair(p_root, p_tt));
 				}
-				return l_result;
-			}
-			else
-			{
-				dcassert(0);
-				return false;
+				else
+				{
+					dcassert(0);
+				}
 			}
 		}
+		if (l_tree)
+		{
+			// still under m_cs: add_treeL erases the entry under it too, so an old tree read here can't come back after that
+			g_tiger_tree_cache.insert(p_root, l_tree);
+		}
 	}
 	catch (const database_error& e)
 	{
 		errorDB("SQLite - get_tree: " + e.getError());
 	}
-	return false;
+	g_tiger_tree_cache.addFetch(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - l_start).count());
+	return l_tree;
 }
 //========================================================================================================
 __int64 CFlylinkDBManager::get_tth_idL(const TTHValue& p_tth)
@@ -4790,10 +4812,7 @@ void CFlylinkDBManager::add_tree_internal_bind_and_executeL(sqlite3_command* p_s
 //========================================================================================================
 __int64 CFlylinkDBManager::add_treeL(const TigerTree& p_tt)
 {
-	{
-		CFlyFastLock(g_tth_cache_cs);
-		g_tiger_tree_cache.erase(p_tt.getRoot()); //  ,      .
-	}
+	g_tiger_tree_cache.erase(p_tt.getRoot()); //  ,      .
 	try
 	{
 		sqlite3_command* l_sql = nullptr;
@@ -4838,15 +4857,12 @@ __int64 CFlylinkDBManager::add_treeL(const TigerTree& p_tt)
 //========================================================================================================
 void CFlylinkDBManager::clearTTHCache()
 {
-	CFlyFastLock(g_tth_cache_cs);
-	clear_and_reset_capacity(g_tiger_tree_cache);
+	g_tiger_tree_cache.clear();
 }
 //========================================================================================================
 void CFlylinkDBManager::tryFixBadAlloc()
 {
-	g_tth_cache_limit /= 2;
-	if (g_tth_cache_limit < 10)
-		g_tth_cache_limit = 10;
+	g_tiger_tree_cache.setLimit(std::max<size_t>(g_tiger_tree_cache.getLimit() / 2, 1024 * 1024));
 	clearTTHCache();
 }
 //========================================================================================================
@@ -4902,10 +4918,6 @@ void CFlylinkDBManager::shutdown_engine()
 //========================================================================================================
 CFlylinkDBManager::~CFlylinkDBManager()
 {
-	{
-		CFlyFastLock(g_tth_cache_cs);
-		dcassert(g_tiger_tree_cache.empty());
-	}
 	dcassert(m_cache_hash_files.empty());
 	flush();
 #ifdef _DEBUG
@@ -5008,6 +5020,19 @@ CFlylinkDBManager::FileStatus CFlylinkDBManager::get_status_file(const TTHValue&
 #endif // FLYLINKDC_USE_LEVELDB
 }
 //========================================================================================================
+void CFlylinkDBManager::get_status_files(const std::vector<TTHValue>& p_tth, std::vector<uint8_t>& p_status)
+{
+#ifdef FLYLINKDC_USE_LEVELDB
+	m_TTHLevelDB.get_values(p_tth, p_status);
+#else
+	p_status.resize(p_tth.size());
+	for (size_t i = 0; i < p_tth.size(); ++i)
+	{
+		p_status[i] = uint8_t(get_status_file(p_tth[i]));
+	}
+#endif
+}
+//========================================================================================================
 #ifdef FLYLINKDC_LOG_IN_SQLITE_BASE
 void CFlylinkDBManager::log(const int p_area, const StringMap& p_params)
 {
@@ -5127,7 +5152,7 @@ __int64 CFlylinkDBManager::convert_tth_history()
 }
 #ifdef FLYLINKDC_USE_LEVELDB
 //========================================================================================================
-CFlyLevelDB::CFlyLevelDB(): m_level_db(nullptr)
+CFlyLevelDB::CFlyLevelDB(): m_level_db(nullptr), m_is_filter_stale(false), m_is_filter_building(false), m_is_stop(false), m_filter_builder(*this)
 {
 	m_readoptions.verify_checksums = true;
 	m_readoptions.fill_cache = true;
@@ -5149,6 +5174,8 @@ CFlyLevelDB::CFlyLevelDB(): m_level_db(nullptr)
 //========================================================================================================
 CFlyLevelDB::~CFlyLevelDB()
 {
+	m_is_stop = true;
+	m_filter_builder.waitShutdown();
 	safe_delete(m_level_db);
 	safe_delete(m_options.filter_policy);
 	safe_delete(m_options.block_cache);
@@ -5265,12 +5292,135 @@ uint32_t CFlyLevelDB::set_bit(const TTHValue& p_tth, uint32_t p_mask)
 		l_mask |= p_mask;
 		if (set_value(p_tth, Util::toString(l_mask)))
 		{
+			if (l_value.empty()) // a new key - the known ones are in the filter already
+			{
+				CFlyFastLock(m_filter_cs);
+				if (m_is_filter_building)
+				{
+					m_filter_pending.push_back(p_tth);
+				}
+				if (!m_filter.empty())
+				{
+					m_filter.add(p_tth.data);
+					if (m_filter.isFull())
+					{
+						// the key count has doubled since the build - false positives grow, a bigger one is built by the next get_values()
+						m_is_filter_stale = true;
+					}
+				}
+			}
 			return l_mask;
 		}
 	}
 	dcassert(0);
 	return 0;
 }
+//========================================================================================================
+void CFlyLevelDB::build_filter()
+{
+	// runs on m_filter_builder, m_is_filter_building is set by get_values(): the database is scanned
+	// without m_filter_cs, set_bit() keeps updating the current filter and remembers its keys for the new one
+	CFlyLog l_log("[CFlyLevelDB::build_filter]");
+	std::vector<TTHValue> l_keys;
+	{
+		std::unique_ptr<leveldb::Iterator> l_it(m_level_db->NewIterator(m_iteroptions));
+		for (l_it->SeekToFirst(); l_it->Valid() && !m_is_stop; l_it->Next())
+		{
+			if (l_it->key().size() == TTHValue::BYTES)
+			{
+				l_keys.push_back(TTHValue(reinterpret_cast<const uint8_t*>(l_it->key().data())));
+			}
+		}
+	}
+	if (m_is_stop)
+	{
+		CFlyFastLock(m_filter_cs);
+		m_filter_pending.clear();
+		m_is_filter_building = false;
+		return;
+	}
+	CFlyTTHFilter l_filter;
+	l_filter.init(l_keys.size());
+	for (auto i = l_keys.cbegin(); i != l_keys.cend(); ++i)
+	{
+		l_filter.add(i->data);
+	}
+	const size_t l_filter_size = l_filter.getByteSize();
+	{
+		CFlyFastLock(m_filter_cs);
+		for (auto i = m_filter_pending.cbegin(); i != m_filter_pending.cend(); ++i)
+		{
+			l_filter.add(i->data);
+		}
+		m_filter_pending.clear();
+		m_filter.swap(l_filter); // the old bits are freed outside the lock
+		m_is_filter_stale = false;
+		m_is_filter_building = false;
+	}
+	l_log.step("keys = " + Util::toString(l_keys.size()) + " filter = " + Util::formatBytes(int64_t(l_filter_size)));
+}
+//========================================================================================================
+void CFlyLevelDB::get_values(const std::vector<TTHValue>& p_tth, std::vector<uint8_t>& p_result)
+{
+	p_result.assign(p_tth.size(), 0);
+	dcassert(m_level_db);
+	if (!m_level_db || p_tth.empty())
+		return;
+	bool l_is_build = false;
+	{
+		CFlyFastLock(m_filter_cs);
+		if ((m_filter.empty() || m_is_filter_stale) && !m_is_filter_building && !m_is_stop)
+		{
+			m_is_filter_building = true;
+			l_is_build = true;
+		}
+	}
+	if (l_is_build)
+	{
+		m_filter_builder.addTask(true);
+	}
+	std::vector<uint32_t> l_candidates;
+	{
+		CFlyFastLock(m_filter_cs);
+		for (uint32_t i = 0; i < p_tth.size(); ++i)
+		{
+			// no filter yet (the first one is being built) - every key is a candidate
+			if (m_filter.empty() || m_filter.contains(p_tth[i].data))
+			{
+				l_candidates.push_back(i);
+			}
+		}
+	}
+	// sorted keys - the iterator moves forward only, neighbouring keys share the same blocks
+	std::sort(l_candidates.begin(), l_candidates.end(), [&p_tth](uint32_t a, uint32_t b)
+	{
+		return memcmp(p_tth[a].data, p_tth[b].data, TTHValue::BYTES) < 0;
+	});
+	std::unique_ptr<leveldb::Iterator> l_it(m_level_db->NewIterator(m_readoptions));
+	for (auto i = l_candidates.cbegin(); i != l_candidates.cend(); ++i)
+	{
+		const leveldb::Slice l_key(reinterpret_cast<const char*>(p_tth[*i].data), TTHValue::BYTES);
+		l_it->Seek(l_key);
+		if (!l_it->Valid())
+			break;
+		if (l_it->key() == l_key)
+		{
+			// the value is a small decimal number (see set_bit)
+			const leveldb::Slice l_value = l_it->value();
+			uint32_t l_status = 0;
+			for (size_t j = 0; j < l_value.size() && l_value[j] >= '0' && l_value[j] <= '9'; ++j)
+			{
+				l_status = l_status * 10 + (l_value[j] - '0');
+			}
+			dcassert(l_status <= 7);
+			p_result[*i] = uint8_t(l_status);
+		}
+	}
+	if (!l_it->status().ok())
+	{
+		LogManager::message("[CFlyLevelDB::get_values] " + l_it->status().ToString(), true);
+	}
+}
 #ifdef FLYLINKDC_USE_IPCACHE_LEVELDB
 //========================================================================================================
 CFlyIPMessageCache CFlyLevelDBCacheIP::get_last_ip_and_message_count(uint32_t p_hub_id, const string& p_nick)
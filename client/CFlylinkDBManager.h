@@ -12,6 +12,9 @@
 #include "QueueItem.h"
 #include "Singleton.h"
 #include "CFlyThread.h"
+#include "CFlyIPRangeIndex.h"
+#include "CFlyTTHFilter.h"
+#include "CFlyTigerTreeCache.h"
 #include "sqlite/sqlite3x.hpp"
 #include "CFlyMediaInfo.h"
 #include "LogManager.h"
@@ -75,6 +78,28 @@ class CFlyLevelDB
 		leveldb::ReadOptions  m_iteroptions;
 		leveldb::WriteOptions m_writeoptions;
 		
+		// Bloom filter over all TTH keys of the database - answers "not in the database" without touching LevelDB.
+		// The first get_values() call starts building it on m_filter_builder, until then the keys are read
+		// from LevelDB directly. set_bit() keeps it up to date.
+		FastCriticalSection m_filter_cs;
+		CFlyTTHFilter m_filter;
+		bool m_is_filter_stale;    // too full - rebuilt by the next get_values(), used until then
+		bool m_is_filter_building; // the database is being scanned without m_filter_cs
+		volatile bool m_is_stop;   // the scan is abandoned, the database is being closed
+		std::vector<TTHValue> m_filter_pending; // keys added by set_bit() during the scan
+		void build_filter();
+		class CFlyFilterBuilder : public BackgroundTaskExecuter<bool>
+		{
+			public:
+				explicit CFlyFilterBuilder(CFlyLevelDB& p_db) : m_db(p_db) { }
+			private:
+				void execute(const bool&)
+				{
+					m_db.build_filter();
+				}
+				CFlyLevelDB& m_db;
+		} m_filter_builder;
+		
 	public:
 		CFlyLevelDB();
 		~CFlyLevelDB();
@@ -96,6 +121,8 @@ class CFlyLevelDB
 				return false;
 		}
 		uint32_t set_bit(const TTHValue& p_tth, uint32_t p_mask);
+		/** Statuses (see set_bit) of many TTHs at once: p_result[i] belongs to p_tth[i], 0 if unknown */
+		void get_values(const std::vector<TTHValue>& p_tth, std::vector<uint8_t>& p_result);
 };
 #ifdef FLYLINKDC_USE_IPCACHE_LEVELDB
 #pragma pack(push, 1)
@@ -381,8 +408,12 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		};
 		
 		FileStatus get_status_file(const TTHValue& p_tth);
+		/** Batch version of get_status_file() for file list loading: p_status[i] is FileStatus of p_tth[i] */
+		void get_status_files(const std::vector<TTHValue>& p_tth, std::vector<uint8_t>& p_status);
 		
 		bool get_tree(const TTHValue& p_root, TigerTree& p_tt, __int64& p_block_size);
+		/** Shared (cached) tree without a copy, null if there is no valid tree in the database */
+		CFlyTigerTreeCache::TreePtr get_tree_ptr(const TTHValue& p_root);
 		unsigned __int64 get_block_size_sql(const TTHValue& p_root, __int64 p_size);
 		__int64 get_path_id(string p_path, bool p_create, bool p_case_convet, bool& p_is_no_mediainfo, bool p_sweep_path);
 		void add_tree(const TigerTree& p_tt);
@@ -406,6 +437,10 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		void save_torrent_resume(const libtorrent::sha1_hash& p_sha1, const std::string& p_name, const std::vector<char>& p_resume);
 		void load_torrent_resume(libtorrent::session& p_session);
 		void delete_torrent_resume(const libtorrent::sha1_hash& p_sha1);
+		void flush_torrent_resume();
+	private:
+		void save_torrent_resumeL(const libtorrent::sha1_hash& p_sha1, const std::string& p_name, const std::vector<char>& p_resume);
+	public:
 		
 		bool merge_mediainfo(const __int64 p_tth_id, const __int64 p_path_id, const string& p_file_name, const CFlyMediaInfo& p_media);
 #ifdef USE_REBUILD_MEDIAINFO
@@ -521,9 +556,20 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		}
 	private:
 #ifdef FLYLINKDC_USE_GEO_IP
-		string load_country_locations_p2p_guard_from_db(uint32_t p_ip, uint32_t& p_location_cache_index, uint16_t& p_country_cache_index);
-		bool find_cache_country(uint32_t p_ip, uint16_t& p_index);
-		bool find_cache_location(uint32_t p_ip, uint32_t& p_location_index, uint16_t& p_flag_index);
+		// fly_country_ip, fly_location_ip and fly_p2pguard_ip loaded into memory.
+		// Replaced as a whole after save_geoip/save_location/save_p2p_guard, readers keep their snapshot.
+		struct CFlyGeoIndex
+		{
+			CFlyIPRangeIndex m_country;   // -> m_country_cache index
+			CFlyIPRangeIndex m_location;  // -> m_location_cache_array index
+			CFlyIPRangeIndex m_p2p_guard; // -> m_p2p_guard_notes index
+			std::vector<string> m_p2p_guard_notes;
+		};
+		typedef std::shared_ptr<const CFlyGeoIndex> CFlyGeoIndexPtr;
+		CFlyGeoIndexPtr m_geo_index;
+		CFlyGeoIndexPtr get_geo_index(bool p_is_use_only_cache);
+		void load_geo_indexL();
+		void reset_geo_index();
 		__int64 get_dic_country_id(const string& p_country);
 		void clear_dic_cache_country();
 #endif
@@ -587,6 +633,14 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		typedef boost::unordered_map<string, CFlyHashCacheItem> CFlyHashCacheMap;
 		CFlyHashCacheMap m_cache_hash_files;
 		FastCriticalSection  m_cache_hash_files_cs;
+		struct CFlyTorrentResumeItem
+		{
+			std::string m_name;
+			std::vector<char> m_resume;
+		};
+		typedef std::unordered_map<libtorrent::sha1_hash, CFlyTorrentResumeItem> CFlyTorrentResumeMap;
+		CFlyTorrentResumeMap m_cache_torrent_resume; // only the latest resume data of every torrent, written by flush_torrent_resume()
+		FastCriticalSection  m_cache_torrent_resume_cs;
 #ifdef FLYLINKDC_USE_LEVELDB
 		CFlyLevelDB         m_TTHLevelDB;
 #ifdef FLYLINKDC_USE_IPCACHE_LEVELDB
@@ -713,18 +767,16 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		CFlySQLCommand m_delete_registry;
 		
 		FastCriticalSection m_cache_location_cs;
+		// Descriptions of countries/locations are only appended (every distinct name + flag once),
+		// so an index handed out to Util::CustomNetworkIndex stays valid after the tables are reloaded.
+		typedef boost::unordered_map<std::pair<string, uint16_t>, uint32_t> CFlyLocationDescIndex;
 		vector<CFlyLocationDesc> m_location_cache_array;
-		struct CFlyCacheIPInfo
-		{
-			string m_description_p2p_guard;
-			uint32_t m_location_cache_index;
-			uint16_t m_country_cache_index;
-			uint16_t m_flag_location_index;
-			CFlyCacheIPInfo() : m_location_cache_index(0), m_country_cache_index(0), m_flag_location_index(0)
-			{
-			}
-		};
-		boost::unordered_map<uint32_t, CFlyCacheIPInfo> m_ip_info_cache;
+		CFlyLocationDescIndex m_location_cache_index;
+		static uint32_t get_location_desc_index(vector<CFlyLocationDesc>& p_cache, CFlyLocationDescIndex& p_index, const string& p_description, uint16_t p_flag_index);
+#ifdef FLYLINKDC_USE_GEO_IP
+		void load_geo_rangesL(const char* p_sql, vector<CFlyLocationDesc>& p_cache, CFlyLocationDescIndex& p_cache_index,
+		                      uint32_t p_max_desc_index, CFlyIPRangeIndex& p_ranges);
+#endif
 		
 		int m_count_fly_location_ip_record;
 		bool is_fly_location_ip_valid() const
@@ -742,14 +794,10 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		boost::unordered_set<string> m_lost_location_cache;
 #endif
 #ifdef FLYLINKDC_USE_GEO_IP
-		CFlySQLCommand m_select_country_and_location;
-		// TODO CFlySQLCommand m_select_only_location;
 		CFlySQLCommand m_insert_geoip;
 		CFlySQLCommand m_delete_geoip;
 		vector<CFlyLocationDesc> m_country_cache;
-#endif
-#ifdef _DEBUG
-		boost::unordered_map<uint32_t, unsigned> m_count_ip_sql_query_guard;
+		CFlyLocationDescIndex m_country_cache_index;
 #endif
 		CFlySQLCommand m_select_manual_p2p_guard;
 		CFlySQLCommand m_delete_manual_p2p_guard;
@@ -830,10 +878,8 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		static int32_t g_count_queue_source;
 		static int32_t g_count_queue_files;
 		
-		static boost::unordered_map<TTHValue, TigerTree> g_tiger_tree_cache;
-		static FastCriticalSection g_tth_cache_cs;
+		static CFlyTigerTreeCache g_tiger_tree_cache;
 		static void clearTTHCache();
-		static unsigned g_tth_cache_limit;
 	public:
 		static bool is_resume_torrent(const libtorrent::sha1_hash& p_sha1);
 		static bool is_delete_torrent(const libtorrent::sha1_hash& p_sha1);
@@ -841,9 +887,14 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		static void tryFixBadAlloc();
 		static unsigned get_tth_cache_size()
 		{
-			//CFlyFastLock(g_tth_cache_cs);
 			return g_tiger_tree_cache.size();
 		}
+		/** @return "size, hit rate, average database read time" for the statistics */
+		static string get_tth_cache_stat()
+		{
+			return Util::formatBytes(int64_t(g_tiger_tree_cache.getBytes())) + ", hits " + Util::toString(g_tiger_tree_cache.getHitRate()) +
+			       "%, DB read " + Util::toString(g_tiger_tree_cache.getAvgFetchTime()) + " us";
+		}
 };
 #endif
 
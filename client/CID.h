@@ -46,7 +46,7 @@ class CID
 		{
 			//dcassert(base32.length() == 39);
 			dcassert(base32.find(' ') == string::npos);
-			if (base32.length() == 39)
+			if (base32.length() <= 39) // a shorter string ends with '\0' - fromBase32 handles it
 				Encoder::fromBase32(base32.c_str(), cid, sizeof(cid));
 			else
 			{
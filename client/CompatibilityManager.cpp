@@ -45,6 +45,8 @@
 #include "../FlyFeatures/flyServer.h"
 #include <iphlpapi.h>
 #include <direct.h>
+#include <intrin.h>
+#include <immintrin.h>
 
 #pragma comment(lib, "Imagehlp.lib")
 
@@ -54,6 +56,7 @@ DWORDLONG CompatibilityManager::g_TotalPhysMemory;
 DWORDLONG CompatibilityManager::g_FreePhysMemory;
 OSVERSIONINFOEX CompatibilityManager::g_osvi = {0};
 SYSTEM_INFO CompatibilityManager::g_sysInfo = {0};
+uint32_t CompatibilityManager::g_cpu_features = 0;
 bool CompatibilityManager::g_supports[LAST_SUPPORTS];
 LONG CompatibilityManager::g_comCtlVersion = 0;
 DWORD CompatibilityManager::g_oldPriorityClass = 0;
@@ -89,6 +92,7 @@ void CompatibilityManager::init()
 		
 	detectOsSupports();
 	getSystemInfoFromOS();
+	detectCPUFeatures();
 	generateSystemInfoForApp();
 	if (CompatibilityManager::isWin7Plus())
 	{
@@ -104,6 +108,50 @@ void CompatibilityManager::getSystemInfoFromOS()
 	GetSystemInfo(&g_sysInfo);
 }
 
+void CompatibilityManager::detectCPUFeatures()
+{
+	int l_info[4] = {0};
+	__cpuid(l_info, 0);
+	const int l_max_leaf = l_info[0];
+	if (l_max_leaf < 1)
+		return;
+	__cpuid(l_info, 1);
+	if (l_info[3] & (1 << 26))
+		g_cpu_features |= CPU_SSE2;
+	if (l_info[2] & (1 << 9))
+		g_cpu_features |= CPU_SSSE3;
+	if (l_info[2] & (1 << 19))
+		g_cpu_features |= CPU_SSE41;
+	// AVX also needs the OS to save the YMM registers (OSXSAVE + XCR0)
+	const bool l_is_avx_os = (l_info[2] & (1 << 27)) && (l_info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+	if (l_is_avx_os)
+		g_cpu_features |= CPU_AVX;
+	if (l_max_leaf >= 7)
+	{
+		__cpuidex(l_info, 7, 0);
+		if (l_is_avx_os && (l_info[1] & (1 << 5)))
+			g_cpu_features |= CPU_AVX2;
+		if (l_info[1] & (1 << 29))
+			g_cpu_features |= CPU_SHA;
+	}
+}
+
+string CompatibilityManager::getCPUFeaturesString()
+{
+	static const char* g_names[] = { "SSE2", "SSSE3", "SSE4.1", "AVX", "AVX2", "SHA" };
+	string l_result;
+	for (size_t i = 0; i < _countof(g_names); ++i)
+	{
+		if (g_cpu_features & (1 << i))
+		{
+			if (!l_result.empty())
+				l_result += ' ';
+			l_result += g_names[i];
+		}
+	}
+	return l_result.empty() ? "none" : l_result;
+}
+
 void CompatibilityManager::detectOsSupports()
 {
 	g_osvi.dwOSVersionInfoSize = sizeof(OSVERSIONINFOEX);
@@ -564,6 +612,7 @@ void CompatibilityManager::generateSystemInfoForApp()
 	                 + "\tProcessor type: ";
 	g_startupInfo += getProcArchString();
 	g_startupInfo += ".\r\n";
+	g_startupInfo += "\tCPU features: " + getCPUFeaturesString() + ".\r\n";
 	
 	g_startupInfo += generateGlobalMemoryStatusMessage();
 	g_startupInfo += "\r\n";
@@ -754,7 +803,7 @@ string CompatibilityManager::generateProgramStats() // moved form WinUtil.
 				          "\t-=[ RAM (peak): %s (%s). Virtual (peak): %s (%s) ]=-\r\n"
 				          "\t-=[ GDI units (peak): %d (%d). Handle (peak): %d (%d) ]=-\r\n"
 				          "\t-=[ Share: %s. Files in share: %u. Total users: %u on hubs: %u ]=-\r\n"
-				          "\t-=[ TigerTree cache: %u Search not exists cache: %u Search exists cache: %u]=-\r\n"
+				          "\t-=[ TigerTree cache: %u (%s) Search not exists cache: %u Search exists cache: %u]=-\r\n"
 #ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
 				          "\t-=[ Total download: %s. Total upload: %s ]=-\r\n"
 #endif
@@ -788,6 +837,7 @@ string CompatibilityManager::generateProgramStats() // moved form WinUtil.
 				          ClientManager::getTotalUsers(),
 				          Client::getTotalCounts(),
 				          CFlylinkDBManager::get_tth_cache_size(),
+				          CFlylinkDBManager::get_tth_cache_stat().c_str(),
 				          ShareManager::get_cache_size_file_not_exists_set(),
 				          ShareManager::get_cache_file_map(),
 #ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
@@ -1229,7 +1279,7 @@ string CompatibilityManager::CPUInfo()
 			result += _T(" MHz)");
 		}
 	}
-	return result.empty() ? "Unknown" : Text::fromT(result);
+	return (result.empty() ? "Unknown" : Text::fromT(result)) + " [" + getCPUFeaturesString() + ']';
 }
 string CompatibilityManager::getSysUptime()
 {
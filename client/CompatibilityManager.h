@@ -127,6 +127,20 @@ class CompatibilityManager
 		{
 			return g_startupInfo;
 		}
+		enum CPUFeatures
+		{
+			CPU_SSE2 = 1 << 0,
+			CPU_SSSE3 = 1 << 1,
+			CPU_SSE41 = 1 << 2,
+			CPU_AVX = 1 << 3,
+			CPU_AVX2 = 1 << 4,
+			CPU_SHA = 1 << 5
+		};
+		static bool isCPUFeature(CPUFeatures p_feature)
+		{
+			return (g_cpu_features & p_feature) != 0;
+		}
+		static string getCPUFeaturesString();
 		static size_t getProcessorsCount()
 		{
 			return g_sysInfo.dwNumberOfProcessors;
@@ -161,6 +175,7 @@ class CompatibilityManager
 		static string g_startupInfo;
 		static OSVERSIONINFOEX g_osvi;
 		static SYSTEM_INFO g_sysInfo;
+		static uint32_t g_cpu_features;
 		
 		enum Supports
 		{
@@ -197,6 +212,7 @@ class CompatibilityManager
 		static bool detectWine();// [+] PPA
 		static LONG getComCtlVersionFromOS();
 		static void getSystemInfoFromOS();
+		static void detectCPUFeatures();
 		static string getProcArchString();
 		static void generateSystemInfoForApp();
 		static bool getFromSystemIsAppRunningIsWow64();
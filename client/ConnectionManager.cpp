@@ -36,16 +36,16 @@ std::unique_ptr<webrtc::RWLockWrapper> ConnectionManager::g_csConnection = std::
 std::unique_ptr<webrtc::RWLockWrapper> ConnectionManager::g_csDownloads = std::unique_ptr<webrtc::RWLockWrapper> (webrtc::RWLockWrapper::CreateRWLock());
 //std::unique_ptr<webrtc::RWLockWrapper> ConnectionManager::g_csUploads = std::unique_ptr<webrtc::RWLockWrapper> (webrtc::RWLockWrapper::CreateRWLock());
 CriticalSection ConnectionManager::g_csUploads;
-FastCriticalSection ConnectionManager::g_csDdosCheck;
 std::unique_ptr<webrtc::RWLockWrapper> ConnectionManager::g_csDdosCTM2HUBCheck = std::unique_ptr<webrtc::RWLockWrapper>(webrtc::RWLockWrapper::CreateRWLock());
-std::unique_ptr<webrtc::RWLockWrapper> ConnectionManager::g_csTTHFilter = std::unique_ptr<webrtc::RWLockWrapper> (webrtc::RWLockWrapper::CreateRWLock());
-std::unique_ptr<webrtc::RWLockWrapper> ConnectionManager::g_csFileFilter = std::unique_ptr<webrtc::RWLockWrapper>(webrtc::RWLockWrapper::CreateRWLock());
 
 boost::unordered_set<UserConnection*> ConnectionManager::g_userConnections;
-boost::unordered_map<string, ConnectionManager::CFlyTickTTH> ConnectionManager::g_duplicate_search_tth;
-boost::unordered_map<string, ConnectionManager::CFlyTickFile> ConnectionManager::g_duplicate_search_file;
+CFlyRepeatCounter ConnectionManager::g_duplicate_search_tth(32 * 1024);
+CFlyRepeatCounter ConnectionManager::g_duplicate_search_file(32 * 1024);
+CFlyFloodGuard ConnectionManager::g_ddos_guard(4 * 1024, 4 * 1024);
+boost::atomic<uint32_t> ConnectionManager::g_count_ddos_blocked(0);
+boost::atomic<uint32_t> ConnectionManager::g_count_duplicate_tth(0);
+boost::atomic<uint32_t> ConnectionManager::g_count_duplicate_file(0);
 boost::unordered_set<string> ConnectionManager::g_ddos_ctm2hub;
-std::map<ConnectionManager::CFlyDDOSkey, ConnectionManager::CFlyDDoSTick> ConnectionManager::g_ddos_map;
 std::set<ConnectionQueueItemPtr> ConnectionManager::g_downloads; // TODO -    User?
 std::set<ConnectionQueueItemPtr> ConnectionManager::g_uploads; // TODO -    User?
 
@@ -474,14 +474,6 @@ void ConnectionManager::on(TimerManagerListener::Second, uint64_t aTick) noexcep
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
-	if (((aTick / 1000) % (CFlyServerConfig::g_max_unique_tth_search + 2)) == 0)
-	{
-		cleanupDuplicateSearchTTH(aTick);
-	}
-	if (((aTick / 1000) % (CFlyServerConfig::g_max_unique_file_search + 2)) == 0)
-	{
-		cleanupDuplicateSearchFile(aTick);
-	}
 	flushOnUserUpdated();
 	std::vector<ConnectionQueueItemPtr> l_removed;
 #ifdef USING_IDLERS_IN_CONNECTION_MANAGER
@@ -662,96 +654,10 @@ void ConnectionManager::on(TimerManagerListener::Second, uint64_t aTick) noexcep
 #endif
 }
 
-void ConnectionManager::cleanupIpFlood(const uint64_t p_tick)
-{
-	CFlyFastLock(g_csDdosCheck);
-	for (auto j = g_ddos_map.cbegin(); j != g_ddos_map.cend();)
-	{
-		//          -     -    !
-		const auto l_tick_delta = p_tick - j->second.m_first_tick;
-		const bool l_is_min_ban_close = j->second.m_count_connect < CFlyServerConfig::g_max_ddos_connect_to_me && l_tick_delta > 1000 * 60;
-		if (l_is_min_ban_close)
-		{
-#ifdef _DEBUG
-			//LogManager::ddos_message("BlockID = " + Util::toString(j->second.m_block_id) + ", Removed mini-ban for: " +
-			//                         j->first.first + j->second.getPorts() + ", Hub IP = " + j->first.second.to_string() +
-			//                         " m_ddos_map.size() = " + Util::toString(m_ddos_map.size()));
-#endif
-		}
-		//      IP   ,       5 ( )
-		//      
-		const bool l_is_ddos_ban_close = j->second.m_count_connect > CFlyServerConfig::g_max_ddos_connect_to_me
-		                                 && l_tick_delta > CFlyServerConfig::g_ban_ddos_connect_to_me * 1000 * 60;
-		if (l_is_ddos_ban_close && BOOLSETTING(LOG_DDOS_TRACE))
-		{
-			string l_type;
-			if (j->first.m_ip.is_unspecified()) //    IP     ConnectToMe
-			{
-				l_type =  "IP-1:" + j->first.m_server + j->second.getPorts();
-			}
-			else
-			{
-				l_type = " IP-1:" + j->first.m_server + j->second.getPorts() + " IP-2: " + j->first.m_ip.to_string();
-			}
-			LogManager::ddos_message("BlockID = " + Util::toString(j->second.m_block_id) + ", Removed DDoS lock " + j->second.m_type_block +
-			                         ", Count connect = " + Util::toString(j->second.m_count_connect) + " " + l_type +
-			                         ", g_ddos_map.size() = " + Util::toString(g_ddos_map.size()));
-		}
-		if (l_is_ddos_ban_close || l_is_min_ban_close)
-			g_ddos_map.erase(j++);
-		else
-			++j;
-	}
-}
-void ConnectionManager::cleanupDuplicateSearchFile(const uint64_t p_tick)
-{
-	CFlyWriteLock(*g_csFileFilter);
-	for (auto j = g_duplicate_search_file.cbegin(); j != g_duplicate_search_file.cend();)
-	{
-		if ((p_tick - j->second.m_first_tick) > 1000 * CFlyServerConfig::g_max_unique_file_search)
-		{
-#ifdef FLYLINKDC_USE_LOG_FOR_DUPLICATE_FILE_SEARCH
-			if (j->second.m_count_connect > 1) //      - ?
-			{
-				LogManager::ddos_message(string(j->second.m_count_connect, '*') + " BlockID = " + Util::toString(j->second.m_block_id) +
-				                         ", Unlock duplicate File search: " + j->first +
-				                         ", Count connect = " + Util::toString(j->second.m_count_connect) +
-				                         ", Hash map size: " + Util::toString(g_duplicate_search_tth.size()));
-			}
-#endif
-			g_duplicate_search_file.erase(j++);
-		}
-		else
-			++j;
-	}
-}
-void ConnectionManager::cleanupDuplicateSearchTTH(const uint64_t p_tick)
-{
-	CFlyWriteLock(*g_csTTHFilter);
-	for (auto j = g_duplicate_search_tth.cbegin(); j != g_duplicate_search_tth.cend();)
-	{
-		if ((p_tick - j->second.m_first_tick) > 1000 * CFlyServerConfig::g_max_unique_tth_search)
-		{
-#ifdef FLYLINKDC_USE_LOG_FOR_DUPLICATE_TTH_SEARCH
-			if (j->second.m_count_connect > 1) //      - ?
-			{
-				LogManager::ddos_message(string(j->second.m_count_connect, '*') + " BlockID = " + Util::toString(j->second.m_block_id) +
-				                         ", Unlock duplicate TTH search: " + j->first +
-				                         ", Count connect = " + Util::toString(j->second.m_count_connect) +
-				                         ", Hash map size: " + Util::toString(g_duplicate_search_tth.size()));
-			}
-#endif
-			g_duplicate_search_tth.erase(j++);
-		}
-		else
-			++j;
-	}
-}
 void ConnectionManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
-	cleanupIpFlood(aTick);
 	CFlyReadLock(*g_csConnection);
 	for (auto j = g_userConnections.cbegin(); j != g_userConnections.cend(); ++j)
 	{
@@ -913,44 +819,21 @@ void ConnectionManager::accept(const Socket& sock, bool secure, Server* p_server
 }
 bool ConnectionManager::checkDuplicateSearchFile(const string& p_search_command)
 {
-	CFlyWriteLock(*g_csFileFilter);
-	const auto l_tick = GET_TICK();
-	CFlyTickFile l_item;
-	l_item.m_first_tick = l_tick;
-	l_item.m_last_tick = l_tick;
 	const auto l_key_pos = p_search_command.rfind(' ');
 	if (l_key_pos != string::npos && l_key_pos)
 	{
-		const string l_key = p_search_command.substr(0, l_key_pos);
-		auto l_result = g_duplicate_search_file.insert(std::pair<string, CFlyTickFile>(l_key, l_item));
-		auto& l_cur_value = l_result.first->second;
-		++l_cur_value.m_count_connect;
-		if (l_result.second == false) //    -     .
+		// the key is the search without the last token
+		const uint64_t l_hash = CFlyWindowSketch::getHash(p_search_command.data(), l_key_pos);
+		const uint32_t l_count = g_duplicate_search_file.add(l_hash, GET_TICK(), 1000 * uint64_t(CFlyServerConfig::g_max_unique_file_search));
+		if (l_count > 1)
 		{
-			l_cur_value.m_last_tick = l_tick;
-			if (l_tick - l_cur_value.m_first_tick > 1000 * CFlyServerConfig::g_max_unique_file_search)
-			{
-				//      
-				return false;
-			}
-			if (l_cur_value.m_count_connect > 1)
-			{
-				static uint16_t g_block_id = 0;
-				if (l_cur_value.m_block_id == 0)
-				{
-					l_cur_value.m_block_id = ++g_block_id;
-				}
-				if (l_cur_value.m_count_connect >= 2)
-				{
+			++g_count_duplicate_file;
 #ifdef FLYLINKDC_USE_LOG_FOR_DUPLICATE_FILE_SEARCH
-					LogManager::ddos_message(string(l_cur_value.m_count_connect, '*') + " BlockID = " + Util::toString(l_cur_value.m_block_id) +
-					                         ", Lock File search = " + p_search_command +
-					                         ", Count = " + Util::toString(l_cur_value.m_count_connect) +
-					                         ", Hash map size: " + Util::toString(g_duplicate_search_file.size()));
+			LogManager::ddos_message(string(std::min(l_count, 255u), '*') + " Lock File search = " + p_search_command +
+			                         ", Count = " + Util::toString(l_count) +
+			                         ", Total = " + Util::toString(g_count_duplicate_file));
 #endif
-				}
-				return true;
-			}
+			return true;
 		}
 	}
 	return false;
@@ -958,41 +841,18 @@ bool ConnectionManager::checkDuplicateSearchFile(const string& p_search_command)
 
 bool ConnectionManager::checkDuplicateSearchTTH(const string& p_search_command, const TTHValue& p_tth)
 {
-	CFlyWriteLock(*g_csTTHFilter);
-	const auto l_tick = GET_TICK();
-	CFlyTickTTH l_item;
-	l_item.m_first_tick = l_tick;
-	l_item.m_last_tick  = l_tick;
-	auto l_result = g_duplicate_search_tth.insert(std::pair<string, CFlyTickTTH>(p_search_command + ' ' + p_tth.toBase32(), l_item));
-	auto& l_cur_value = l_result.first->second;
-	++l_cur_value.m_count_connect;
-	if (l_result.second == false) //    -     .
-	{
-		l_cur_value.m_last_tick  = l_tick;
-		if (l_tick - l_cur_value.m_first_tick > 1000 * CFlyServerConfig::g_max_unique_tth_search)
-		{
-			//      
-			return false;
-		}
-		if (l_cur_value.m_count_connect > 1)
-		{
-			static uint16_t g_block_id = 0;
-			if (l_cur_value.m_block_id == 0)
-			{
-				l_cur_value.m_block_id = ++g_block_id;
-			}
-			if (l_cur_value.m_count_connect >= 2)
-			{
+	const uint64_t l_hash = CFlyWindowSketch::getHash(p_tth.data, TTHValue::BYTES, CFlyWindowSketch::getHash(p_search_command));
+	const uint32_t l_count = g_duplicate_search_tth.add(l_hash, GET_TICK(), 1000 * uint64_t(CFlyServerConfig::g_max_unique_tth_search));
+	if (l_count > 1)
+	{
+		++g_count_duplicate_tth;
 #ifdef FLYLINKDC_USE_LOG_FOR_DUPLICATE_TTH_SEARCH
-				LogManager::ddos_message(string(l_cur_value.m_count_connect, '*') + " BlockID = " + Util::toString(l_cur_value.m_block_id) +
-				                         ", Lock TTH search = " + p_search_command +
-				                         ", TTH = " + p_tth.toBase32() +
-				                         ", Count = " + Util::toString(l_cur_value.m_count_connect) +
-				                         ", Hash map size: " + Util::toString(g_duplicate_search_tth.size()));
+		LogManager::ddos_message(string(std::min(l_count, 255u), '*') + " Lock TTH search = " + p_search_command +
+		                         ", TTH = " + p_tth.toBase32() +
+		                         ", Count = " + Util::toString(l_count) +
+		                         ", Total = " + Util::toString(g_count_duplicate_tth));
 #endif
-			}
-			return true;
-		}
+		return true;
 	}
 	return false;
 }
@@ -1037,8 +897,6 @@ bool ConnectionManager::checkIpFlood(const string& aIPServer, uint16_t aPort, co
 		dcassert(l_server_lower == aIPServer);
 		// boost::system::error_code ec;
 		// const auto l_ip = boost::asio::ip::address_v4::from_string(aIPServer, ec);
-		const CFlyDDOSkey l_key(l_server_lower, p_ip_hub);
-		// dcassert(!ec); // TODO -    Host
 		bool l_is_ctm2hub = false;
 		{
 			CFlyReadLock(*g_csDdosCTM2HUBCheck);
@@ -1053,54 +911,26 @@ bool ConnectionManager::checkIpFlood(const string& aIPServer, uint16_t aPort, co
 			LogManager::ddos_message(l_cmt2hub);
 			return true;
 		}
-		CFlyDDoSTick l_item;
-		l_item.m_first_tick = l_tick;
-		l_item.m_last_tick = l_tick;
-		CFlyFastLock(g_csDdosCheck);
-		auto l_result = g_ddos_map.insert(std::pair<CFlyDDOSkey, CFlyDDoSTick>(l_key, l_item));
-		auto& l_cur_value = l_result.first->second;
-		++l_cur_value.m_count_connect;
-		string l_debug_key;
-		if (BOOLSETTING(LOG_DDOS_TRACE))
+		// no more than g_max_ddos_connect_to_me connects to one target per minute,
+		// after that the target is locked for g_ban_ddos_connect_to_me minutes
+		const string l_key = l_server_lower + ' ' + Util::toString(p_ip_hub.to_ulong());
+		const uint64_t l_ban_window = uint64_t(CFlyServerConfig::g_ban_ddos_connect_to_me) * 1000 * 60;
+		const uint32_t l_count = g_ddos_guard.add(l_key, l_tick, 1000 * 60, CFlyServerConfig::g_max_ddos_connect_to_me, l_ban_window);
+		if (l_count >= CFlyServerConfig::g_max_ddos_connect_to_me)
 		{
-			l_debug_key = " Time: " + Util::getShortTimeString() + " Hub info = " + p_HubInfo; // https://drdump.com/Problem.aspx?ClientID=guest&ProblemID=92733
-			if (!p_userInfo.empty())
+			if (l_count == CFlyServerConfig::g_max_ddos_connect_to_me && BOOLSETTING(LOG_DDOS_TRACE))
 			{
-				l_debug_key + " UserInfo = [" + p_userInfo + "]";
+				const string l_info   = "[Count limit: " + Util::toString(CFlyServerConfig::g_max_ddos_connect_to_me) + "]\t";
+				const string l_target = "[Target: " + aIPServer + " Port: " + Util::toString(aPort) + "]\t";
+				const string l_user_info = !p_userInfo.empty() ? "[UserInfo: " + p_userInfo + "]\t"  : "";
+				const string l_type_block = "Type DDoS:" + std::string(p_ip_hub.is_unspecified() ? "[$ConnectToMe]" : "[$Search]");
+				LogManager::ddos_message("Blocked: " + Util::toString(g_count_ddos_blocked + 1) + ", " + l_type_block + p_HubInfo + l_info + l_target + l_user_info);
 			}
-			l_cur_value.m_original_query_for_debug[l_debug_key]++;
 		}
-		if (l_result.second == false)
+		if (g_ddos_guard.isBanned(l_key, l_tick))
 		{
-			//   
-			l_cur_value.m_last_tick = l_tick;   //    .
-			l_cur_value.m_ports.insert(aPort);  //   
-			if (l_cur_value.m_count_connect == CFlyServerConfig::g_max_ddos_connect_to_me) //  -    IP
-			{
-				static uint16_t g_block_id = 0;
-				l_cur_value.m_block_id = ++g_block_id;
-				if (BOOLSETTING(LOG_DDOS_TRACE))
-				{
-					const string l_info   = "[Count limit: " + Util::toString(CFlyServerConfig::g_max_ddos_connect_to_me) + "]\t";
-					const string l_target = "[Target: " + aIPServer + l_cur_value.getPorts() + "]\t";
-					const string l_user_info = !p_userInfo.empty() ? "[UserInfo: " + p_userInfo + "]\t"  : "";
-					l_cur_value.m_type_block = "Type DDoS:" + std::string(p_ip_hub.is_unspecified() ? "[$ConnectToMe]" : "[$Search]");
-					LogManager::ddos_message("BlockID=" + Util::toString(l_cur_value.m_block_id) + ", " + l_cur_value.m_type_block + p_HubInfo + l_info + l_target + l_user_info);
-					for (auto k = l_cur_value.m_original_query_for_debug.cbegin() ; k != l_cur_value.m_original_query_for_debug.cend(); ++k)
-					{
-						LogManager::ddos_message("  Detail BlockID=" + Util::toString(l_cur_value.m_block_id) + " " + k->first + " Count:" + Util::toString(k->second)); // TODO -   +  -
-					}
-				}
-				l_cur_value.m_original_query_for_debug.clear();
-			}
-			if (l_cur_value.m_count_connect >= CFlyServerConfig::g_max_ddos_connect_to_me)
-			{
-				if ((l_cur_value.m_last_tick - l_cur_value.m_first_tick) < CFlyServerConfig::g_ban_ddos_connect_to_me * 1000 * 60)
-				{
-					return true; //      . TODO -    
-					//     -          .
-				}
-			}
+			++g_count_ddos_blocked;
+			return true;
 		}
 	}
 	{
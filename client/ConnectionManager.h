@@ -29,6 +29,7 @@
 #include "Singleton.h"
 #include "ConnectionManagerListener.h"
 #include "HintedUser.h"
+#include "CFlyWindowSketch.h"
 
 class TokenManager
 {
@@ -284,10 +285,7 @@ class ConnectionManager :
 		static std::unique_ptr<webrtc::RWLockWrapper> g_csDownloads;
 		//static std::unique_ptr<webrtc::RWLockWrapper> g_csUploads;
 		static CriticalSection g_csUploads;
-		static FastCriticalSection g_csDdosCheck;
 		static std::unique_ptr<webrtc::RWLockWrapper> g_csDdosCTM2HUBCheck;
-		static std::unique_ptr<webrtc::RWLockWrapper> g_csTTHFilter;
-		static std::unique_ptr<webrtc::RWLockWrapper> g_csFileFilter;
 		
 		/** All ConnectionQueueItems */
 		static std::set<ConnectionQueueItemPtr> g_downloads;
@@ -296,64 +294,17 @@ class ConnectionManager :
 		/** All active connections */
 		static boost::unordered_set<UserConnection*> g_userConnections;
 		
-		struct CFlyDDOSkey
-		{
-			std::string m_server;
-			boost::asio::ip::address_v4 m_ip;
-			CFlyDDOSkey(const std::string& p_server, boost::asio::ip::address_v4 p_ip) : m_server(p_server), m_ip(p_ip)
-			{
-			}
-			bool operator < (const CFlyDDOSkey& p_val) const
-			{
-				return (m_ip < p_val.m_ip) || (m_ip == p_val.m_ip && m_server < p_val.m_server);
-			}
-		};
-		class CFlyTickDetect
-		{
-			public:
-				uint64_t m_first_tick;
-				uint64_t m_last_tick;
-				uint16_t m_count_connect;
-				uint16_t m_block_id;
-				CFlyTickDetect(): m_first_tick(0), m_last_tick(0), m_count_connect(0), m_block_id(0)
-				{
-				}
-		};
-		class CFlyTickTTH : public CFlyTickDetect
-		{
-		};
-		class CFlyTickFile : public CFlyTickDetect
-		{
-		};
-		class CFlyDDoSTick : public CFlyTickDetect
-		{
-			public:
-				std::string m_type_block;
-				boost::unordered_set<uint16_t> m_ports;
-				boost::unordered_map<std::string, uint32_t> m_original_query_for_debug;
-				CFlyDDoSTick()
-				{
-				}
-				string getPorts() const
-				{
-					string l_ports;
-					string l_sep;
-					for (auto i = m_ports.cbegin(); i != m_ports.cend(); ++i)
-					{
-						l_ports += l_sep;
-						l_ports += Util::toString(*i);
-						l_sep = ",";
-					}
-					return " Port: " + l_ports;
-				}
-		};
-		static std::map<CFlyDDOSkey, CFlyDDoSTick> g_ddos_map;
+		// [!] FlylinkDC++ flood protection works in bounded memory: a sketch nominates the targets, the ban is decided exactly
+		static CFlyFloodGuard g_ddos_guard;
 		static boost::unordered_set<string> g_ddos_ctm2hub; // $Error CTM2HUB
 	public:
 		static void addCTM2HUB(const string& p_server_port, const HintedUser& p_hinted_user);
 	private:
-		static boost::unordered_map<string, CFlyTickTTH> g_duplicate_search_tth;
-		static boost::unordered_map<string, CFlyTickFile> g_duplicate_search_file;
+		static CFlyRepeatCounter g_duplicate_search_tth;
+		static CFlyRepeatCounter g_duplicate_search_file;
+		static boost::atomic<uint32_t> g_count_ddos_blocked;
+		static boost::atomic<uint32_t> g_count_duplicate_tth;
+		static boost::atomic<uint32_t> g_count_duplicate_file;
 		
 #define USING_IDLERS_IN_CONNECTION_MANAGER // [!] IRainman fix: don't disable this.
 #ifdef USING_IDLERS_IN_CONNECTION_MANAGER
@@ -409,11 +360,15 @@ class ConnectionManager :
 		static bool checkIpFlood(const string& aIPServer, uint16_t aPort, const boost::asio::ip::address_v4& p_ip_hub, const string& userInfo, const string& p_HubInfo);
 		static bool checkDuplicateSearchTTH(const string& p_search_command, const TTHValue& p_tth);
 		static bool checkDuplicateSearchFile(const string& p_search_command);
+		static uint32_t getCountDDoSBlocked()
+		{
+			return g_count_ddos_blocked;
+		}
+		static uint32_t getCountDuplicateSearch()
+		{
+			return g_count_duplicate_tth + g_count_duplicate_file;
+		}
 	private:
-	
-		static void cleanupDuplicateSearchTTH(const uint64_t p_tick);
-		static void cleanupDuplicateSearchFile(const uint64_t p_tick);
-		static void cleanupIpFlood(const uint64_t p_tick);
 		
 		// UserConnectionListener
 		void on(Connected, UserConnection*) noexcept override;
@@ -32,6 +32,7 @@
 #include "WebServerManager.h"
 #include "ThrottleManager.h"
 #include "GPGPUManager.h"
+#include "CFlyHashBackend.h"
 
 #include "CFlylinkDBManager.h"
 #include "../FlyFeatures/flyServer.h"
@@ -131,6 +132,7 @@ void startup(PROGRESSCALLBACKPROC pProgressCallbackProc, void* pProgressParam, G
 #ifdef FLYLINKDC_USE_GPU_TTH
 	LOAD_STEP("TTH on GPU", GPGPUTTHManager::newInstance());
 #endif
+	CFlyHashBackend::init();
 	HashManager::newInstance();
 #ifdef FLYLINKDC_USE_VLD
 	VLDDisable(); // TODO VLD    -      OpenSSL
@@ -103,6 +103,13 @@ void DirectoryListing::loadFile(const string& p_file, bool p_own_list)
 	if (!ClientManager::isBeforeShutdown())
 	{
 		::File ff(p_file, ::File::READ, ::File::OPEN);
+		const bool l_is_cache = !p_own_list && isCacheAllowed(p_file);
+		const int64_t l_source_size = ff.getSize();
+		const int64_t l_source_time_stamp = ff.getLastWriteTime();
+		if (l_is_cache && loadCache(getCacheFileName(p_file), l_source_size, l_source_time_stamp))
+		{
+			return;
+		}
 		if (stricmp(ext, ".bz2") == 0
 		        || stricmp(ext, ".dcls") == 0 // [+] IRainman dclst support
 		        || stricmp(ext, ".dclst") == 0 // [+] SSA dclst support
@@ -115,6 +122,10 @@ void DirectoryListing::loadFile(const string& p_file, bool p_own_list)
 		{
 			loadXML(ff, false, p_own_list);
 		}
+		if (l_is_cache)
+		{
+			saveCache(getCacheFileName(p_file), l_source_size, l_source_time_stamp);
+		}
 	}
 }
 
@@ -143,6 +154,7 @@ class ListLoader : public SimpleXMLReader::CallBack
 		{
 			return m_is_first_check_mediainfo_list ? m_is_mediainfo_list : true;
 		}
+		void loadFileStatus();
 	private:
 #ifdef _DEBUG
 		static CFlyCacheMediaInfo g_cache_mediainfo;
@@ -159,8 +171,77 @@ class ListLoader : public SimpleXMLReader::CallBack
 		bool m_is_mediainfo_list;
 		bool m_is_first_check_mediainfo_list;
 		int m_empty_file_name_counter;
+		std::vector<DirectoryListing::File*> m_status_files; // waiting for CFlylinkDBManager::get_status_files
 };
 
+// Sets the share/queue flags of a new file, files which need the database status are collected into p_status_files
+static void checkFileStatus(DirectoryListing::File* f, bool p_own_list, std::vector<DirectoryListing::File*>& p_status_files)
+{
+	if (f->getSize())
+	{
+		if (p_own_list)//[+] FlylinkDC++
+		{
+			f->setFlag(DirectoryListing::FLAG_SHARED_OWN);  // TODO -  FLAG_SHARED_OWN
+		}
+		else
+		{
+			if (ShareManager::isTTHShared(f->getTTH()))
+			{
+				f->setFlag(DirectoryListing::FLAG_SHARED);
+			}
+			else
+			{
+				if (QueueManager::is_queue_tth(f->getTTH()))
+				{
+					f->setFlag(DirectoryListing::FLAG_QUEUE);
+				}
+				// TODO if(l_size >= 100 * 1024 *1024)
+				{
+					if (!CFlyServerConfig::isParasitFile(f->getName())) // TODO -   
+					{
+						f->setFlag(DirectoryListing::FLAG_NOT_SHARED);
+						p_status_files.push_back(f); // [!] status is resolved for the whole list in loadFileStatus()
+					}
+				}
+			}
+		}//[+] FlylinkDC++
+	}
+}
+
+static void loadFileStatus(std::vector<DirectoryListing::File*>& p_status_files)
+{
+	if (p_status_files.empty())
+		return;
+	std::vector<TTHValue> l_tth;
+	l_tth.reserve(p_status_files.size());
+	for (auto i = p_status_files.cbegin(); i != p_status_files.cend(); ++i)
+	{
+		l_tth.push_back((*i)->getTTH());
+	}
+	std::vector<uint8_t> l_status;
+	CFlylinkDBManager::getInstance()->get_status_files(l_tth, l_status);
+	dcassert(l_status.size() == p_status_files.size());
+	for (size_t i = 0; i < p_status_files.size() && i < l_status.size(); ++i)
+	{
+		const auto l_status_file = l_status[i];
+		if (l_status_file == 0)
+			continue;
+		auto f = p_status_files[i];
+		if (l_status_file & CFlylinkDBManager::PREVIOUSLY_DOWNLOADED)
+			f->setFlag(DirectoryListing::FLAG_DOWNLOAD);
+		if (l_status_file & CFlylinkDBManager::VIRUS_FILE_KNOWN)
+			f->setFlag(DirectoryListing::FLAG_VIRUS_FILE);
+		if (l_status_file & CFlylinkDBManager::PREVIOUSLY_BEEN_IN_SHARE)
+			f->setFlag(DirectoryListing::FLAG_OLD_TTH);
+	}
+	p_status_files.clear();
+}
+
+void ListLoader::loadFileStatus()
+{
+	::loadFileStatus(m_status_files);
+}
+
 #ifdef _DEBUG
 CFlyCacheMediaInfo ListLoader::g_cache_mediainfo;
 #endif
@@ -196,11 +277,411 @@ string DirectoryListing::loadXML(InputStream& is, bool updating, bool p_is_own_l
 	//l_log.step("start parse");
 	SimpleXMLReader(&ll).parse(is);
 	l_log.step("Stop parse file:" + m_file);
+	ll.loadFileStatus();
+	l_log.step("Load file status");
 	m_is_mediainfo = ll.isMediainfoList();
 	m_is_own_list = p_is_own_list;
 	return ll.getBase();
 }
 
+/*
+ * Binary cache of a downloaded file list: <list>.dlcache next to <list>.xml.bz2
+ * header | directories (preorder) | files (grouped by directory, in directory order) | media | string table
+ * The files array can be walked without building the tree (see loadCacheTTH).
+ */
+#pragma pack(push, 1)
+struct CFlyListCacheString
+{
+	uint32_t m_offset;
+	uint32_t m_length;
+};
+struct CFlyListCacheHeader
+{
+	enum { MAGIC = 0x434C4446, VERSION = 1 }; // "FDLC"
+	enum { FLAG_MEDIAINFO_LIST = 1 };
+	uint32_t m_magic;
+	uint32_t m_version;
+	int64_t m_source_size;
+	int64_t m_source_time_stamp;
+	uint32_t m_flags;
+	uint32_t m_dir_count;
+	uint32_t m_file_count;
+	uint32_t m_media_count;
+	uint32_t m_strings_size;
+};
+struct CFlyListCacheDir
+{
+	enum { FLAG_COMPLETE = 1, FLAG_MEDIAINFO = 2 };
+	CFlyListCacheString m_name;
+	uint32_t m_parent; // the root is the first one and has no parent
+	uint32_t m_file_count;
+	uint32_t m_flags;
+};
+struct CFlyListCacheFile
+{
+	static const uint32_t NO_MEDIA = UINT32_MAX;
+	CFlyListCacheString m_name;
+	int64_t m_size;
+	uint8_t m_tth[TTHValue::BYTES];
+	uint32_t m_hit;
+	uint32_t m_ts;
+	uint32_t m_media;
+};
+struct CFlyListCacheMedia
+{
+	CFlyListCacheString m_audio;
+	CFlyListCacheString m_video;
+	uint16_t m_bitrate;
+	uint16_t m_mediaX;
+	uint16_t m_mediaY;
+};
+#pragma pack(pop)
+
+class CFlyListCacheWriter
+{
+	public:
+		CFlyListCacheWriter()
+		{
+			memzero(&m_header, sizeof(m_header));
+		}
+		void add(const DirectoryListing::Directory* p_dir, uint32_t p_parent)
+		{
+			const uint32_t l_index = uint32_t(m_dirs.size());
+			CFlyListCacheDir l_dir;
+			l_dir.m_name = addString(p_dir->getName());
+			l_dir.m_parent = p_parent;
+			l_dir.m_file_count = uint32_t(p_dir->m_files.size());
+			l_dir.m_flags = (p_dir->getComplete() ? CFlyListCacheDir::FLAG_COMPLETE : 0) | (p_dir->isMediainfo() ? CFlyListCacheDir::FLAG_MEDIAINFO : 0);
+			m_dirs.push_back(l_dir);
+			for (auto i = p_dir->m_files.cbegin(); i != p_dir->m_files.cend(); ++i)
+			{
+				const DirectoryListing::File* f = *i;
+				CFlyListCacheFile l_file;
+				l_file.m_name = addString(f->getName());
+				l_file.m_size = f->getSize();
+				memcpy(l_file.m_tth, f->getTTH().data, TTHValue::BYTES);
+				l_file.m_hit = uint32_t(f->getHit());
+				l_file.m_ts = uint32_t(f->getTS());
+				l_file.m_media = CFlyListCacheFile::NO_MEDIA;
+				if (f->m_media)
+				{
+					CFlyListCacheMedia l_media;
+					l_media.m_audio = addSharedString(f->m_media->m_audio);
+					l_media.m_video = addSharedString(f->m_media->m_video);
+					l_media.m_bitrate = f->m_media->m_bitrate;
+					l_media.m_mediaX = f->m_media->m_mediaX;
+					l_media.m_mediaY = f->m_media->m_mediaY;
+					l_file.m_media = uint32_t(m_media.size());
+					m_media.push_back(l_media);
+				}
+				m_files.push_back(l_file);
+			}
+			for (auto i = p_dir->directories.cbegin(); i != p_dir->directories.cend(); ++i)
+			{
+				add(*i, l_index);
+			}
+		}
+		void write(::File& p_file, int64_t p_source_size, int64_t p_source_time_stamp, bool p_is_mediainfo_list)
+		{
+			m_header.m_magic = CFlyListCacheHeader::MAGIC;
+			m_header.m_version = CFlyListCacheHeader::VERSION;
+			m_header.m_source_size = p_source_size;
+			m_header.m_source_time_stamp = p_source_time_stamp;
+			m_header.m_flags = p_is_mediainfo_list ? CFlyListCacheHeader::FLAG_MEDIAINFO_LIST : 0;
+			m_header.m_dir_count = uint32_t(m_dirs.size());
+			m_header.m_file_count = uint32_t(m_files.size());
+			m_header.m_media_count = uint32_t(m_media.size());
+			m_header.m_strings_size = uint32_t(m_strings.size());
+			p_file.write(&m_header, sizeof(m_header));
+			writeArray(p_file, m_dirs);
+			writeArray(p_file, m_files);
+			writeArray(p_file, m_media);
+			if (!m_strings.empty())
+			{
+				p_file.write(m_strings.data(), m_strings.size());
+			}
+		}
+	private:
+		template<class T> static void writeArray(::File& p_file, const std::vector<T>& p_array)
+		{
+			if (!p_array.empty())
+			{
+				p_file.write(p_array.data(), p_array.size() * sizeof(T));
+			}
+		}
+		CFlyListCacheString addString(const string& p_str)
+		{
+			CFlyListCacheString l_ref;
+			l_ref.m_offset = uint32_t(m_strings.size());
+			l_ref.m_length = uint32_t(p_str.size());
+			m_strings.append(p_str);
+			return l_ref;
+		}
+		// audio/video descriptions repeat a lot - keep one copy of each
+		CFlyListCacheString addSharedString(const string& p_str)
+		{
+			const auto l_res = m_shared_strings.insert(std::make_pair(p_str, CFlyListCacheString()));
+			if (l_res.second)
+			{
+				l_res.first->second = addString(p_str);
+			}
+			return l_res.first->second;
+		}
+		CFlyListCacheHeader m_header;
+		std::vector<CFlyListCacheDir> m_dirs;
+		std::vector<CFlyListCacheFile> m_files;
+		std::vector<CFlyListCacheMedia> m_media;
+		string m_strings;
+		boost::unordered_map<string, CFlyListCacheString> m_shared_strings;
+};
+
+/** Read-only view of a validated cache file */
+class CFlyListCacheReader
+{
+	public:
+		CFlyListCacheReader() : m_map(NULL), m_data(nullptr), m_size(0), m_header(nullptr), m_dirs(nullptr), m_files(nullptr), m_media(nullptr), m_strings(nullptr)
+		{
+		}
+		~CFlyListCacheReader()
+		{
+			if (m_data)
+			{
+				UnmapViewOfFile(m_data);
+			}
+			if (m_map)
+			{
+				CloseHandle(m_map);
+			}
+		}
+		bool open(const string& p_cache_file, int64_t p_source_size, int64_t p_source_time_stamp)
+		{
+			try
+			{
+				::File l_file(p_cache_file, ::File::READ, ::File::OPEN | ::File::SHARED);
+				const int64_t l_size = l_file.getSize();
+				if (l_size < int64_t(sizeof(CFlyListCacheHeader)) || l_size > INT32_MAX)
+				{
+					return false;
+				}
+				m_map = CreateFileMapping(l_file.getHandle(), NULL, PAGE_READONLY, 0, 0, NULL);
+				if (!m_map)
+				{
+					return false;
+				}
+				m_data = static_cast<const uint8_t*>(MapViewOfFile(m_map, FILE_MAP_READ, 0, 0, 0));
+				if (!m_data)
+				{
+					return false;
+				}
+				m_size = size_t(l_size);
+			}
+			catch (const FileException&)
+			{
+				return false;
+			}
+			m_header = reinterpret_cast<const CFlyListCacheHeader*>(m_data);
+			if (m_header->m_magic != CFlyListCacheHeader::MAGIC ||
+			        m_header->m_version != CFlyListCacheHeader::VERSION ||
+			        m_header->m_source_size != p_source_size ||
+			        m_header->m_source_time_stamp != p_source_time_stamp ||
+			        m_header->m_dir_count == 0)
+			{
+				return false;
+			}
+			const uint64_t l_expected_size = sizeof(CFlyListCacheHeader) +
+			                                 uint64_t(m_header->m_dir_count) * sizeof(CFlyListCacheDir) +
+			                                 uint64_t(m_header->m_file_count) * sizeof(CFlyListCacheFile) +
+			                                 uint64_t(m_header->m_media_count) * sizeof(CFlyListCacheMedia) +
+			                                 m_header->m_strings_size;
+			if (l_expected_size != m_size)
+			{
+				return false;
+			}
+			m_dirs = reinterpret_cast<const CFlyListCacheDir*>(m_header + 1);
+			m_files = reinterpret_cast<const CFlyListCacheFile*>(m_dirs + m_header->m_dir_count);
+			m_media = reinterpret_cast<const CFlyListCacheMedia*>(m_files + m_header->m_file_count);
+			m_strings = reinterpret_cast<const char*>(m_media + m_header->m_media_count);
+			return true;
+		}
+		// full check before the tree is built - a damaged cache must not leave a half loaded listing
+		bool validate() const
+		{
+			uint64_t l_file_count = 0;
+			for (uint32_t i = 0; i < m_header->m_dir_count; ++i)
+			{
+				const auto& l_dir = m_dirs[i];
+				if (!isValid(l_dir.m_name) || (i > 0 && l_dir.m_parent >= i))
+					return false;
+				l_file_count += l_dir.m_file_count;
+			}
+			if (l_file_count != m_header->m_file_count)
+				return false;
+			for (uint32_t i = 0; i < m_header->m_file_count; ++i)
+			{
+				const auto& l_file = m_files[i];
+				if (!isValid(l_file.m_name) || (l_file.m_media != CFlyListCacheFile::NO_MEDIA && l_file.m_media >= m_header->m_media_count))
+					return false;
+			}
+			for (uint32_t i = 0; i < m_header->m_media_count; ++i)
+			{
+				if (!isValid(m_media[i].m_audio) || !isValid(m_media[i].m_video))
+					return false;
+			}
+			return true;
+		}
+		string getString(const CFlyListCacheString& p_ref) const
+		{
+			return string(m_strings + p_ref.m_offset, p_ref.m_length);
+		}
+		
+		const CFlyListCacheHeader* m_header;
+		const CFlyListCacheDir* m_dirs;
+		const CFlyListCacheFile* m_files;
+		const CFlyListCacheMedia* m_media;
+	private:
+		bool isValid(const CFlyListCacheString& p_ref) const
+		{
+			return uint64_t(p_ref.m_offset) + p_ref.m_length <= m_header->m_strings_size;
+		}
+		HANDLE m_map;
+		const uint8_t* m_data;
+		size_t m_size;
+		const char* m_strings;
+};
+
+bool DirectoryListing::isCacheAllowed(const string& p_file)
+{
+	// only lists downloaded into the FileLists folder, not .dcls or files opened from elsewhere
+	const string& l_list_path = Util::getListPath();
+	if (p_file.size() <= l_list_path.size() || strnicmp(p_file, l_list_path, l_list_path.size()) != 0)
+		return false;
+	const string l_ext = Util::getFileExt(p_file);
+	return stricmp(l_ext, ".bz2") == 0 || stricmp(l_ext, ".xml") == 0;
+}
+
+string DirectoryListing::getCacheFileName(const string& p_file)
+{
+	// the name must not match "*.xml*" - see QueueManager::matchAllFileLists
+	string l_name = p_file;
+	if (l_name.size() > 4 && stricmp(Util::getFileExt(l_name), ".bz2") == 0)
+		l_name.erase(l_name.size() - 4);
+	if (l_name.size() > 4 && stricmp(Util::getFileExt(l_name), ".xml") == 0)
+		l_name.erase(l_name.size() - 4);
+	return l_name + ".dlcache";
+}
+
+void DirectoryListing::saveCache(const string& p_cache_file, int64_t p_source_size, int64_t p_source_time_stamp) const
+{
+	if (getAbort() || ClientManager::isBeforeShutdown())
+		return;
+	const string l_tmp_file = p_cache_file + ".tmp";
+	try
+	{
+		CFlyListCacheWriter l_writer;
+		l_writer.add(root, 0);
+		{
+			::File l_file(l_tmp_file, ::File::WRITE, ::File::CREATE | ::File::TRUNCATE);
+			l_writer.write(l_file, p_source_size, p_source_time_stamp, m_is_mediainfo);
+		}
+		::File::deleteFile(p_cache_file);
+		::File::renameFile(l_tmp_file, p_cache_file);
+	}
+	catch (const FileException& e)
+	{
+		::File::deleteFile(l_tmp_file);
+		LogManager::message("[DirectoryListing] Error save cache " + p_cache_file + " : " + e.getError());
+	}
+}
+
+bool DirectoryListing::loadCache(const string& p_cache_file, int64_t p_source_size, int64_t p_source_time_stamp)
+{
+	CFlyListCacheReader l_reader;
+	if (!l_reader.open(p_cache_file, p_source_size, p_source_time_stamp) || !l_reader.validate())
+	{
+		return false;
+	}
+	CFlyLog l_log("[loadCache]");
+	const auto l_header = l_reader.m_header;
+	m_is_mediainfo = (l_header->m_flags & CFlyListCacheHeader::FLAG_MEDIAINFO_LIST) != 0;
+	m_is_own_list = false;
+	std::vector<Directory*> l_dirs(l_header->m_dir_count);
+	std::vector<File*> l_status_files;
+	l_dirs[0] = root;
+	root->setComplete((l_reader.m_dirs[0].m_flags & CFlyListCacheDir::FLAG_COMPLETE) != 0);
+	const CFlyListCacheFile* l_file = l_reader.m_files;
+	for (uint32_t i = 0; i < l_header->m_dir_count; ++i)
+	{
+		if (getAbort() || ClientManager::isBeforeShutdown())
+		{
+			throw AbortException("DirectoryListing::loadCache - " + STRING(ABORT_EM));
+		}
+		const CFlyListCacheDir& l_cache_dir = l_reader.m_dirs[i];
+		Directory* l_dir = l_dirs[i];
+		if (i > 0)
+		{
+			Directory* l_parent = l_dirs[l_cache_dir.m_parent];
+			l_dir = new Directory(this, l_parent, l_reader.getString(l_cache_dir.m_name), false,
+			                      (l_cache_dir.m_flags & CFlyListCacheDir::FLAG_COMPLETE) != 0,
+			                      (l_cache_dir.m_flags & CFlyListCacheDir::FLAG_MEDIAINFO) != 0);
+			l_parent->directories.push_back(l_dir);
+			l_dirs[i] = l_dir;
+		}
+		l_dir->m_files.reserve(l_cache_dir.m_file_count);
+		for (uint32_t j = 0; j < l_cache_dir.m_file_count; ++j, ++l_file)
+		{
+			std::shared_ptr<CFlyMediaInfo> l_media;
+			if (l_file->m_media != CFlyListCacheFile::NO_MEDIA)
+			{
+				const CFlyListCacheMedia& l_cache_media = l_reader.m_media[l_file->m_media];
+				l_media = std::make_shared<CFlyMediaInfo>(Util::emptyString, l_cache_media.m_bitrate,
+				                                          l_reader.getString(l_cache_media.m_audio),
+				                                          l_reader.getString(l_cache_media.m_video));
+				l_media->m_mediaX = l_cache_media.m_mediaX;
+				l_media->m_mediaY = l_cache_media.m_mediaY;
+			}
+			const string l_name = l_reader.getString(l_file->m_name);
+			auto f = new File(l_dir, l_name, l_file->m_size, TTHValue(l_file->m_tth), l_file->m_hit, l_file->m_ts, l_media);
+			l_dir->m_virus_detect.add(l_name, l_file->m_size);
+			l_dir->m_files.push_back(f);
+			checkFileStatus(f, false, l_status_files);
+		}
+	}
+	l_log.step("Stop load cache:" + m_file);
+	loadFileStatus(l_status_files);
+	l_log.step("Load file status");
+	return true;
+}
+
+bool DirectoryListing::loadCacheTTH(const string& p_file, const TTHCallback& p_callback)
+{
+	if (!isCacheAllowed(p_file))
+		return false;
+	int64_t l_source_size;
+	int64_t l_source_time_stamp;
+	try
+	{
+		::File l_file(p_file, ::File::READ, ::File::OPEN | ::File::SHARED);
+		l_source_size = l_file.getSize();
+		l_source_time_stamp = l_file.getLastWriteTime();
+	}
+	catch (const FileException&)
+	{
+		return false;
+	}
+	CFlyListCacheReader l_reader;
+	if (!l_reader.open(getCacheFileName(p_file), l_source_size, l_source_time_stamp))
+	{
+		return false;
+	}
+	const auto l_count = l_reader.m_header->m_file_count;
+	for (uint32_t i = 0; i < l_count; ++i)
+	{
+		const CFlyListCacheFile& l_file = l_reader.m_files[i];
+		p_callback(TTHValue(l_file.m_tth), l_file.m_size);
+	}
+	return true;
+}
+
 static const string sFileListing = "FileListing";
 static const string sBase = "Base";
 static const string sCID = "CID"; // [+] IRainman Delayed loading (dclst support)
@@ -410,41 +891,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 			auto f = new DirectoryListing::File(m_cur, l_name, l_size, l_tth, l_i_hit, l_i_ts, l_mediaXY);
 			m_cur->m_virus_detect.add(l_name, l_size);
 			m_cur->m_files.push_back(f);
-			if (l_size)
-			{
-				if (m_is_own_list)//[+] FlylinkDC++
-				{
-					f->setFlag(DirectoryListing::FLAG_SHARED_OWN);  // TODO -  FLAG_SHARED_OWN
-				}
-				else
-				{
-					if (ShareManager::isTTHShared(f->getTTH()))
-					{
-						f->setFlag(DirectoryListing::FLAG_SHARED);
-					}
-					else
-					{
-						if (QueueManager::is_queue_tth(f->getTTH()))
-						{
-							f->setFlag(DirectoryListing::FLAG_QUEUE);
-						}
-						// TODO if(l_size >= 100 * 1024 *1024)
-						{
-							if (!CFlyServerConfig::isParasitFile(f->getName())) // TODO -   
-							{
-								f->setFlag(DirectoryListing::FLAG_NOT_SHARED);
-								const auto l_status_file = CFlylinkDBManager::getInstance()->get_status_file(f->getTTH()); // TODO -    ?
-								if (l_status_file & CFlylinkDBManager::PREVIOUSLY_DOWNLOADED)
-									f->setFlag(DirectoryListing::FLAG_DOWNLOAD);
-								if (l_status_file & CFlylinkDBManager::VIRUS_FILE_KNOWN)
-									f->setFlag(DirectoryListing::FLAG_VIRUS_FILE);
-								if (l_status_file & CFlylinkDBManager::PREVIOUSLY_BEEN_IN_SHARE)
-									f->setFlag(DirectoryListing::FLAG_OLD_TTH);
-							}
-						}
-					}
-				}//[+] FlylinkDC++
-			}
+			checkFileStatus(f, m_is_own_list, m_status_files);
 		}
 		else if (name == g_SDirectory)
 		{
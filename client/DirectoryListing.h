@@ -158,6 +158,10 @@ class DirectoryListing : public UserInfoBase
 				GETSET(Directory*, parent, Parent);
 				GETSET(bool, adls, Adls);
 				GETSET(bool, complete, Complete);
+				bool isMediainfo() const
+				{
+					return m_is_mediainfo;
+				}
 			private:
 				bool m_is_mediainfo;
 		};
@@ -175,6 +179,14 @@ class DirectoryListing : public UserInfoBase
 		
 		void loadFile(const string& name, bool p_own_list = false);
 		
+		typedef std::function<void(const TTHValue& p_tth, int64_t p_size)> TTHCallback;
+		/**
+		 * Passes TTH and size of every file from the binary cache of a downloaded list to p_callback without building the tree.
+		 * @return false if the list has no up to date cache (loadFile() creates it)
+		 */
+		static bool loadCacheTTH(const string& p_file, const TTHCallback& p_callback);
+		static string getCacheFileName(const string& p_file);
+		
 		string updateXML(const std::string&, bool p_own_list);
 		string loadXML(InputStream& xml, bool updating, bool p_own_list);
 		
@@ -239,7 +251,7 @@ class DirectoryListing : public UserInfoBase
 		GETSET(HintedUser, hintedUser, HintedUser);
 		GETSET(bool, abort, Abort);
 		GETSET(bool, includeSelf, IncludeSelf);
-		void logMatchedFiles(const UserPtr& p_user, int p_count); //[+]PPA
+		static void logMatchedFiles(const UserPtr& p_user, int p_count); //[+]PPA
 	private:
 		friend class ListLoader;
 		friend class DirectoryListingFrame;
@@ -250,6 +262,10 @@ class DirectoryListing : public UserInfoBase
 		string m_file;
 		Directory* find(const string& aName, Directory* current);
 		
+		static bool isCacheAllowed(const string& p_file);
+		bool loadCache(const string& p_cache_file, int64_t p_source_size, int64_t p_source_time_stamp);
+		void saveCache(const string& p_cache_file, int64_t p_source_size, int64_t p_source_time_stamp) const;
+		
 };
 
 inline bool operator==(const DirectoryListing::Directory::Ptr a, const string& b)
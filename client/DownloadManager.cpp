@@ -41,6 +41,7 @@
 #include "libtorrent/hex.hpp"
 #include "libtorrent/write_resume_data.hpp"
 #include "libtorrent/magnet_uri.hpp"
+#include "libtorrent/session_stats.hpp"
 #endif
 
 
@@ -135,6 +136,7 @@ void DownloadManager::shutdown_torrent()
 			Sleep(100);
 		}
 		dcassert(m_torrent_resume_count == 0);
+		CFlylinkDBManager::getInstance()->flush_torrent_resume();
 		m_torrent_session.reset();
 	}
 }
@@ -168,6 +170,10 @@ void DownloadManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
+#ifdef FLYLINKDC_USE_TORRENT
+	// resume data collected by the alert handler is written here, off the libtorrent network thread
+	CFlylinkDBManager::getInstance()->flush_torrent_resume();
+#endif
 		
 	typedef vector<pair<std::string, UserPtr> > TargetList;
 	TargetList dropTargets;
@@ -641,7 +647,6 @@ void DownloadManager::endData(UserConnection* aSource)
 			return;
 		}
 		
-		aSource->setSpeed(d->getRunningAverage());
 		aSource->updateChunkSize(d->getTigerTree().getBlockSize(), d->getSize(), GET_TICK() - d->getStart());
 		
 		dcdebug("Download finished: %s, size " I64_FMT ", pos: " I64_FMT "\n", d->getPath().c_str(), d->getSize(), d->getPos());
@@ -1233,6 +1238,31 @@ void DownloadManager::onTorrentAlertNotify(libtorrent::session* p_torrent_sesion
 #endif
 					}
 					
+					if (const auto l_a = lt::alert_cast<lt::session_stats_alert>(a))
+					{
+						static const int g_recv_idx = lt::find_metric_idx("net.recv_payload_bytes");
+						static const int g_sent_idx = lt::find_metric_idx("net.sent_payload_bytes");
+						const auto l_counters = l_a->counters();
+						const int64_t l_recv = l_counters[g_recv_idx];
+						const int64_t l_sent = l_counters[g_sent_idx];
+						const uint64_t l_tick = GET_TICK();
+						// stats are posted with every batch of alerts - average over at least a second
+						if (m_torrent_stats_tick == 0 || l_recv < m_torrent_recv_bytes || l_sent < m_torrent_sent_bytes)
+						{
+							m_torrent_stats_tick = l_tick;
+							m_torrent_recv_bytes = l_recv;
+							m_torrent_sent_bytes = l_sent;
+						}
+						else if (l_tick >= m_torrent_stats_tick + 1000)
+						{
+							const int64_t l_delta = int64_t(l_tick - m_torrent_stats_tick);
+							m_torrent_download_rate = (l_recv - m_torrent_recv_bytes) * 1000 / l_delta;
+							m_torrent_upload_rate = (l_sent - m_torrent_sent_bytes) * 1000 / l_delta;
+							m_torrent_stats_tick = l_tick;
+							m_torrent_recv_bytes = l_recv;
+							m_torrent_sent_bytes = l_sent;
+						}
+					}
 					if (const auto l_a = lt::alert_cast<save_resume_data_failed_alert>(a))
 					{
 						dcassert(0);
@@ -1328,7 +1358,7 @@ void DownloadManager::onTorrentAlertNotify(libtorrent::session* p_torrent_sesion
 			}
 			std::this_thread::sleep_for(std::chrono::milliseconds(200));
 			p_torrent_sesion->post_torrent_updates();
-			// . p_torrent_sesion->post_session_stats();
+			p_torrent_sesion->post_session_stats(); // transfer rates for ThrottleManager
 			// p_torrent_sesion->post_dht_stats();
 		}
 		                                       );
@@ -1364,6 +1394,31 @@ void DownloadManager::fire_added_torrent(const libtorrent::sha1_hash& p_sha1)
 		fly_fire2(DownloadManagerListener::AddedTorrent(), p_sha1, get_torrent_name(p_sha1)); // TODO opt
 	}
 }
+static bool isRateLimitChanged(int p_old_limit, int p_new_limit)
+{
+	if (p_old_limit == p_new_limit)
+		return false;
+	if (p_old_limit <= 0 || p_new_limit == 0)
+		return true;
+	return std::abs(p_new_limit - p_old_limit) * 20 > p_old_limit; // ignore changes below 5%
+}
+void DownloadManager::set_torrent_rate_limit(int p_download_limit, int p_upload_limit)
+{
+	if (m_torrent_session)
+	{
+		if (!isRateLimitChanged(m_torrent_download_limit, p_download_limit) &&
+		        !isRateLimitChanged(m_torrent_upload_limit, p_upload_limit))
+		{
+			return;
+		}
+		lt::settings_pack l_sett;
+		l_sett.set_int(settings_pack::download_rate_limit, p_download_limit);
+		l_sett.set_int(settings_pack::upload_rate_limit, p_upload_limit);
+		m_torrent_session->apply_settings(l_sett);
+		m_torrent_download_limit = p_download_limit;
+		m_torrent_upload_limit = p_upload_limit;
+	}
+}
 int DownloadManager::listen_torrent_port()
 {
 	if (m_torrent_session)
@@ -1542,6 +1597,11 @@ void DownloadManager::init_torrent(bool p_is_force)
 	{
 		m_torrent_resume_count = 0;
 		m_torrent_rename_count = 0;
+		m_torrent_download_rate = 0;
+		m_torrent_upload_rate = 0;
+		m_torrent_stats_tick = 0;
+		m_torrent_download_limit = -1;
+		m_torrent_upload_limit = -1;
 		lt::settings_pack l_sett;
 		l_sett.set_int(lt::settings_pack::alert_mask
 		               , lt::alert::error_notification
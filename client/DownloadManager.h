@@ -61,6 +61,13 @@ class DownloadManager : public Speaker<DownloadManagerListener>,
 		std::atomic<int> m_torrent_resume_count = { 0 };
 		std::atomic<int> m_torrent_rename_count = { 0 };
 		std::unordered_set<libtorrent::torrent_handle> m_torrents;
+		std::atomic<int64_t> m_torrent_download_rate = { 0 };
+		std::atomic<int64_t> m_torrent_upload_rate = { 0 };
+		int64_t m_torrent_recv_bytes = 0; // session counters at m_torrent_stats_tick (network thread only)
+		int64_t m_torrent_sent_bytes = 0;
+		uint64_t m_torrent_stats_tick = 0;
+		int m_torrent_download_limit = -1;
+		int m_torrent_upload_limit = -1;
 	public:
 		void init_torrent(bool p_is_force = false);
 		void shutdown_torrent();
@@ -72,6 +79,17 @@ class DownloadManager : public Speaker<DownloadManagerListener>,
 		int listen_torrent_port();
 		void fire_added_torrent(const libtorrent::sha1_hash& p_sha1);
 		std::string get_torrent_name(const libtorrent::sha1_hash& p_sha1);
+		/** @return BitTorrent payload speed in Bytes/s taken from the session counters */
+		int64_t get_torrent_download_rate() const
+		{
+			return m_torrent_download_rate;
+		}
+		int64_t get_torrent_upload_rate() const
+		{
+			return m_torrent_upload_rate;
+		}
+		/** Sets the session wide limits in Bytes/s (0 - unlimited), see ThrottleManager */
+		void set_torrent_rate_limit(int p_download_limit, int p_upload_limit);
 #endif
 		
 	public:
@@ -48,39 +48,82 @@ const char Encoder::g_base32Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
 
 string& Encoder::toBase32(const uint8_t* src, size_t len, string& dst)
 {
-	// Code snagged from the bitzi bitcollider
-	size_t i, index;
-	uint8_t word;
-	dst.reserve(((len * 8) / 5) + 1);
-	
-	for (i = 0, index = 0; i < len;)
+	// 5 bytes -> 8 characters per step, the tail is padded with zero bits
+	const size_t l_pos = dst.size();
+	dst.resize(l_pos + (len * 8 + 4) / 5);
+	char* l_out = &dst[0] + l_pos;
+	size_t i = 0;
+	for (; i + 5 <= len; i += 5, l_out += 8)
+	{
+		const uint64_t l_block = (uint64_t(src[i]) << 32) | (uint64_t(src[i + 1]) << 24) | (uint64_t(src[i + 2]) << 16) |
+		                         (uint64_t(src[i + 3]) << 8) | uint64_t(src[i + 4]);
+		l_out[0] = g_base32Alphabet[(l_block >> 35) & 0x1F];
+		l_out[1] = g_base32Alphabet[(l_block >> 30) & 0x1F];
+		l_out[2] = g_base32Alphabet[(l_block >> 25) & 0x1F];
+		l_out[3] = g_base32Alphabet[(l_block >> 20) & 0x1F];
+		l_out[4] = g_base32Alphabet[(l_block >> 15) & 0x1F];
+		l_out[5] = g_base32Alphabet[(l_block >> 10) & 0x1F];
+		l_out[6] = g_base32Alphabet[(l_block >> 5) & 0x1F];
+		l_out[7] = g_base32Alphabet[l_block & 0x1F];
+	}
+	if (i < len)
 	{
-		/* Is the current word going to span a byte boundary? */
-		if (index > 3)
+		uint64_t l_block = 0;
+		for (size_t j = 0; j < 5; ++j)
 		{
-			word = (uint8_t)(src[i] & (0xFF >> index));
-			index = (index + 5) % 8;
-			word <<= index;
-			if ((i + 1) < len)
-				word |= src[i + 1] >> (8 - index);
-				
-			i++;
+			l_block = (l_block << 8) | (i + j < len ? src[i + j] : 0);
 		}
-		else
+		const size_t l_count = ((len - i) * 8 + 4) / 5;
+		for (size_t j = 0; j < l_count; ++j)
 		{
-			word = (uint8_t)(src[i] >> (8 - (index + 5))) & 0x1F;
-			index = (index + 5) % 8;
-			if (index == 0)
-				i++;
+			l_out[j] = g_base32Alphabet[(l_block >> (35 - j * 5)) & 0x1F];
 		}
-		
-		dcassert(word < 32);
-		dst += g_base32Alphabet[word];
 	}
 	return dst;
 }
 
 void Encoder::fromBase32(const char* src, uint8_t* dst, size_t len)
+{
+	// Fast path - the string starts with enough valid characters (TTH, CID...): 8 characters -> 5 bytes per step
+	const size_t l_count = (len * 8 + 4) / 5;
+	for (size_t i = 0; i < l_count; ++i)
+	{
+		if (g_base32Table[(unsigned char)src[i]] == -1) // '\0' included
+		{
+			fromBase32Slow(src, dst, len);
+			return;
+		}
+	}
+	size_t l_pos = 0;
+	for (; l_pos + 5 <= len; l_pos += 5, src += 8)
+	{
+		uint64_t l_block = 0;
+		for (size_t j = 0; j < 8; ++j)
+		{
+			l_block = (l_block << 5) | uint64_t(g_base32Table[(unsigned char)src[j]]);
+		}
+		dst[l_pos] = uint8_t(l_block >> 32);
+		dst[l_pos + 1] = uint8_t(l_block >> 24);
+		dst[l_pos + 2] = uint8_t(l_block >> 16);
+		dst[l_pos + 3] = uint8_t(l_block >> 8);
+		dst[l_pos + 4] = uint8_t(l_block);
+	}
+	if (l_pos < len)
+	{
+		const size_t l_tail = (len - l_pos) * 8;
+		uint64_t l_block = 0;
+		for (size_t j = 0; j < 8; ++j)
+		{
+			l_block = (l_block << 5) | (j * 5 < l_tail ? uint64_t(g_base32Table[(unsigned char)src[j]]) : 0);
+		}
+		for (size_t j = 0; l_pos + j < len; ++j)
+		{
+			dst[l_pos + j] = uint8_t(l_block >> (32 - j * 8));
+		}
+	}
+}
+
+void Encoder::fromBase32Slow(const char* src, uint8_t* dst, size_t len)
 {
 	size_t i, index, offset;
 	
@@ -124,7 +167,7 @@ bool Encoder::isBase32(const char* src)
 {
 	for (size_t i = 0; src[i]; i++)
 	{
-		if (g_base32Table[src[i]] == -1)
+		if (g_base32Table[(unsigned char)src[i]] == -1)
 			return false;
 	}
 	
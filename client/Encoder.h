@@ -41,6 +41,7 @@ class Encoder
 		static void fromBase16(const char* src, uint8_t *dst, size_t len);
 #endif
 	private:
+		static void fromBase32Slow(const char* src, uint8_t* dst, size_t len);
 		static const int8_t g_base32Table[];
 		static const char g_base32Alphabet[];
 };
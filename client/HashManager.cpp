@@ -233,6 +233,26 @@ void HashManager::hashDone(__int64 p_path_id, const string& aFileName, int64_t a
 		LogManager::message("HashManager::hashDone - aFileName.empty()");
 		return;
 	}
+	HashDoneTask l_task = { p_path_id, aFileName, aTimeStamp, tth, speed, p_is_ntfs, p_size };
+	// the same conditions as getMediaInfo: only these files wait for the container parser
+	if (p_size >= SETTING(MIN_MEDIAINFO_SIZE) * 1024 * 1024 &&
+	        CFlyServerConfig::isMediainfoExt(Text::toLower(Util::getFileExtWithoutDot(aFileName))))
+	{
+		if (m_media_info_pool.addTask(std::move(l_task)))
+			return;
+	}
+	finishHash(l_task);
+}
+
+void HashManager::finishHash(const HashDoneTask& p_task)
+{
+	const __int64 p_path_id = p_task.m_path_id;
+	const string& aFileName = p_task.m_file_name;
+	const int64_t aTimeStamp = p_task.m_time_stamp;
+	const TigerTree& tth = p_task.m_tree;
+	const int64_t speed = p_task.m_speed;
+	const bool p_is_ntfs = p_task.m_is_ntfs;
+	const int64_t p_size = p_task.m_size;
 	CFlyMediaInfo l_out_media;
 	try
 	{
@@ -278,6 +298,73 @@ void HashManager::hashDone(__int64 p_path_id, const string& aFileName, int64_t a
 }
 
 
+bool HashManager::MediaInfoPool::addTask(HashDoneTask&& p_task)
+{
+	{
+		CFlyFastLock(m_cs);
+		if (m_stop || m_tasks.size() >= MAX_TASKS)
+			return false;
+		m_tasks.push_back(std::move(p_task));
+		if (m_threads.size() < std::min<size_t>(MAX_THREADS, std::max<size_t>(1, CompatibilityManager::getProcessorsCount() / 2)) && m_tasks.size() > m_threads.size())
+		{
+			std::unique_ptr<Worker> l_thread(new Worker(*this));
+			try
+			{
+				l_thread->start(0, "HashManager::MediaInfo");
+				m_threads.push_back(std::move(l_thread));
+			}
+			catch (const ThreadException& e)
+			{
+				LogManager::message("HashManager::MediaInfoPool - " + e.getError());
+				if (m_threads.empty())
+				{
+					p_task = std::move(m_tasks.back());
+					m_tasks.pop_back();
+					return false;
+				}
+			}
+		}
+	}
+	m_semaphore.signal();
+	return true;
+}
+
+void HashManager::MediaInfoPool::shutdown()
+{
+	std::vector<std::unique_ptr<Worker>> l_threads;
+	{
+		CFlyFastLock(m_cs);
+		m_stop = true;
+		m_tasks.clear();
+		l_threads.swap(m_threads);
+	}
+	m_semaphore.signal(long(l_threads.size()));
+	for (auto i = l_threads.cbegin(); i != l_threads.cend(); ++i)
+	{
+		(*i)->join();
+	}
+}
+
+int HashManager::MediaInfoPool::Worker::run()
+{
+	for (;;)
+	{
+		m_pool.m_semaphore.wait();
+		HashDoneTask l_task;
+		{
+			CFlyFastLock(m_pool.m_cs);
+			if (m_pool.m_stop)
+				break;
+			if (m_pool.m_tasks.empty())
+				continue;
+			l_task = std::move(m_pool.m_tasks.front());
+			m_pool.m_tasks.pop_front();
+		}
+		HashManager::getInstance()->finishHash(l_task);
+	}
+	return 0;
+}
+
 void HashManager::addFile(__int64 p_path_id, const string& p_file_name, int64_t p_time_stamp, const TigerTree& p_tth, int64_t p_size, CFlyMediaInfo& p_out_media)
 {
 	// dcassert(p_path_id);
@@ -126,6 +126,7 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 			//CFlyLock(cs); //[!]IRainman
 			hasher.shutdown();
 			hasher.join();
+			m_media_info_pool.shutdown();
 		}
 		
 		struct HashPauser
@@ -401,6 +402,58 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 		
 		friend class Hasher;
 		
+		struct HashDoneTask
+		{
+			__int64 m_path_id;
+			string m_file_name;
+			int64_t m_time_stamp;
+			TigerTree m_tree;
+			int64_t m_speed;
+			bool m_is_ntfs;
+			int64_t m_size;
+		};
+		/**
+		 * Finishes hashDone for media files on its own threads: the hasher goes on with the next file
+		 * instead of waiting for the container parser. Every thread keeps its own MediaInfo instance.
+		 */
+		class MediaInfoPool
+		{
+			public:
+				MediaInfoPool() : m_stop(false)
+				{
+				}
+				~MediaInfoPool()
+				{
+					shutdown();
+				}
+				/** @return false if the queue is full - the caller finishes the task itself */
+				bool addTask(HashDoneTask&& p_task);
+				/** Not finished tasks are dropped - the files are not in the database and will be hashed again */
+				void shutdown();
+				size_t size() const
+				{
+					CFlyFastLock(m_cs);
+					return m_tasks.size();
+				}
+			private:
+				class Worker : public Thread
+				{
+					public:
+						explicit Worker(MediaInfoPool& p_pool) : m_pool(p_pool)
+						{
+						}
+					private:
+						int run();
+						MediaInfoPool& m_pool;
+				};
+				enum { MAX_THREADS = 2, MAX_TASKS = 32 };
+				mutable FastCriticalSection m_cs;
+				std::deque<HashDoneTask> m_tasks;
+				std::vector<std::unique_ptr<Worker>> m_threads;
+				Semaphore m_semaphore;
+				volatile bool m_stop;
+		};
+		
 		void addFile(__int64 p_path_id, const string& p_file_name, int64_t p_time_stamp, const TigerTree& p_tth, int64_t p_size, CFlyMediaInfo& p_out_media);
 	private:
 #ifdef IRAINMAN_NTFS_STREAM_TTH
@@ -408,6 +461,8 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 #endif
 		
 		Hasher hasher;
+		MediaInfoPool m_media_info_pool;
+		void finishHash(const HashDoneTask& p_task);
 		
 		void hashDone(__int64 p_path_id, const string& aFileName, int64_t aTimeStamp, const TigerTree& tth, int64_t speed,
 		              bool p_is_ntfs,
@@ -23,6 +23,8 @@
 #include "CompatibilityManager.h"
 #include "TimerManager.h"
 #include "ClientManager.h"
+#include "CFlyBoundedQueue.h"
+#include "Semaphore.h"
 
 #ifdef _DEBUG
 boost::unordered_map<string, pair<string, size_t> > LogManager::g_pathCache;
@@ -34,14 +36,325 @@ boost::unordered_map<string, string> LogManager::g_pathCache;
 bool LogManager::g_isInit = false;
 int LogManager::g_logOptions[LAST][2];
 FastCriticalSection LogManager::g_csPathCache;
-std::map<std::string, FastCriticalSection> LogManager::g_csFile;
 FastCriticalSection LogManager::g_csFileArea;
-CFlyMessagesBuffer LogManager::g_LogFilesBuffer;
-FastCriticalSection LogManager::g_csLogFilesBuffer;
 HWND LogManager::g_mainWnd = nullptr;
 int  LogManager::g_LogMessageID = 0;
 bool LogManager::g_isLogSpeakerEnabled = false;
 
+#ifndef _CONSOLE
+/**
+ * Compression of the rotated logs - bz2 of a big file must not hold the writer thread.
+ */
+class CFlyLogCompressor : public BackgroundTaskExecuter<string>
+{
+	private:
+		void execute(const string& p_path)
+		{
+			try
+			{
+				if (File::bz2CompressFile(Text::toT(p_path), Text::toT(p_path + ".bz2")))
+				{
+					File::deleteFile(p_path);
+				}
+			}
+			catch (const Exception&)
+			{
+				File::deleteFile(p_path + ".bz2");
+			}
+		}
+};
+static CFlyLogCompressor g_log_compressor;
+#endif
+
+/**
+ * Single writer thread for all log files.
+ * Producers only move the formatted line into a lock-free queue; the writer groups the lines by file,
+ * keeps the recently used files open (LRU) and rotates them by size.
+ * Memory is bounded by the queue capacity and MAX_QUEUED_BYTES - on overflow the line is dropped and counted.
+ */
+class CFlyLogWriter : public Thread
+{
+	public:
+		enum
+		{
+			QUEUE_CAPACITY = 16384,
+			MAX_QUEUED_BYTES = 16 * 1024 * 1024,
+			MAX_OPEN_FILES = 16,
+			IDLE_CLOSE_TIME = 60 * 1000,
+			ROTATE_RETRY_TIME = 10 * 60 * 1000
+		};
+		CFlyLogWriter() : m_records(QUEUE_CAPACITY), m_queued_bytes(0), m_pushed(0), m_written(0), m_dropped(0), m_reported_dropped(0),
+			m_flush_waiters(0), m_is_stop(false), m_is_running(false)
+		{
+		}
+		~CFlyLogWriter()
+		{
+			shutdown();
+		}
+		void startWriter()
+		{
+			if (!m_is_running)
+			{
+				m_is_stop = false;
+				m_is_running = true;
+				start(0, "LogManager");
+			}
+		}
+		void shutdown()
+		{
+			if (m_is_running)
+			{
+				m_is_stop = true;
+				m_semaphore.signal();
+				join();
+				// a producer which saw isRunning() just before m_is_stop may have queued a line after the last drain()
+				drain();
+				m_files.clear();
+				m_is_running = false;
+			}
+		}
+		bool isRunning() const
+		{
+			return m_is_running && !m_is_stop;
+		}
+		bool push(const string& p_path, string&& p_msg)
+		{
+			const size_t l_size = p_msg.size();
+			if (m_queued_bytes.fetch_add(l_size) + l_size > MAX_QUEUED_BYTES)
+			{
+				m_queued_bytes -= l_size;
+				++m_dropped;
+				return false;
+			}
+			++m_pushed;
+			LogRecord l_record;
+			l_record.m_path = p_path;
+			l_record.m_msg = std::move(p_msg);
+			if (!m_records.push(std::move(l_record)))
+			{
+				--m_pushed;
+				m_queued_bytes -= l_size;
+				++m_dropped;
+				return false;
+			}
+			return true;
+		}
+		void wakeup()
+		{
+			m_semaphore.signal();
+		}
+		/** Waits until everything queued before the call is written, at most p_timeout ms
+		    @return false if the writer did not make it in time */
+		bool flush(uint32_t p_timeout)
+		{
+			const uint64_t l_target = m_pushed;
+			const uint64_t l_start = GET_TICK();
+			++m_flush_waiters;
+			m_semaphore.signal();
+			bool l_is_done;
+			while (!(l_is_done = !isRunning() || m_written >= std::min(l_target, m_pushed.load())))
+			{
+				const uint64_t l_elapsed = GET_TICK() - l_start;
+				if (l_elapsed >= p_timeout)
+					break;
+				m_flushed.wait(uint32_t(p_timeout - l_elapsed));
+			}
+			--m_flush_waiters;
+			return l_is_done;
+		}
+		uint32_t getDropped() const
+		{
+			return m_dropped;
+		}
+	private:
+		struct LogRecord
+		{
+			string m_path;
+			string m_msg;
+		};
+		struct OpenFile
+		{
+			string m_path;
+			std::unique_ptr<File> m_file;
+			int64_t m_size;
+			uint64_t m_last_tick;
+		};
+		typedef std::list<OpenFile> OpenFileList;
+		
+		int run()
+		{
+			for (;;)
+			{
+				m_semaphore.wait(1000);
+				const bool l_is_stop = m_is_stop;
+				drain();
+				closeIdleFiles();
+				if (l_is_stop)
+					break;
+			}
+			drain();
+			m_files.clear();
+			return 0;
+		}
+		void drain()
+		{
+			CFlyMessagesBuffer l_batch;
+			uint64_t l_count = 0;
+			LogRecord l_record;
+			while (m_records.pop(l_record))
+			{
+				m_queued_bytes -= l_record.m_msg.size();
+				l_batch[l_record.m_path] += l_record.m_msg;
+				++l_count;
+			}
+			if (l_count == 0)
+				return;
+			const uint32_t l_dropped = m_dropped;
+			if (l_dropped != m_reported_dropped)
+			{
+				// queued as usual - written to the system log by the next drain()
+				LogManager::message("LogManager: " + Util::toString(l_dropped - m_reported_dropped) + " message(s) dropped (log queue overflow)", true);
+				m_reported_dropped = l_dropped;
+			}
+			const int64_t l_rotate_size = int64_t(SETTING(LOG_ROTATE_SIZE)) * 1024 * 1024;
+			for (auto i = l_batch.cbegin(); i != l_batch.cend(); ++i)
+			{
+				write(i->first, i->second, l_rotate_size);
+			}
+			m_written += l_count;
+			const long l_waiters = m_flush_waiters;
+			if (l_waiters > 0)
+			{
+				m_flushed.signal(l_waiters);
+			}
+		}
+		void write(const string& p_path, const string& p_data, int64_t p_rotate_size)
+		{
+			try
+			{
+				OpenFile& l_file = getFile(p_path);
+				l_file.m_file->write(p_data);
+				l_file.m_size += p_data.size();
+				l_file.m_last_tick = GET_TICK();
+				if (p_rotate_size > 0 && l_file.m_size >= p_rotate_size && isRotateAllowed(p_path))
+				{
+					rotate(p_path);
+				}
+			}
+			catch (const FileException&)
+			{
+				closeFile(p_path);
+				dcassert(0);
+			}
+		}
+		OpenFile& getFile(const string& p_path)
+		{
+			for (auto i = m_files.begin(); i != m_files.end(); ++i)
+			{
+				if (i->m_path == p_path)
+				{
+					m_files.splice(m_files.begin(), m_files, i);
+					return m_files.front();
+				}
+			}
+			if (m_files.size() >= MAX_OPEN_FILES)
+			{
+				m_files.pop_back();
+			}
+			OpenFile l_file;
+			l_file.m_path = p_path;
+			try
+			{
+				l_file.m_file.reset(new File(p_path, File::WRITE, File::OPEN | File::CREATE | File::SHARED));
+			}
+			catch (const FileException&)
+			{
+				File::ensureDirectory(p_path);
+				l_file.m_file.reset(new File(p_path, File::WRITE, File::OPEN | File::CREATE | File::SHARED));
+			}
+			l_file.m_size = l_file.m_file->setEndPos(0);
+			if (l_file.m_size == 0)
+			{
+				l_file.m_file->write("\xef\xbb\xbf");
+				l_file.m_size = 3;
+			}
+			l_file.m_last_tick = GET_TICK();
+			m_files.push_front(std::move(l_file));
+			return m_files.front();
+		}
+		void closeFile(const string& p_path)
+		{
+			for (auto i = m_files.begin(); i != m_files.end(); ++i)
+			{
+				if (i->m_path == p_path)
+				{
+					m_files.erase(i);
+					return;
+				}
+			}
+		}
+		void closeIdleFiles()
+		{
+			// Don't keep files of the finished periods (%Y-%m-%d in the name) and rarely used logs open forever
+			const uint64_t l_tick = GET_TICK();
+			while (!m_files.empty() && l_tick - m_files.back().m_last_tick > IDLE_CLOSE_TIME)
+			{
+				m_files.pop_back();
+			}
+		}
+		bool isRotateAllowed(const string& p_path)
+		{
+			if (m_rotate_failed.empty())
+				return true;
+			const auto i = m_rotate_failed.find(p_path);
+			if (i == m_rotate_failed.end())
+				return true;
+			if (GET_TICK() < i->second)
+				return false;
+			m_rotate_failed.erase(i);
+			return true;
+		}
+		void rotate(const string& p_path)
+		{
+			closeFile(p_path);
+			const string l_ext = Util::getFileExt(p_path);
+			const string l_base = p_path.substr(0, p_path.size() - l_ext.size()) + '.' + Util::formatTime("%Y%m%d-%H%M%S", GET_TIME());
+			string l_target = l_base + l_ext;
+			for (int i = 1; File::isExist(l_target) || File::isExist(l_target + ".bz2"); ++i)
+			{
+				l_target = l_base + '-' + Util::toString(i) + l_ext;
+			}
+			if (!File::renameFile(p_path, l_target))
+			{
+				// the file is locked by someone else - keep appending and try again later, not on every write
+				m_rotate_failed[p_path] = GET_TICK() + ROTATE_RETRY_TIME;
+				LogManager::message("LogManager: can't rotate " + p_path + " (retry in " + Util::toString(ROTATE_RETRY_TIME / 60000) + " min)", true);
+				return;
+			}
+#ifndef _CONSOLE
+			if (BOOLSETTING(LOG_ROTATE_COMPRESS))
+			{
+				g_log_compressor.addTask(l_target, false);
+			}
+#endif
+		}
+		
+		CFlyBoundedQueue<LogRecord> m_records;
+		Semaphore m_semaphore;
+		Semaphore m_flushed; // signalled after every drain() while flush() waits
+		OpenFileList m_files; // only the writer thread touches it
+		boost::unordered_map<string, uint64_t> m_rotate_failed; // path -> tick of the next rotate attempt
+		boost::atomic<size_t> m_queued_bytes;
+		boost::atomic<uint64_t> m_pushed;
+		boost::atomic<uint64_t> m_written;
+		boost::atomic<uint32_t> m_dropped;
+		uint32_t m_reported_dropped;
+		boost::atomic<long> m_flush_waiters;
+		volatile bool m_is_stop;
+		volatile bool m_is_running;
+};
+static CFlyLogWriter g_log_writer;
+
 void LogManager::init()
 {
 	g_logOptions[UPLOAD][FILE]        = SettingsManager::LOG_FILE_UPLOAD;
@@ -81,6 +394,7 @@ void LogManager::init()
 	g_logOptions[TORRENT_TRACE][FORMAT] = SettingsManager::LOG_FORMAT_TORRENT_TRACE;
 	
 	g_isInit = true;
+	g_log_writer.startWriter();
 	
 	if (!CompatibilityManager::getStartupInfo().empty())
 	{
@@ -140,78 +454,73 @@ void LogManager::log(const string& p_area, const string& p_msg) noexcept
 #endif
 		}
 	}
-	{
-		CFlyFastLock(g_csLogFilesBuffer);
-		string l_msg;
+	string l_msg;
 #ifdef _DEBUG
-		if (ClientManager::isStartup())
-			l_msg += "[init]";
-		if (ClientManager::isShutdown())
-			l_msg += "[shutdown]";
-		l_msg += "[" + Util::toString(::GetCurrentThreadId()) + "]";
+	if (ClientManager::isStartup())
+		l_msg += "[init]";
+	if (ClientManager::isShutdown())
+		l_msg += "[shutdown]";
+	l_msg += "[" + Util::toString(::GetCurrentThreadId()) + "]";
 #endif
-		l_msg += p_msg + "\r\n";
-		auto l_log = g_LogFilesBuffer.insert(make_pair(l_area, l_msg));
-		if (l_log.second == false)
-		{
-			l_log.first->second += l_msg;
-		}
-	}
+	l_msg += p_msg + "\r\n";
 	dcassert(!l_area.empty());
-	if (l_is_new_path)
+	if (g_log_writer.isRunning())
 	{
-		File::ensureDirectory(l_area);
-	}
+		g_log_writer.push(l_area, std::move(l_msg));
 #ifndef _DEBUG
-	if (ClientManager::isStartup() == true)
+		if (ClientManager::isStartup() == true)
 #endif
-	{
-		flush_all_log();
-	}
-}
-void LogManager::flush_all_log()
-{
-	CFlyMessagesBuffer l_buffer;
-	{
-		CFlyFastLock(g_csLogFilesBuffer);
-		l_buffer.swap(g_LogFilesBuffer);
+		{
+			g_log_writer.wakeup();
+		}
 	}
-	for (auto i = l_buffer.cbegin(); i != l_buffer.cend(); ++i)
+	else
 	{
+		// the writer is already stopped (or not started yet) - write directly
+		if (l_is_new_path)
+		{
+			File::ensureDirectory(l_area);
+		}
 		try
 		{
-			flush_file(i->first, i->second);
+			flush_file(l_area, l_msg);
 		}
-		catch (const FileException& e)
+		catch (const FileException&)
 		{
-			const auto l_code = GetLastError();
-			if (l_code == 3) // ERROR_PATH_NOT_FOUND
+			try
 			{
-				try
-				{
-					File::ensureDirectory(i->first);
-					flush_file(i->first, i->second);
-				}
-				catch (const FileException& e)
-				{
-					dcassert(0);
-				}
+				File::ensureDirectory(l_area);
+				flush_file(l_area, l_msg);
 			}
-			else
+			catch (const FileException&)
 			{
 				dcassert(0);
 			}
 		}
 	}
 }
+bool LogManager::flush_all_log(uint32_t p_timeout /* = FLUSH_TIMEOUT */)
+{
+	return g_log_writer.flush(p_timeout);
+}
+
+void LogManager::shutdown()
+{
+	g_log_writer.shutdown();
+#ifndef _CONSOLE
+	g_log_compressor.waitShutdown();
+#endif
+}
+
+uint32_t LogManager::getDroppedMessages()
+{
+	return g_log_writer.getDropped();
+}
 
 void LogManager::flush_file(const string& p_area, const string& p_msg)
 {
-	g_csFileArea.lock();
-	FastCriticalSection& l_cs = g_csFile[p_area];
-	g_csFileArea.unlock();
-	CFlyFastLock(l_cs);
-	File f(p_area, File::WRITE, File::OPEN | File::CREATE);
+	CFlyFastLock(g_csFileArea);
+	File f(p_area, File::WRITE, File::OPEN | File::CREATE | File::SHARED);
 	if (f.setEndPos(0) == 0)
 	{
 		f.write("\xef\xbb\xbf");
@@ -82,7 +82,14 @@ class LogManager
 		static HWND g_mainWnd;
 		static bool g_isLogSpeakerEnabled;
 		static int  g_LogMessageID;
-		static void flush_all_log();
+		enum
+		{
+			FLUSH_TIMEOUT = 5000
+		};
+		/** Waits (at most p_timeout ms) until the log thread has written everything queued before the call */
+		static bool flush_all_log(uint32_t p_timeout = FLUSH_TIMEOUT);
+		static void shutdown();
+		static uint32_t getDroppedMessages();
 	private:
 		static void flush_file(const string& p_area, const string& p_msg);
 		static void log(const string& p_area, const string& p_msg) noexcept;
@@ -99,9 +106,6 @@ class LogManager
 		static FastCriticalSection g_csPathCache; // [!] IRainman opt: use spin lock here.
 		static bool g_isInit;
 		
-		static CFlyMessagesBuffer g_LogFilesBuffer;
-		static FastCriticalSection g_csLogFilesBuffer;
-		static std::map<std::string, FastCriticalSection> g_csFile; // map -   
 		static FastCriticalSection g_csFileArea;
 		
 		LogManager();
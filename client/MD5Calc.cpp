@@ -2,8 +2,9 @@
 
 #include "stdinc.h"
 #include "MD5Calc.h"
+#include "CFlyHashBackend.h"
 
-MD5Calc::MD5Calc()
+MD5Calc::MD5Calc() : m_is_openssl(false)
 {
 }
 
@@ -85,6 +86,17 @@ char* MD5Calc::CalcMD5FromString(const char *s8_Input)
  */
 void MD5Calc::MD5Init()
 {
+	MD5Init(CFlyHashBackend::isOpenSSLMD5());
+}
+
+void MD5Calc::MD5Init(bool p_is_openssl)
+{
+	m_is_openssl = p_is_openssl;
+	if (m_is_openssl)
+	{
+		MD5_Init(&m_ssl_ctx);
+		return;
+	}
 	m_ctx.buf[0] = 0x67452301;
 	m_ctx.buf[1] = 0xefcdab89;
 	m_ctx.buf[2] = 0x98badcfe;
@@ -100,6 +112,11 @@ void MD5Calc::MD5Init()
  */
 void MD5Calc::MD5Update(unsigned char *buf, unsigned len)
 {
+	if (m_is_openssl)
+	{
+		MD5_Update(&m_ssl_ctx, buf, len);
+		return;
+	}
 	unsigned long t;
 	
 	/* Update bitcount */
@@ -170,6 +187,11 @@ char* MD5Calc::MD5FinalToString()
  */
 void MD5Calc::MD5Final(unsigned char digest[16])
 {
+	if (m_is_openssl)
+	{
+		MD5_Final(digest, &m_ssl_ctx);
+		return;
+	}
 	unsigned count;
 	unsigned char *p;
 	
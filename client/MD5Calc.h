@@ -7,6 +7,7 @@
 #define DCPLUSPLUS_DCPP_MD5CALC_H_
 
 #include "Util.h"
+#include <openssl/md5.h>
 
 class MD5Calc
 #ifdef _DEBUG
@@ -18,8 +19,10 @@ class MD5Calc
 		char* CalcMD5FromFile(const wchar_t *s8_Path);
 		MD5Calc();
 		
-		void MD5Init();
+		void MD5Init(); // OpenSSL if CFlyHashBackend::isOpenSSLMD5()
+		void MD5Init(bool p_is_openssl);
 		void MD5Update(unsigned char *buf, unsigned len);
+		void MD5Final(unsigned char digest[16]);
 		char* MD5FinalToString();
 		
 		~MD5Calc();
@@ -32,13 +35,13 @@ class MD5Calc
 			unsigned char in[64];
 		};
 		
-		void MD5Final(unsigned char digest[16]);
-		
 		void MD5Transform(unsigned long buf[4], unsigned long in[16]);
 		
 		void byteReverse(unsigned char *buf, unsigned longs);
 		
 		MD5Context m_ctx;
+		MD5_CTX m_ssl_ctx;
+		bool m_is_openssl;
 		char ms8_MD5[40]; // Output buffer
 };
 
@@ -23,6 +23,7 @@
 
 #include <boost/unordered/unordered_map.hpp>
 #include "StringPool.h"
+#include "CFlyPackedStringMap.h"
 #include "User.h"
 #include "UserInfoBase.h"
 #include "UserInfoColumns.h"
@@ -846,7 +847,7 @@ class Identity
 		}
 		bool setExtJSON(const string& p_ExtJSON);
 		
-		typedef boost::unordered_map<short, string> InfMap;
+		typedef CFlyPackedStringMap InfMap;
 		
 		mutable FastCriticalSection m_si_fcs;
 		InfMap m_stringInfo;
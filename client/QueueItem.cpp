@@ -32,6 +32,8 @@ std::unique_ptr<webrtc::RWLockWrapper> QueueItem::g_cs = std::unique_ptr<webrtc:
 #else
 std::unique_ptr<CriticalSection> QueueItem::g_cs = std::unique_ptr<CriticalSection>(new CriticalSection);
 #endif
+FastCriticalSection QueueItem::g_dirty_cs;
+std::vector<QueueItemPtr> QueueItem::g_dirty_items;
 
 const string g_dc_temp_extension = "dctmp";
 
@@ -50,7 +52,9 @@ QueueItem::QueueItem(const string& aTarget, int64_t aSize, Priority aPriority, b
 	m_dirty_base(false),
 	m_dirty_source(false),
 	m_dirty_segment(false),
+	m_is_in_dirty_list(false),
 	m_is_file_not_exist(false),
+	m_is_restored_data(false),
 //	m_is_failed(false),
 	m_block_size(0),
 	m_tthRoot(p_tth),
@@ -65,7 +69,7 @@ QueueItem::QueueItem(const string& aTarget, int64_t aSize, Priority aPriority, b
 {
 	if (p_FlyQueueID == 0)
 	{
-		m_dirty_base = true;
+		m_dirty_base = true; // FileQueue::add puts the item into the dirty list, shared_from_this() is not available here
 	}
 #ifdef _DEBUG
 	//LogManager::message("QueueItem::QueueItem aTarget = " + aTarget + " this = " + Util::toString(__int64(this)));
@@ -264,6 +268,7 @@ void QueueItem::setSectionString(const string& p_section, bool p_is_first_load)
 		
 		if ((Sections.size() & 1) == 0)
 		{
+			m_is_restored_data = true;
 			CFlyFastLock(m_fcs_segment);
 			for (auto i = Sections.cbegin(); i < Sections.cend(); i += 2)
 			{
@@ -487,6 +492,47 @@ bool QueueItem::removeDownload(const UserPtr& p_user)
 	}
 	return l_size_before != m_downloads.size();
 }
+// Sorts the list and merges overlapping segments - the result is disjoint and can be searched by findSegment
+static void mergeSegments(vector<Segment>& p_segments)
+{
+	p_segments.erase(std::remove_if(p_segments.begin(), p_segments.end(), [](const Segment & p_segment)
+	{
+		return p_segment.getSize() <= 0; // tree downloads
+	}), p_segments.end());
+	std::sort(p_segments.begin(), p_segments.end());
+	size_t l_count = 0;
+	for (size_t i = 0; i < p_segments.size(); ++i)
+	{
+		if (l_count && p_segments[l_count - 1].getEnd() >= p_segments[i].getStart())
+		{
+			Segment& l_last = p_segments[l_count - 1];
+			l_last.setSize(std::max(l_last.getEnd(), p_segments[i].getEnd()) - l_last.getStart());
+		}
+		else
+		{
+			p_segments[l_count++] = p_segments[i];
+		}
+	}
+	p_segments.resize(l_count);
+}
+
+// @return The first segment of a sorted disjoint list which ends after p_pos
+template<class Iter>
+static Iter findSegment(Iter p_first, Iter p_upper_bound, int64_t p_pos)
+{
+	if (p_upper_bound != p_first && std::prev(p_upper_bound)->getEnd() > p_pos)
+		return std::prev(p_upper_bound);
+	return p_upper_bound;
+}
+static QueueItem::SegmentSet::const_iterator findSegment(const QueueItem::SegmentSet& p_segments, int64_t p_pos)
+{
+	return findSegment(p_segments.cbegin(), p_segments.upper_bound(Segment(p_pos, std::numeric_limits<int64_t>::max())), p_pos);
+}
+static vector<Segment>::const_iterator findSegment(const vector<Segment>& p_segments, int64_t p_pos)
+{
+	return findSegment(p_segments.cbegin(), std::upper_bound(p_segments.cbegin(), p_segments.cend(), Segment(p_pos, std::numeric_limits<int64_t>::max())), p_pos);
+}
+
 Segment QueueItem::getNextSegmentL(const int64_t  blockSize, const int64_t wantedSize, const int64_t lastSpeed, const PartialSource::Ptr &partialSource) const
 {
 	if (getSize() == -1 || blockSize == 0)
@@ -626,78 +672,78 @@ Segment QueueItem::getNextSegmentL(const int64_t  blockSize, const int64_t wante
 	}
 	
 	int64_t start = 0;
-	int64_t curSize = targetSize;
 	{
 		CFlyFastLock(m_fcs_download);
 		{
 			CFlyFastLock(m_fcs_segment);
+			// running chunks merged into a sorted disjoint list, done segments are already kept this way - every check below is a lookup
+			vector<Segment> l_running;
+			l_running.reserve(m_downloads.size());
+			for (auto i = m_downloads.cbegin(); i != m_downloads.cend(); ++i)
+			{
+				l_running.push_back((*i)->getSegment());
+			}
+			mergeSegments(l_running);
+			
 			while (start < getSize())
 			{
-				int64_t end = std::min(getSize(), start + curSize);
-				Segment block(start, end - start);
-				bool overlaps = false;
+				const auto l_done = findSegment(m_done_segment, start);
+				const auto l_run = findSegment(l_running, start);
+				int64_t l_busy = getSize();
+				if (l_done != m_done_segment.cend())
 				{
-					for (auto i = m_done_segment.cbegin(); !overlaps && i != m_done_segment.cend(); ++i)
-					{
-						if (curSize <= blockSize)
-						{
-							int64_t dstart = i->getStart();
-							int64_t dend = i->getEnd();
-							// We accept partial overlaps, only consider the block done if it is fully consumed by the done block
-							if (dstart <= start && dend >= end)
-							{
-								overlaps = true;
-							}
-						}
-						else
-						{
-							overlaps = block.overlaps(*i);
-						}
-					}
+					l_busy = std::min(l_busy, l_done->getStart());
 				}
-				if (!overlaps)
+				if (l_run != l_running.cend())
 				{
-					for (auto i = m_downloads.cbegin(); !overlaps && i != m_downloads.cend(); ++i)
-					{
-						overlaps = block.overlaps((*i)->getSegment());
-					}
+					l_busy = std::min(l_busy, l_run->getStart());
 				}
 				
-				if (!overlaps)
+				// take as much of the free space as wanted, whole blocks only
+				int64_t end = std::min(getSize(), start + targetSize);
+				if (l_busy < end)
+				{
+					end = l_busy > start ? start + (l_busy - start) / blockSize * blockSize : start;
+				}
+				if (end == start)
 				{
-					if (partialSource)
+					end = std::min(getSize(), start + blockSize);
+					if (l_run != l_running.cend() && l_run->getStart() < end)
 					{
-						// store all chunks we could need
-						for (auto j = posArray.cbegin(); j < posArray.cend(); j += 2)
-						{
-							if ((*j <= start && start < * (j + 1)) || (start <= *j && *j < end))
-							{
-								int64_t b = max(start, *j);
-								int64_t e = min(end, *(j + 1));
-								
-								// segment must be blockSize aligned
-								dcassert(b % blockSize == 0);
-								dcassert(e % blockSize == 0 || e == getSize());
-								
-								neededParts.push_back(Segment(b, e - b));
-							}
-						}
+						start = Util::roundUp(l_run->getEnd(), blockSize);
+						continue;
 					}
-					else
+					// We accept partial overlaps, only consider the block done if it is fully consumed by the done block
+					if (l_done != m_done_segment.cend() && l_done->getStart() <= start && l_done->getEnd() >= end)
 					{
-						return block;
+						start = std::max(end, l_done->getEnd() / blockSize * blockSize);
+						continue;
 					}
 				}
-				
-				if (overlaps && (curSize > blockSize))
+				const Segment block(start, end - start);
+				if (partialSource)
 				{
-					curSize -= blockSize;
+					// store all chunks we could need
+					for (auto j = posArray.cbegin(); j < posArray.cend(); j += 2)
+					{
+						if ((*j <= start && start < * (j + 1)) || (start <= *j && *j < end))
+						{
+							int64_t b = max(start, *j);
+							int64_t e = min(end, *(j + 1));
+							
+							// segment must be blockSize aligned
+							dcassert(b % blockSize == 0);
+							dcassert(e % blockSize == 0 || e == getSize());
+							
+							neededParts.push_back(Segment(b, e - b));
+						}
+					}
 				}
 				else
 				{
-					start = end;
-					curSize = targetSize;
+					return block;
 				}
+				start = end;
 			}
 		}
 	} // end lock
@@ -715,36 +761,47 @@ Segment QueueItem::getNextSegmentL(const int64_t  blockSize, const int64_t wante
 	
 	if (partialSource == NULL && BOOLSETTING(OVERLAP_CHUNKS) && lastSpeed > 10 * 1024)
 	{
-		// overlap slow running chunk
+		// endgame: nothing free is left - duplicate the running chunk which would finish last,
+		// if this (faster) source can download its rest more than 2x faster
 		
 		const uint64_t l_CurrentTick = GET_TICK();//[+]IRainman refactoring transfer mechanism
-		CFlyFastLock(m_fcs_download);
-		for (auto i = m_downloads.cbegin(); i != m_downloads.cend(); ++i)
+		DownloadPtr l_slowest;
 		{
-			const auto d = *i;
-			
-			// current chunk mustn't be already overlapped
-			if (d->getOverlapped())
-				continue;
-				
-			// current chunk must be running at least for 2 seconds
-			if (d->getStart() == 0 || l_CurrentTick - d->getStart() < 2000)//[!]IRainman refactoring transfer mechanism
-				continue;
-				
-			// current chunk mustn't be finished in next 10 seconds
-			if (d->getSecondsLeft() < 10)
-				continue;
+			CFlyFastLock(m_fcs_download);
+			for (auto i = m_downloads.cbegin(); i != m_downloads.cend(); ++i)
+			{
+				const auto d = *i;
 				
+				// current chunk mustn't be already overlapped
+				if (d->getOverlapped())
+					continue;
+					
+				// current chunk must be running at least for 2 seconds
+				if (d->getStart() == 0 || l_CurrentTick - d->getStart() < 2000)//[!]IRainman refactoring transfer mechanism
+					continue;
+					
+				// current chunk mustn't be finished in next 10 seconds
+				if (d->getSecondsLeft() < 10)
+					continue;
+					
+				if (!l_slowest || d->getSecondsLeft() > l_slowest->getSecondsLeft())
+				{
+					l_slowest = d;
+				}
+			}
+		}
+		if (l_slowest)
+		{
 			// overlap current chunk at last block boundary
-			int64_t l_pos = d->getPos() - (d->getPos() % blockSize);
-			int64_t l_size = d->getSize() - l_pos;
+			const int64_t l_pos = l_slowest->getPos() - (l_slowest->getPos() % blockSize);
+			const int64_t l_size = l_slowest->getSize() - l_pos;
 			
 			// new user should finish this chunk more than 2x faster
-			int64_t newChunkLeft = l_size / lastSpeed;
-			if (2 * newChunkLeft < d->getSecondsLeft())
+			const int64_t newChunkLeft = l_size / lastSpeed;
+			if (2 * newChunkLeft < l_slowest->getSecondsLeft())
 			{
-				dcdebug("Overlapping... old user: %I64d s, new user: %I64d s\n", d->getSecondsLeft(), newChunkLeft);
-				return Segment(d->getStartPos() + l_pos, l_size, true);
+				dcdebug("Overlapping... old user: %I64d s, new user: %I64d s\n", l_slowest->getSecondsLeft(), newChunkLeft);
+				return Segment(l_slowest->getStartPos() + l_pos, l_size, true);
 			}
 		}
 	}
@@ -835,7 +892,7 @@ void QueueItem::addSegmentL(const Segment& p_segment, bool p_is_first_load)
 	}
 #endif
 	dcassert(p_segment.getOverlapped() == false);
-	m_done_segment.insert(p_segment);
+	const auto l_it = m_done_segment.insert(p_segment).first;
 #ifdef _DEBUG
 //  LogManager::message("QueueItem::addSegment, setDirty = true! id = " +
 //                      Util::toString(this->getFlyQueueID()) + " target = " + this->getTarget()
@@ -851,25 +908,49 @@ void QueueItem::addSegmentL(const Segment& p_segment, bool p_is_first_load)
 	{
 		setDirtySegment(true);
 	}
-	for (auto i = ++m_done_segment.cbegin(); i != m_done_segment.cend();)
+	// the set is always kept disjoint, so only the neighbours of the new segment can be merged with it
+	int64_t l_start = l_it->getStart();
+	int64_t l_end = l_it->getEnd();
+	auto l_first = l_it;
+	while (l_first != m_done_segment.cbegin())
 	{
-		SegmentSet::iterator prev = i;
-		--prev;
-		if (prev->getEnd() >= i->getStart())
-		{
-			const Segment big(prev->getStart(), i->getEnd() - prev->getStart());
-			m_done_segment.erase(prev);
-			m_done_segment.erase(i++);
-			m_done_segment.insert(big);
-			if (p_is_first_load == false)
-			{
-				setDirtySegment(true);
-			}
-		}
-		else
-		{
-			++i;
-		}
+		const auto l_prev = std::prev(l_first);
+		if (l_prev->getEnd() < l_start)
+			break;
+		l_start = l_prev->getStart();
+		l_end = std::max(l_end, l_prev->getEnd());
+		l_first = l_prev;
+	}
+	auto l_last = std::next(l_it);
+	while (l_last != m_done_segment.cend() && l_last->getStart() <= l_end)
+	{
+		l_end = std::max(l_end, l_last->getEnd());
+		++l_last;
+	}
+	if (l_first != l_it || l_last != std::next(l_it))
+	{
+		m_done_segment.erase(l_first, l_last);
+		m_done_segment.insert(Segment(l_start, l_end - l_start));
+	}
+}
+
+void QueueItem::addToDirtyList()
+{
+	CFlyFastLock(g_dirty_cs);
+	if (!m_is_in_dirty_list)
+	{
+		m_is_in_dirty_list = true;
+		g_dirty_items.push_back(shared_from_this());
+	}
+}
+
+void QueueItem::swapDirtyList(std::vector<QueueItemPtr>& p_items)
+{
+	CFlyFastLock(g_dirty_cs);
+	g_dirty_items.swap(p_items);
+	for (auto i = p_items.cbegin(); i != p_items.cend(); ++i)
+	{
+		(*i)->m_is_in_dirty_list = false;
 	}
 }
 
@@ -22,6 +22,7 @@
 #ifndef DCPLUSPLUS_DCPP_QUEUE_ITEM_H
 #define DCPLUSPLUS_DCPP_QUEUE_ITEM_H
 
+#include <boost/atomic.hpp>
 #include "Segment.h"
 #include "HintedUser.h"
 #include "webrtc/system_wrappers/include/rw_lock_wrapper.h"
@@ -57,7 +58,7 @@ class QueueItemDelegate
 		virtual void setDownloadItem(int64_t pos, int64_t size) = 0;
 };
 #endif
-class QueueItem : public Flags
+class QueueItem : public Flags, public std::enable_shared_from_this<QueueItem>
 #ifdef _DEBUG
 	, boost::noncopyable // [+] IRainman fix.
 #endif
@@ -271,6 +272,10 @@ class QueueItem : public Flags
 			LogManager::message(__FUNCTION__ " p_dirty = " + Util::toString(p_dirty));
 #endif
 			m_dirty_base = p_dirty;
+			if (p_dirty)
+			{
+				addToDirtyList();
+			}
 		}
 		void resetDirtyAll()
 		{
@@ -296,6 +301,10 @@ class QueueItem : public Flags
 			}
 #endif
 			m_dirty_source = p_dirty;
+			if (p_dirty)
+			{
+				addToDirtyList();
+			}
 		}
 		void setDirtySegment(bool p_dirty)
 		{
@@ -306,7 +315,15 @@ class QueueItem : public Flags
 			}
 #endif
 			m_dirty_segment = p_dirty;
+			if (p_dirty)
+			{
+				addToDirtyList();
+			}
 		}
+		/** Remembers the item for the next saveQueue (once until the list is taken) */
+		void addToDirtyList();
+		/** Takes the items changed since the last call - saveQueue doesn't walk the whole queue */
+		static void swapDirtyList(std::vector<QueueItemPtr>& p_items);
 		mutable FastCriticalSection m_fcs_download;
 		mutable FastCriticalSection m_fcs_segment;
 		void addDownload(const DownloadPtr& p_download);
@@ -371,10 +388,15 @@ class QueueItem : public Flags
 		bool m_dirty_base;
 		bool m_dirty_source;
 		bool m_dirty_segment;
+		bool m_is_in_dirty_list;
+		static FastCriticalSection g_dirty_cs;
+		static std::vector<QueueItemPtr> g_dirty_items;
 		uint64_t m_block_size;
 		void calcBlockSize();
 	public:
 		bool m_is_file_not_exist;
+		/** Some segments came from the previous session and were not checked against the tree since then (read by the mover thread) */
+		boost::atomic<bool> m_is_restored_data;
 		
 		const TTHValue& getTTH() const
 		{
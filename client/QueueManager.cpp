@@ -36,6 +36,7 @@
 #include "ADLSearch.h"
 #include "../FlyFeatures/flyServer.h"
 #include "ShareManager.h"
+#include "CompatibilityManager.h"
 
 
 std::unique_ptr<webrtc::RWLockWrapper> QueueManager::FileQueue::g_cs_remove = std::unique_ptr<webrtc::RWLockWrapper>(webrtc::RWLockWrapper::CreateRWLock());
@@ -197,12 +198,20 @@ bool QueueManager::FileQueue::is_queue_tth(const TTHValue& p_tth)
 
 void QueueManager::FileQueue::add(const QueueItemPtr& qi) // [!] IRainman fix.
 {
-	WLock(*g_csFQ); // [+] IRainman fix.
-	g_queue.insert(make_pair(qi->getTarget(), qi));
-	auto l_count_tth = g_queue_tth_map.insert(make_pair(qi->getTTH(), 1));
-	if (l_count_tth.second == false)
 	{
-		l_count_tth.first->second++;
+		WLock(*g_csFQ); // [+] IRainman fix.
+		g_queue.insert(make_pair(qi->getTarget(), qi));
+		auto l_count_tth = g_queue_tth_map.insert(make_pair(qi->getTTH(), 1));
+		if (l_count_tth.second == false)
+		{
+			l_count_tth.first->second++;
+		}
+	}
+	// A new item is dirty from the constructor, and saveQueue may have dropped an item that a setter
+	// put into the dirty list before it was in the queue - queue it for the save again now.
+	if (qi->isDirtyAll())
+	{
+		qi->addToDirtyList();
 	}
 }
 void QueueManager::FileQueue::remove_internal(const QueueItemPtr& qi)
@@ -860,10 +869,11 @@ void QueueManager::Rechecker::execute(const string& p_file) // [!] IRainman core
 	//If no bad blocks then the file probably got stuck in the temp folder for some reason
 	if (!hasBadBlocks)
 	{
-		qm->moveStuckFile(q);
+		qm->moveStuckFile(q, tt);
 		return;
 	}
 	
+	q->m_is_restored_data = false; // only the blocks which passed the check are kept
 	{
 		CFlyFastLock(q->m_fcs_segment);
 		for (auto i = l_sizes.cbegin(); i != l_sizes.cend(); ++i)
@@ -924,7 +934,11 @@ QueueManager::~QueueManager() noexcept
 			std::sort(filelists.begin(), filelists.end());
 			std::for_each(filelists.begin(),
 			              std::set_difference(filelists.begin(), filelists.end(), protectedFileLists.begin(), protectedFileLists.end(), filelists.begin()),
-			              File::deleteFile);
+			              [](const string & p_file)
+			{
+				File::deleteFile(p_file);
+				File::deleteFile(DirectoryListing::getCacheFileName(p_file));
+			});
 		}
 	}
 #endif
@@ -1548,70 +1562,104 @@ QueueItem::Priority QueueManager::hasDownload(const UserPtr& aUser)
 	}
 	return qi->getPriority();
 }
-void QueueManager::buildMap(const DirectoryListing::Directory* dir, TTHMap& p_tthMap) noexcept // [!] IRainman fix.
+void QueueManager::matchDirectory(const DirectoryListing::Directory* dir, const QueueTTHMap& p_queue, std::vector<QueueItemPtr>& p_matches) noexcept // [!] IRainman fix.
 {
 	for (auto j = dir->directories.cbegin(); j != dir->directories.cend(); ++j)
 	{
 		if (!(*j)->getAdls()) // [1] https://www.box.net/shared/d511d114cb87f7fa5b8d
 		{
-			buildMap(*j, p_tthMap); // [!] IRainman fix.
+			matchDirectory(*j, p_queue, p_matches); // [!] IRainman fix.
 		}
 	}
 	
 	for (auto i = dir->m_files.cbegin(); i != dir->m_files.cend(); ++i)
 	{
 		const DirectoryListing::File* df = *i;
-		p_tthMap.insert(make_pair(df->getTTH(), df));
+		matchTTH(p_queue, df->getTTH(), df->getSize(), p_matches);
 	}
 }
 
-int QueueManager::matchListing(const DirectoryListing& dl) noexcept
+void QueueManager::getQueueTTHMap(QueueTTHMap& p_queue)
 {
-	dcassert(dl.getUser()); // [!] IRainman fix: It makes no sense to check the file list on the presence of a file from our download queue if the user in the file list is empty!
-	
-	int matches = 0;
-	
-	// [!] IRainman fix.
-	if (!g_fileQueue.empty()) // [!] opt
+	RLock(*QueueItem::g_cs);
 	{
-		// [-] CFlyLock(cs); [-]
-		TTHMap l_tthMap;// tthMap.clear(); [!]
-		buildMap(dl.getRoot(), l_tthMap); // [!]
-		dcassert(!l_tthMap.empty());
+		RLock(*FileQueue::g_csFQ);
+		const auto& l_queue = g_fileQueue.getQueueL();
+		p_queue.reserve(l_queue.size());
+		for (auto i = l_queue.cbegin(); i != l_queue.cend(); ++i)
 		{
-			WLock(*QueueItem::g_cs);
+			const QueueItemPtr& qi = i->second;
+			if (qi->isFinished())
+				continue;
+			if (qi->isAnySet(QueueItem::FLAG_USER_LIST | QueueItem::FLAG_USER_GET_IP))
+				continue;
+			p_queue.insert(std::make_pair(qi->getTTH(), qi));
+		}
+	}
+}
+
+void QueueManager::addListSources(std::vector<CFlyListMatch>& p_lists)
+{
+	bool l_is_found = false;
+	for (auto i = p_lists.begin(); i != p_lists.end(); ++i)
+	{
+		// a list may contain the same file many times
+		std::sort(i->m_items.begin(), i->m_items.end());
+		i->m_items.erase(std::unique(i->m_items.begin(), i->m_items.end()), i->m_items.end());
+		l_is_found |= !i->m_items.empty();
+	}
+	if (!l_is_found)
+		return;
+	{
+		WLock(*QueueItem::g_cs);
+		{
+			RLock(*FileQueue::g_csFQ);
+			const auto& l_queue = g_fileQueue.getQueueL();
+			for (auto i = p_lists.begin(); i != p_lists.end(); ++i)
 			{
-				RLock(*FileQueue::g_csFQ);
-				// [~] IRainman fix.
-				for (auto i = g_fileQueue.getQueueL().cbegin(); i != g_fileQueue.getQueueL().cend(); ++i)
+				for (auto j = i->m_items.cbegin(); j != i->m_items.cend(); ++j)
 				{
-					const QueueItemPtr& qi = i->second;
-					if (qi->isFinished())
-						continue;
-					if (qi->isAnySet(QueueItem::FLAG_USER_LIST | QueueItem::FLAG_USER_GET_IP))
-						continue;
-					const auto j = l_tthMap.find(qi->getTTH());
-					if (j != l_tthMap.end() && j->second->getSize() == qi->getSize()) // [!] IRainman fix.
+					const QueueItemPtr& qi = *j;
+					const auto l_queue_item = l_queue.find(qi->getTarget());
+					if (l_queue_item == l_queue.end() || l_queue_item->second != qi || qi->isFinished())
+						continue; // removed or finished while the lists were matched
+					try
 					{
-						try
-						{
-							addSourceL(qi, dl.getUser(), QueueItem::Source::FLAG_FILE_NOT_AVAILABLE);
-							matches++;
-						}
-						catch (const Exception&)
-						{
-							// Ignore...
-						}
+						addSourceL(qi, i->m_user, QueueItem::Source::FLAG_FILE_NOT_AVAILABLE);
+						i->m_count++;
+					}
+					catch (const Exception&)
+					{
+						// Ignore...
 					}
 				}
 			}
 		}
-		if (matches > 0)
+	}
+	for (auto i = p_lists.cbegin(); i != p_lists.cend(); ++i)
+	{
+		if (i->m_count > 0)
 		{
-			get_download_connection(dl.getUser());
+			get_download_connection(i->m_user);
 		}
 	}
-	return matches;
+}
+
+int QueueManager::matchListing(const DirectoryListing& dl) noexcept
+{
+	dcassert(dl.getUser()); // [!] IRainman fix: It makes no sense to check the file list on the presence of a file from our download queue if the user in the file list is empty!
+	
+	if (g_fileQueue.empty()) // [!] opt
+	{
+		return 0;
+	}
+	QueueTTHMap l_queue;
+	getQueueTTHMap(l_queue);
+	std::vector<CFlyListMatch> l_lists(1);
+	l_lists[0].m_user = dl.getUser();
+	matchDirectory(dl.getRoot(), l_queue, l_lists[0].m_items);
+	addListSources(l_lists);
+	return l_lists[0].m_count;
 }
 
 #ifdef FLYLINKDC_USE_DETECT_CHEATING
@@ -1635,25 +1683,118 @@ void QueueManager::FileListQueue::execute(const DirectoryListInfoPtr& list) // [
 }
 #endif
 
+/**
+ * Matches downloaded file lists: every thread takes the next list, reads its TTHs (from the binary cache
+ * when possible) and probes the queue snapshot. Nothing is locked until the sources are added.
+ */
+class CFlyListMatcherThread : public Thread
+{
+	public:
+		CFlyListMatcherThread(boost::atomic<size_t>& p_next, size_t p_count, const std::function<void(size_t)>& p_job) :
+			m_next(p_next), m_count(p_count), m_job(p_job)
+		{
+		}
+	private:
+		int run()
+		{
+			for (size_t i = m_next++; i < m_count && !ClientManager::isBeforeShutdown(); i = m_next++)
+			{
+				m_job(i);
+			}
+			return 0;
+		}
+		boost::atomic<size_t>& m_next;
+		const size_t m_count;
+		const std::function<void(size_t)>& m_job;
+};
+
 void QueueManager::ListMatcher::execute(const StringList& list) // [+] IRainman fix: moved form MainFrame to core.
 {
-	for (auto i = list.cbegin(); i != list.cend(); ++i)
+	if (list.empty() || g_fileQueue.empty())
+		return;
+	const uint64_t l_start = GET_TICK();
+	QueueTTHMap l_queue;
+	getQueueTTHMap(l_queue);
+	if (l_queue.empty())
+		return;
+	std::vector<CFlyListMatch> l_lists(list.size());
+	boost::atomic<size_t> l_cache_count(0);
+	const std::function<void(size_t)> l_job = [&](size_t i)
 	{
-		UserPtr u = DirectoryListing::getUserFromFilename(*i);
+		const UserPtr u = DirectoryListing::getUserFromFilename(list[i]);
 		if (!u)
-			continue;
-			
-		DirectoryListing dl(HintedUser(u, Util::emptyString));
+			return;
+		auto& l_matches = l_lists[i].m_items;
+		const DirectoryListing::TTHCallback l_match = [&](const TTHValue & p_tth, int64_t p_size)
+		{
+			matchTTH(l_queue, p_tth, p_size, l_matches);
+		};
 		try
 		{
-			dl.loadFile(*i);
-			dl.logMatchedFiles(u, QueueManager::getInstance()->matchListing(dl));
+			if (DirectoryListing::loadCacheTTH(list[i], l_match))
+			{
+				++l_cache_count;
+			}
+			else
+			{
+				DirectoryListing dl(HintedUser(u, Util::emptyString));
+				dl.loadFile(list[i]); // creates the cache for the next time
+				matchDirectory(dl.getRoot(), l_queue, l_matches);
+			}
+			l_lists[i].m_user = u;
 		}
 		catch (const Exception&)
 		{
 			//-V565
+			l_matches.clear();
+		}
+	};
+	
+	const size_t l_thread_count = std::min(list.size(), std::min(size_t(8), std::max(size_t(1), CompatibilityManager::getProcessorsCount())));
+	boost::atomic<size_t> l_next(0);
+	if (l_thread_count > 1)
+	{
+		std::vector<std::unique_ptr<CFlyListMatcherThread>> l_threads;
+		for (size_t i = 0; i < l_thread_count; ++i)
+		{
+			std::unique_ptr<CFlyListMatcherThread> l_thread(new CFlyListMatcherThread(l_next, list.size(), l_job));
+			try
+			{
+				l_thread->start(0, "QueueManager::ListMatcher");
+				l_threads.push_back(std::move(l_thread));
+			}
+			catch (const ThreadException& e)
+			{
+				LogManager::message("QueueManager::ListMatcher - " + e.getError());
+				break;
+			}
+		}
+		for (auto i = l_threads.cbegin(); i != l_threads.cend(); ++i)
+		{
+			(*i)->join();
+		}
+	}
+	// a single list or the threads could not be started - finish the rest here
+	for (size_t i = l_next++; i < list.size() && !ClientManager::isBeforeShutdown(); i = l_next++)
+	{
+		l_job(i);
+	}
+	if (ClientManager::isBeforeShutdown())
+		return;
+		
+	QueueManager::getInstance()->addListSources(l_lists);
+	for (auto i = l_lists.cbegin(); i != l_lists.cend(); ++i)
+	{
+		if (i->m_user)
+		{
+			DirectoryListing::logMatchedFiles(i->m_user, i->m_count);
 		}
 	}
+	LogManager::message("[ListMatcher] lists = " + Util::toString(list.size()) +
+	                    " (from cache = " + Util::toString(size_t(l_cache_count)) +
+	                    "), queue files = " + Util::toString(l_queue.size()) +
+	                    ", threads = " + Util::toString(l_thread_count) +
+	                    ", time = " + Util::toString(GET_TICK() - l_start) + " ms", true);
 }
 
 void QueueManager::QueueManagerWaiter::execute(const WaiterFile& p_currentFile) // [+] IRainman: auto pausing running downloads before moving.
@@ -1997,7 +2138,7 @@ void QueueManager::setFile(const DownloadPtr& d)
 	}
 }
 
-void QueueManager::moveFile(const string& p_source, const string& p_target)
+void QueueManager::moveFile(const string& p_source, const string& p_target, const std::shared_ptr<const TigerTree>& p_verified_tree /*= nullptr */)
 {
 #ifdef FLYLINKDC_USE_SHARED_FILE_CACHE
 	{
@@ -2008,29 +2149,46 @@ void QueueManager::moveFile(const string& p_source, const string& p_target)
 #endif
 	// TODO -       
 	File::ensureDirectory(p_target);
+	CFlyMoveTask l_task;
+	l_task.m_source = p_source;
+	l_task.m_target = p_target;
+	l_task.m_verified_tree = p_verified_tree;
 	if (File::getSize(p_source) > MOVER_LIMIT)
 	{
-		m_mover.moveFile(p_source, p_target);
+		m_mover.moveFile(l_task);
 	}
 	else
 	{
-		internalMoveFile(p_source, p_target);
+		internalMoveFile(l_task);
 	}
 }
 
-bool QueueManager::internalMoveFile(const string& p_source, const string& p_target)
+bool QueueManager::internalMoveFile(const CFlyMoveTask& p_task)
 {
+	const string& p_source = p_task.m_source;
+	const string& p_target = p_task.m_target;
 	CFlyLog l_log("[MoveFile]");
 	try
 	{
 #ifdef SSA_VIDEO_PREVIEW_FEATURE
 		getInstance()->fly_fire1(QueueManagerListener::TryFileMoving(), p_target);
 #endif
+		int64_t l_size = -1;
+		int64_t l_time_stamp = 0;
+		bool l_is_link = false;
+		if (p_task.m_verified_tree && !File::isExist(p_source, l_size, l_time_stamp, l_is_link))
+		{
+			l_size = -1;
+		}
 		l_log.log(p_source + ' ' + STRING(RENAMED_TO) + ' ' + p_target);
 		if (!File::renameFile(p_source, p_target))
 		{
 			SharedFileStream::delete_file(p_source);
 		}
+		else if (p_task.m_verified_tree && l_size == p_task.m_verified_tree->getFileSize())
+		{
+			addVerifiedFile(p_target, *p_task.m_verified_tree, l_time_stamp);
+		}
 		getInstance()->fly_fire1(QueueManagerListener::FileMoved(), p_target);
 		return true;
 	}
@@ -2056,9 +2214,46 @@ bool QueueManager::internalMoveFile(const string& p_source, const string& p_targ
 	return false;
 }
 
-void QueueManager::moveStuckFile(const QueueItemPtr& qi)
+std::shared_ptr<const TigerTree> QueueManager::getVerifiedTree(const QueueItemPtr& p_qi, const TigerTree& p_tree)
 {
-	moveFile(qi->getTempTarget(), qi->getTarget());
+	// the data left from the previous session could be damaged after it was checked (crash, changed temp file)
+	if (p_qi->m_is_restored_data || p_qi->getSize() <= 0)
+		return nullptr;
+	if (p_tree.getRoot() != p_qi->getTTH() || p_tree.getFileSize() != p_qi->getSize())
+		return nullptr;
+	if (p_qi->getSize() <= int64_t(MIN_BLOCK_SIZE))
+	{
+		// the root is the only leaf - the same tree the hasher makes
+		return std::make_shared<TigerTree>(p_qi->getSize(), TigerTree::getMaxBlockSize(p_qi->getSize()), p_qi->getTTH());
+	}
+	// a root-only tree of a large file (the source had no TTHL) has no leaves to share
+	if (p_tree.getBlockSize() > int64_t(TigerTree::getMaxBlockSize(p_qi->getSize())) ||
+	        p_tree.getLeaves().size() != TigerTree::calcBlocks(p_qi->getSize(), p_tree.getBlockSize()))
+		return nullptr;
+	return std::make_shared<TigerTree>(p_tree);
+}
+
+void QueueManager::addVerifiedFile(const string& p_target, const TigerTree& p_tree, int64_t p_time_stamp)
+{
+	if (!ShareManager::destinationShared(p_target))
+		return;
+	// the file must be the same one that was checked: rename keeps the write time, a copy to other volume too
+	int64_t l_size = -1;
+	int64_t l_time_stamp = 0;
+	bool l_is_link = false;
+	if (!File::isExist(p_target, l_size, l_time_stamp, l_is_link) || l_size != p_tree.getFileSize() || l_time_stamp != p_time_stamp)
+	{
+		LogManager::message("[MoveFile] " + p_target + " was changed after the download, it will be hashed");
+		return;
+	}
+	HashManager::getInstance()->addTree(p_target, l_time_stamp, p_tree, l_size);
+}
+
+void QueueManager::moveStuckFile(const QueueItemPtr& qi, const TigerTree& p_tree)
+{
+	// every block of the temp file has just been checked against the tree
+	qi->m_is_restored_data = false;
+	moveFile(qi->getTempTarget(), qi->getTarget(), getVerifiedTree(qi, p_tree));
 	{
 		if (qi->isFinished())
 		{
@@ -2271,7 +2466,7 @@ void QueueManager::putDownload(const string& p_path, DownloadPtr aDownload, bool
 								if (!q->isSet(Download::FLAG_USER_GET_IP))
 									// TODO !q->isSet(Download::FLAG_USER_CHECK)
 								{
-									moveFile(aDownload->getTempTarget(), p_path);
+									moveFile(aDownload->getTempTarget(), p_path, getVerifiedTree(q, aDownload->getTigerTree()));
 								}
 							}
 							SharedFileStream::cleanup();
@@ -2804,6 +2999,11 @@ void QueueManager::saveQueue(bool force /* = false*/) noexcept
 	if (!g_dirty && !force)
 		return;
 		
+	const uint64_t l_start_tick = GET_TICK();
+	// only the items changed since the last save are checked, not the whole queue
+	std::vector<QueueItemPtr> l_dirty_items;
+	QueueItem::swapDirtyList(l_dirty_items);
+	
 	CFlySegmentArray l_segment_array;
 	std::vector<QueueItemPtr> l_items;
 	{
@@ -2811,9 +3011,13 @@ void QueueManager::saveQueue(bool force /* = false*/) noexcept
 		{
 			{
 				RLock(*FileQueue::g_csFQ);
-				for (auto i = g_fileQueue.getQueueL().begin(); i != g_fileQueue.getQueueL().end(); ++i)
+				const auto& l_queue = g_fileQueue.getQueueL();
+				for (auto i = l_dirty_items.cbegin(); i != l_dirty_items.cend(); ++i)
 				{
-					auto& qi = i->second;
+					const auto& qi = *i;
+					const auto l_queue_item = l_queue.find(qi->getTarget());
+					if (l_queue_item == l_queue.end() || l_queue_item->second != qi)
+						continue; // removed from the queue
 					if (!qi->isAnySet(QueueItem::FLAG_USER_LIST | QueueItem::FLAG_USER_GET_IP))
 					{
 						if (qi->getFlyQueueID() &&
@@ -2850,6 +3054,13 @@ void QueueManager::saveQueue(bool force /* = false*/) noexcept
 #endif
 				CFlylinkDBManager::getInstance()->merge_queue_all_items(l_items);
 			}
+			for (auto i = l_items.cbegin(); i != l_items.cend(); ++i)
+			{
+				if ((*i)->isDirtyAll())
+				{
+					(*i)->addToDirtyList(); // not stored - try again next time
+				}
+			}
 		}
 	}
 	//     +  -       
@@ -2880,6 +3091,14 @@ void QueueManager::saveQueue(bool force /* = false*/) noexcept
 	// Put this here to avoid very many saves tries when disk is full...
 	g_lastSave = GET_TICK();
 	g_dirty = false; // [+] IRainman fix.
+	const uint64_t l_save_time = g_lastSave - l_start_tick;
+	if (l_save_time > 100)
+	{
+		LogManager::message("[Save queue] checked: " + Util::toString(l_dirty_items.size()) +
+		                    " items: " + Util::toString(l_items.size()) +
+		                    " segments: " + Util::toString(l_segment_array.size()) +
+		                    " time: " + Util::toString(l_save_time) + " ms", true);
+	}
 }
 
 class QueueLoader : public SimpleXMLReader::CallBack
@@ -2981,6 +3200,7 @@ void QueueLoader::startTag(const string& name, StringPairList& attribs, bool sim
 					{
 						qi->addSegment(Segment(0, downloaded));
 					}
+					qi->m_is_restored_data = true;
 					qi->setPriority(qi->calculateAutoPriority());
 				}
 				
@@ -3002,6 +3222,7 @@ void QueueLoader::startTag(const string& name, StringPairList& attribs, bool sim
 				{
 					m_cur->addSegment(Segment(start, size));
 				}
+				m_cur->m_is_restored_data = true;
 				m_cur->setPriority(m_cur->calculateAutoPriority());
 			}
 		}
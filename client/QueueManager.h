@@ -186,8 +186,31 @@ class QueueManager : public Singleton<QueueManager>,
 		                  
 		int matchListing(const DirectoryListing& dl) noexcept;
 	private:
-		typedef boost::unordered_map<TTHValue, const DirectoryListing::File*> TTHMap;
-		static void buildMap(const DirectoryListing::Directory* dir, TTHMap& tthMap) noexcept;
+		// read-only snapshot of the queued files shared by all list matching threads
+		typedef boost::unordered_multimap<TTHValue, QueueItemPtr> QueueTTHMap;
+		struct CFlyListMatch
+		{
+			UserPtr m_user;
+			std::vector<QueueItemPtr> m_items;
+			int m_count;
+			CFlyListMatch() : m_count(0)
+			{
+			}
+		};
+		static void getQueueTTHMap(QueueTTHMap& p_queue);
+		static void matchTTH(const QueueTTHMap& p_queue, const TTHValue& p_tth, int64_t p_size, std::vector<QueueItemPtr>& p_matches)
+		{
+			const auto l_range = p_queue.equal_range(p_tth);
+			for (auto i = l_range.first; i != l_range.second; ++i)
+			{
+				if (i->second->getSize() == p_size)
+				{
+					p_matches.push_back(i->second);
+				}
+			}
+		}
+		static void matchDirectory(const DirectoryListing::Directory* dir, const QueueTTHMap& p_queue, std::vector<QueueItemPtr>& p_matches) noexcept;
+		void addListSources(std::vector<CFlyListMatch>& p_lists);
 		void fire_remove_internal(const QueueItemPtr& p_qi, bool p_is_remove_item, bool p_is_force_remove_item, bool p_is_batch_remove);
 	public:
 		void fire_remove_batch();
@@ -278,20 +301,26 @@ class QueueManager : public Singleton<QueueManager>,
 		StringList m_remove_target_array;
 		
 		enum { MOVER_LIMIT = 10 * 1024 * 1024 };
-		class FileMover : public BackgroundTaskExecuter<pair<string, string>> // [!] IRainman core.
+		struct CFlyMoveTask
+		{
+			string m_source;
+			string m_target;
+			std::shared_ptr<const TigerTree> m_verified_tree; // every block of the file was checked against it, null - unknown
+		};
+		class FileMover : public BackgroundTaskExecuter<CFlyMoveTask> // [!] IRainman core.
 		{
 			public:
 				explicit FileMover() { }
 				~FileMover() { }
 				
-				void moveFile(const string& source, const string& p_target)
+				void moveFile(const CFlyMoveTask& p_task)
 				{
-					addTask(make_pair(source, p_target));
+					addTask(p_task);
 				}
 			private:
-				void execute(const pair<string, string>& p_next)
+				void execute(const CFlyMoveTask& p_next)
 				{
-					internalMoveFile(p_next.first, p_next.second);
+					internalMoveFile(p_next);
 				}
 		} m_mover;
 		
@@ -462,9 +491,11 @@ class QueueManager : public Singleton<QueueManager>,
 		void processList(const string& name, const HintedUser& hintedUser, int flags);
 		
 		void load(const SimpleXML& aXml);
-		void moveFile(const string& source, const string& p_target);
-		static bool internalMoveFile(const string& source, const string& p_target);
-		void moveStuckFile(const QueueItemPtr& qi); // [!] IRainman fix.
+		void moveFile(const string& source, const string& p_target, const std::shared_ptr<const TigerTree>& p_verified_tree = nullptr);
+		static bool internalMoveFile(const CFlyMoveTask& p_task);
+		static std::shared_ptr<const TigerTree> getVerifiedTree(const QueueItemPtr& p_qi, const TigerTree& p_tree);
+		static void addVerifiedFile(const string& p_target, const TigerTree& p_tree, int64_t p_time_stamp);
+		void moveStuckFile(const QueueItemPtr& qi, const TigerTree& p_tree); // [!] IRainman fix.
 		void rechecked(const QueueItemPtr& qi); // [!] IRainman fix.
 		
 		static void setDirty();
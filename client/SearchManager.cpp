@@ -24,10 +24,14 @@
 #include "StringTokenizer.h"
 #include "FinishedManager.h"
 #include "DebugManager.h"
+#include "CompatibilityManager.h"
+#include "CFlyUdpBatchReader.h"
 #include "../FlyFeatures/flyServer.h"
 
 
 uint16_t SearchManager::g_search_port = 0;
+boost::atomic<uint32_t> SearchManager::g_dropped_results(0);
+boost::atomic<uint32_t> SearchManager::g_duplicate_results(0);
 
 const char* SearchManager::getTypeStr(Search::TypeModes type)
 {
@@ -52,11 +56,12 @@ const char* SearchManager::getTypeStr(Search::TypeModes type)
 SearchManager::SearchManager() :
 	m_stop(false)
 {
-
+	TimerManager::getInstance()->addListener(this);
 }
 
 SearchManager::~SearchManager()
 {
+	TimerManager::getInstance()->removeListener(this);
 	if (socket.get())
 	{
 		m_stop = true;
@@ -122,11 +127,12 @@ void SearchManager::disconnect()
 	if (socket.get())
 	{
 		m_stop = true;
-		m_queue_thread.shutdown();
 		socket->disconnect();
 		g_search_port = 0;
 		
 		join();
+		// the receive loop has stopped - nothing is added to the queue after this
+		m_queue_thread.shutdown();
 		
 		socket.reset();
 		
@@ -134,13 +140,12 @@ void SearchManager::disconnect()
 	}
 }
 
-#define BUFSIZE 8192
 int SearchManager::run()
 {
-	std::unique_ptr<uint8_t[]> buf(new uint8_t[BUFSIZE]);
-	int len;
-	sockaddr_in remoteAddr = { 0 };
-	m_queue_thread.start(0);
+	std::unique_ptr<uint8_t[]> buf(new uint8_t[CFlyUdpBatchReader::BUF_SIZE]);
+	UdpPacketList l_batch;
+	l_batch.reserve(CFlyUdpBatchReader::BATCH_SIZE);
+	m_queue_thread.start();
 	while (!m_stop)
 	{
 		try
@@ -153,15 +158,17 @@ int SearchManager::run()
 				{
 					continue; // [merge] https://github.com/eiskaltdcpp/eiskaltdcpp/commit/c8dcf444d17fffacb6797d14a57b102d653896d0
 				}
-				if (m_stop || (len = socket->read(&buf[0], BUFSIZE, remoteAddr)) <= 0)
+				// drain everything the socket already has and hand it over to the parsers in one go
+				const bool l_is_error = !CFlyUdpBatchReader::drain(*socket, buf.get(), m_stop, [&](const uint8_t* p_data, int p_len, const sockaddr_in & p_from)
+				{
+					UdpPacket l_packet;
+					l_packet.m_data.assign(reinterpret_cast<const char*>(p_data), p_len);
+					l_packet.m_ip4 = boost::asio::ip::address_v4(ntohl(p_from.sin_addr.S_un.S_addr));
+					l_batch.push_back(std::move(l_packet));
+				});
+				m_queue_thread.addResults(l_batch);
+				if (l_is_error || m_stop)
 					break;
-				const boost::asio::ip::address_v4 l_ip4(ntohl(remoteAddr.sin_addr.S_un.S_addr));
-#ifdef _DEBUG
-				const string l_ip1 = l_ip4.to_string();
-				const string l_ip2 = inet_ntoa(remoteAddr.sin_addr);
-				dcassert(l_ip1 == l_ip2);
-#endif
-				onData(&buf[0], len, l_ip4);
 			}
 		}
 		catch (const SocketException& e)
@@ -208,287 +215,342 @@ int SearchManager::run()
 	return 0;
 }
 
-int SearchManager::UdpQueue::run()
+int SearchManager::UdpQueue::Parser::run()
 {
-	string x;
-	boost::asio::ip::address_v4 remoteIp;
-	m_is_stop = false;
-	
+	UdpPacket l_packet;
 	while (true)
 	{
-		m_search_semaphore.wait();
-		if (m_is_stop)
+		m_queue.m_search_semaphore.wait();
+		if (m_queue.m_is_stop)
 			break;
-			
+		if (!m_queue.m_packets.pop(l_packet))
+			continue;
+		parse(l_packet.m_data, l_packet.m_ip4, m_buffers);
+	}
+	return 0;
+}
+
+void SearchManager::UdpQueue::start()
+{
+	dcassert(m_parsers.empty());
+	m_is_stop = false;
+	const size_t l_count = std::max(size_t(1), std::min(size_t(MAX_PARSERS), CompatibilityManager::getProcessorsCount() / 2));
+	for (size_t i = 0; i < l_count; ++i)
+	{
+		std::unique_ptr<Parser> l_parser(new Parser(*this));
+		l_parser->start(0, "SearchManager::UdpQueue");
+		m_parsers.push_back(std::move(l_parser));
+	}
+}
+
+void SearchManager::UdpQueue::shutdown()
+{
+	m_is_stop = true;
+	if (!m_parsers.empty())
+	{
+		m_search_semaphore.signal(long(m_parsers.size()));
+		for (auto i = m_parsers.cbegin(); i != m_parsers.cend(); ++i)
 		{
-			CFlyFastLock(m_cs);
-			if (m_resultList.empty()) continue;
-			
-			x = m_resultList.front().first;
-			remoteIp = m_resultList.front().second;
-			m_resultList.pop_front();
+			(*i)->join();
 		}
-		dcassert(x.length() > 4);
-		if (x.length() <= 4)
+		m_parsers.clear();
+	}
+	UdpPacket l_packet;
+	while (m_packets.pop(l_packet))
+	{
+	}
+}
+
+void SearchManager::UdpQueue::addResults(UdpPacketList& p_packets)
+{
+	long l_count = 0;
+	for (auto i = p_packets.begin(); i != p_packets.end(); ++i)
+	{
+		if (m_packets.push(std::move(*i)))
+			++l_count;
+		else
+			++g_dropped_results;
+	}
+	p_packets.clear();
+	if (l_count)
+	{
+		m_search_semaphore.signal(l_count);
+	}
+}
+
+void SearchManager::UdpQueue::parse(const string& x, const boost::asio::ip::address_v4& remoteIp, ParseBuffers& p_buffers)
+{
+	dcassert(x.length() > 4);
+	if (x.length() <= 4)
+	{
+		dcassert(0);
+		return;
+	}
+	try
+	{
+		if (x.compare(0, 4, "$SR ", 4) == 0)
 		{
-			dcassert(0);
-			continue;
-		}
-		try {
-			if (x.compare(0, 4, "$SR ", 4) == 0)
+			string::size_type i = 4;
+			string::size_type j;
+			// Directories: $SR <nick><0x20><directory><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
+			// Files:       $SR <nick><0x20><filename><0x05><filesize><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
+			if ((j = x.find(' ', i)) == string::npos)
 			{
-				string::size_type i = 4;
-				string::size_type j;
-				// Directories: $SR <nick><0x20><directory><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
-				// Files:       $SR <nick><0x20><filename><0x05><filesize><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
-				if ((j = x.find(' ', i)) == string::npos)
-				{
-					continue;
-				}
-				string nick = x.substr(i, j - i);
-				i = j + 1;
-				
-				// A file has 2 0x05, a directory only one
-				// const size_t cnt = count(x.begin() + j, x.end(), 0x05);
-				// C    2-.   
-				const auto l_find_05_first = x.find(0x05, j);
-				dcassert(l_find_05_first != string::npos);
-				if (l_find_05_first == string::npos)
-					continue;
-				const auto l_find_05_second = x.find(0x05, l_find_05_first + 1);
-				SearchResult::Types type = SearchResult::TYPE_FILE;
-				string file;
-				int64_t size = 0;
-				
-				if (l_find_05_first != string::npos && l_find_05_second == string::npos) // cnt == 1
-				{
-					// We have a directory...find the first space beyond the first 0x05 from the back
-					// (dirs might contain spaces as well...clever protocol, eh?)
-					type = SearchResult::TYPE_DIRECTORY;
-					// Get past the hubname that might contain spaces
-					j = l_find_05_first;
-					// Find the end of the directory info
-					if ((j = x.rfind(' ', j - 1)) == string::npos)
-					{
-						continue;
-					}
-					if (j < i + 1)
-					{
-						continue;
-					}
-					file = x.substr(i, j - i) + '\\';
-				}
-				else if (l_find_05_first != string::npos && l_find_05_second != string::npos) // cnt == 2
-				{
-					j = l_find_05_first;
-					file = x.substr(i, j - i);
-					i = j + 1;
-					if ((j = x.find(' ', i)) == string::npos)
-					{
-						continue;
-					}
-					size = Util::toInt64(x.substr(i, j - i));
-				}
-				i = j + 1;
-				
-				if ((j = x.find('/', i)) == string::npos)
+				return;
+			}
+			// the fields are sliced by offsets into the datagram, the strings are reused buffers of the parser thread
+			string& nick = p_buffers.m_nick;
+			nick.assign(x, i, j - i);
+			i = j + 1;
+			
+			// A file has 2 0x05, a directory only one
+			// const size_t cnt = count(x.begin() + j, x.end(), 0x05);
+			// C    2-.   
+			const auto l_find_05_first = x.find(0x05, j);
+			dcassert(l_find_05_first != string::npos);
+			if (l_find_05_first == string::npos)
+				return;
+			const auto l_find_05_second = x.find(0x05, l_find_05_first + 1);
+			SearchResult::Types type = SearchResult::TYPE_FILE;
+			string& file = p_buffers.m_file;
+			file.clear();
+			int64_t size = 0;
+			
+			if (l_find_05_first != string::npos && l_find_05_second == string::npos) // cnt == 1
+			{
+				// We have a directory...find the first space beyond the first 0x05 from the back
+				// (dirs might contain spaces as well...clever protocol, eh?)
+				type = SearchResult::TYPE_DIRECTORY;
+				// Get past the hubname that might contain spaces
+				j = l_find_05_first;
+				// Find the end of the directory info
+				if ((j = x.rfind(' ', j - 1)) == string::npos)
 				{
-					continue;
+					return;
 				}
-				uint8_t freeSlots = (uint8_t)Util::toInt(x.substr(i, j - i));
-				i = j + 1;
-				if ((j = x.find((char)5, i)) == string::npos)
+				if (j < i + 1)
 				{
-					continue;
+					return;
 				}
-				uint8_t slots = (uint8_t)Util::toInt(x.substr(i, j - i));
+				file.assign(x, i, j - i);
+				file += '\\';
+			}
+			else if (l_find_05_first != string::npos && l_find_05_second != string::npos) // cnt == 2
+			{
+				j = l_find_05_first;
+				file.assign(x, i, j - i);
 				i = j + 1;
-				if ((j = x.rfind(" (")) == string::npos)
-				{
-					continue;
-				}
-				string l_hub_name_or_tth = x.substr(i, j - i);
-				i = j + 2;
-				if ((j = x.rfind(')')) == string::npos)
+				if ((j = x.find(' ', i)) == string::npos)
 				{
-					continue;
+					return;
 				}
-				
-				const string hubIpPort = x.substr(i, j - i);
-				const string url = ClientManager::findHub(hubIpPort); // TODO -   . 
-				//   IP   "$SR chen video\multfilm\, !\, ! 2.avi33492992 5/5TTH:B4O5M74UPKZ7I23CH36NA3SZOUZTJLWNVEIJMTQ (dc.a-galaxy.com:411)|"
-				//      - .
-				//  dc.dly-server.ru -   IP- "31.186.103.125:411"
-				// url   https://www.box.net/shared/ayirspvdjk2boix4oetr
-				//   dcassert    findHubEncoding.
-				// [!] IRainman fix:  !!!!   !!!
-				// [-] string encoding;
-				// [-] if (!url.empty())
-				const string l_encoding = ClientManager::findHubEncoding(url); // [!]
-				// [~]
-				nick = Text::toUtf8(nick, l_encoding);
-				file = Text::toUtf8(file, l_encoding);
-				const bool l_isTTH = isTTHBase64(l_hub_name_or_tth);
-				if (!l_isTTH) // [+]FlylinkDC++ Team
-					l_hub_name_or_tth = Text::toUtf8(l_hub_name_or_tth, l_encoding);
-					
-				UserPtr user = ClientManager::findUser(nick, url); // TODO  makeCID
-				//    "$SR snooper-06 \   -.avi1565253632 15/15TTH:LUWOOXBE2H77TUV4S4HNZQTVDXLPEYC757OUMLY (31.186.103.125:411)"
-				//   url -    ClientManager::findUser -  .
-				//     ClientManager::findLegacyUser
-				// url        SOCKS5
-				// TODO -     -   ?
+				size = Util::toInt64(x.c_str() + i); // digits are terminated by ' '
+			}
+			i = j + 1;
+			
+			if ((j = x.find('/', i)) == string::npos)
+			{
+				return;
+			}
+			uint8_t freeSlots = (uint8_t)Util::toInt(x.c_str() + i); // digits are terminated by '/'
+			i = j + 1;
+			if ((j = x.find((char)5, i)) == string::npos)
+			{
+				return;
+			}
+			uint8_t slots = (uint8_t)Util::toInt(x.c_str() + i); // digits are terminated by 0x05
+			i = j + 1;
+			if ((j = x.rfind(" (")) == string::npos)
+			{
+				return;
+			}
+			// <Hubname> or TTH:<base32> - only the TTH is used
+			const string::size_type l_tth_pos = i;
+			const bool l_isTTH = j - i == 43 && x.compare(i, 4, g_tth) == 0;
+			i = j + 2;
+			if ((j = x.rfind(')')) == string::npos)
+			{
+				return;
+			}
+			
+			string& hubIpPort = p_buffers.m_hub_ip_port;
+			hubIpPort.assign(x, i, j - i);
+			const string url = ClientManager::findHub(hubIpPort); // TODO -   . 
+			//   IP   "$SR chen video\multfilm\, !\, ! 2.avi33492992 5/5TTH:B4O5M74UPKZ7I23CH36NA3SZOUZTJLWNVEIJMTQ (dc.a-galaxy.com:411)|"
+			//      - .
+			//  dc.dly-server.ru -   IP- "31.186.103.125:411"
+			// url   https://www.box.net/shared/ayirspvdjk2boix4oetr
+			//   dcassert    findHubEncoding.
+			// [!] IRainman fix:  !!!!   !!!
+			// [-] string encoding;
+			// [-] if (!url.empty())
+			const string l_encoding = ClientManager::findHubEncoding(url); // [!]
+			// [~]
+			// no conversion (and no copy) for UTF-8 hubs
+			const string& l_nick = Text::toUtf8(nick, l_encoding, p_buffers.m_nick_utf8);
+			const string& l_file = Text::toUtf8(file, l_encoding, p_buffers.m_file_utf8);
+			
+			UserPtr user = ClientManager::findUser(l_nick, url); // TODO  makeCID
+			//    "$SR snooper-06 \   -.avi1565253632 15/15TTH:LUWOOXBE2H77TUV4S4HNZQTVDXLPEYC757OUMLY (31.186.103.125:411)"
+			//   url -    ClientManager::findUser -  .
+			//     ClientManager::findLegacyUser
+			// url        SOCKS5
+			// TODO -     -   ?
+			if (!user)
+			{
+				// LogManager::message("Error ClientManager::findUser nick = " + nick + " url = " + url);
+				// Could happen if hub has multiple URLs / IPs
+				user = ClientManager::findLegacyUser(l_nick, url);
 				if (!user)
 				{
-					// LogManager::message("Error ClientManager::findUser nick = " + nick + " url = " + url);
-					// Could happen if hub has multiple URLs / IPs
-					user = ClientManager::findLegacyUser(nick, url);
-					if (!user)
-					{
-						//LogManager::message("Error ClientManager::findLegacyUser nick = " + nick + " url = " + url);
-						continue;
-					}
+					//LogManager::message("Error ClientManager::findLegacyUser nick = " + nick + " url = " + url);
+					return;
 				}
-				if (!remoteIp.is_unspecified())
-				{
-					user->setIP(remoteIp, true);
+			}
+			if (!remoteIp.is_unspecified())
+			{
+				user->setIP(remoteIp, true);
 #ifdef _DEBUG
-					//ClientManager::setIPUser(user, remoteIp); // TODO -    ?
+				//ClientManager::setIPUser(user, remoteIp); // TODO -    ?
 #endif
-					//      -    IP   ?
-				}
-				string tth;
-				if (l_isTTH)
-				{
-					tth = l_hub_name_or_tth.substr(4);
-				}
-				if (tth.empty() && type == SearchResult::TYPE_FILE)
-				{
-					dcassert(tth.empty() && type == SearchResult::TYPE_FILE);
-					continue;
-				}
-				
-				const TTHValue l_tth_value(tth);
-				auto sr = std::make_unique<SearchResult>(user, type, slots, freeSlots, size, file, Util::emptyString, url, remoteIp, l_tth_value, -1 /*0 == auto*/);
-				COMMAND_DEBUG("[Search-result] url = " + url + " remoteIp = " + remoteIp.to_string() + " file = " + file + " user = " + user->getLastNick(), DebugTask::CLIENT_IN, remoteIp.to_string());
-				SearchManager::getInstance()->fly_fire1(SearchManagerListener::SR(), sr);
+				//      -    IP   ?
+			}
+			if (!l_isTTH && type == SearchResult::TYPE_FILE)
+			{
+				return;
+			}
+			
+			// decoded straight from the datagram
+			TTHValue l_tth_value;
+			if (l_isTTH)
+			{
+				Encoder::fromBase32(x.c_str() + l_tth_pos + 4, l_tth_value.data, TTHValue::BYTES);
+			}
+			auto sr = std::make_unique<SearchResult>(user, type, slots, freeSlots, size, l_file, Util::emptyString, url, remoteIp, l_tth_value, -1 /*0 == auto*/);
+			COMMAND_DEBUG("[Search-result] url = " + url + " remoteIp = " + remoteIp.to_string() + " file = " + l_file + " user = " + user->getLastNick(), DebugTask::CLIENT_IN, remoteIp.to_string());
+			SearchManager::getInstance()->fireSearchResult(sr);
 #ifdef FLYLINKDC_USE_COLLECT_STAT
-				CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "$SR", x, remoteIp, "", url, tth);
+			CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "$SR", x, remoteIp, "", url, l_tth_value.toBase32());
 #endif
-			}
-			else if (x.compare(1, 4, "RES ", 4) == 0 && x[x.length() - 1] == 0x0a)
+		}
+		else if (x.compare(1, 4, "RES ", 4) == 0 && x[x.length() - 1] == 0x0a)
+		{
+			const AdcCommand c(x.substr(0, x.length() - 1));
+			if (c.getParamCount() == 0)
+				return;
+			const auto cid = c.getParamView(0);
+			if (cid.size() != 39)
 			{
-				AdcCommand c(x.substr(0, x.length() - 1));
-				if (c.getParameters().empty())
-					continue;
-				const string cid = c.getParam(0);
-				if (cid.size() != 39)
-				{
-					dcassert(0);
-					continue;
-				}
-				UserPtr user = ClientManager::findUser(CID(cid));
-				if (!user)
-					continue;
-					
-				// This should be handled by AdcCommand really...
-				c.getParameters().erase(c.getParameters().begin());
+				dcassert(0);
+				return;
+			}
+			UserPtr user = ClientManager::findUser(CID(cid.str()));
+			if (!user)
+				return;
 				
-				SearchManager::getInstance()->onRES(c, user, remoteIp);
+			// the first parameter is the CID - the handler skips it
+			SearchManager::getInstance()->onRES(c, user, remoteIp, 1);
 #ifdef FLYLINKDC_USE_COLLECT_STAT
-				CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "RES", x, remoteIp, "", "", "");
+			CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "RES", x, remoteIp, "", "", "");
 #endif
-			}
-			else if (x.compare(1, 4, "PSR ", 4) == 0 && x[x.length() - 1] == 0x0a)
-			{
-				AdcCommand c(x.substr(0, x.length() - 1));
-				if (c.getParameters().empty())
-					continue;
-				const string cid = c.getParam(0);
-				if (cid.size() != 39)
-					continue;
-					
-				const UserPtr user = ClientManager::findUser(CID(cid));
-				// when user == NULL then it is probably NMDC user, check it later
+		}
+		else if (x.compare(1, 4, "PSR ", 4) == 0 && x[x.length() - 1] == 0x0a)
+		{
+			const AdcCommand c(x.substr(0, x.length() - 1));
+			if (c.getParamCount() == 0)
+				return;
+			const auto cid = c.getParamView(0);
+			if (cid.size() != 39)
+				return;
 				
-				if (user)
-				{
-					c.getParameters().erase(c.getParameters().begin());
-					SearchManager::getInstance()->onPSR(c, user, remoteIp);
+			const UserPtr user = ClientManager::findUser(CID(cid.str()));
+			// when user == NULL then it is probably NMDC user, check it later
+			
+			if (user)
+			{
+				SearchManager::getInstance()->onPSR(c, user, remoteIp, 1);
 #ifdef FLYLINKDC_USE_COLLECT_STAT
-					CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "PSR", x, remoteIp, "", "", "");
+				CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "PSR", x, remoteIp, "", "", "");
 #endif
-				}
 			}
-			else if (x.compare(0, 15, "$FLY-TEST-PORT ", 15) == 0)
+		}
+		else if (x.compare(0, 15, "$FLY-TEST-PORT ", 15) == 0)
+		{
+			//dcassert(SettingsManager::g_TestUDPSearchLevel <= 1);
+			const auto l_magic = x.substr(15, 39);
+			if (ClientManager::getMyCID().toBase32() == l_magic)
 			{
-				//dcassert(SettingsManager::g_TestUDPSearchLevel <= 1);
-				const auto l_magic = x.substr(15, 39);
-				if (ClientManager::getMyCID().toBase32() == l_magic)
+				LogManager::message("Test UDP port - OK!");
+				SettingsManager::g_TestUDPSearchLevel = CFlyServerJSON::setTestPortOK(SETTING(UDP_PORT), "udp");
+				auto l_ip = x.substr(15 + 39);
+				if (l_ip.size() && l_ip[l_ip.size() - 1] == '|')
 				{
-					LogManager::message("Test UDP port - OK!");
-					SettingsManager::g_TestUDPSearchLevel = CFlyServerJSON::setTestPortOK(SETTING(UDP_PORT), "udp");
-					auto l_ip = x.substr(15 + 39);
-					if (l_ip.size() && l_ip[l_ip.size() - 1] == '|')
-					{
-						l_ip = l_ip.substr(0, l_ip.size() - 1);
-					}
-					SettingsManager::g_UDPTestExternalIP = l_ip;
-				}
-				else
-				{
-					SettingsManager::g_TestUDPSearchLevel = false;
-					CFlyServerJSON::pushError(57, "UDP Error magic value = " + l_magic);
+					l_ip = l_ip.substr(0, l_ip.size() - 1);
 				}
+				SettingsManager::g_UDPTestExternalIP = l_ip;
 			}
 			else
 			{
-				// ADC commands must end with \n
-				if (x[x.length() - 1] != 0x0a) {
-					dcassert(0);
-					dcdebug("Invalid UDP data received: %s (no newline)\n", x.c_str());
-					CFlyServerJSON::pushError(88, "[UDP]Invalid UDP data received: %s (no newline): ip = " + remoteIp.to_string() + " x = [" + x + "]");
-					continue;
-				}
-				
-				if (!Text::validateUtf8(x)) {
-					dcassert(0);
-					dcdebug("UTF-8 valition failed for received UDP data: %s\n", x.c_str());
-					CFlyServerJSON::pushError(87, "[UDP]UTF-8 valition failed for received UDP data: ip = " + remoteIp.to_string() + " x = [" + x + "]");
-					continue;
-				}
-				// TODO  respond(AdcCommand(x.substr(0, x.length()-1)));
-				
+				SettingsManager::g_TestUDPSearchLevel = false;
+				CFlyServerJSON::pushError(57, "UDP Error magic value = " + l_magic);
 			}
 		}
-		catch (const ParseException& e)
+		else
 		{
-			dcassert(0);
-			CFlyServerJSON::pushError(86, "[UDP][ParseException]:" + e.getError() + " ip = " + remoteIp.to_string() + " x = [" + x + "]");
+			// ADC commands must end with \n
+			if (x[x.length() - 1] != 0x0a) {
+				dcassert(0);
+				dcdebug("Invalid UDP data received: %s (no newline)\n", x.c_str());
+				CFlyServerJSON::pushError(88, "[UDP]Invalid UDP data received: %s (no newline): ip = " + remoteIp.to_string() + " x = [" + x + "]");
+				return;
+			}
+			
+			if (!Text::validateUtf8(x)) {
+				dcassert(0);
+				dcdebug("UTF-8 valition failed for received UDP data: %s\n", x.c_str());
+				CFlyServerJSON::pushError(87, "[UDP]UTF-8 valition failed for received UDP data: ip = " + remoteIp.to_string() + " x = [" + x + "]");
+				return;
+			}
+			// TODO  respond(AdcCommand(x.substr(0, x.length()-1)));
+			
 		}
-		
-		sleep(2);
 	}
-	return 0;
-}
-
-void SearchManager::onData(const std::string& p_line)
-{
-	m_queue_thread.addResult(p_line, boost::asio::ip::address_v4());
+	catch (const ParseException& e)
+	{
+		dcassert(0);
+		CFlyServerJSON::pushError(86, "[UDP][ParseException]:" + e.getError() + " ip = " + remoteIp.to_string() + " x = [" + x + "]");
+	}
 }
 
-void SearchManager::onData(const uint8_t* buf, size_t aLen, const boost::asio::ip::address_v4& remoteIp)
+void SearchManager::fireSearchResult(const std::unique_ptr<SearchResult>& p_sr)
 {
-	if (aLen > 4)
+	// the same result comes once per hub the user shares with us - let the listeners see it once per search
+	if (p_sr->getType() != SearchResult::TYPE_FILE ||
+	        m_aggregator.add(p_sr->getToken(), p_sr->getTTH(), p_sr->getUser()->getCID(), p_sr->getFile(), p_sr->getSize(), p_sr->getFreeSlots(), GET_TICK()))
 	{
-		string x((char*)buf, aLen);
-		m_queue_thread.addResult(x, remoteIp);
+		fly_fire1(SearchManagerListener::SR(), p_sr);
 	}
 	else
 	{
-		dcassert(0);
+		++g_duplicate_results;
+	}
+}
+
+void SearchManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept
+{
+	CFlySearchResultAggregator::DeltaList l_deltas;
+	m_aggregator.flush(aTick, l_deltas);
+	for (auto i = l_deltas.cbegin(); i != l_deltas.cend(); ++i)
+	{
+		fly_fire2(SearchManagerListener::SRGroups(), i->first, i->second);
 	}
 }
+
+void SearchManager::onData(const std::string& p_line)
+{
+	m_queue_thread.addResult(p_line, boost::asio::ip::address_v4());
+}
+
 void SearchManager::search_auto(const string& p_tth)
 {
 	SearchParamOwner l_search_param;
@@ -507,7 +569,7 @@ void SearchManager::search_auto(const string& p_tth)
 	ClientManager::search(l_search_param);
 }
 
-void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const boost::asio::ip::address_v4& p_remoteIp)
+void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const boost::asio::ip::address_v4& p_remoteIp, size_t p_start /* = 0 */)
 {
 	int freeSlots = -1;
 	int64_t size = -1;
@@ -515,28 +577,29 @@ void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const boos
 	string tth;
 	uint32_t l_token = -1; // 0 == auto
 	
-	for (auto i = cmd.getParameters().cbegin(); i != cmd.getParameters().cend(); ++i)
+	const size_t l_count = cmd.getParamCount();
+	for (size_t i = p_start; i < l_count; ++i)
 	{
-		const string& str = *i;
-		if (str.compare(0, 2, "FN", 2) == 0)
+		const AdcCommand::ParamView str = cmd.getParamView(i);
+		if (str.isCode("FN"))
 		{
 			file = Util::toNmdcFile(str.substr(2));
 		}
-		else if (str.compare(0, 2, "SL", 2) == 0)
+		else if (str.isCode("SL"))
 		{
-			freeSlots = Util::toInt(str.substr(2));
+			freeSlots = Util::toInt(str.c_str() + 2);
 		}
-		else if (str.compare(0, 2, "SI", 2) == 0)
+		else if (str.isCode("SI"))
 		{
-			size = Util::toInt64(str.substr(2));
+			size = Util::toInt64(str.c_str() + 2);
 		}
-		else if (str.compare(0, 2, "TR", 2) == 0)
+		else if (str.isCode("TR"))
 		{
 			tth = str.substr(2);
 		}
-		else if (str.compare(0, 2, "TO", 2) == 0)
+		else if (str.isCode("TO"))
 		{
-			l_token = Util::toUInt32(str.substr(2));
+			l_token = Util::toUInt32(str.c_str() + 2);
 			// dcassert(l_token);
 		}
 	}
@@ -556,11 +619,11 @@ void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const boos
 			
 		const uint8_t slots = ClientManager::getSlots(from->getCID());
 		auto sr = std::make_unique<SearchResult>(from, type, slots, (uint8_t)freeSlots, size, file, hubName, hub, p_remoteIp, TTHValue(tth), l_token);
-		fly_fire1(SearchManagerListener::SR(), sr);
+		fireSearchResult(sr);
 	}
 }
 
-void SearchManager::onPSR(const AdcCommand& p_cmd, UserPtr from, const boost::asio::ip::address_v4& remoteIp)
+void SearchManager::onPSR(const AdcCommand& p_cmd, UserPtr from, const boost::asio::ip::address_v4& remoteIp, size_t p_start /* = 0 */)
 {
 	uint16_t udpPort = 0;
 	uint32_t partialCount = 0;
@@ -569,30 +632,31 @@ void SearchManager::onPSR(const AdcCommand& p_cmd, UserPtr from, const boost::as
 	string nick;
 	PartsInfo partialInfo;
 	
-	for (auto i = p_cmd.getParameters().cbegin(); i != p_cmd.getParameters().cend(); ++i)
+	const size_t l_count = p_cmd.getParamCount();
+	for (size_t i = p_start; i < l_count; ++i)
 	{
-		const string& str = *i;
-		if (str.compare(0, 2, "U4", 2) == 0)
+		const AdcCommand::ParamView str = p_cmd.getParamView(i);
+		if (str.isCode("U4"))
 		{
-			udpPort = static_cast<uint16_t>(Util::toInt(str.substr(2)));
+			udpPort = static_cast<uint16_t>(Util::toInt(str.c_str() + 2));
 		}
-		else if (str.compare(0, 2, "NI", 2) == 0)
+		else if (str.isCode("NI"))
 		{
 			nick = str.substr(2);
 		}
-		else if (str.compare(0, 2, "HI", 2) == 0)
+		else if (str.isCode("HI"))
 		{
 			hubIpPort = str.substr(2);
 		}
-		else if (str.compare(0, 2, "TR", 2) == 0)
+		else if (str.isCode("TR"))
 		{
 			tth = str.substr(2);
 		}
-		else if (str.compare(0, 2, "PC", 2) == 0)
+		else if (str.isCode("PC"))
 		{
-			partialCount = Util::toUInt32(str.substr(2)) * 2;
+			partialCount = Util::toUInt32(str.c_str() + 2) * 2;
 		}
-		else if (str.compare(0, 2, "PI", 2) == 0)
+		else if (str.isCode("PI"))
 		{
 			const StringTokenizer<string> tok(str.substr(2), ',');
 			for (auto j = tok.getTokens().cbegin(); j != tok.getTokens().cend(); ++j)
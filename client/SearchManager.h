@@ -23,12 +23,15 @@
 #define DCPLUSPLUS_DCPP_SEARCH_MANAGER_H
 
 #include "CFlyThread.h"
+#include "CFlyBoundedQueue.h"
+#include "CFlySearchResultAggregator.h"
+#include "TimerManager.h"
 #include "StringSearch.h" // [+] IRainman
 #include "SearchManagerListener.h"
 #include "AdcCommand.h"
 #include "ClientManager.h"
 
-class SearchManager : public Speaker<SearchManagerListener>, public Singleton<SearchManager>, public Thread
+class SearchManager : public Speaker<SearchManagerListener>, public Singleton<SearchManager>, public Thread, private TimerManagerListener
 {
 	public:
 		static const char* getTypeStr(Search::TypeModes type);
@@ -60,41 +63,97 @@ class SearchManager : public Speaker<SearchManagerListener>, public Singleton<Se
 			onData(aLine);
 		}
 		
-		void onRES(const AdcCommand& cmd, const UserPtr& from, const boost::asio::ip::address_v4& remoteIp);
-		void onPSR(const AdcCommand& cmd, UserPtr from, const boost::asio::ip::address_v4& remoteIp);
+		/** p_start - index of the first result parameter (1 for the UDP commands, their first parameter is the sender's CID) */
+		void onRES(const AdcCommand& cmd, const UserPtr& from, const boost::asio::ip::address_v4& remoteIp, size_t p_start = 0);
+		void onPSR(const AdcCommand& cmd, UserPtr from, const boost::asio::ip::address_v4& remoteIp, size_t p_start = 0);
 		static void toPSR(AdcCommand& cmd, bool wantResponse, const string& myNick, const string& hubIpPort, const string& tth, const vector<uint16_t>& partialInfo);
 		
+		static uint32_t getDroppedResults()
+		{
+			return g_dropped_results;
+		}
+		static uint32_t getDuplicateResults()
+		{
+			return g_duplicate_results;
+		}
+		/** AdcHub sent our search with p_token - its results are aggregated from now on */
+		void onSearchSent(uint32_t p_token)
+		{
+			m_aggregator.addToken(p_token, GET_TICK());
+		}
+		void getTopResults(uint32_t p_token, SearchResultGroupList& p_groups) const
+		{
+			m_aggregator.getTopGroups(p_token, p_groups);
+		}
+		
 	private:
-		class UdpQueue: public Thread
+		struct UdpPacket
+		{
+			string m_data;
+			boost::asio::ip::address_v4 m_ip4;
+		};
+		typedef std::vector<UdpPacket> UdpPacketList;
+		
+		// [!] FlylinkDC++ lock-free bounded queue drained by a small pool of parser threads
+		class UdpQueue
+#ifdef _DEBUG
+			: boost::noncopyable
+#endif
 		{
 			public:
-				UdpQueue() : m_is_stop(false) {}
+				UdpQueue() : m_packets(QUEUE_CAPACITY), m_is_stop(true) {}
 				~UdpQueue()
 				{
 					shutdown();
 				}
 				
-				int run();
-				void shutdown()
-				{
-					m_is_stop = true;
-					m_search_semaphore.signal();
-				}
+				void start();
+				void shutdown();
 				void addResult(const string& buf, const boost::asio::ip::address_v4& p_ip4)
 				{
-					{
-						CFlyFastLock(m_cs);
-						m_resultList.push_back(make_pair(buf, p_ip4));
-					}
-					m_search_semaphore.signal();
+					UdpPacket l_packet;
+					l_packet.m_data = buf;
+					l_packet.m_ip4 = p_ip4;
+					if (m_packets.push(std::move(l_packet)))
+						m_search_semaphore.signal();
+					else
+						++g_dropped_results;
 				}
+				void addResults(UdpPacketList& p_packets);
 				
 			private:
-				FastCriticalSection m_cs; // [!] IRainman opt: use spin lock here.
+				enum { QUEUE_CAPACITY = 16 * 1024, MAX_PARSERS = 4 };
+				// $SR fields are copied into these, they keep their capacity between datagrams
+				struct ParseBuffers
+				{
+					string m_nick;
+					string m_file;
+					string m_hub_ip_port;
+					string m_nick_utf8;
+					string m_file_utf8;
+				};
+				class Parser : public Thread
+				{
+					public:
+						explicit Parser(UdpQueue& p_queue) : m_queue(p_queue) {}
+					private:
+						int run();
+						UdpQueue& m_queue;
+						ParseBuffers m_buffers;
+				};
+				static void parse(const string& x, const boost::asio::ip::address_v4& remoteIp, ParseBuffers& p_buffers);
+				
+				CFlyBoundedQueue<UdpPacket> m_packets;
 				Semaphore m_search_semaphore;
-				deque<pair<string, boost::asio::ip::address_v4>> m_resultList;
+				std::vector<std::unique_ptr<Parser>> m_parsers;
 				volatile bool m_is_stop; // [!] IRainman fix: this variable is volatile.
 		} m_queue_thread;
+		static boost::atomic<uint32_t> g_dropped_results;
+		static boost::atomic<uint32_t> g_duplicate_results;
+		
+		CFlySearchResultAggregator m_aggregator;
+		void fireSearchResult(const std::unique_ptr<SearchResult>& p_sr);
+		void on(TimerManagerListener::Second, uint64_t aTick) noexcept override;
 		
 		// [-] CriticalSection cs; [-] FlylinkDC++
 		unique_ptr<Socket> socket;
@@ -107,7 +166,6 @@ class SearchManager : public Speaker<SearchManagerListener>, public Singleton<Se
 		int run();
 		
 		~SearchManager();
-		void onData(const uint8_t* buf, size_t aLen, const boost::asio::ip::address_v4& address);
 		void onData(const std::string& p_line);
 		
 		static string getPartsString(const PartsInfo& partsInfo);
@@ -23,6 +23,7 @@
 #define DCPLUSPLUS_DCPP_SEARCH_MANAGER_LISTENER_H
 
 #include "SearchResult.h"
+#include "CFlySearchResultAggregator.h"
 
 class SearchManagerListener
 {
@@ -34,7 +35,10 @@ class SearchManagerListener
 		};
 		
 		typedef X<0> SR;
+		typedef X<1> SRGroups;
 		virtual void on(SR, const std::unique_ptr<SearchResult>&) noexcept = 0;
+		// TTH groups of the search token which got new sources during the last second
+		virtual void on(SRGroups, uint32_t, const SearchResultGroupList&) noexcept { }
 };
 
 #endif // !defined(SEARCH_MANAGER_LISTENER_H)
@@ -45,9 +45,9 @@ class Semaphore
 			}
 		}
 		
-		void signal() noexcept
+		void signal(long p_count = 1) noexcept
 		{
-			if (!ReleaseSemaphore(h, 1, NULL))
+			if (!ReleaseSemaphore(h, p_count, NULL))
 			{
 				const auto l_error_code = GetLastError();
 				if (l_error_code)
@@ -439,6 +439,10 @@ static const char* g_settingTags[] =
 	"TTHGPUDevNum",
 	//"UsersTop", "UsersBottom", "UsersLeft", "UsersRight",
 	"FavUsersSplitterPos",
+	"UploadQueuePolicy", "UploadPrefetchSize",
+	"LogRotateSize", "LogRotateCompress",
+	"ThrottleTorrentWeight",
+	"MD5UseOpenSSL",
 	"SENTRY",
 };
 
@@ -1262,6 +1266,11 @@ void SettingsManager::setDefaults()
 	setDefault(REPORT_TO_USER_IF_OUTDATED_OS_DETECTED, TRUE);
 #endif
 	setDefault(TTH_GPU_DEV_NUM, -1);
+	setDefault(UPLOAD_QUEUE_POLICY, 1); // WaitingUserQueue::POLICY_FAIR
+	setDefault(UPLOAD_PREFETCH_SIZE, 1024); // KiB, 0 - disabled
+	setDefault(LOG_ROTATE_SIZE, 64); // MiB, 0 - disabled
+	setDefault(THROTTLE_TORRENT_WEIGHT, 50); // % of the speed limits guaranteed to BitTorrent
+	setDefault(MD5_USE_OPENSSL, 0); // MD5Calc: builtin code or OpenSSL
 	setSearchTypeDefaults();
 	// TODO -        .
 	Util::shrink_to_fit(&strDefaults[STR_FIRST], &strDefaults[STR_LAST]); // [+] IRainman opt.
@@ -1837,6 +1846,26 @@ bool SettingsManager::set(IntSetting key, int value)
 			VER_MIN(16);
 			break;
 		}
+		case UPLOAD_QUEUE_POLICY:
+		{
+			VERIFI(0, 1);
+			break;
+		}
+		case UPLOAD_PREFETCH_SIZE:
+		{
+			VERIFI(0, 64 * 1024);
+			break;
+		}
+		case LOG_ROTATE_SIZE:
+		{
+			VERIFI(0, 4096);
+			break;
+		}
+		case THROTTLE_TORRENT_WEIGHT:
+		{
+			VERIFI(0, 100);
+			break;
+		}
 #ifdef FLYLINKDC_SUPPORT_WIN_XP
 		case SOCKET_IN_BUFFER:
 		case SOCKET_OUT_BUFFER:
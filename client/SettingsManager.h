@@ -462,6 +462,10 @@ class SettingsManager : public Singleton<SettingsManager>, public Speaker<Settin
 		                  TTH_GPU_DEV_NUM,
 		                  //  USERS_TOP, USERS_BOTTOM, USERS_LEFT, USERS_RIGHT,
 		                  FAV_USERS_SPLITTER_POS,
+		                  UPLOAD_QUEUE_POLICY, UPLOAD_PREFETCH_SIZE,
+		                  LOG_ROTATE_SIZE, LOG_ROTATE_COMPRESS,
+		                  THROTTLE_TORRENT_WEIGHT,
+		                  MD5_USE_OPENSSL,
 		                  INT_LAST,
 		                  SETTINGS_LAST = INT_LAST
 		                };
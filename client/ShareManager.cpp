@@ -29,12 +29,15 @@
 #include "File.h"
 #include "FilteredFile.h"
 #include "BZUtils.h"
+#include "ZUtils.h"
 #include "Wildcards.h"
 #include "Transfer.h"
 #include "Download.h"
 #include "HashBloom.h"
 #include "SearchResult.h"
 #include "UploadManager.h"
+#include "CompatibilityManager.h"
+#include "CFlyParallelJobs.h"
 #include "../FlyFeatures/flyServer.h"
 #include "../client/CFlylinkDBManager.h"
 #include "../windows/resource.h"
@@ -65,14 +68,18 @@ std::unique_ptr<webrtc::RWLockWrapper> ShareManager::g_csShareCache = std::uniqu
 CriticalSection ShareManager::g_csTTHIndex;
 
 FastCriticalSection ShareManager::g_csPartialCache;
-std::unordered_map<string, std::pair<string, unsigned> > ShareManager::g_partial_list_cache;
-
-FastCriticalSection ShareManager::g_csTTHPathCache;
-std::unordered_map<TTHValue, std::pair<string, unsigned> > ShareManager::g_tth_path_cache;
+std::unordered_map<string, ShareManager::CFlyPartialCacheItem> ShareManager::g_partial_list_cache;
+size_t ShareManager::g_partial_list_cache_size = 0;
+unsigned ShareManager::g_partial_list_generation = 0;
+static const size_t PARTIAL_LIST_CACHE_LIMIT = 16 * 1024 * 1024;
 
 QueryNotExistsSet ShareManager::g_file_not_exists_set;
 QueryCacheMap ShareManager::g_file_cache_map;
-ShareManager::HashFileMap ShareManager::g_tthIndex;
+ShareManager::CFlyShareSnapshotPtr ShareManager::g_share_snapshot;
+boost::atomic<uint32_t> ShareManager::g_share_snapshot_version(0);
+ShareManager::HashFileMap ShareManager::g_tth_pending;
+boost::unordered_set<TTHValue> ShareManager::g_tth_pending_erase;
+boost::atomic<size_t> ShareManager::g_tth_pending_count(0);
 ShareManager::ShareMap ShareManager::g_shares;
 ShareManager::ShareMap ShareManager::g_lost_shares;
 int64_t ShareManager::g_lastSharedDate = 0;
@@ -127,6 +134,11 @@ ShareManager::~ShareManager()
 	HashManager::getInstance()->removeListener(this);
 	CFlylinkDBManager::getInstance()->flush_hash();
 	join();
+	{
+		CFlyLock(g_csTTHIndex);
+		std::atomic_store(&g_share_snapshot, CFlyShareSnapshotPtr());
+		++g_share_snapshot_version;
+	}
 	
 	if (bzXmlRef.get())
 	{
@@ -211,6 +223,55 @@ string ShareManager::Directory::getRealPathL(const std::string& path) const
 	}
 }
 
+string ShareManager::CFlyTTHEntry::getADCPath() const
+{
+	string l_path = '/' + getFullName();
+	std::replace(l_path.begin(), l_path.end(), PATH_SEPARATOR, '/');
+	return l_path;
+}
+
+string ShareManager::CFlyTTHEntry::getRealPath() const
+{
+	const CFlyShareSnapshot* l_snapshot = getThreadSnapshot();
+	const auto l_pos = m_dir->find(PATH_SEPARATOR);
+	if (!l_snapshot || l_pos == string::npos)
+	{
+		throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, m_name);
+	}
+	return ShareManager::findRealRoot(l_snapshot->m_shares, m_dir->substr(0, l_pos), m_dir->substr(l_pos + 1) + m_name);
+}
+
+string ShareManager::findRealRoot(const ShareMap& p_shares, const string& virtualRoot, const string& virtualPath)
+{
+	// The disk is asked only when several real roots are merged under the same virtual name
+	const string* l_single_path = nullptr;
+	size_t l_count = 0;
+	for (auto i = p_shares.cbegin(); i != p_shares.cend(); ++i)
+	{
+		if (stricmp(i->second.m_synonym, virtualRoot) == 0)
+		{
+			l_single_path = &i->first;
+			++l_count;
+		}
+	}
+	if (l_count == 1)
+	{
+		return *l_single_path + virtualPath;
+	}
+	for (auto i = p_shares.cbegin(); i != p_shares.cend(); ++i)
+	{
+		if (stricmp(i->second.m_synonym, virtualRoot) == 0)
+		{
+			const std::string name = i->first + virtualPath;
+			if (FileFindIter(name) != FileFindIter::end)
+			{
+				return name;
+			}
+		}
+	}
+	throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, virtualPath);
+}
+
 string ShareManager::findRealRootL(const string& virtualRoot, const string& virtualPath)
 {
 	for (auto i = g_shares.cbegin(); i != g_shares.cend(); ++i)
@@ -280,35 +341,128 @@ bool ShareManager::getRealPathAndSize(const TTHValue& tth, string& path, int64_t
 }
 #endif
 
-bool ShareManager::isTTHShared(const TTHValue& tth)
+const ShareManager::CFlyShareSnapshot* ShareManager::getThreadSnapshot()
 {
-	if (!ClientManager::isBeforeShutdown())
+	struct CFlyThreadSnapshot
 	{
-		CFlyLock(g_csTTHIndex);
-		return g_tthIndex.find(tth) != g_tthIndex.end();
+		CFlyThreadSnapshot() : m_version(0)
+		{
+		}
+		CFlyShareSnapshotPtr m_snapshot;
+		uint32_t m_version;
+	};
+	static thread_local CFlyThreadSnapshot g_thread_snapshot;
+	const uint32_t l_version = g_share_snapshot_version.load(boost::memory_order_acquire);
+	if (g_thread_snapshot.m_version != l_version)
+	{
+		g_thread_snapshot.m_snapshot = getSnapshot();
+		g_thread_snapshot.m_version = l_version;
 	}
-	return false;
+	return g_thread_snapshot.m_snapshot.get();
 }
-string ShareManager::toRealPath(const TTHValue& tth)
+
+bool ShareManager::findTTH(const TTHValue& p_tth, CFlyTTHEntry* p_entry /* = nullptr */)
 {
-#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
-	CFlyReadLock(*g_csShare);
-#else
-	CFlyLock(g_csShare);
-#endif
+	// the counter is read before the snapshot: publishSnapshotL resets it only after the new snapshot is stored
+	if (g_tth_pending_count != 0)
 	{
 		CFlyLock(g_csTTHIndex);
-		const auto i = g_tthIndex.find(tth);
-		if (i != g_tthIndex.end())
+		const auto i = g_tth_pending.find(p_tth);
+		if (i != g_tth_pending.end())
 		{
-			try
+			if (p_entry)
 			{
-				return i->second->getRealPathL();
+				*p_entry = i->second;
 			}
-			catch (const ShareException& e)
+			return true;
+		}
+		if (g_tth_pending_erase.find(p_tth) != g_tth_pending_erase.end())
+		{
+			return false;
+		}
+	}
+	const CFlyShareSnapshot* l_snapshot = getThreadSnapshot();
+	if (l_snapshot)
+	{
+		const auto i = l_snapshot->m_tth_index.find(p_tth);
+		if (i != l_snapshot->m_tth_index.end())
+		{
+			if (p_entry)
 			{
-				dcassert(0);
+				*p_entry = i->second;
 			}
+			return true;
+		}
+	}
+	return false;
+}
+
+void ShareManager::publishSnapshotL(HashFileMap* p_index)
+{
+	std::shared_ptr<CFlyShareSnapshot> l_snapshot = std::make_shared<CFlyShareSnapshot>();
+	CFlyLock(g_csTTHIndex);
+	if (p_index)
+	{
+		l_snapshot->m_tth_index.swap(*p_index);
+	}
+	else
+	{
+		const CFlyShareSnapshotPtr l_current = getSnapshot();
+		if (l_current)
+		{
+			l_snapshot->m_tth_index = l_current->m_tth_index;
+		}
+		for (auto i = g_tth_pending_erase.cbegin(); i != g_tth_pending_erase.cend(); ++i)
+		{
+			l_snapshot->m_tth_index.erase(*i);
+		}
+		for (auto i = g_tth_pending.cbegin(); i != g_tth_pending.cend(); ++i)
+		{
+			l_snapshot->m_tth_index[i->first] = i->second;
+		}
+	}
+	l_snapshot->m_shares = g_shares;
+	std::atomic_store(&g_share_snapshot, CFlyShareSnapshotPtr(l_snapshot));
+	g_share_snapshot_version.fetch_add(1, boost::memory_order_release);
+	// the pending changes stay visible to findTTH until the new snapshot is stored
+	g_tth_pending.clear();
+	g_tth_pending_erase.clear();
+	g_tth_pending_count = 0;
+}
+
+void ShareManager::publishPending()
+{
+	if (g_tth_pending_count)
+	{
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+		CFlyReadLock(*g_csShare);
+#else
+		CFlyLock(g_csShare);
+#endif
+		publishSnapshotL(nullptr);
+	}
+}
+
+bool ShareManager::isTTHShared(const TTHValue& tth)
+{
+	if (!ClientManager::isBeforeShutdown())
+	{
+		return findTTH(tth);
+	}
+	return false;
+}
+string ShareManager::toRealPath(const TTHValue& tth)
+{
+	CFlyTTHEntry l_file;
+	if (findTTH(tth, &l_file))
+	{
+		try
+		{
+			return l_file.getRealPath();
+		}
+		catch (const ShareException&)
+		{
+			dcassert(0);
 		}
 	}
 	return Util::emptyString;
@@ -325,18 +479,10 @@ string ShareManager::toVirtual(const TTHValue& tth)
 	{
 		return Transfer::g_user_list_name;
 	}
-#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
-	CFlyReadLock(*g_csShare);
-#else
-	CFlyLock(g_csShare);
-#endif
+	CFlyTTHEntry l_file;
+	if (findTTH(tth, &l_file))
 	{
-		CFlyLock(g_csTTHIndex);
-		const auto& i = g_tthIndex.find(tth);
-		if (i != g_tthIndex.end())
-		{
-			return i->second->getADCPathL();
-		}
+		return l_file.getADCPath();
 	}
 	
 	throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, "ShareManager::toVirtual: " + tth.toBase32());
@@ -388,29 +534,29 @@ TTHValue ShareManager::getTTH(const string& virtualFile) const
 
 MemoryInputStream* ShareManager::getTree(const string& virtualFile) const
 {
-	TigerTree tree;
-	__int64 l_block_size;
+	CFlyTigerTreeCache::TreePtr tree;
 	if (virtualFile.compare(0, 4, "TTH/", 4) == 0)
 	{
-		if (!CFlylinkDBManager::getInstance()->get_tree(TTHValue(virtualFile.substr(4)), tree, l_block_size))
-			return 0;
+		tree = CFlylinkDBManager::getInstance()->get_tree_ptr(TTHValue(virtualFile.substr(4)));
 	}
 	else
 	{
 		try
 		{
 			const TTHValue tth = getTTH(virtualFile);
-			CFlylinkDBManager::getInstance()->get_tree(tth, tree, l_block_size);
+			tree = CFlylinkDBManager::getInstance()->get_tree_ptr(tth);
 		}
 		catch (const Exception&)
 		{
 			return 0;
 		}
 	}
-	
-	ByteVector buf;
-	tree.getLeafData(buf);
-	return new MemoryInputStream(&buf[0], buf.size());
+	if (!tree || tree->getLeaves().empty())
+		return 0;
+		
+	// leaves are stored one after another, the same bytes as TigerTree::getLeafData() makes
+	const auto& l_leaves = tree->getLeaves();
+	return new MemoryInputStream(l_leaves[0].data, l_leaves.size() * TigerTree::BYTES);
 }
 
 void ShareManager::getFileInfo(AdcCommand& cmd, const string& aFile)
@@ -438,24 +584,15 @@ void ShareManager::getFileInfo(AdcCommand& cmd, const string& aFile)
 		throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, aFile);
 		
 	const TTHValue val(aFile.c_str() + 4); //[+]FlylinkDC++
-#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
-	CFlyReadLock(*g_csShare);
-#else
-	CFlyLock(g_csShare);
-#endif
+	CFlyTTHEntry f;
+	if (!findTTH(val, &f))
 	{
-		CFlyLock(g_csTTHIndex);
-		const auto& i = g_tthIndex.find(val);
-		if (i == g_tthIndex.end())
-		{
-			throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, aFile);
-		}
-		
-		const auto& f = *i->second;
-		cmd.addParam("FN", f.getADCPathL());
-		cmd.addParam("SI", Util::toString(f.getSize()));
-		cmd.addParam("TR", f.getTTH().toBase32());
+		throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, aFile);
 	}
+	
+	cmd.addParam("FN", f.getADCPath());
+	cmd.addParam("SI", Util::toString(f.getSize()));
+	cmd.addParam("TR", val.toBase32());
 }
 pair<ShareManager::Directory::Ptr, string> ShareManager::splitVirtualL(const string& virtualPath) const
 {
@@ -502,54 +639,26 @@ void ShareManager::checkShutdown(const string& virtualFile) const
 }
 string ShareManager::findFileAndRealPath(const string& virtualFile, TTHValue& p_tth, bool p_is_fetch_tth) const
 {
-	const bool l_is_tth = virtualFile.compare(0, 4, "TTH/", 4) == 0;
-	if (l_is_tth)
+	if (virtualFile.compare(0, 4, "TTH/", 4) == 0)
 	{
-		CFlyFastLock(g_csTTHPathCache);
-		const TTHValue l_tth(virtualFile.substr(4));
-		auto i = g_tth_path_cache.find(l_tth);
-		if (i != g_tth_path_cache.end())
-		{
-			i->second.second++;
-#ifdef FLYLINKDC_BETA
-			//LogManager::message("Use real path cache TTH = " + virtualFile.substr(4)
-			//                    + " path = " + i->second.first + " count = " + Util::toString(i->second.second));
-#endif // FLYLINKDC_BETA
-			checkShutdown(virtualFile);
-			if (p_is_fetch_tth)
-			{
-				p_tth = i->first;
-			}
-			return i->second.first;
-		}
-	}
-#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
-	CFlyReadLock(*g_csShare);
-#else
-	CFlyLock(g_csShare);
-#endif
-	if (l_is_tth)
-	{
-		CFlyLock(g_csTTHIndex);
-		const TTHValue l_tth(virtualFile.substr(4));
-		const auto i = g_tthIndex.find(l_tth);
-		if (i == g_tthIndex.end())
+		const TTHValue l_tth(virtualFile.c_str() + 4);
+		CFlyTTHEntry l_file;
+		if (!findTTH(l_tth, &l_file))
 		{
 			throw ShareException(UserConnection::g_FILE_NOT_AVAILABLE, virtualFile);
 		}
 		checkShutdown(virtualFile);
 		if (p_is_fetch_tth)
 		{
-			p_tth = i->second->getTTH(); // https://drdump.com/DumpGroup.aspx?DumpGroupID=555791&Login=guest
-		}
-		const string l_path = i->second->getRealPathL();
-		{
-			CFlyFastLock(g_csTTHPathCache);
-			auto& i = g_tth_path_cache[l_tth];
-			i.first = l_path;
+			p_tth = l_tth;
 		}
-		return l_path;
+		return l_file.getRealPath();
 	}
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+	CFlyReadLock(*g_csShare);
+#else
+	CFlyLock(g_csShare);
+#endif
 	const auto v = splitVirtualL(virtualFile);
 	const auto it = std::find_if(v.first->m_share_files.begin(), v.first->m_share_files.end(),
 	                             [&](const Directory::ShareFile & p_file) -> bool {return stricmp(p_file.getName(), v.second) == 0;}
@@ -801,10 +910,12 @@ bool ShareManager::loadCache() noexcept
 #endif
 				
 				{
+					HashFileMap l_index;
 					for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
 					{
-						updateIndicesDirL(**i);
+						updateIndicesDirL(**i, l_index, nullptr);
 					}
+					publishSnapshotL(&l_index);
 				}
 			}
 			internalClearCache(true);
@@ -985,18 +1096,24 @@ void ShareManager::addDirectory(const string& realPath, const string& virtualNam
 			
 			{
 				__int64 l_path_id = 0;
-				Directory::Ptr dp = buildTreeL(l_path_id, realPath, Directory::Ptr(), p_is_job);
+				CFlyShareScanStats l_stats;
+				Directory::Ptr dp = buildTreeL(l_path_id, realPath, Directory::Ptr(), p_is_job, nullptr, l_stats);
+				l_stats.apply();
+				m_prev_roots.clear(); // the root may be merged with another one now
 				
 				const string vName = validateVirtual(virtualName);
 				dp->setNameAndLower(vName);
 				
 				g_shares.insert(std::make_pair(realPath, CFlyBaseDirItem(vName, l_path_id)));
 				{
+					const CFlyShareSnapshotPtr l_snapshot = getSnapshot();
 					CFlyLock(g_csTTHIndex);
-					updateIndicesDirL(*get_mergeL(dp));
+					updateIndicesDirL(*get_mergeL(dp), g_tth_pending, l_snapshot ? &l_snapshot->m_tth_index : nullptr);
+					publishSnapshotL(nullptr);
 				}
 			}
 		}
+		clear_partial_cache(""); // the new root may be merged into an existing one
 		setDirty();
 	}
 }
@@ -1121,13 +1238,16 @@ void ShareManager::removeDirectory(const string& realPath)
 		{
 			if (stricmp(i->second.m_synonym, l_Name) == 0 && checkAttributs(i->first))// [!]IRainman checkHidden(i->first)
 			{
-				Directory::Ptr dp = buildTreeL(i->second.m_path_id, i->first, Directory::Ptr(), true);
+				CFlyShareScanStats l_stats;
+				Directory::Ptr dp = buildTreeL(i->second.m_path_id, i->first, Directory::Ptr(), true, nullptr, l_stats);
+				l_stats.apply();
 				dp->setNameAndLower(i->second.m_synonym);
 				{
 					get_mergeL(dp);
 				}
 			}
 		}
+		m_prev_roots.clear();
 		rebuildIndicesL(true);
 	}
 	internalCalcShareSize();
@@ -1194,34 +1314,106 @@ void ShareManager::internalCalcShareSize() // [!] IRainman opt.
 		{
 			g_isNeedsUpdateShareSize = false;
 			int64_t l_CurrentShareSize = 0;
+			publishPending();
+			const CFlyShareSnapshotPtr l_snapshot = getSnapshot();
+			if (l_snapshot)
 			{
-				CFlyLock(g_csTTHIndex);
-				for (auto i = g_tthIndex.cbegin(); i != g_tthIndex.cend(); ++i)
+				for (auto i = l_snapshot->m_tth_index.cbegin(); i != l_snapshot->m_tth_index.cend(); ++i)
 				{
-					l_CurrentShareSize += i->second->getSize(); // https://drdump.com/DumpGroup.aspx?DumpGroupID=532748
+					l_CurrentShareSize += i->second.m_size; // https://drdump.com/DumpGroup.aspx?DumpGroupID=532748
 				}
-				g_lastSharedFiles = unsigned(g_tthIndex.size());
+				g_lastSharedFiles = unsigned(l_snapshot->m_tth_index.size());
 			}
 			g_CurrentShareSize = l_CurrentShareSize;
 		}
 	}
 }
 
-ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const string& aName, const Directory::Ptr& aParent, bool p_is_job)
+void ShareManager::buildTreesParallelL(CFlyDirItemArray& p_directories, DirList& p_new_dirs)
 {
-
-	bool p_is_no_mediainfo = false;
-	if (p_path_id == 0)
+	const uint64_t l_start = GET_TICK();
+	std::unordered_map<string, Directory::Ptr> l_prev_roots;
+	l_prev_roots.swap(m_prev_roots);
+	
+	std::vector<Directory::Ptr> l_trees(p_directories.size());
+	std::vector<CFlyShareScanStats> l_stats(p_directories.size());
+	const std::function<void(size_t)> l_job = [&](size_t i)
 	{
-		p_path_id = CFlylinkDBManager::getInstance()->get_path_id(Text::toLower(aName), !p_is_job, false, p_is_no_mediainfo, m_sweep_path);
+		CFlyDirItem& l_item = p_directories[i];
+		if (!checkAttributs(l_item.m_path))
+			return;
+		const auto l_prev = l_prev_roots.find(Text::toLower(l_item.m_path));
+		l_trees[i] = buildTreeL(l_item.m_path_id, l_item.m_path, Directory::Ptr(), false,
+		                        l_prev != l_prev_roots.end() ? l_prev->second.get() : nullptr, l_stats[i]);
+	};
+	
+	// The roots usually live on different disks so the enumeration is done in parallel,
+	// the database calls are serialized by CFlylinkDBManager itself.
+	const CFlyParallelJobs::StopCheck l_is_stop = []()
+	{
+		return ClientManager::isBeforeShutdown();
+	};
+	const size_t l_max_threads = std::min(size_t(8), std::max(size_t(1), CompatibilityManager::getProcessorsCount()));
+	const size_t l_thread_count = CFlyParallelJobs::run(p_directories.size(), l_max_threads, l_job, l_is_stop, "ShareManager::buildTree");
+	
+	// Only the roots with their own virtual name can be compared next time - merged ones get foreign files
+	std::unordered_map<string, unsigned> l_synonym_count;
+	for (auto i = p_directories.cbegin(); i != p_directories.cend(); ++i)
+	{
+		++l_synonym_count[Text::toLower(i->m_synonym)];
+	}
+	CFlyShareScanStats l_total;
+	for (size_t i = 0; i < p_directories.size(); ++i)
+	{
+		l_total.add(l_stats[i]);
+		const Directory::Ptr& dp = l_trees[i];
+		if (!dp)
+			continue;
+		dp->setNameAndLower(p_directories[i].m_synonym);
+		p_new_dirs.push_back(dp);
+		if (l_synonym_count[Text::toLower(p_directories[i].m_synonym)] == 1)
+		{
+			m_prev_roots[Text::toLower(p_directories[i].m_path)] = dp;
+		}
 	}
+	l_total.apply();
+	LogManager::message("Share refresh: directories = " + Util::toString(l_total.m_dirs) +
+	                    " (without database = " + Util::toString(l_total.m_dirs_without_db) +
+	                    "), files = " + Util::toString(l_total.m_files) +
+	                    " (unchanged = " + Util::toString(l_total.m_files_unchanged) +
+	                    "), threads = " + Util::toString(l_thread_count) +
+	                    ", time = " + Util::toString(GET_TICK() - l_start) + " ms");
+}
+
+ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const string& aName, const Directory::Ptr& aParent, bool p_is_job,
+                                                      const Directory* p_prev, CFlyShareScanStats& p_stats)
+{
+	bool p_is_no_mediainfo = false;
 	Directory::Ptr dir = Directory::create(Util::getLastDir(aName), aParent);
 	
 	auto l_lastFileIter = dir->m_share_files.begin();
 	
 	CFlyDirMap l_dir_map;
-	if (p_path_id)
-		CFlylinkDBManager::getInstance()->load_dir(p_path_id, l_dir_map, p_is_no_mediainfo);
+	bool l_is_dir_loaded = false;
+	// The database is asked only when a file is new or changed since the previous refresh.
+	// A sweep has to see every path so it always loads.
+	const auto loadDir = [&]()
+	{
+		if (l_is_dir_loaded)
+			return;
+		l_is_dir_loaded = true;
+		if (p_path_id == 0)
+		{
+			p_path_id = CFlylinkDBManager::getInstance()->get_path_id(Text::toLower(aName), !p_is_job, false, p_is_no_mediainfo, m_sweep_path);
+		}
+		if (p_path_id)
+			CFlylinkDBManager::getInstance()->load_dir(p_path_id, l_dir_map, p_is_no_mediainfo);
+	};
+	if (p_prev == nullptr || m_sweep_path)
+	{
+		loadDir();
+	}
+	++p_stats.m_dirs;
 	for (FileFindIter i(aName + '*'); !ClientManager::isBeforeShutdown() && i != FileFindIter::end; ++i)// [!]IRainman add m_close [10] https://www.box.net/shared/067924cecdb252c9d26c
 	{
 		if (i->isTemporary())// [+]IRainman
@@ -1249,7 +1441,14 @@ ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const
 			        && isShareFolder(newName))
 			{
 				__int64 l_path_id = 0;
-				dir->m_share_directories[l_file_name] = buildTreeL(l_path_id, newName, dir, p_is_job);
+				const Directory* l_prev_dir = nullptr;
+				if (p_prev)
+				{
+					const auto l_prev_it = p_prev->m_share_directories.find(l_file_name);
+					if (l_prev_it != p_prev->m_share_directories.end())
+						l_prev_dir = l_prev_it->second.get();
+				}
+				dir->m_share_directories[l_file_name] = buildTreeL(l_path_id, newName, dir, p_is_job, l_prev_dir, p_stats);
 			}
 		}
 		else
@@ -1319,6 +1518,36 @@ ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const
 					}
 				}
 				const int64_t l_ts = i->getLastWriteTime();
+				++p_stats.m_files;
+				if (p_prev && !l_is_dir_loaded)
+				{
+					const Directory::ShareFile* l_prev_file = p_prev->findFileExactL(l_file_name);
+					if (l_prev_file && l_prev_file->getSize() == l_size && l_prev_file->isSameWriteTime(l_ts))
+					{
+						l_lastFileIter = dir->m_share_files.insert(l_lastFileIter,
+						                                           Directory::ShareFile(l_file_name,
+						                                                                l_size,
+						                                                                dir,
+						                                                                l_prev_file->getTTH(),
+						                                                                l_prev_file->getHit(),
+						                                                                l_prev_file->getTS(),
+						                                                                l_prev_file->getFType()
+						                                                               )
+						                                          );
+						auto f = const_cast<ShareManager::Directory::ShareFile*>(&(*l_lastFileIter));
+						f->initLowerName();
+						f->setWriteTime(l_ts);
+						auto l_media_ptr = l_prev_file->m_media_ptr;
+						f->initMediainfo(l_media_ptr);
+						if (l_prev_file->getTS() > p_stats.m_last_shared_date)
+						{
+							p_stats.m_last_shared_date = l_prev_file->getTS();
+						}
+						++p_stats.m_files_unchanged;
+						continue;
+					}
+					loadDir();
+				}
 				CFlyDirMap::iterator l_dir_item = l_dir_map.find(l_lower_name);
 				bool l_is_new_file = l_dir_item == l_dir_map.end();
 				if (!l_is_new_file)
@@ -1365,9 +1594,10 @@ ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const
 						                                          );
 						auto f = const_cast<ShareManager::Directory::ShareFile*>(&(*l_lastFileIter));
 						f->initLowerName();
-						if (l_dir_item_second.m_StampShare > g_lastSharedDate)
+						f->setWriteTime(l_ts);
+						if (l_dir_item_second.m_StampShare > p_stats.m_last_shared_date)
 						{
-							g_lastSharedDate = l_dir_item_second.m_StampShare;
+							p_stats.m_last_shared_date = l_dir_item_second.m_StampShare;
 						}
 						f->initMediainfo(l_dir_item_second.m_media_ptr);
 						l_dir_item_second.m_media_ptr = nullptr;
@@ -1383,6 +1613,10 @@ ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const
 	if (l_path_id && !m_sweep_guard)
 		CFlylinkDBManager::getInstance()->sweep_files(l_path_id, l_dir_map);
 #endif
+	if (!l_is_dir_loaded)
+	{
+		++p_stats.m_dirs_without_db;
+	}
 	return dir;
 }
 
@@ -1526,7 +1760,7 @@ __int64 ShareManager::rebuildMediainfo(CFlyLog& p_log)
 }
 #endif // USE_REBUILD_MEDIAINFO
 
-bool ShareManager::updateIndicesDirL(Directory& dir)
+bool ShareManager::updateIndicesDirL(Directory& dir, HashFileMap& p_index, const HashFileMap* p_base)
 {
 	if (!ClientManager::isBeforeShutdown())
 	{
@@ -1538,17 +1772,18 @@ bool ShareManager::updateIndicesDirL(Directory& dir)
 		
 		for (auto i = dir.m_share_directories.cbegin(); i != dir.m_share_directories.cend(); ++i)
 		{
-			if (updateIndicesDirL(*i->second) == false) // Recursion
+			if (updateIndicesDirL(*i->second, p_index, p_base) == false) // Recursion
 			{
 				return false;
 			}
 		}
 		
 		dir.m_size = 0;
+		const auto l_dir_name = std::make_shared<const string>(dir.getFullName());
 		CFlyWriteLock(*g_csBloom);
-		for (auto i = dir.m_share_files.cbegin(); i != dir.m_share_files.cend();)
+		for (auto i = dir.m_share_files.cbegin(); i != dir.m_share_files.cend(); ++i)
 		{
-			if (updateIndicesFileL(dir, i++) == false)
+			if (updateIndicesFileL(dir, l_dir_name, *i, p_index, p_base) == false)
 			{
 				return false;
 			}
@@ -1562,10 +1797,6 @@ void ShareManager::rebuildIndicesL(bool p_is_clear_cache)
 {
 	if (!ClientManager::isBeforeShutdown())
 	{
-		{
-			CFlyLock(g_csTTHIndex);
-			g_tthIndex.clear();
-		}
 		{
 			CFlyWriteLock(*g_csBloom);
 			g_bloom.clear();
@@ -1573,36 +1804,41 @@ void ShareManager::rebuildIndicesL(bool p_is_clear_cache)
 		if (p_is_clear_cache)
 		{
 			clear_partial_cache("");
-			clear_tth_path_cache();
 		}
+		HashFileMap l_index;
+		for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
 		{
-			CFlyLock(g_csTTHIndex);
-			for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
-			{
-				if (updateIndicesDirL(**i) == false)
-					break;
-			}
+			if (updateIndicesDirL(**i, l_index, nullptr) == false)
+				break;
 		}
+		publishSnapshotL(&l_index);
 		g_isNeedsUpdateShareSize = true;
 	}
 }
 
-bool ShareManager::updateIndicesFileL(Directory& dir, const Directory::ShareFile::Set::iterator& i)
+bool ShareManager::updateIndicesFileL(Directory& dir, const std::shared_ptr<const string>& p_dir_name, const Directory::ShareFile& f, HashFileMap& p_index, const HashFileMap* p_base)
 {
 	if (!ClientManager::isBeforeShutdown())
 	{
-		const auto& f = *i;
 		{
-			auto j = g_tthIndex.find(f.getTTH());
-			if (j == g_tthIndex.end())
+			auto j = p_index.find(f.getTTH());
+			if (j == p_index.end())
 			{
-				dir.m_size += f.getSize();
-				g_tthIndex.insert(make_pair(f.getTTH(), i));
-				g_isNeedsUpdateShareSize = true;
+				if (p_base == nullptr || p_base->find(f.getTTH()) == p_base->end())
+				{
+					dir.m_size += f.getSize();
+					g_isNeedsUpdateShareSize = true;
+				}
+				p_index.insert(make_pair(f.getTTH(), makeTTHEntry(p_dir_name, f)));
+				if (&p_index == &g_tth_pending)
+				{
+					g_tth_pending_erase.erase(f.getTTH());
+					updatePendingCountL();
+				}
 			}
 			else
 			{
-				j->second = i;
+				j->second = makeTTHEntry(p_dir_name, f);
 			}
 			dir.addType(f.getFType());
 		}
@@ -1726,15 +1962,7 @@ int ShareManager::run()
 			CFlyLock(g_csShare);
 #endif
 			
-			for (auto i = directories.begin(); i != directories.end(); ++i)
-			{
-				if (checkAttributs(i->m_path))
-				{
-					Directory::Ptr dp = buildTreeL(i->m_path_id, i->m_path, Directory::Ptr(), false);
-					dp->setNameAndLower(i->m_synonym);
-					newDirs.push_back(dp);
-				}
-			}
+			buildTreesParallelL(directories, newDirs);
 		}
 		if (m_sweep_path)
 		{
@@ -1761,7 +1989,7 @@ int ShareManager::run()
 					get_mergeL(*i);
 				}
 			}
-			rebuildIndicesL(false);
+			rebuildIndicesL(true); // the partial lists of the old tree are stale
 		}
 		internalCalcShareSize();
 		m_is_refreshDirs = false;
@@ -1781,9 +2009,11 @@ void ShareManager::getBloom(ByteVector& v, size_t k, size_t m, size_t h)
 	dcdebug("Creating bloom filter, k=%u, m=%u, h=%u\n", unsigned(k), unsigned(m), unsigned(h));
 	HashBloom bloom;
 	bloom.reset(k, m, h);
+	publishPending();
+	const CFlyShareSnapshotPtr l_snapshot = getSnapshot();
+	if (l_snapshot)
 	{
-		CFlyLock(g_csTTHIndex);
-		for (auto i = g_tthIndex.cbegin(); i != g_tthIndex.cend(); ++i)
+		for (auto i = l_snapshot->m_tth_index.cbegin(); i != l_snapshot->m_tth_index.cend(); ++i)
 		{
 			bloom.add(i->first);
 		}
@@ -1904,110 +2134,135 @@ void ShareManager::generateXmlList()
 	m_updateXmlListInProcess.clear(); // [+] IRainman opt.
 }
 
-MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool recurse
+CFlyPartialListStream* ShareManager::generatePartialList(const string& dir, bool recurse
 #ifdef IRAINMAN_INCLUDE_HIDE_SHARE_MOD
-                                                     , bool ishidingShare
+                                                         , bool ishidingShare
 #endif
-                                                    ) const
+                                                        ) const
 {
 	if (dir[0] != '/' || dir[dir.size() - 1] != '/')
 		return 0;
-	string xml = SimpleXML::utf8Header;
-	string tmp;
-	xml += "<FileListing Version=\"1\" CID=\"" + ClientManager::getMyCID().toBase32() + "\" Base=\"" + SimpleXML::escape(dir, tmp, false) + "\" Generator=\"DC++ "  DCVERSIONSTRING  "\">\r\n";
+	// "//" is skipped by the parser below but would not be found by clear_partial_cache
+	const bool l_is_cached = recurse == false && dir.find("//") == string::npos
 #ifdef IRAINMAN_INCLUDE_HIDE_SHARE_MOD
-	if (ishidingShare)
-	{
-		xml += "</FileListing>";
-		return new MemoryInputStream(xml);
-	}
+	                         && ishidingShare == false
 #endif
-	if (recurse == false)
+	                         ;
+	unsigned l_generation = 0;
+	if (l_is_cached)
 	{
 		CFlyFastLock(g_csPartialCache);
 		auto i = g_partial_list_cache.find(dir);
 		if (i != g_partial_list_cache.end())
 		{
-			i->second.second++;
+			i->second.m_hits++;
+			i->second.m_last_access = GET_TICK();
 #ifdef FLYLINKDC_BETA
-			// LogManager::message("Use partial file list cache: " + dir + " count = " + Util::toString(i->second.second));
+			// LogManager::message("Use partial file list cache: " + dir + " count = " + Util::toString(i->second.m_hits));
 #endif // FLYLINKDC_BETA
-			return new MemoryInputStream(i->second.first);
+			return new CFlyPartialListStream(i->second.m_list);
 		}
+		l_generation = g_partial_list_generation;
 	}
-	StringOutputStream sos(xml);
-	
-#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
-	CFlyReadLock(*g_csShare);
-#else
-	CFlyLock(g_csShare);
-#endif
-	
-	
-	string indent = "\t";
-	
-	if (dir == "/")
+	auto l_list = std::make_shared<CFlyPartialList>();
+	string& xml = l_list->m_xml;
+	xml = SimpleXML::utf8Header;
+	string tmp;
+	xml += "<FileListing Version=\"1\" CID=\"" + ClientManager::getMyCID().toBase32() + "\" Base=\"" + SimpleXML::escape(dir, tmp, false) + "\" Generator=\"DC++ "  DCVERSIONSTRING  "\">\r\n";
+#ifdef IRAINMAN_INCLUDE_HIDE_SHARE_MOD
+	if (ishidingShare)
 	{
-		for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
-		{
-			tmp.clear();
-			(*i)->toXmlL(sos, indent, tmp, recurse);
-		}
+		xml += "</FileListing>";
+		return new CFlyPartialListStream(l_list);
 	}
-	else
+#endif
 	{
-		string::size_type i = 1, j = 1;
+		StringOutputStream sos(xml);
 		
-		Directory::Ptr root;
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+		CFlyReadLock(*g_csShare);
+#else
+		CFlyLock(g_csShare);
+#endif
 		
-		bool first = true;
+		string indent = "\t";
 		
-		while ((i = dir.find('/', j)) != string::npos)
+		if (dir == "/")
 		{
-			if (i == j)
+			for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
 			{
-				j++;
-				continue;
+				tmp.clear();
+				(*i)->toXmlL(sos, indent, tmp, recurse);
 			}
+		}
+		else
+		{
+			string::size_type i = 1, j = 1;
 			
-			if (first)
+			Directory::Ptr root;
+			
+			bool first = true;
+			
+			while ((i = dir.find('/', j)) != string::npos)
 			{
-				first = false;
-				const auto it = getByVirtualL(dir.substr(j, i - j));
+				if (i == j)
+				{
+					j++;
+					continue;
+				}
 				
-				if (it == g_list_directories.end())
-					return nullptr;
+				if (first)
+				{
+					first = false;
+					const auto it = getByVirtualL(dir.substr(j, i - j));
 					
-				root = *it;
-			}
-			else
-			{
-				const auto  it2 = root->m_share_directories.find(dir.substr(j, i - j));
-				if (it2 == root->m_share_directories.end())
+					if (it == g_list_directories.end())
+						return nullptr;
+						
+					root = *it;
+				}
+				else
 				{
-					return nullptr;
+					const auto  it2 = root->m_share_directories.find(dir.substr(j, i - j));
+					if (it2 == root->m_share_directories.end())
+					{
+						return nullptr;
+					}
+					
+					root = it2->second;
 				}
+				j = i + 1;
+			}
+			if (!root)
+				return nullptr;
 				
-				root = it2->second;
+			for (auto it2 = root->m_share_directories.cbegin(); it2 != root->m_share_directories.cend(); ++it2)
+			{
+				it2->second->toXmlL(sos, indent, tmp, recurse);
 			}
-			j = i + 1;
-		}
-		if (!root)
-			return nullptr;
-			
-		for (auto it2 = root->m_share_directories.cbegin(); it2 != root->m_share_directories.cend(); ++it2)
-		{
-			it2->second->toXmlL(sos, indent, tmp, recurse);
+			root->filesToXmlL(sos, indent, tmp);
 		}
-		root->filesToXmlL(sos, indent, tmp);
 	}
 	
 	xml += "</FileListing>";
-	if (recurse == false)
+	if (l_is_cached)
 	{
+		// deflate once here instead of ZFilter in every upload of this list
+		if (SETTING(MAX_COMPRESSION) && ZFilter::g_is_disable_compression == false)
+		{
+			uLongf l_zlib_size = compressBound(uLong(xml.size()));
+			std::unique_ptr<Bytef[]> l_zlib(new Bytef[l_zlib_size]);
+			if (compress2(l_zlib.get(), &l_zlib_size, reinterpret_cast<const Bytef*>(xml.data()), uLong(xml.size()), SETTING(MAX_COMPRESSION)) == Z_OK &&
+			        l_zlib_size < xml.size() / 100 * 95) // the same threshold as ZFilter uses
+			{
+				l_list->m_zlib.assign(reinterpret_cast<const char*>(l_zlib.get()), l_zlib_size);
+			}
+		}
 		CFlyFastLock(g_csPartialCache);
-		auto& i = g_partial_list_cache[dir];
-		i.first = xml;
+		if (l_generation == g_partial_list_generation) // the share was not changed while the list was being built
+		{
+			storePartialListL(dir, l_list);
+		}
 	}
 	
 #ifdef _DEBUG
@@ -2022,7 +2277,34 @@ MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool rec
 		//dcassert(0);
 	}
 #endif
-	return new MemoryInputStream(xml);
+	return new CFlyPartialListStream(l_list);
+}
+
+void ShareManager::storePartialListL(const string& p_key, const CFlyPartialListPtr& p_list)
+{
+	const size_t l_size = p_list->m_xml.size() + p_list->m_zlib.size();
+	if (l_size > PARTIAL_LIST_CACHE_LIMIT / 16)
+		return; // one huge directory would push out all the others
+	while (g_partial_list_cache_size + l_size > PARTIAL_LIST_CACHE_LIMIT && !g_partial_list_cache.empty())
+	{
+		auto l_oldest = g_partial_list_cache.begin();
+		for (auto i = g_partial_list_cache.begin(); i != g_partial_list_cache.end(); ++i)
+		{
+			if (i->second.m_last_access < l_oldest->second.m_last_access)
+				l_oldest = i;
+		}
+		g_partial_list_cache_size -= l_oldest->second.m_list->m_xml.size() + l_oldest->second.m_list->m_zlib.size();
+		g_partial_list_cache.erase(l_oldest);
+	}
+	auto& l_item = g_partial_list_cache[p_key];
+	if (l_item.m_list)
+	{
+		g_partial_list_cache_size -= l_item.m_list->m_xml.size() + l_item.m_list->m_zlib.size();
+	}
+	l_item.m_list = p_list;
+	l_item.m_last_access = GET_TICK();
+	l_item.m_hits = 0;
+	g_partial_list_cache_size += l_size;
 }
 
 #define LITERAL(n) n, sizeof(n)-1
@@ -2524,63 +2806,42 @@ void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::L
 }
 bool ShareManager::search_tth(const TTHValue& p_tth, SearchResultList& aResults, bool p_is_check_parent)
 {
-	CFlyLock(g_csTTHIndex);
-	const auto& i = g_tthIndex.find(p_tth);
-	if (i == g_tthIndex.end())
-		return false;
-	dcassert(i->second->getParent());
-	if (p_is_check_parent && !i->second->getParent())
+	CFlyTTHEntry l_file;
+	if (!findTTH(p_tth, &l_file))
 		return false;
-	if (!g_RebuildIndexes) // https://drdump.com/DumpGroup.aspx?DumpGroupID=382746&Login=guest
-	{
-		const auto &l_fileMap = i->second;
-		// TODO -  TTH     SearchResult
-		const SearchResultCore sr(SearchResult::TYPE_FILE, l_fileMap->getSize(), l_fileMap->getParent()->getFullName() + l_fileMap->getName(), l_fileMap->getTTH(), -1/*token*/);
-		incHits();
-		aResults.push_back(sr);
-		return true;
-	}
-	return false;
+	// TODO -  TTH     SearchResult
+	const SearchResultCore sr(SearchResult::TYPE_FILE, l_file.m_size, l_file.getFullName(), p_tth, -1/*token*/);
+	incHits();
+	aResults.push_back(sr);
+	return true;
 }
 bool ShareManager::searchTTHArray(CFlySearchArrayTTH& p_all_search_array, const Client* p_client)
 {
-	bool l_result = true;
-	CFlyLock(g_csTTHIndex);
+	// the snapshot is never changed under us - no need to skip the searches during a rebuild of the indexes
+	CFlyTTHEntry l_file;
 	for (auto j = p_all_search_array.begin(); j != p_all_search_array.end(); ++j)
 	{
-		const auto& i = g_tthIndex.find(j->m_tth);
-		if (i == g_tthIndex.end())
+		if (!findTTH(j->m_tth, &l_file))
 		{
 			continue;
 		}
-		if (!g_RebuildIndexes) // https://drdump.com/DumpGroup.aspx?DumpGroupID=382746&Login=guest
-		{
-			dcassert(i->second->getParent());
-			const auto &l_fileMap = i->second;
-			const SearchResultBaseTTH l_result(SearchResult::TYPE_FILE,
-			                                   l_fileMap->getSize(),
-			                                   l_fileMap->getParent()->getFullName() + l_fileMap->getName(),
-			                                   l_fileMap->getTTH(),
-			                                   UploadManager::getSlots(),
-			                                   UploadManager::getFreeSlots()
-			                                  );
-			incHits();
-			j->m_toSRCommand = std::make_unique<string>(l_result.toSR(*p_client));
-			COMMAND_DEBUG("[TTH]$Search " + j->m_search + " TTH = " + j->m_tth.toBase32(), DebugTask::HUB_IN, p_client->getIpPort());
-		}
-		else
-		{
-			j->m_is_skip = true;
-			l_result = false;
-		}
+		const SearchResultBaseTTH l_result(SearchResult::TYPE_FILE,
+		                                   l_file.m_size,
+		                                   l_file.getFullName(),
+		                                   j->m_tth,
+		                                   UploadManager::getSlots(),
+		                                   UploadManager::getFreeSlots()
+		                                  );
+		incHits();
+		j->m_toSRCommand = std::make_unique<string>(l_result.toSR(*p_client));
+		COMMAND_DEBUG("[TTH]$Search " + j->m_search + " TTH = " + j->m_tth.toBase32(), DebugTask::HUB_IN, p_client->getIpPort());
 	}
-	return l_result;
+	return true;
 }
 
 bool ShareManager::isUnknownTTH(const TTHValue& p_tth)
 {
-	CFlyLock(g_csTTHIndex);
-	return g_tthIndex.find(p_tth) == g_tthIndex.end();
+	return !findTTH(p_tth);
 }
 
 bool ShareManager::isUnknownFile(const string& p_search)
@@ -3011,6 +3272,7 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
                       int64_t aTimeStamp, const CFlyMediaInfo& p_out_media, int64_t p_size) noexcept
 {
 	dcassert(!ClientManager::isBeforeShutdown());
+	string l_adc_path;
 	{
 		CFlyBusy l_busy(g_RebuildIndexes);
 #ifdef FLYLINKDC_USE_RW_LOCK_SHARE
@@ -3026,15 +3288,24 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 				const auto i = d->findFileIterL(l_file_name);
 				if (i != d->m_share_files.end())
 				{
-					CFlyLock(g_csTTHIndex);
-					if (p_root != i->getTTH())
-					{
-						g_tthIndex.erase(i->getTTH());
-					}
+					const TTHValue l_old_tth = i->getTTH();
 					// Get rid of false constness...
 					Directory::ShareFile* f = const_cast<Directory::ShareFile*>(&(*i));
 					f->setTTH(p_root);
-					g_tthIndex.insert(make_pair(f->getTTH(), i));
+					f->setWriteTime(aTimeStamp);
+					{
+						const auto l_entry = makeTTHEntry(std::make_shared<const string>(d->getFullName()), *f);
+						CFlyLock(g_csTTHIndex);
+						if (p_root != l_old_tth)
+						{
+							// findTTH hides the old TTH at once, the snapshot drops it with the next publish
+							g_tth_pending.erase(l_old_tth);
+							g_tth_pending_erase.insert(l_old_tth);
+						}
+						g_tth_pending[p_root] = l_entry;
+						g_tth_pending_erase.erase(p_root);
+						updatePendingCountL();
+					}
 					// TODO g_lastSharedDate =
 					g_isNeedsUpdateShareSize = true;
 				}
@@ -3046,6 +3317,7 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 					dcassert(it.second);
 					auto f = const_cast<Directory::ShareFile*>(&(*it.first));
 					f->initLowerName();
+					f->setWriteTime(aTimeStamp);
 					if (it.second)
 					{
 						auto l_media_ptr = std::make_shared<CFlyMediaInfo>(p_out_media);
@@ -3053,47 +3325,52 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 						f->initMediainfo(l_media_ptr);
 					}
 					{
+						const CFlyShareSnapshotPtr l_snapshot = getSnapshot();
 						CFlyLock(g_csTTHIndex);
 						{
 							CFlyWriteLock(*g_csBloom);
-							updateIndicesFileL(*d, it.first);
+							updateIndicesFileL(*d, std::make_shared<const string>(d->getFullName()), *it.first, g_tth_pending, l_snapshot ? &l_snapshot->m_tth_index : nullptr);
 						}
 					}
 				}
 				setDirty();
 				m_is_forceXmlRefresh = true;
+				l_adc_path = d->getADCPathL();
 			}
 		}
 	}
 	//   
-	clear_partial_cache(fname);
-	clear_tth_path_cache();
+	if (!l_adc_path.empty())
+	{
+		clear_partial_cache(l_adc_path);
+	}
 	internalClearCache(true);
 }
 
-void ShareManager::clear_partial_cache(string p_path)
+void ShareManager::clear_partial_cache(const string& p_adc_path)
 {
 	CFlyFastLock(g_csPartialCache);
-	bool l_is_clear = true;
-	if (!p_path.empty())
+	++g_partial_list_generation;
+	if (p_adc_path.empty())
+	{
+		g_partial_list_cache.clear();
+		g_partial_list_cache_size = 0;
+		return;
+	}
+	dcassert(p_adc_path.size() > 1 && p_adc_path[p_adc_path.size() - 1] == '/');
+	const string l_parent = p_adc_path.substr(0, p_adc_path.rfind('/', p_adc_path.size() - 2) + 1);
+	for (auto i = g_partial_list_cache.begin(); i != g_partial_list_cache.end();)
 	{
-		boost::replace_all(p_path, "\\", "/");
-		for (auto i = g_partial_list_cache.begin(); i != g_partial_list_cache.end();)
+		if (stricmp(i->first, p_adc_path) == 0 || stricmp(i->first, l_parent) == 0)
+		{
+			g_partial_list_cache_size -= i->second.m_list->m_xml.size() + i->second.m_list->m_zlib.size();
+			i = g_partial_list_cache.erase(i);
+		}
+		else
 		{
-			if (p_path.find(i->first) != string::npos)
-			{
-				l_is_clear = false;
-				g_partial_list_cache.erase(i->first);
-				i = g_partial_list_cache.begin();
-				continue;
-			}
 			++i;
 		}
 	}
-	if (l_is_clear)
-	{
-		g_partial_list_cache.clear();
-	}
 }
 
 void ShareManager::on(TimerManagerListener::Second, uint64_t tick) noexcept
@@ -3101,6 +3378,7 @@ void ShareManager::on(TimerManagerListener::Second, uint64_t tick) noexcept
 	if ((++m_count_sec % 10) == 0)
 	{
 		CFlylinkDBManager::getInstance()->flush_hash();
+		publishPending();
 	}
 }
 
@@ -3129,7 +3407,6 @@ void ShareManager::tryFixBadAlloc()
 	}
 	internalClearCache(true);
 	clear_partial_cache("");
-	clear_tth_path_cache();
 	static bool g_is_send_report = false;
 	if (!g_is_send_report)
 	{
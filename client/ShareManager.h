@@ -45,6 +45,60 @@ class SearchResultBaseTTH;
 
 struct ShareLoader;
 typedef std::vector<SearchResultCore> SearchResultList;
+
+/** Partial file list (ADC GET list) kept in the cache together with its zlib form */
+struct CFlyPartialList
+{
+	string m_xml;
+	string m_zlib; // empty when compression is off or does not pay
+};
+typedef std::shared_ptr<const CFlyPartialList> CFlyPartialListPtr;
+
+/**
+ * Reads a partial list without copying it.
+ * After setCompressed() the precompressed bytes are sent as is and the reported source length
+ * is scaled to the XML size, so the upload progress looks the same as with ZFilter.
+ */
+class CFlyPartialListStream : public InputStream
+{
+	public:
+		explicit CFlyPartialListStream(const CFlyPartialListPtr& p_list) : m_list(p_list), m_data(&p_list->m_xml), m_pos(0)
+		{
+		}
+		size_t read(void* p_buf, size_t& p_len) override
+		{
+			const size_t l_len = std::min(p_len, m_data->size() - m_pos);
+			memcpy(p_buf, m_data->data() + m_pos, l_len);
+			if (m_data == &m_list->m_xml)
+			{
+				p_len = l_len;
+			}
+			else
+			{
+				const uint64_t l_xml_size = m_list->m_xml.size();
+				const uint64_t l_zlib_size = m_data->size();
+				p_len = size_t(l_xml_size * (m_pos + l_len) / l_zlib_size - l_xml_size * m_pos / l_zlib_size);
+			}
+			m_pos += l_len;
+			return l_len;
+		}
+		size_t getSize() const
+		{
+			return m_list->m_xml.size();
+		}
+		/** Switches to the precompressed bytes, @return false if there are none (the caller falls back to ZFilter) */
+		bool setCompressed()
+		{
+			if (m_pos || m_list->m_zlib.empty())
+				return false;
+			m_data = &m_list->m_zlib;
+			return true;
+		}
+	private:
+		const CFlyPartialListPtr m_list;
+		const string* m_data;
+		size_t m_pos;
+};
 typedef boost::unordered_set<std::string> QueryNotExistsSet;
 typedef boost::unordered_map<std::string, SearchResultList> QueryCacheMap;
 
@@ -107,7 +161,7 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		
 		static void getDirectories(CFlyDirItemArray& p_dirs);
 		
-		MemoryInputStream* generatePartialList(const string& dir, bool recurse
+		CFlyPartialListStream* generatePartialList(const string& dir, bool recurse
 #ifdef IRAINMAN_INCLUDE_HIDE_SHARE_MOD
 		                                       , bool ishidingShare
 #endif
@@ -257,12 +311,21 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 							{
 								return a.getName() == b.getName();
 							}
+							// lookup by name without constructing a ShareFile
+							size_t operator()(const string& a) const
+							{
+								return std::hash<std::string>()(a);
+							}
+							bool operator()(const string& a, const ShareFile& b) const
+							{
+								return a == b.getName();
+							}
 						};
 						typedef boost::unordered_set<ShareFile, FileTraits, FileTraits> Set;
 						
 						ShareFile(const string& aName, int64_t aSize, Directory::Ptr aParent, const TTHValue& aRoot, uint32_t aHit, uint32_t aTs,
 						          Search::TypeModes aftype) :
-							CFlyLowerName(aName), m_tth(aRoot), size(aSize), m_parent(aParent.get()), m_hit(aHit), ts(aTs), ftype(aftype), m_media_ptr(nullptr)
+							CFlyLowerName(aName), m_tth(aRoot), size(aSize), m_parent(aParent.get()), m_hit(aHit), ts(aTs), ftype(aftype), m_media_ptr(nullptr), m_write_stamp(0)
 						{
 							dcassert(aName.find('\\') == string::npos);
 						}
@@ -283,7 +346,6 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 						{
 							return m_parent->getRealPathL(getName());
 						}
-						
 						GETSET(int64_t, size, Size);
 						GETSET(Directory*, m_parent, Parent);
 						GETC(uint32_t, m_hit, Hit);
@@ -307,9 +369,23 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 						{
 							return ftype;
 						}
+						/** Remembers the last write time of the file to detect unchanged files on the next refresh */
+						void setWriteTime(int64_t p_time)
+						{
+							m_write_stamp = foldWriteTime(p_time);
+						}
+						bool isSameWriteTime(int64_t p_time) const
+						{
+							return m_write_stamp != 0 && m_write_stamp == foldWriteTime(p_time);
+						}
 					private:
+						static uint32_t foldWriteTime(int64_t p_time)
+						{
+							return uint32_t(p_time) ^ uint32_t(uint64_t(p_time) >> 32);
+						}
 						TTHValue m_tth;
 						Search::TypeModes ftype;
+						uint32_t m_write_stamp; // fits into the padding after ftype
 				};
 				
 				DirectoryMap m_share_directories;
@@ -343,6 +419,11 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 				void toXmlL(OutputStream& xmlFile, string& indent, string& tmp2, bool fullList) const;
 				void filesToXmlL(OutputStream& xmlFile, string& indent, string& tmp2) const;
 				
+				const ShareFile* findFileExactL(const string& p_name) const
+				{
+					const auto i = m_share_files.find(p_name, ShareFile::FileTraits(), ShareFile::FileTraits());
+					return i != m_share_files.end() ? &(*i) : nullptr;
+				}
 				ShareFile::Set::const_iterator findFileIterL(const string& aFile) const
 				{
 					const auto l_res = std::find_if(m_share_files.begin(), m_share_files.end(), [&](const ShareFile & p_file) -> bool {return stricmp(p_file.getName(), aFile) == 0;});
@@ -414,17 +495,19 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		
 		static CriticalSection g_csTTHIndex;
 		
-		static FastCriticalSection g_csPartialCache;
-		static std::unordered_map<string, std::pair<string, unsigned>> g_partial_list_cache;
-		static void clear_partial_cache(string p_path);
-		
-		static FastCriticalSection g_csTTHPathCache;
-		static std::unordered_map<TTHValue, std::pair<string, unsigned>> g_tth_path_cache;
-		static void clear_tth_path_cache()
+		struct CFlyPartialCacheItem
 		{
-			CFlyFastLock(g_csTTHPathCache);
-			g_tth_path_cache.clear();
-		}
+			CFlyPartialListPtr m_list;
+			uint64_t m_last_access;
+			unsigned m_hits;
+		};
+		static FastCriticalSection g_csPartialCache;
+		static std::unordered_map<string, CFlyPartialCacheItem> g_partial_list_cache; // key - lower case ADC path
+		static size_t g_partial_list_cache_size;
+		static unsigned g_partial_list_generation;
+		/** Drops the lists of the directory and of its parent (it shows the directory as empty or Incomplete), empty path - everything */
+		static void clear_partial_cache(const string& p_adc_path);
+		static void storePartialListL(const string& p_key, const CFlyPartialListPtr& p_list);
 		
 #ifdef FLYLINKDC_USE_RW_LOCK_SHARE
 		static std::unique_ptr<webrtc::RWLockWrapper> g_csShare;
@@ -445,9 +528,69 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		static ShareMap g_shares;
 		static ShareMap g_lost_shares;
 		
-		typedef boost::unordered_map<TTHValue, Directory::ShareFile::Set::const_iterator> HashFileMap;
+		/**
+		 * Indexed file copied by value: TTHDone changes the ShareFile in place and the trees are changed under g_csShare,
+		 * so the readers of a snapshot never touch them.
+		 */
+		struct CFlyTTHEntry
+		{
+			std::shared_ptr<const string> m_dir; // getFullName() of the directory, shared by its files
+			string m_name;
+			int64_t m_size;
+			string getFullName() const
+			{
+				return *m_dir + m_name;
+			}
+			string getADCPath() const;
+			/** Real path by the shares of the snapshot cached by the calling thread, no g_csShare */
+			string getRealPath() const;
+		};
+		static CFlyTTHEntry makeTTHEntry(const std::shared_ptr<const string>& p_dir, const Directory::ShareFile& p_file)
+		{
+			CFlyTTHEntry l_entry;
+			l_entry.m_dir = p_dir;
+			l_entry.m_name = p_file.getName();
+			l_entry.m_size = p_file.getSize();
+			return l_entry;
+		}
+		typedef boost::unordered_map<TTHValue, CFlyTTHEntry> HashFileMap;
 		
-		static HashFileMap g_tthIndex;
+		/**
+		 * Read-only copy of the TTH index for the lock-free read path (uploads, TTH searches, isTTHShared).
+		 * A published snapshot is never changed: files hashed later are collected in g_tth_pending (old TTHs of rehashed
+		 * files in g_tth_pending_erase) and folded into a new snapshot by the timer, structural changes publish at once.
+		 * The snapshot does not refer to the trees, so a thread which keeps an old one holds only values.
+		 */
+		struct CFlyShareSnapshot
+		{
+			HashFileMap m_tth_index;
+			ShareMap m_shares;
+		};
+		typedef std::shared_ptr<const CFlyShareSnapshot> CFlyShareSnapshotPtr;
+		static CFlyShareSnapshotPtr g_share_snapshot;
+		static boost::atomic<uint32_t> g_share_snapshot_version; // changed under g_csTTHIndex after every publish
+		static HashFileMap g_tth_pending; // under g_csTTHIndex
+		static boost::unordered_set<TTHValue> g_tth_pending_erase; // under g_csTTHIndex
+		static boost::atomic<size_t> g_tth_pending_count; // size of both
+		static void updatePendingCountL()
+		{
+			g_tth_pending_count = g_tth_pending.size() + g_tth_pending_erase.size();
+		}
+		static CFlyShareSnapshotPtr getSnapshot()
+		{
+			return std::atomic_load(&g_share_snapshot);
+		}
+		/**
+		 * Snapshot cached by the calling thread: std::atomic_load of a shared_ptr takes a global spin lock and
+		 * changes the reference counter, so it is repeated only when the version shows a new publish.
+		 * The pointer is valid until the next call in the same thread, a thread without lookups keeps its old copy alive.
+		 */
+		static const CFlyShareSnapshot* getThreadSnapshot();
+		/** @param p_entry receives a copy of the found file (nullptr - only check) */
+		static bool findTTH(const TTHValue& p_tth, CFlyTTHEntry* p_entry = nullptr);
+		/** Publishes a new snapshot: p_index replaces the whole index (nullptr - the current one plus pending changes) */
+		static void publishSnapshotL(HashFileMap* p_index);
+		static void publishPending();
 		static unsigned g_lastSharedFiles;
 		static QueryNotExistsSet g_file_not_exists_set;
 		static QueryCacheMap g_file_cache_map;
@@ -473,7 +616,39 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		string findFileAndRealPath(const string& virtualFile, TTHValue& p_tth, bool p_is_fetch_tth) const;
 		void checkShutdown(const string& virtualFile) const;
 		
-		Directory::Ptr buildTreeL(__int64& p_path_id, const string& p_path, const Directory::Ptr& p_parent, bool p_is_job);
+		struct CFlyShareScanStats
+		{
+			CFlyShareScanStats() : m_dirs(0), m_dirs_without_db(0), m_files(0), m_files_unchanged(0), m_last_shared_date(0)
+			{
+			}
+			uint32_t m_dirs;
+			uint32_t m_dirs_without_db;
+			uint32_t m_files;
+			uint32_t m_files_unchanged;
+			int64_t m_last_shared_date;
+			void add(const CFlyShareScanStats& p_stats)
+			{
+				m_dirs += p_stats.m_dirs;
+				m_dirs_without_db += p_stats.m_dirs_without_db;
+				m_files += p_stats.m_files;
+				m_files_unchanged += p_stats.m_files_unchanged;
+				m_last_shared_date = std::max(m_last_shared_date, p_stats.m_last_shared_date);
+			}
+			void apply() const
+			{
+				if (m_last_shared_date > g_lastSharedDate)
+					g_lastSharedDate = m_last_shared_date;
+			}
+		};
+		/**
+		 * @param p_prev the same directory from the previous refresh (or nullptr) - files with the same name,
+		 * size and write time are taken from it without asking the database
+		 */
+		Directory::Ptr buildTreeL(__int64& p_path_id, const string& p_path, const Directory::Ptr& p_parent, bool p_is_job,
+		                          const Directory* p_prev, CFlyShareScanStats& p_stats);
+		void buildTreesParallelL(CFlyDirItemArray& p_directories, DirList& p_new_dirs);
+		/** Trees of the share roots (lower real path) built by the last full refresh, used to skip unchanged files */
+		std::unordered_map<string, Directory::Ptr> m_prev_roots;
 #ifdef FLYLINKDC_USE_ONLINE_SWEEP_DB
 		bool m_sweep_guard;
 #endif
@@ -486,8 +661,8 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		//[~]IRainman
 		void rebuildIndicesL(bool p_is_clear_cache);
 		
-		bool updateIndicesDirL(Directory& aDirectory);
-		bool updateIndicesFileL(Directory& dir, const Directory::ShareFile::Set::iterator& i);
+		bool updateIndicesDirL(Directory& aDirectory, HashFileMap& p_index, const HashFileMap* p_base);
+		bool updateIndicesFileL(Directory& dir, const std::shared_ptr<const string>& p_dir_name, const Directory::ShareFile& f, HashFileMap& p_index, const HashFileMap* p_base);
 		
 		Directory::Ptr get_mergeL(const Directory::Ptr& directory);
 		
@@ -497,6 +672,7 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		static DirList::const_iterator getByVirtualL(const string& virtualName);
 		pair<Directory::Ptr, string> splitVirtualL(const string& virtualPath) const;
 		static string findRealRootL(const string& virtualRoot, const string& virtualLeaf);
+		static string findRealRoot(const ShareMap& p_shares, const string& virtualRoot, const string& virtualLeaf);
 		
 		static Directory::Ptr getDirectoryL(const string& fname);
 		
@@ -238,6 +238,7 @@ enum Strings   // @DontAdd
 	CMD_FIRST_LINE, // "\t\t\t\t\t HELP \t\t\t\t\t\t\t\t"
 	CMD_FLYLINKDC, // "Print FlylinkDC++ version to chat"
 	CMD_GETLIST, // "Get (user) File-list"
+	CMD_HASHBENCH, // "Measure the speed of the MD5, Tiger and SHA-1 backends (result in the system log)"
 	CMD_HELP_INFO, // "\t\tFor more help please visit FlylinkDC++ Forums (Help -> Forums)"
 	CMD_IGNORELIST, // "Show Ignore-list in chat"
 	CMD_JOIN_HUB, // "Joins hub with address #"
@@ -1383,6 +1384,7 @@ enum Strings   // @DontAdd
 	SETTINGS_MAX_COMPRESS, // "Max compression level"
 	SETTINGS_MAX_HASH_SPEED, // "Max hash speed"
 	SETTINGS_MAX_TAB_ROWS, // "Max tab rows"
+	SETTINGS_MD5_USE_OPENSSL, // "Compute MD5 with OpenSSL (see /hashbench)"
 	SETTINGS_MENUHEADER_EXAMPLE, // "Sample text"
 	SETTINGS_MESSAGES, // "Messages"
 	SETTINGS_MINIMIZE_ON_STARTUP, // "Minimize at program startup"
@@ -1486,6 +1488,7 @@ enum Strings   // @DontAdd
 	SETTINGS_TEXT_STYLES, // "Colors & Fonts"
 	SETTINGS_THEME_EXPORT, // "Export theme"
 	SETTINGS_THEME_IMPORT, // "Import theme"
+	SETTINGS_THROTTLE_TORRENT_WEIGHT, // "BitTorrent share of the limits"
 	SETTINGS_TIME_STAMPS, // "Show timestamps in chat by default"
 	SETTINGS_TIME_STAMPS_FORMAT, // "Set timestamps"
 	SETTINGS_TLS_PORT, // "TLS"
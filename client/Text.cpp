@@ -40,9 +40,28 @@ const string g_code1251 = "Russian_Russia.1251"; //[+]FlylinkDC++ Team optimizat
 const string g_code1252 = "English_United Kingdom.1252"; //[+]FlylinkDC++ Team optimization
 
 string g_systemCharset;
+wchar_t g_lowerTable[0x10000];
+
+static void initLowerTable()
+{
+	// one call for the whole BMP instead of CharLowerW for every character
+	for (size_t i = 1; i < 0x10000; ++i)
+	{
+		g_lowerTable[i] = static_cast<wchar_t>(i);
+	}
+#ifdef _WIN32
+	CharLowerBuffW(g_lowerTable + 1, 0x10000 - 1);
+#else
+	for (size_t i = 1; i < 0x10000; ++i)
+	{
+		g_lowerTable[i] = static_cast<wchar_t>(towlower(g_lowerTable[i]));
+	}
+#endif
+}
 
 void initialize()
 {
+	initLowerTable();
 	setlocale(LC_ALL, "");
 	char *ctype = setlocale(LC_CTYPE, NULL);
 	if (ctype)
@@ -175,23 +194,24 @@ int utf8ToWc(const char* str, wchar_t& c)
 	}
 }
 
-static inline void wcToUtf8(wchar_t c, string& str)
+static inline char* wcToUtf8(wchar_t c, char* p_out)
 {
 	if (c >= 0x0800)
 	{
-		str += (char)(0x80 | 0x40 | 0x20 | (c >> 12));
-		str += (char)(0x80 | ((c >> 6) & 0x3f));
-		str += (char)(0x80 | (c & 0x3f));
+		*p_out++ = (char)(0x80 | 0x40 | 0x20 | (c >> 12));
+		*p_out++ = (char)(0x80 | ((c >> 6) & 0x3f));
+		*p_out++ = (char)(0x80 | (c & 0x3f));
 	}
 	else if (c >= 0x0080)
 	{
-		str += (char)(0x80 | 0x40 | (c >> 6));
-		str += (char)(0x80 | (c & 0x3f));
+		*p_out++ = (char)(0x80 | 0x40 | (c >> 6));
+		*p_out++ = (char)(0x80 | (c & 0x3f));
 	}
 	else
 	{
-		str += (char)c;
+		*p_out++ = (char)c;
 	}
+	return p_out;
 }
 
 const string& acpToUtf8(const string& str, string& tmp, const string& fromCharset) noexcept
@@ -335,29 +355,58 @@ const wstring& toLower(const wstring& str, wstring& tmp) noexcept
 	return tmp;
 }
 
-const string& toLower(const string& str, string& tmp) noexcept
+size_t toLower(const char* p_str, size_t p_len, char* p_out) noexcept
 {
-	if (str.empty())
-		return Util::emptyString;
-		
-	tmp.clear();
-	tmp.reserve(str.length() + 1);
-	const char* end = &str[0] + str.length();
-	for (const char* p = &str[0]; p < end;)
+	const char* p = p_str;
+	const char* const l_end = p_str + p_len;
+	char* l_out = p_out;
+	while (p < l_end)
 	{
+		// ASCII - 8 characters per step: set 0x20 in every byte from 'A' to 'Z'
+		while (l_end - p >= 8)
+		{
+			uint64_t l_word;
+			memcpy(&l_word, p, 8);
+			if (l_word & 0x8080808080808080ULL)
+				break;
+			const uint64_t l_upper = ((l_word + 0x2525252525252525ULL) ^ (l_word + 0x3F3F3F3F3F3F3F3FULL)) & 0x8080808080808080ULL;
+			l_word |= l_upper >> 2;
+			memcpy(l_out, &l_word, 8);
+			p += 8;
+			l_out += 8;
+		}
+		if (p == l_end)
+			break;
+		const uint8_t l_char = (uint8_t)*p;
+		if (l_char < 0x80)
+		{
+			*l_out++ = (char)(uint8_t(l_char - 'A') < 26 ? l_char + 0x20 : l_char);
+			++p;
+			continue;
+		}
 		wchar_t c = 0;
 		const int n = utf8ToWc(p, c);
 		if (n < 0)
 		{
-			tmp += '_';
+			*l_out++ = '_';
 			p += abs(n);
 		}
 		else
 		{
 			p += n;
-			wcToUtf8(toLower(c), tmp);
+			l_out = wcToUtf8(toLower(c), l_out);
 		}
 	}
+	return l_out - p_out;
+}
+
+const string& toLower(const string& str, string& tmp) noexcept
+{
+	if (str.empty())
+		return Util::emptyString;
+		
+	tmp.resize(str.length() + str.length() / 2);
+	tmp.resize(toLower(str.c_str(), str.length(), &tmp[0]));
 	return tmp;
 }
 const string& toLabel(const string& str, string& tmp) noexcept
@@ -43,6 +43,7 @@ extern const string g_utf8;
 extern const string g_code1251;
 extern const string g_code1252;
 extern string g_systemCharset;
+extern wchar_t g_lowerTable[0x10000]; // lowercase of every BMP character, filled by initialize() (0 - not filled yet)
 
 void initialize();
 
@@ -137,6 +138,12 @@ inline char asciiToLower(uint8_t p_c)
 
 inline wchar_t toLower(wchar_t c) noexcept
 {
+	if (static_cast<uint32_t>(c) < 0x10000)
+	{
+		const wchar_t l_lower = g_lowerTable[static_cast<uint32_t>(c)];
+		if (l_lower)
+			return l_lower;
+	}
 #ifdef _WIN32
 	return static_cast<wchar_t>(reinterpret_cast<ptrdiff_t>(CharLowerW((LPWSTR)c)));
 #else
@@ -151,6 +158,13 @@ inline wstring toLower(const wstring& str) noexcept
 	return toLower(str, tmp);
 }
 
+/**
+ * Lowercases UTF-8 without allocations, invalid sequences are replaced with '_'.
+ * @param p_str must be followed by '\0' (as string::c_str())
+ * @param p_out buffer of at least p_len + p_len / 2 bytes (U+023A -> U+2C65 grows from 2 to 3 bytes)
+ * @return Number of bytes written to p_out
+ */
+size_t toLower(const char* p_str, size_t p_len, char* p_out) noexcept;
 const string& toLower(const string& str, string& tmp) noexcept;
 inline string toLower(const string& str) noexcept
 {
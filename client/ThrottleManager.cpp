@@ -22,6 +22,7 @@
 #include "DownloadManager.h"
 
 #include "UploadManager.h"
+#include "CFlyBandwidthSplit.h"
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 #ifdef FLYLINKDC_USE_BOOST_LOCK
@@ -32,8 +33,9 @@
 
 #define CONDWAIT_TIMEOUT        250
 
-ThrottleManager::ThrottleManager(void) : downTokens(0), upTokens(0), downLimit(0), upLimit(0)
+ThrottleManager::ThrottleManager(void) : downTokens(0), upTokens(0), downLimit(0), upLimit(0), m_dc_down_limit(0), m_dc_up_limit(0)
 {
+	memzero(&m_stat, sizeof(m_stat));
 }
 
 ThrottleManager::~ThrottleManager(void)
@@ -58,7 +60,7 @@ int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
 	
 	if (downTokens > 0)
 	{
-		const size_t slice = getDownloadLimitInBytes() / downs;//[!]IRainman SpeedLimiter
+		const size_t slice = m_dc_down_limit / downs;//[!]IRainman SpeedLimiter
 		size_t readSize = min(slice, min(len, downTokens));
 		
 		// read from socket
@@ -118,7 +120,7 @@ int ThrottleManager::write(Socket* p_sock, const void* p_buffer, size_t& p_len)
 		if (upTokens > 0)
 		{
 			const size_t ups = UploadManager::getUploadCount();
-			const size_t slice = getUploadLimitInBytes() / (ups ? ups : 1);
+			const size_t slice = m_dc_up_limit / (ups ? ups : 1);
 			p_len = min(slice, min(p_len, upTokens));
 			
 			// Pour buckets of the calculated number of bytes,
@@ -151,24 +153,51 @@ void ThrottleManager::on(TimerManagerListener::Second, uint64_t /*aTick*/) noexc
 	{
 		downLimit = 0;
 		upLimit = 0;
-		return;
 	}
+	rebalance();
 	// readd tokens
 	if (downLimit > 0)
 	{
 		boost::lock_guard<boost::mutex> lock(downMutex);
-		downTokens = downLimit;
+		downTokens = m_dc_down_limit;
 		downCond.notify_all();
 	}
 	
 	if (upLimit > 0)
 	{
 		boost::lock_guard<boost::mutex> lock(upMutex);
-		upTokens = upLimit;
+		upTokens = m_dc_up_limit;
 		upCond.notify_all();
 	}
 }
 
+void ThrottleManager::rebalance()
+{
+	TrafficStat l_stat;
+	l_stat.m_dc_download = DownloadManager::getRunningAverage();
+	l_stat.m_dc_upload = UploadManager::getRunningAverage();
+#ifdef FLYLINKDC_USE_TORRENT
+	l_stat.m_torrent_download = DownloadManager::getInstance()->get_torrent_download_rate();
+	l_stat.m_torrent_upload = DownloadManager::getInstance()->get_torrent_upload_rate();
+#else
+	l_stat.m_torrent_download = 0;
+	l_stat.m_torrent_upload = 0;
+#endif
+	const int l_torrent_weight = SETTING(THROTTLE_TORRENT_WEIGHT);
+	int64_t l_dc_down_limit;
+	int64_t l_dc_up_limit;
+	CFlyBandwidthSplit::split(downLimit, l_torrent_weight, l_stat.m_dc_download, l_stat.m_torrent_download, l_dc_down_limit, l_stat.m_torrent_download_limit);
+	CFlyBandwidthSplit::split(upLimit, l_torrent_weight, l_stat.m_dc_upload, l_stat.m_torrent_upload, l_dc_up_limit, l_stat.m_torrent_upload_limit);
+	m_dc_down_limit = size_t(l_dc_down_limit);
+	m_dc_up_limit = size_t(l_dc_up_limit);
+#ifdef FLYLINKDC_USE_TORRENT
+	DownloadManager::getInstance()->set_torrent_rate_limit(int(std::min<int64_t>(l_stat.m_torrent_download_limit, INT_MAX)),
+	                                                       int(std::min<int64_t>(l_stat.m_torrent_upload_limit, INT_MAX)));
+#endif
+	CFlyFastLock(m_stat_cs);
+	m_stat = l_stat;
+}
+
 //[+]IRainman SpeedLimiter
 void ThrottleManager::on(TimerManagerListener::Minute, uint64_t /*aTick*/) noexcept
 {
@@ -30,6 +30,8 @@
 /**
  * Manager for throttling traffic flow speed.
  * Inspired by Token Bucket algorithm: http://en.wikipedia.org/wiki/Token_bucket
+ * The limits are shared by DC and BitTorrent transfers: every second the budget is split
+ * between DC tokens and the libtorrent session limits according to THROTTLE_TORRENT_WEIGHT.
  */
 class ThrottleManager :
 	public Singleton<ThrottleManager>, private TimerManagerListener
@@ -63,6 +65,7 @@ class ThrottleManager :
 		void setDownloadLimit(size_t p_NewDownLimit) //[+]IRainman SpeedLimiter
 		{
 			downLimit = p_NewDownLimit * 1024;
+			m_dc_down_limit = downLimit; // until the next rebalance()
 		}
 		
 		/*
@@ -81,10 +84,29 @@ class ThrottleManager :
 		void setUploadLimit(size_t p_NewUploadLimit) //[+]IRainman SpeedLimiter
 		{
 			upLimit = p_NewUploadLimit * 1024;
+			m_dc_up_limit = upLimit;
 		}
 		
 		void updateLimits();// [+] IRainman SpeedLimiter
 		
+		/*
+		 * Speeds (Bytes/s) of the last second and the limits given to BitTorrent (0 - unlimited)
+		 */
+		struct TrafficStat
+		{
+			int64_t m_dc_download;
+			int64_t m_dc_upload;
+			int64_t m_torrent_download;
+			int64_t m_torrent_upload;
+			int64_t m_torrent_download_limit;
+			int64_t m_torrent_upload_limit;
+		};
+		TrafficStat getTrafficStat() const
+		{
+			CFlyFastLock(m_stat_cs);
+			return m_stat;
+		}
+		
 		void startup()
 		{
 			TimerManager::getInstance()->addListener(this);
@@ -103,6 +125,14 @@ class ThrottleManager :
 		boost::condition_variable   upCond;
 		boost::mutex                upMutex;
 		
+		// DC part of downLimit/upLimit, recalculated every second
+		size_t             m_dc_down_limit;
+		size_t             m_dc_up_limit;
+		
+		TrafficStat m_stat;
+		mutable FastCriticalSection m_stat_cs;
+		void rebalance();
+		
 		friend class Singleton<ThrottleManager>;
 		
 		ThrottleManager(void);
@@ -49,6 +49,85 @@ std::unique_ptr<webrtc::RWLockWrapper> UploadManager::g_csBans = std::unique_ptr
 std::unique_ptr<webrtc::RWLockWrapper> UploadManager::g_csUploadsDelay = std::unique_ptr<webrtc::RWLockWrapper>(webrtc::RWLockWrapper::CreateRWLock());
 std::unique_ptr<webrtc::RWLockWrapper> UploadManager::g_csReservedSlots = std::unique_ptr<webrtc::RWLockWrapper> (webrtc::RWLockWrapper::CreateRWLock());
 int64_t UploadManager::g_runningAverage;
+UploadManager::SlotStat UploadManager::g_slot_stat;
+FastCriticalSection UploadManager::g_csSlotStat;
+
+bool WaitingUser::isMiniSlotRequest() const
+{
+	static const string g_list_ext = ".xml.bz2";
+	const int64_t l_mini_size = int64_t(SETTING(SET_MINISLOT_SIZE)) * 1024;
+	for (auto i = m_waiting_files.cbegin(); i != m_waiting_files.cend(); ++i)
+	{
+		const string& l_file = (*i)->getFile();
+		const bool l_is_file_list = l_file.size() > g_list_ext.size() && l_file.compare(l_file.size() - g_list_ext.size(), g_list_ext.size(), g_list_ext) == 0;
+		if ((*i)->getSize() > l_mini_size && !l_is_file_list)
+		{
+			return false;
+		}
+	}
+	return !m_waiting_files.empty();
+}
+
+WaitingUserQueue::iterator WaitingUserQueue::find(const UserPtr& p_user)
+{
+	const auto i = m_index.find(p_user);
+	return i != m_index.end() ? i->second : m_users.end();
+}
+
+WaitingUserQueue::const_iterator WaitingUserQueue::find(const UserPtr& p_user) const
+{
+	const auto i = m_index.find(p_user);
+	return i != m_index.end() ? const_iterator(i->second) : m_users.cend();
+}
+
+size_t WaitingUserQueue::getPosition(const_iterator p_it) const
+{
+	return m_order.getPosition(p_it->getUser());
+}
+
+void WaitingUserQueue::push_back(const WaitingUser& p_wu)
+{
+	dcassert(m_index.find(p_wu.getUser()) == m_index.end());
+	const auto l_it = m_users.insert(m_users.end(), p_wu);
+	m_index.insert(std::make_pair(p_wu.getUser(), l_it));
+	const bool l_is_fair = SETTING(UPLOAD_QUEUE_POLICY) == POLICY_FAIR;
+	m_order.push(p_wu.getUser(), l_is_fair && !p_wu.isMiniSlotRequest() ? 1 : 0, l_is_fair);
+}
+
+void WaitingUserQueue::update(iterator p_it)
+{
+	const bool l_is_fair = SETTING(UPLOAD_QUEUE_POLICY) == POLICY_FAIR;
+	m_order.update(p_it->getUser(), l_is_fair && !p_it->isMiniSlotRequest() ? 1 : 0, l_is_fair);
+}
+
+void WaitingUserQueue::erase(const_iterator p_it)
+{
+	m_order.erase(p_it->getUser());
+	m_index.erase(p_it->getUser());
+	m_users.erase(p_it);
+}
+
+void WaitingUserQueue::clear()
+{
+	m_order.clear();
+	m_index.clear();
+	m_users.clear();
+}
+
+const WaitingUser& WaitingUserQueue::front() const
+{
+	dcassert(!m_order.empty());
+	return *m_index.find(m_order.front())->second;
+}
+
+void WaitingUserQueue::pop_front()
+{
+	dcassert(!m_order.empty());
+	if (!m_order.empty())
+	{
+		erase(m_index.find(m_order.front())->second);
+	}
+}
 
 UploadManager::UploadManager() noexcept :
 	extra(0), lastGrant(0), m_lastFreeSlots(-1),
@@ -62,6 +141,7 @@ UploadManager::~UploadManager()
 {
 	TimerManager::getInstance()->removeListener(this);
 	ClientManager::getInstance()->removeListener(this);
+	m_prefetcher.waitShutdown();
 	{
 		CFlyLock(m_csQueue); // [!] IRainman opt.
 		m_slotQueue.clear(); // TODO -      shutdown
@@ -470,7 +550,7 @@ bool UploadManager::prepareFile(UserConnection* aSource, const string& aType, co
 		else if (l_is_TypePartialTree)
 		{
 			// Partial file list
-			MemoryInputStream* mis = ShareManager::getInstance()->generatePartialList(aFile, listRecursive
+			CFlyPartialListStream* mis = ShareManager::getInstance()->generatePartialList(aFile, listRecursive
 #ifdef IRAINMAN_INCLUDE_HIDE_SHARE_MOD
 			                                                                          , ishidingShare
 #endif
@@ -718,6 +798,12 @@ ok: //[!] TODO 
 	u->setFileSize(fileSize);
 	u->setType(type);
 	
+	if (type == Transfer::TYPE_FILE && !l_is_partial && SETTING(UPLOAD_PREFETCH_SIZE) > 0 && start + size < fileSize)
+	{
+		// the peer will most likely ask for the following chunk right after this one
+		m_prefetcher.prefetch(sourceFile, start + size, min(int64_t(SETTING(UPLOAD_PREFETCH_SIZE)) * 1024, fileSize - (start + size)));
+	}
+	
 	{
 		CFlyWriteLock(*g_csUploadsDelay);
 		g_uploads.push_back(u);
@@ -818,6 +904,10 @@ void UploadManager::removeUpload(UploadPtr& aUpload, bool delay)
 		g_uploads.erase(remove(g_uploads.begin(), g_uploads.end(), aUpload), g_uploads.end());
 	}
 	decreaseUserConnectionAmountL(aUpload->getUser());// [+] IRainman SpeedLimiter
+	if (aUpload->getType() == Transfer::TYPE_FILE && !ClientManager::isBeforeShutdown())
+	{
+		UploadManager::getInstance()->m_slotQueue.addServedBytes(aUpload->getUser(), aUpload->getPos());
+	}
 	
 	if (delay)
 	{
@@ -842,10 +932,7 @@ void UploadManager::reserveSlot(const HintedUser& hintedUser, uint64_t aTime)
 	{
 		CFlyLock(m_csQueue); // [+] IRainman opt.
 		// find user in uploadqueue to connect with correct token
-		auto it = std::find_if(m_slotQueue.cbegin(), m_slotQueue.cend(), [&](const UserPtr & u)
-		{
-			return u == hintedUser.user;
-		});
+		const auto it = m_slotQueue.find(hintedUser.user);
 		if (it != m_slotQueue.cend())
 		{
 			bool l_is_active_client;
@@ -969,7 +1056,11 @@ void UploadManager::on(AdcCommand::GET, UserConnection* aSource, const AdcComman
 				{
 					try
 					{
-						u->setReadStream(new FilteredInputStream<ZFilter, true>(u->getReadStream()));
+						// cached partial lists carry the zlib bytes made once for all requesters
+						if (u->getType() != Transfer::TYPE_PARTIAL_LIST || !static_cast<CFlyPartialListStream*>(u->getReadStream())->setCompressed())
+						{
+							u->setReadStream(new FilteredInputStream<ZFilter, true>(u->getReadStream()));
+						}
 						u->setFlag(Upload::FLAG_ZUPLOAD);
 						cmd.addParam("ZL1");
 					}
@@ -1061,9 +1152,10 @@ size_t UploadManager::addFailedUpload(const UserConnection* aSource, const strin
 	
 	CFlyLock(m_csQueue); // [+] IRainman opt.
 	
-	auto it = std::find_if(m_slotQueue.begin(), m_slotQueue.end(), [&](const UserPtr & u) -> bool { ++queue_position; return u == aSource->getUser(); });
+	auto it = m_slotQueue.find(aSource->getUser());
 	if (it != m_slotQueue.end())
 	{
+		queue_position = m_slotQueue.getPosition(it);
 		it->setToken(aSource->getUserConnectionToken());
 		// https://crash-server.com/DumpGroup.aspx?ClientID=guest&DumpGroupID=130703
 		for (auto i = it->m_waiting_files.cbegin(); i != it->m_waiting_files.cend(); ++i) //TODO https://crash-server.com/DumpGroup.aspx?ClientID=guest&DumpGroupID=128318
@@ -1078,12 +1170,13 @@ size_t UploadManager::addFailedUpload(const UserConnection* aSource, const strin
 	UploadQueueItemPtr uqi(new UploadQueueItem(aSource->getHintedUser(), file, pos, size));
 	if (it == m_slotQueue.end())
 	{
-		++queue_position;
 		m_slotQueue.push_back(WaitingUser(aSource->getHintedUser(), aSource->getUserConnectionToken(), uqi));
+		queue_position = m_slotQueue.getPosition(m_slotQueue.find(aSource->getUser()));
 	}
 	else
 	{
 		it->m_waiting_files.push_back(uqi);
+		m_slotQueue.update(it);
 	}
 	// Crash https://www.crash-server.com/Problem.aspx?ClientID=guest&ProblemID=29270
 	if (g_count_WaitingUsersFrame)
@@ -1106,11 +1199,8 @@ void UploadManager::clearWaitingFilesL(const WaitingUser& p_wu)
 void UploadManager::clearUserFilesL(const UserPtr& aUser)
 {
 	//dcassert(!ClientManager::isBeforeShutdown());
-	auto it = std::find_if(m_slotQueue.cbegin(), m_slotQueue.cend(), [&](const UserPtr & u)
-	{
-		return u == aUser;
-	});
-	if (it != m_slotQueue.end())
+	const auto it = m_slotQueue.find(aUser);
+	if (it != m_slotQueue.cend())
 	{
 		clearWaitingFilesL(*it);
 		if (g_count_WaitingUsersFrame && !ClientManager::isBeforeShutdown())
@@ -1207,6 +1297,7 @@ void UploadManager::notifyQueuedUsers(int64_t p_tick)
 				{
 					m_notifiedUsers[wu.getUser()] = p_tick;
 					l_notifyList.push_back(wu);
+					registerGrant(wu, p_tick);
 					freeslots--;
 				}
 				m_slotQueue.pop_front();
@@ -1221,6 +1312,79 @@ void UploadManager::notifyQueuedUsers(int64_t p_tick)
 	
 }
 
+void UploadManager::registerGrant(const WaitingUser& p_wu, uint64_t p_tick)
+{
+	const uint64_t l_wait = p_tick > p_wu.getEnqueueTick() ? p_tick - p_wu.getEnqueueTick() : 0;
+	const bool l_is_mini = p_wu.isMiniSlotRequest();
+	CFlyFastLock(g_csSlotStat);
+	++g_slot_stat.m_granted;
+	if (l_is_mini)
+	{
+		++g_slot_stat.m_granted_mini;
+	}
+	g_slot_stat.m_wait_total += l_wait;
+	g_slot_stat.m_wait_max = max(g_slot_stat.m_wait_max, l_wait);
+}
+
+UploadManager::SlotStat UploadManager::getSlotStat()
+{
+	CFlyFastLock(g_csSlotStat);
+	return g_slot_stat;
+}
+
+uint64_t UploadManager::getAverageQueueWait()
+{
+	CFlyFastLock(g_csSlotStat);
+	return g_slot_stat.m_granted ? g_slot_stat.m_wait_total / g_slot_stat.m_granted : 0;
+}
+
+unsigned UploadManager::getSlotUtilisation()
+{
+	CFlyFastLock(g_csSlotStat);
+	return g_slot_stat.m_slot_samples ? unsigned(g_slot_stat.m_slot_busy * 100 / g_slot_stat.m_slot_samples) : 0;
+}
+
+void UploadManager::UploadPrefetcher::prefetch(const string& p_path, int64_t p_pos, int64_t p_size)
+{
+	// don't let a burst of chunk requests pile up more than a few read-aheads
+	const int64_t l_limit = int64_t(SETTING(UPLOAD_PREFETCH_SIZE)) * 1024 * 4;
+	if (p_size <= 0)
+		return;
+	// reserve the bytes in one step, two concurrent requests must not both pass the check
+	int64_t l_pending = m_pending.load();
+	do
+	{
+		if (l_pending + p_size > l_limit)
+			return;
+	}
+	while (!m_pending.compare_exchange_weak(l_pending, l_pending + p_size));
+	addTask(PrefetchTask(p_path, p_pos, p_size));
+}
+
+void UploadManager::UploadPrefetcher::execute(const PrefetchTask& p_task)
+{
+	try
+	{
+		// read through the system cache, the data itself is not needed
+		File l_file(p_task.m_path, File::READ, File::OPEN | File::SHARED);
+		l_file.setPos(p_task.m_pos);
+		std::unique_ptr<uint8_t[]> l_buf(new uint8_t[64 * 1024]);
+		for (int64_t l_left = p_task.m_size; l_left > 0 && !ClientManager::isBeforeShutdown();)
+		{
+			size_t l_len = size_t(min(l_left, int64_t(64 * 1024)));
+			l_file.read(l_buf.get(), l_len);
+			if (l_len == 0)
+				break;
+			l_left -= l_len;
+		}
+	}
+	catch (const FileException& e)
+	{
+		dcdebug("UploadPrefetcher: %s %s\n", p_task.m_path.c_str(), e.getError().c_str());
+	}
+	m_pending -= p_task.m_size;
+}
+
 void UploadManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
@@ -1234,6 +1398,7 @@ void UploadManager::on(TimerManagerListener::Minute, uint64_t aTick) noexcept
 		}
 #endif
 		testSlotTimeout(aTick);//[!] FlylinkDC
+		m_slotQueue.decayServedBytes();
 		
 		{
 			CFlyLock(m_csQueue); // [+] IRainman opt.
@@ -1425,6 +1590,12 @@ void UploadManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept
 			}
 			g_runningAverage = l_currentSpeed; // [+] IRainman refactoring transfer mechanism
 		}
+		{
+			const int l_slots = getSlots();
+			CFlyFastLock(g_csSlotStat);
+			g_slot_stat.m_slot_samples += l_slots;
+			g_slot_stat.m_slot_busy += min(g_running, l_slots);
+		}
 		if (!l_tickList.empty())
 		{
 			fly_fire1(UploadManagerListener::Tick(), l_tickList);
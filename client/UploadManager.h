@@ -27,6 +27,7 @@
 #include "UploadManagerListener.h"
 #include "ClientManagerListener.h"
 #include "UserConnection.h"
+#include "CFlyFairQueue.h"
 
 typedef pair<UserPtr, unsigned int> CurrentConnectionPair;
 typedef boost::unordered_map<UserPtr, unsigned int, User::Hash> CurrentConnectionMap;
@@ -99,7 +100,7 @@ class WaitingUser
 #endif
 {
 	public:
-		WaitingUser(const HintedUser& p_hintedUser, const std::string& p_token, const UploadQueueItemPtr& p_uqi) : m_hintedUser(p_hintedUser), m_token(p_token)
+		WaitingUser(const HintedUser& p_hintedUser, const std::string& p_token, const UploadQueueItemPtr& p_uqi) : m_hintedUser(p_hintedUser), m_token(p_token), m_enqueue_tick(GET_TICK())
 		{
 			m_waiting_files.push_back(p_uqi);
 		}
@@ -111,9 +112,91 @@ class WaitingUser
 		{
 			return m_hintedUser.user;
 		}
+		/** @return true if every waiting file fits into a mini-slot (file lists and small files) */
+		bool isMiniSlotRequest() const;
 		std::vector<UploadQueueItemPtr> m_waiting_files;
 		HintedUser m_hintedUser;
 		GETSET(string, m_token, Token);
+		GETM(uint64_t, m_enqueue_tick, EnqueueTick);
+};
+
+/**
+ * Queue of users waiting for an upload slot.
+ * Keeps arrival order for the UI and a separate ordered index which decides who is granted the next slot:
+ * FIFO (legacy behaviour) or fair queueing - small requests go through a fast lane
+ * and the rest are ordered by bytes recently uploaded to the user (least served first).
+ * The grant order is kept by CFlyFairQueue: lookups by user are O(1), insert/remove/pop are O(log n),
+ * getPosition() is O(n).
+ */
+class WaitingUserQueue
+#ifdef _DEBUG
+	: boost::noncopyable
+#endif
+{
+	public:
+		typedef std::list<WaitingUser> List;
+		typedef List::iterator iterator;
+		typedef List::const_iterator const_iterator;
+		enum Policy
+		{
+			POLICY_FIFO = 0,
+			POLICY_FAIR = 1
+		};
+		
+		const_iterator begin() const
+		{
+			return m_users.begin();
+		}
+		const_iterator end() const
+		{
+			return m_users.end();
+		}
+		const_iterator cbegin() const
+		{
+			return m_users.cbegin();
+		}
+		const_iterator cend() const
+		{
+			return m_users.cend();
+		}
+		size_t size() const
+		{
+			return m_users.size();
+		}
+		bool empty() const
+		{
+			return m_users.empty();
+		}
+		iterator find(const UserPtr& p_user);
+		const_iterator find(const UserPtr& p_user) const;
+		/** @return Position of the user in the grant order (1-based) */
+		size_t getPosition(const_iterator p_it) const;
+		void push_back(const WaitingUser& p_wu);
+		/** Recalculates the scheduling key after the waiting files of the user have changed */
+		void update(iterator p_it);
+		void erase(const_iterator p_it);
+		void clear();
+		/** @return The user who will be granted the next free slot */
+		const WaitingUser& front() const;
+		void pop_front();
+		
+		/** Accounting of uploaded bytes which is used by the fair policy */
+		void addServedBytes(const UserPtr& p_user, int64_t p_bytes)
+		{
+			m_order.addServedBytes(p_user, p_bytes);
+		}
+		/** Halves the served bytes history so that old transfers are forgotten gradually */
+		void decayServedBytes()
+		{
+			m_order.decayServedBytes();
+		}
+		
+	private:
+		typedef boost::unordered_map<UserPtr, iterator, User::Hash> UserIndex;
+		
+		List m_users;
+		UserIndex m_index;
+		CFlyFairQueue<UserPtr, User::Hash> m_order;
 };
 
 class UploadManager : private ClientManagerListener, private UserConnectionListener, public Speaker<UploadManagerListener>, private TimerManagerListener, public Singleton<UploadManager>
@@ -184,7 +267,7 @@ class UploadManager : private ClientManagerListener, private UserConnectionListe
 				}
 		};
 		
-		typedef std::list<WaitingUser> SlotQueue;
+		typedef WaitingUserQueue SlotQueue;
 		const SlotQueue& getUploadQueueL() const
 		{
 			return m_slotQueue;
@@ -216,7 +299,50 @@ class UploadManager : private ClientManagerListener, private UserConnectionListe
 		static time_t getReservedSlotTime(const UserPtr& aUser);
 		static void shutdown();
 		
+		// [+] FlylinkDC++ slot scheduler statistics
+		struct SlotStat
+		{
+			SlotStat() : m_granted(0), m_granted_mini(0), m_wait_total(0), m_wait_max(0), m_slot_samples(0), m_slot_busy(0)
+			{
+			}
+			uint64_t m_granted;      // users granted from the waiting queue
+			uint64_t m_granted_mini; // of them through the fast lane
+			uint64_t m_wait_total;   // ms
+			uint64_t m_wait_max;     // ms
+			uint64_t m_slot_samples; // slot-seconds available
+			uint64_t m_slot_busy;    // slot-seconds used
+		};
+		static SlotStat getSlotStat();
+		/** @return Average time in ms a user waited in the queue before a slot was granted */
+		static uint64_t getAverageQueueWait();
+		/** @return Percent of standard slots in use, averaged over the session */
+		static unsigned getSlotUtilisation();
+		
 	private:
+		// [+] FlylinkDC++ read-ahead of the next chunk of an accepted upload into the OS file cache
+		struct PrefetchTask
+		{
+			PrefetchTask() : m_pos(0), m_size(0) { }
+			PrefetchTask(const string& p_path, int64_t p_pos, int64_t p_size) : m_path(p_path), m_pos(p_pos), m_size(p_size) { }
+			string m_path;
+			int64_t m_pos;
+			int64_t m_size;
+		};
+		class UploadPrefetcher : public BackgroundTaskExecuter<PrefetchTask>
+		{
+			public:
+				explicit UploadPrefetcher() : m_pending(0) { }
+				~UploadPrefetcher() { }
+				void prefetch(const string& p_path, int64_t p_pos, int64_t p_size);
+			private:
+				void execute(const PrefetchTask& p_task);
+				boost::atomic<int64_t> m_pending;
+		} m_prefetcher;
+		
+		static SlotStat g_slot_stat;
+		static FastCriticalSection g_csSlotStat;
+		static void registerGrant(const WaitingUser& p_wu, uint64_t p_tick);
+		
 		bool isFireball;
 		bool isFileServer;
 		static int  g_running;
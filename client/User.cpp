@@ -543,7 +543,8 @@ void Identity::getParams(StringMap& sm, const string& prefix, bool compatibility
 		CFlyFastLock(m_si_fcs);
 		for (auto i = m_stringInfo.cbegin(); i != m_stringInfo.cend(); ++i)
 		{
-			sm[prefix + string((char*)(&i->first), 2)] = i->second;
+			const uint16_t l_code = i.code();
+			sm[prefix + string((const char*)(&l_code), 2)] = i.value();
 		}
 	}
 }
@@ -724,17 +725,17 @@ string Identity::getStringParam(const char* name) const // [!] IRainman fix.
 	
 	{
 		CFlyFastLock(m_si_fcs);
-		const auto i = m_stringInfo.find(*(short*)name);
+		const auto i = m_stringInfo.find(*(uint16_t*)name);
 #ifdef FLYLINKDC_USE_PROFILER_CS
 		l_lock.m_add_log_info = "[get] name = ";
-		l_lock.m_add_log_info += string(name) + string(i == m_stringInfo.end() ? " [ not_found! ]" : "[ " + i->second + " ]" + " Nick = " + getNick());
+		l_lock.m_add_log_info += string(name) + string(i == m_stringInfo.cend() ? " [ not_found! ]" : "[ " + i.value() + " ]" + " Nick = " + getNick());
 #endif
-		if (i != m_stringInfo.end())
+		if (i != m_stringInfo.cend())
 		{
 #ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
 			CFlylinkDBManager::getInstance()->identity_get(name, iNickRule->second);
 #endif
-			return i->second;
+			return i.value();
 		}
 	}
 	return Util::emptyString;
@@ -862,14 +863,7 @@ void Identity::setStringParam(const char* name, const string& val) // [!] IRainm
 			l_lock.m_add_log_info = "[set] name = ";
 			l_lock.m_add_log_info += string(name) + string(val.empty() ? " val.empty()" : val);
 #endif
-			if (val.empty())
-			{
-				m_stringInfo.erase(*(short*)name);
-			}
-			else
-			{
-				m_stringInfo[*(short*)name] = val;
-			}
+			m_stringInfo.set(*(uint16_t*)name, val); // empty value removes the tag
 		}
 	}
 	else
@@ -1087,10 +1081,11 @@ void Identity::getReport(string& p_report) const
 			CFlyFastLock(m_si_fcs);
 			for (auto i = m_stringInfo.cbegin(); i != m_stringInfo.cend(); ++i)
 			{
-				auto name = string((char*)(&i->first), 2);
-				const auto& value = i->second;
+				const uint16_t l_code = i.code();
+				auto name = string((const char*)(&l_code), 2);
+				const auto value = i.value();
 				// TODO: translate known tags and format values to something more readable
-				switch (i->first)
+				switch (l_code)
 				{
 					case TAG('C', 'S'): // ok
 						name = "Cheat description";
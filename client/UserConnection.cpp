@@ -26,6 +26,7 @@
 #include "QueueManager.h"
 #include "PGLoader.h"
 #include "IpGuard.h"
+#include "CFlySegmentSize.h"
 #include "../FlyFeatures/flyServer.h"
 const string UserConnection::FEATURE_MINISLOTS = "MiniSlots";
 const string UserConnection::FEATURE_XML_BZLIST = "XmlBZList";
@@ -434,7 +435,7 @@ void UserConnection::supports(const StringList& feat)
 
 void UserConnection::handle(AdcCommand::STA t, const AdcCommand& c)
 {
-	if (c.getParameters().size() >= 2)
+	if (c.getParamCount() >= 2)
 	{
 		const string& code = c.getParam(0);
 		if (!code.empty() && code[0] - '0' == AdcCommand::SEV_FATAL)
@@ -532,55 +533,9 @@ void UserConnection::on(Failed, const string& aLine) noexcept
 	delete this;
 }
 
-// # ms we should aim for per segment
-static const int64_t SEGMENT_TIME = 120 * 1000;
-static const int64_t MIN_CHUNK_SIZE = 64 * 1024;
-
 void UserConnection::updateChunkSize(int64_t leafSize, int64_t lastChunk, uint64_t ticks)
 {
-
-	if (m_chunkSize == 0)
-	{
-		m_chunkSize = std::max((int64_t)64 * 1024, std::min(lastChunk, (int64_t)1024 * 1024));
-		return;
-	}
-	
-	if (ticks <= 10)
-	{
-		// Can't rely on such fast transfers - double
-		m_chunkSize *= 2;
-		return;
-	}
-	
-	double lastSpeed = (1000. * lastChunk) / ticks;
-	
-	int64_t targetSize = m_chunkSize;
-	
-	// How long current chunk size would take with the last speed...
-	double msecs = 1000 * double(targetSize) / lastSpeed;
-	
-	if (msecs < SEGMENT_TIME / 4)
-	{
-		targetSize *= 2;
-	}
-	else if (msecs < SEGMENT_TIME / 1.25)
-	{
-		targetSize += leafSize;
-	}
-	else if (msecs < SEGMENT_TIME * 1.25)
-	{
-		// We're close to our target size - don't change it
-	}
-	else if (msecs < SEGMENT_TIME * 4)
-	{
-		targetSize = std::max(MIN_CHUNK_SIZE, targetSize - m_chunkSize);
-	}
-	else
-	{
-		targetSize = std::max(MIN_CHUNK_SIZE, targetSize / 2);
-	}
-	
-	m_chunkSize = targetSize;
+	m_chunkSize = CFlySegmentSize::next(m_chunkSize, speed, leafSize, lastChunk, ticks);
 }
 
 void UserConnection::send(const string& aString)
@@ -360,7 +360,7 @@ class UserConnection : public Speaker<UserConnectionListener>,
 		
 		GETSET(string, m_user_connection_token, UserConnectionToken);
 		GETSET(string, m_connection_queue_token, ConnectionQueueToken);
-		GETSET(int64_t, speed, Speed);
+		GETSET(int64_t, speed, Speed); // estimated (EWMA) download speed of this source, updated by updateChunkSize
 		
 		uint64_t m_lastActivity;
 		unsigned m_count_activite;
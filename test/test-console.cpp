@@ -10,6 +10,11 @@
 #include <atlfile.h>
 #include <unordered_map>
 #include <time.h>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <chrono>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/unordered/unordered_map.hpp>
@@ -21,12 +26,31 @@
 #include <limits>
 #include "../client/CFlyProfiler.h"
 #include "../client/CFlyThread.h"
+#include "../client/CFlyBoundedQueue.h"
+#include "../client/CFlyUdpBatchReader.h"
+#include "../client/ClientManager.h" // CommandHandler::dispatch
+#include "../client/AdcCommand.h"
+#include "../client/CFlyPackedStringMap.h"
+#include "../client/CFlySegmentSize.h"
+#include "../client/Encoder.h"
+#include "../client/Text.h"
+#include "../client/CFlySearchResultAggregator.h"
+#include "../client/MD5Calc.h"
+#include "../client/CFlyHashBackend.h"
+#include "../client/CFlyFairQueue.h"
+#include "../client/CFlyWindowSketch.h"
+#include "../client/CFlyIPRangeIndex.h"
+#include "../client/CFlyTTHFilter.h"
+#include "../client/CFlyParallelJobs.h"
+#include "../client/CFlyLineFramer.h"
+#include "../client/CFlyBandwidthSplit.h"
 #include "cperformance.h"
 #include "FastAlloc.h"
 #include "cycle.h"
 
 #include<winsock2.h>
 #include<Iphlpapi.h>
+#include<Psapi.h>
 #include<stdio.h>
 
 #include "zmq.h"
@@ -36,6 +60,7 @@
 //#include "libtorrent/session.hpp"
 
 #pragma comment(lib,"Iphlpapi.lib")
+#pragma comment(lib,"Psapi.lib")
 
 int getmac();
 void get_adapters();
@@ -719,8 +744,2144 @@ class A
 		}
 };
 
+// Search UDP receive path: the old spin-locked deque vs CFlyBoundedQueue and a loopback flood through the batched receive
+struct TestUdpPacket
+{
+	std::string m_data;
+	uint32_t m_ip4;
+};
+
+class TestLockedDeque
+{
+	public:
+		explicit TestLockedDeque(size_t) {}
+		bool push(TestUdpPacket&& p_value)
+		{
+			FastLock l(m_cs);
+			m_packets.push_back(std::move(p_value));
+			return true;
+		}
+		bool pop(TestUdpPacket& p_value)
+		{
+			FastLock l(m_cs);
+			if (m_packets.empty())
+				return false;
+			p_value = std::move(m_packets.front());
+			m_packets.pop_front();
+			return true;
+		}
+	private:
+		FastCriticalSection m_cs;
+		std::deque<TestUdpPacket> m_packets;
+};
+
+static const char g_test_sr[] = "$SR User Share\\Video\\Some.Movie.2016.1080p.mkv\x05" "1234567890 3/4\x05TTH:ABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFGHIJKLM (127.0.0.1:411)|";
+
+// consumer side of UdpQueue::parse - only splits the fields, the real one fires SearchManagerListener::SR
+static size_t test_split_sr(const std::string& p_data)
+{
+	size_t l_fields = 0;
+	for (auto i = p_data.find('\x05'); i != std::string::npos; i = p_data.find('\x05', i + 1))
+		++l_fields;
+	return l_fields;
+}
+
+template<class Queue>
+static bool test_queue_throughput(const char* p_name, unsigned p_producers, unsigned p_consumers, unsigned p_count)
+{
+	Queue l_queue(16 * 1024);
+	std::atomic<unsigned> l_full(0);
+	std::atomic<unsigned> l_parsed(0);
+	std::atomic<unsigned> l_producers_done(0);
+	std::vector<std::thread> l_threads;
+	performance::timer l_timer;
+	l_timer.start();
+	for (unsigned i = 0; i < p_producers; ++i)
+	{
+		l_threads.push_back(std::thread([&]
+		{
+			for (unsigned j = 0; j < p_count; ++j)
+			{
+				TestUdpPacket l_packet;
+				l_packet.m_data = g_test_sr;
+				l_packet.m_ip4 = j;
+				while (!l_queue.push(std::move(l_packet)))
+				{
+					++l_full; // the receiver would drop it - measure the queue itself
+					std::this_thread::yield();
+				}
+			}
+			++l_producers_done;
+		}));
+	}
+	for (unsigned i = 0; i < p_consumers; ++i)
+	{
+		l_threads.push_back(std::thread([&]
+		{
+			TestUdpPacket l_packet;
+			for (;;)
+			{
+				if (l_queue.pop(l_packet))
+				{
+					if (test_split_sr(l_packet.m_data))
+						++l_parsed;
+				}
+				else if (l_producers_done == p_producers)
+				{
+					if (!l_queue.pop(l_packet))
+						break;
+					if (test_split_sr(l_packet.m_data))
+						++l_parsed;
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		}));
+	}
+	for (auto i = l_threads.begin(); i != l_threads.end(); ++i)
+		i->join();
+	const double l_time = l_timer.finish();
+	std::cout << p_name << " producers = " << p_producers << " consumers = " << p_consumers
+	          << " parsed = " << l_parsed << " queue full = " << l_full
+	          << " time = " << l_time << " s (" << unsigned(l_parsed / l_time) << " packets/s)" << std::endl;
+	return l_parsed == p_producers * p_count;
+}
+
+// Socket of the client is not compiled into the test - the calls CFlyUdpBatchReader makes, on a plain socket
+class TestUdpSocket
+{
+	public:
+		enum { WAIT_READ = 0x02 };
+		explicit TestUdpSocket(SOCKET p_socket) : m_socket(p_socket) {}
+		int wait(uint64_t p_millis, int)
+		{
+			fd_set l_set;
+			FD_ZERO(&l_set);
+			FD_SET(m_socket, &l_set);
+			timeval l_wait = { long(p_millis / 1000), long(p_millis % 1000 * 1000) };
+			return select(0, &l_set, nullptr, nullptr, &l_wait) == 1 ? WAIT_READ : 0;
+		}
+		int read(void* p_buf, int p_len, sockaddr_in& p_from)
+		{
+			int l_from_len = sizeof(p_from);
+			return recvfrom(m_socket, (char*)p_buf, p_len, 0, (sockaddr*)&p_from, &l_from_len);
+		}
+	private:
+		SOCKET m_socket;
+};
+
+// the receive loop of SearchManager::run: wait for the socket, CFlyUdpBatchReader::drain, hand over the batch
+template<class Queue>
+static bool test_udp_flood(const char* p_name, unsigned p_parsers, unsigned p_count)
+{
+	const SOCKET l_in = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	const SOCKET l_out = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	int l_buf_size = 8 * 1024 * 1024;
+	setsockopt(l_in, SOL_SOCKET, SO_RCVBUF, (const char*)&l_buf_size, sizeof(l_buf_size));
+	sockaddr_in l_addr = { 0 };
+	l_addr.sin_family = AF_INET;
+	l_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(l_in, (const sockaddr*)&l_addr, sizeof(l_addr));
+	int l_addr_len = sizeof(l_addr);
+	getsockname(l_in, (sockaddr*)&l_addr, &l_addr_len);
+	
+	Queue l_queue(16 * 1024);
+	std::atomic<unsigned> l_received(0);
+	std::atomic<unsigned> l_dropped(0);
+	std::atomic<unsigned> l_parsed(0);
+	std::atomic<bool> l_is_sent(false);
+	std::atomic<bool> l_is_received(false);
+	std::atomic<bool> l_is_valid(true);
+	performance::timer l_timer;
+	l_timer.start();
+	std::thread l_sender([&]
+	{
+		for (unsigned i = 0; i < p_count; ++i)
+			sendto(l_out, g_test_sr, sizeof(g_test_sr) - 1, 0, (const sockaddr*)&l_addr, sizeof(l_addr));
+		l_is_sent = true;
+	});
+	std::thread l_receiver([&]
+	{
+		TestUdpSocket l_socket(l_in);
+		uint8_t l_buf[CFlyUdpBatchReader::BUF_SIZE];
+		const volatile bool l_stop = false;
+		std::vector<TestUdpPacket> l_batch;
+		l_batch.reserve(CFlyUdpBatchReader::BATCH_SIZE);
+		for (;;)
+		{
+			if (l_socket.wait(400, TestUdpSocket::WAIT_READ) != TestUdpSocket::WAIT_READ)
+			{
+				if (l_is_sent)
+					break;
+				continue;
+			}
+			const bool l_is_read = CFlyUdpBatchReader::drain(l_socket, l_buf, l_stop, [&](const uint8_t* p_data, int p_len, const sockaddr_in & p_from)
+			{
+				TestUdpPacket l_packet;
+				l_packet.m_data.assign((const char*)p_data, p_len);
+				l_packet.m_ip4 = ntohl(p_from.sin_addr.s_addr);
+				l_batch.push_back(std::move(l_packet));
+			});
+			if (!l_is_read || l_batch.size() > CFlyUdpBatchReader::BATCH_SIZE)
+				l_is_valid = false;
+			l_received += unsigned(l_batch.size());
+			for (auto i = l_batch.begin(); i != l_batch.end(); ++i)
+			{
+				if (!l_queue.push(std::move(*i)))
+					++l_dropped;
+			}
+			l_batch.clear();
+		}
+		l_is_received = true;
+	});
+	std::vector<std::thread> l_parsers;
+	for (unsigned i = 0; i < p_parsers; ++i)
+	{
+		l_parsers.push_back(std::thread([&]
+		{
+			TestUdpPacket l_packet;
+			for (;;)
+			{
+				if (l_queue.pop(l_packet))
+				{
+					if (test_split_sr(l_packet.m_data) == 2 && l_packet.m_data == g_test_sr)
+						++l_parsed;
+					else
+						l_is_valid = false;
+				}
+				else if (l_is_received)
+				{
+					break;
+				}
+				else
+				{
+					std::this_thread::yield();
+				}
+			}
+		}));
+	}
+	l_sender.join();
+	l_receiver.join();
+	for (auto i = l_parsers.begin(); i != l_parsers.end(); ++i)
+		i->join();
+	const double l_time = l_timer.finish() - 0.4; // the last select timeout
+	closesocket(l_in);
+	closesocket(l_out);
+	std::cout << p_name << " parsers = " << p_parsers << " sent = " << p_count << " received = " << l_received
+	          << " lost in socket = " << p_count - l_received << " dropped by queue = " << l_dropped
+	          << " parsed = " << l_parsed << " time = " << l_time << " s" << std::endl;
+	// every datagram that reached the queue is parsed intact, nothing is counted twice
+	return l_is_valid && l_received <= p_count && l_parsed + l_dropped == l_received && l_received > 0;
+}
+
+void test_bounded_queue()
+{
+	WSADATA l_wsa;
+	WSAStartup(MAKEWORD(2, 2), &l_wsa);
+	const unsigned l_count = 1000 * 1000;
+	bool l_is_valid = true;
+	l_is_valid &= test_queue_throughput<TestLockedDeque>("deque + FastCriticalSection", 1, 1, l_count);
+	l_is_valid &= test_queue_throughput<CFlyBoundedQueue<TestUdpPacket>>("CFlyBoundedQueue", 1, 1, l_count);
+	l_is_valid &= test_queue_throughput<TestLockedDeque>("deque + FastCriticalSection", 2, 4, l_count);
+	l_is_valid &= test_queue_throughput<CFlyBoundedQueue<TestUdpPacket>>("CFlyBoundedQueue", 2, 4, l_count);
+	
+	l_is_valid &= test_udp_flood<TestLockedDeque>("UDP flood, deque", 1, l_count);
+	l_is_valid &= test_udp_flood<CFlyBoundedQueue<TestUdpPacket>>("UDP flood, CFlyBoundedQueue", 1, l_count);
+	l_is_valid &= test_udp_flood<CFlyBoundedQueue<TestUdpPacket>>("UDP flood, CFlyBoundedQueue", 4, l_count);
+	WSACleanup();
+	std::cout << "Bounded queue: packet count check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+}
+
+// AdcCommand: the parser kept as offsets into one buffer vs the former StringList parser (reproduced below)
+class TestOldAdcCommand
+{
+	public:
+		explicit TestOldAdcCommand(const std::string& p_line) : m_from(0), m_to(0)
+		{
+			m_type = p_line[0];
+			memcpy(m_cmd, p_line.c_str() + 1, 3);
+			m_cmd[3] = 0;
+			size_t l_skip = m_type == 'B' ? 1 : m_type == 'D' || m_type == 'E' ? 2 : 0;
+			std::string l_cur;
+			l_cur.reserve(128);
+			for (size_t i = 5; i <= p_line.size(); ++i)
+			{
+				if (i == p_line.size() || p_line[i] == ' ')
+				{
+					if (i == p_line.size() && l_cur.empty())
+						break;
+					if (l_skip)
+					{
+						(m_from ? m_to : m_from) = *reinterpret_cast<const uint32_t*>(l_cur.data());
+						--l_skip;
+					}
+					else
+					{
+						m_parameters.push_back(l_cur);
+					}
+					l_cur.clear();
+				}
+				else if (p_line[i] == '\\')
+				{
+					++i;
+					l_cur += p_line[i] == 's' ? ' ' : p_line[i] == 'n' ? '\n' : '\\';
+				}
+				else
+				{
+					l_cur += p_line[i];
+				}
+			}
+		}
+		bool getParam(const char* p_name, size_t p_start, std::string& p_ret) const
+		{
+			for (size_t i = p_start; i < m_parameters.size(); ++i)
+			{
+				if (AdcCommand::toCode(p_name) == AdcCommand::toCode(m_parameters[i].c_str()))
+				{
+					p_ret = m_parameters[i].substr(2);
+					return true;
+				}
+			}
+			return false;
+		}
+		std::string toString(uint32_t p_sid) const
+		{
+			std::string l_header;
+			l_header += m_type;
+			l_header += m_cmd;
+			if (m_type == 'B' || m_type == 'D' || m_type == 'E')
+			{
+				l_header += ' ';
+				l_header += AdcCommand::fromSID(p_sid);
+			}
+			if (m_type == 'D' || m_type == 'E')
+			{
+				l_header += ' ';
+				l_header += AdcCommand::fromSID(m_to);
+			}
+			std::string l_params;
+			l_params.reserve(65);
+			for (auto i = m_parameters.cbegin(); i != m_parameters.cend(); ++i)
+			{
+				std::string l_tmp = *i;
+				std::string::size_type j = 0;
+				while ((j = l_tmp.find_first_of(" \n\\", j)) != std::string::npos)
+				{
+					l_tmp.replace(j, 1, l_tmp[j] == ' ' ? "\\s" : l_tmp[j] == '\n' ? "\\n" : "\\\\");
+					j += 2;
+				}
+				l_params += ' ';
+				l_params += l_tmp;
+			}
+			l_params += '\n';
+			return l_header + l_params;
+		}
+		const StringList& getParameters() const
+		{
+			return m_parameters;
+		}
+	private:
+		char m_type;
+		char m_cmd[4];
+		uint32_t m_from;
+		uint32_t m_to;
+		StringList m_parameters;
+};
+
+// The parameter walk of AdcHub::handle(INF) and SearchManager::onRES, dispatched by CommandHandler as in the client.
+// p_start = 1 for URES: the first parameter is the sender's CID, it is skipped by index instead of erase().
+class TestAdcHandler : public CommandHandler<TestAdcHandler>
+{
+	public:
+		TestAdcHandler() : m_start(0), m_slots(0), m_size(0), m_count(0)
+		{
+		}
+		template<typename T> void handle(T, const AdcCommand&) { }
+		void handle(AdcCommand::INF, const AdcCommand& c)
+		{
+			if (c.getParamCount() == 0 || !c.getParam("ID", 0, m_cid))
+				return;
+			const size_t l_count = c.getParamCount();
+			for (size_t j = 0; j < l_count; ++j)
+			{
+				const AdcCommand::ParamView l_param = c.getParamView(j);
+				if (l_param.length() < 2)
+					continue;
+				switch (*(short*)l_param.c_str())
+				{
+					case 'S' | 'L' << 8:
+					case 'F' | 'S' << 8:
+					case 'S' | 'F' << 8:
+						m_slots += atoi(l_param.c_str() + 2);
+						break;
+					case 'S' | 'S' << 8:
+						m_size += _atoi64(l_param.c_str() + 2);
+						break;
+					default:
+						m_identity.set(*(short*)l_param.c_str(), l_param.substr(2));
+				}
+			}
+			++m_count;
+		}
+		void handle(AdcCommand::RES, const AdcCommand& c)
+		{
+			const size_t l_count = c.getParamCount();
+			for (size_t i = m_start; i < l_count; ++i)
+			{
+				const AdcCommand::ParamView str = c.getParamView(i);
+				if (str.isCode("FN"))
+					m_file = str.substr(2);
+				else if (str.isCode("SL"))
+					m_slots += atoi(str.c_str() + 2);
+				else if (str.isCode("SI"))
+					m_size += _atoi64(str.c_str() + 2);
+				else if (str.isCode("TR"))
+					m_tth = str.substr(2);
+			}
+			++m_count;
+		}
+		size_t m_start;
+		int64_t m_slots;
+		int64_t m_size;
+		size_t m_count;
+		std::string m_cid;
+		std::string m_file;
+		std::string m_tth;
+		CFlyPackedStringMap m_identity;
+};
+
+// The same handlers over the former StringList command: URES erased the CID from a copy of the list
+static void test_old_adc_handler(const TestOldAdcCommand& p_cmd, bool p_is_udp, TestAdcHandler& p_result)
+{
+	StringList l_params = p_cmd.getParameters();
+	if (p_is_udp)
+		l_params.erase(l_params.begin());
+	for (auto i = l_params.cbegin(); i != l_params.cend(); ++i)
+	{
+		if (i->size() < 2)
+			continue;
+		switch (*(short*)i->c_str())
+		{
+			case 'S' | 'L' << 8:
+			case 'F' | 'S' << 8:
+			case 'S' | 'F' << 8:
+				p_result.m_slots += atoi(i->c_str() + 2);
+				break;
+			case 'S' | 'S' << 8:
+			case 'S' | 'I' << 8:
+				p_result.m_size += _atoi64(i->c_str() + 2);
+				break;
+			case 'F' | 'N' << 8:
+				p_result.m_file = i->substr(2);
+				break;
+			case 'T' | 'R' << 8:
+				p_result.m_tth = i->substr(2);
+				break;
+			default:
+				p_result.m_identity.set(*(short*)i->c_str(), i->substr(2));
+		}
+	}
+	++p_result.m_count;
+}
+
+static const char* g_test_adc_lines[] =
+{
+	"BINF AAAB IDSQVHWKP4R4PYSI6RRUNJZIUANOXUGFEC4QK4VWA NIFlylinkDC\\sUser\\s1 DEdescription\\swith\\sspaces\\\\and\\sslash SS1234567890123 SF12345 VEFlylinkDC++\\sr600 US10485760 SL3 FS3 HN12 HR0 HO1 SUTCP4,UDP4,ADC0,SEGA,CCPM I4192.168.1.10 U412345 KPSHA256/ABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFGHIJKLMNOPQRST",
+	"DRES AAAB AAAC FN/Share/Video/Some\\sMovie\\s(2016)/Some.Movie.2016.1080p.mkv SI8589934592 SL3 TRABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFGHIJKLM TOauto123456",
+	"BSCH AAAB TO12345 ANsome ANmovie NOavi EX1 EXmkv GR1 TY1",
+	"URES SQVHWKP4R4PYSI6RRUNJZIUANOXUGFEC4QK4VWA FN/Share/Video/Some\\sMovie\\s(2016)/Some.Movie.2016.1080p.mkv SI8589934592 SL3 TRABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFGHIJKLM TOauto123456",
+};
+
+void test_adc_command()
+{
+	const unsigned l_count = 1000 * 1000;
+	for (size_t j = 0; j < _countof(g_test_adc_lines); ++j)
+	{
+		const std::string l_line = g_test_adc_lines[j];
+		const TestOldAdcCommand l_old(l_line);
+		const AdcCommand l_new(l_line);
+		if (l_old.getParameters() != l_new.getParameters() || l_old.toString(AdcCommand::toSID("AAAB")) != l_new.toString(AdcCommand::toSID("AAAB")))
+		{
+			std::cout << "AdcCommand mismatch: " << l_line << std::endl;
+			continue;
+		}
+		std::string l_value;
+		size_t l_size = 0;
+		performance::timer l_timer;
+		l_timer.start();
+		for (unsigned i = 0; i < l_count; ++i)
+		{
+			const TestOldAdcCommand l_cmd(l_line);
+			l_cmd.getParam("NI", 0, l_value);
+			l_cmd.getParam("TR", 0, l_value);
+			l_cmd.getParam("SL", 0, l_value);
+			l_size += l_cmd.toString(AdcCommand::toSID("AAAB")).size();
+		}
+		double l_old_time = l_timer.finish();
+		std::string l_out;
+		l_timer.start();
+		for (unsigned i = 0; i < l_count; ++i)
+		{
+			const AdcCommand l_cmd(l_line);
+			l_cmd.getParam("NI", 0, l_value);
+			l_cmd.getParam("TR", 0, l_value);
+			l_cmd.getParam("SL", 0, l_value);
+			l_out.clear();
+			l_cmd.serialize(l_out, AdcCommand::toSID("AAAB"));
+			l_size += l_out.size();
+		}
+		double l_new_time = l_timer.finish();
+		std::cout << l_line.substr(0, 4) << ": parse + 3 getParam + serialize x " << l_count
+		          << " StringList = " << l_old_time << " s, offsets = " << l_new_time << " s (" << l_size << ")" << std::endl;
+		          
+		if (l_new.getCommand() != AdcCommand::CMD_INF && l_new.getCommand() != AdcCommand::CMD_RES)
+			continue;
+		// the whole receive path of one line: parse + dispatch + the handler's parameter walk
+		const bool l_is_udp = l_line[0] == 'U';
+		TestAdcHandler l_old_handler;
+		l_timer.start();
+		for (unsigned i = 0; i < l_count; ++i)
+		{
+			const TestOldAdcCommand l_cmd(l_line);
+			test_old_adc_handler(l_cmd, l_is_udp, l_old_handler);
+		}
+		l_old_time = l_timer.finish();
+		TestAdcHandler l_new_handler;
+		l_new_handler.m_start = l_is_udp ? 1 : 0;
+		l_timer.start();
+		for (unsigned i = 0; i < l_count; ++i)
+		{
+			l_new_handler.dispatch(l_line);
+		}
+		l_new_time = l_timer.finish();
+		const bool l_is_valid = l_old_handler.m_count == l_count && l_new_handler.m_count == l_count &&
+		                        l_old_handler.m_slots == l_new_handler.m_slots && l_old_handler.m_size == l_new_handler.m_size &&
+		                        l_old_handler.m_file == l_new_handler.m_file && l_old_handler.m_tth == l_new_handler.m_tth;
+		std::cout << l_line.substr(0, 4) << ": parse + dispatch + handler x " << l_count
+		          << " StringList = " << l_old_time << " s, offsets = " << l_new_time << " s, check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+	}
+}
+
+// Identity string fields: the former boost::unordered_map<short, string> vs CFlyPackedStringMap, heap bytes per online user
+static size_t test_private_bytes()
+{
+	PROCESS_MEMORY_COUNTERS_EX l_counters = { 0 };
+	GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&l_counters, sizeof(l_counters));
+	return l_counters.PrivateUsage;
+}
+
+static std::string test_random_string(size_t p_min, size_t p_max)
+{
+	std::string l_result(p_min + rand() % (p_max - p_min + 1), ' ');
+	for (auto i = l_result.begin(); i != l_result.end(); ++i)
+		*i = char('a' + rand() % 26);
+	return l_result;
+}
+
+// p_users is kept by the caller until all measurements are done - the heap must not reuse the freed blocks
+template<class Map, class Setter>
+static void test_identity_fields(const char* p_name, bool p_is_adc, std::vector<Map>& p_users, size_t p_count, Setter p_set)
+{
+	srand(1);
+	const size_t l_before = test_private_bytes();
+	p_users.resize(p_count);
+	for (auto i = p_users.begin(); i != p_users.end(); ++i)
+	{
+		p_set(*i, 'D' | 'E' << 8, test_random_string(0, 40));
+		p_set(*i, 'E' | 'M' << 8, rand() % 4 ? std::string() : test_random_string(10, 24));
+		if (p_is_adc)
+		{
+			p_set(*i, 'I' | '6' << 8, rand() % 8 ? std::string() : "2001:db8::" + test_random_string(4, 4));
+			p_set(*i, 'K' | 'P' << 8, "SHA256/" + test_random_string(52, 52));
+			p_set(*i, 'L' | 'C' << 8, "ru_RU");
+		}
+	}
+	const size_t l_after = test_private_bytes();
+	std::cout << p_name << (p_is_adc ? " ADC " : " NMDC ") << p_count << " users: "
+	          << double(l_after - l_before) / p_count << " bytes per user" << std::endl;
+}
+
+void test_packed_string_map()
+{
+	typedef boost::unordered_map<short, std::string> OldInfMap;
+	const size_t l_users[] = { 10 * 1000, 50 * 1000 };
+	std::vector<OldInfMap> l_old[_countof(l_users) * 2];
+	std::vector<CFlyPackedStringMap> l_packed[_countof(l_users) * 2];
+	for (size_t i = 0; i < _countof(l_users); ++i)
+	{
+		for (int l_is_adc = 0; l_is_adc < 2; ++l_is_adc)
+		{
+			test_identity_fields("unordered_map<short, string>", l_is_adc != 0, l_old[i * 2 + l_is_adc], l_users[i], [](OldInfMap & p_map, uint16_t p_code, const std::string & p_value)
+			{
+				if (p_value.empty())
+					p_map.erase(p_code);
+				else
+					p_map[p_code] = p_value;
+			});
+			test_identity_fields("CFlyPackedStringMap", l_is_adc != 0, l_packed[i * 2 + l_is_adc], l_users[i], [](CFlyPackedStringMap & p_map, uint16_t p_code, const std::string & p_value)
+			{
+				p_map.set(p_code, p_value);
+			});
+		}
+	}
+	// the lengths are not limited to 16 bit
+	CFlyPackedStringMap l_map;
+	const std::string l_big(100 * 1024, 'x');
+	l_map.set('D' | 'E' << 8, l_big);
+	l_map.set('E' | 'M' << 8, "mail");
+	if (l_map.find('D' | 'E' << 8).value() != l_big || l_map.find('E' | 'M' << 8).value() != "mail")
+		std::cout << "CFlyPackedStringMap: long value mismatch" << std::endl;
+}
+
+// Share refresh: the roots one after another vs one thread per root (up to 8) - CFlyParallelJobs, as in
+// ShareManager::buildTreesParallelL - then a second pass which compares every file with the previous tree
+// by name, size and write time like ShareManager::buildTreeL. A synthetic tree checks the counts,
+// the roots from share-roots.txt (one path per line, the current directory if there is no such file) are timed.
+struct TestShareDir
+{
+	std::unordered_map<std::wstring, std::pair<int64_t, int64_t>> m_files; // name -> size, write time
+	std::unordered_map<std::wstring, std::unique_ptr<TestShareDir>> m_dirs;
+};
+
+struct TestShareStats
+{
+	TestShareStats() : m_dirs(0), m_files(0), m_files_unchanged(0)
+	{
+	}
+	size_t m_dirs;
+	size_t m_files;
+	size_t m_files_unchanged;
+};
+
+static std::unique_ptr<TestShareDir> test_scan_dir(const std::wstring& p_path, const TestShareDir* p_prev, TestShareStats& p_stats)
+{
+	std::unique_ptr<TestShareDir> l_dir(new TestShareDir);
+	++p_stats.m_dirs;
+	WIN32_FIND_DATAW l_data;
+	const HANDLE l_find = FindFirstFileExW((p_path + L"*").c_str(), FindExInfoBasic, &l_data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (l_find == INVALID_HANDLE_VALUE)
+		return l_dir;
+	do
+	{
+		const std::wstring l_name = l_data.cFileName;
+		if (l_name == L"." || l_name == L"..")
+			continue;
+		if (l_data.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_REPARSE_POINT))
+			continue;
+		if (l_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			const TestShareDir* l_prev_dir = nullptr;
+			if (p_prev)
+			{
+				const auto i = p_prev->m_dirs.find(l_name);
+				if (i != p_prev->m_dirs.end())
+					l_prev_dir = i->second.get();
+			}
+			l_dir->m_dirs[l_name] = test_scan_dir(p_path + l_name + L'\\', l_prev_dir, p_stats);
+			continue;
+		}
+		const int64_t l_size = int64_t(l_data.nFileSizeHigh) << 32 | l_data.nFileSizeLow;
+		const int64_t l_time = int64_t(l_data.ftLastWriteTime.dwHighDateTime) << 32 | l_data.ftLastWriteTime.dwLowDateTime;
+		++p_stats.m_files;
+		if (p_prev)
+		{
+			const auto i = p_prev->m_files.find(l_name);
+			if (i != p_prev->m_files.end() && i->second.first == l_size && i->second.second == l_time)
+				++p_stats.m_files_unchanged;
+		}
+		l_dir->m_files[l_name] = std::make_pair(l_size, l_time);
+	}
+	while (FindNextFileW(l_find, &l_data));
+	FindClose(l_find);
+	return l_dir;
+}
+
+static double test_scan_roots(const std::vector<std::wstring>& p_roots, size_t p_max_threads,
+                              std::vector<std::unique_ptr<TestShareDir>>& p_trees, TestShareStats& p_total, size_t& p_thread_count)
+{
+	std::vector<std::unique_ptr<TestShareDir>> l_trees(p_roots.size());
+	std::vector<TestShareStats> l_stats(p_roots.size());
+	const CFlyParallelJobs::Job l_job = [&](size_t i)
+	{
+		l_trees[i] = test_scan_dir(p_roots[i], i < p_trees.size() ? p_trees[i].get() : nullptr, l_stats[i]);
+	};
+	const CFlyParallelJobs::StopCheck l_is_stop = []()
+	{
+		return false;
+	};
+	performance::timer l_timer;
+	l_timer.start();
+	p_thread_count = CFlyParallelJobs::run(p_roots.size(), p_max_threads, l_job, l_is_stop, "test_scan_roots");
+	const double l_time = l_timer.finish();
+	p_total = TestShareStats();
+	for (auto i = l_stats.cbegin(); i != l_stats.cend(); ++i)
+	{
+		p_total.m_dirs += i->m_dirs;
+		p_total.m_files += i->m_files;
+		p_total.m_files_unchanged += i->m_files_unchanged;
+	}
+	p_trees.swap(l_trees);
+	return l_time;
+}
+
+static bool test_scan_passes(const std::vector<std::wstring>& p_roots, const TestShareStats* p_expected)
+{
+	const size_t l_max_threads = std::min(p_roots.size(), std::min(size_t(8), size_t(std::max(1u, std::thread::hardware_concurrency()))));
+	std::vector<std::unique_ptr<TestShareDir>> l_trees;
+	TestShareStats l_stats;
+	TestShareStats l_first;
+	bool l_is_valid = true;
+	const char* l_passes[] = { "warm-up", "sequential full", "parallel full", "sequential refresh", "parallel refresh" };
+	for (size_t i = 0; i < _countof(l_passes); ++i)
+	{
+		const size_t l_threads = i == 2 || i == 4 ? l_max_threads : 1;
+		if (i < 3)
+			l_trees.clear(); // full scan - nothing to compare with
+		size_t l_used_threads = 0;
+		const double l_time = test_scan_roots(p_roots, l_threads, l_trees, l_stats, l_used_threads);
+		if (i == 0)
+			l_first = l_stats;
+		// every pass sees the same tree, a refresh finds every file unchanged
+		l_is_valid &= l_stats.m_dirs == l_first.m_dirs && l_stats.m_files == l_first.m_files && l_used_threads == l_threads;
+		l_is_valid &= i < 3 ? l_stats.m_files_unchanged == 0 : l_stats.m_files_unchanged == l_stats.m_files;
+		if (p_expected)
+			l_is_valid &= l_stats.m_dirs == p_expected->m_dirs && l_stats.m_files == p_expected->m_files;
+		std::cout << l_passes[i] << ": roots = " << p_roots.size() << ", threads = " << l_used_threads
+		          << ", directories = " << l_stats.m_dirs << ", files = " << l_stats.m_files
+		          << " (unchanged = " << l_stats.m_files_unchanged << "), time = " << l_time * 1000 << " ms" << std::endl;
+	}
+	return l_is_valid;
+}
+
+static const size_t g_test_scan_roots = 4;
+static const size_t g_test_scan_dirs = 20;
+static const size_t g_test_scan_files = 50;
+
+static std::vector<std::wstring> test_make_share_tree(const boost::filesystem::path& p_base)
+{
+	std::vector<std::wstring> l_roots;
+	for (size_t r = 0; r < g_test_scan_roots; ++r)
+	{
+		const boost::filesystem::path l_root = p_base / ("root" + std::to_string(r));
+		for (size_t d = 0; d < g_test_scan_dirs; ++d)
+		{
+			const boost::filesystem::path l_dir = l_root / ("dir" + std::to_string(d));
+			boost::filesystem::create_directories(l_dir);
+			for (size_t f = 0; f < g_test_scan_files; ++f)
+			{
+				std::ofstream l_file((l_dir / ("file" + std::to_string(f) + ".bin")).string(), std::ios::binary);
+				l_file << std::string(f + 1, 'x');
+			}
+		}
+		l_roots.push_back(l_root.wstring() + L'\\');
+	}
+	return l_roots;
+}
+
+void test_share_scan()
+{
+	bool l_is_valid = true;
+	{
+		// synthetic share with known counts: every root = 1 + g_test_scan_dirs directories
+		const boost::filesystem::path l_base = boost::filesystem::temp_directory_path() / "flylinkdc-share-scan";
+		boost::filesystem::remove_all(l_base);
+		const std::vector<std::wstring> l_roots = test_make_share_tree(l_base);
+		TestShareStats l_expected;
+		l_expected.m_dirs = g_test_scan_roots * (1 + g_test_scan_dirs);
+		l_expected.m_files = g_test_scan_roots * g_test_scan_dirs * g_test_scan_files;
+		l_is_valid &= test_scan_passes(l_roots, &l_expected);
+		
+		// a refresh after 3 files have grown and 1 is new: only the unchanged ones come from the previous tree
+		std::vector<std::unique_ptr<TestShareDir>> l_trees;
+		TestShareStats l_stats;
+		size_t l_threads = 0;
+		test_scan_roots(l_roots, g_test_scan_roots, l_trees, l_stats, l_threads);
+		for (size_t i = 0; i < 3; ++i)
+		{
+			std::ofstream l_file((l_base / ("root" + std::to_string(i)) / "dir0" / "file0.bin").string(), std::ios::binary | std::ios::app);
+			l_file << "changed";
+		}
+		{
+			std::ofstream l_file((l_base / "root0" / "dir1" / "new.bin").string(), std::ios::binary);
+			l_file << "new";
+		}
+		test_scan_roots(l_roots, g_test_scan_roots, l_trees, l_stats, l_threads);
+		l_is_valid &= l_stats.m_files == l_expected.m_files + 1 && l_stats.m_files_unchanged == l_expected.m_files - 3;
+		std::cout << "changed refresh: files = " << l_stats.m_files << " (unchanged = " << l_stats.m_files_unchanged << ")" << std::endl;
+		boost::filesystem::remove_all(l_base);
+	}
+	
+	// timing on the real roots from share-roots.txt (the current directory if there is no such file)
+	std::vector<std::wstring> l_roots;
+	std::wifstream l_list("share-roots.txt");
+	std::wstring l_line;
+	while (std::getline(l_list, l_line))
+	{
+		if (l_line.empty())
+			continue;
+		if (l_line.back() != L'\\')
+			l_line += L'\\';
+		l_roots.push_back(l_line);
+	}
+	if (l_roots.empty())
+		l_roots.push_back(boost::filesystem::current_path().wstring() + L'\\');
+	l_is_valid &= test_scan_passes(l_roots, nullptr);
+	std::cout << "Share scan: check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+}
+
+// TTH lookups of ShareManager: the map under CriticalSection (before), std::atomic_load of the published
+// snapshot and the snapshot cached by every thread with a version check (ShareManager::getThreadSnapshot).
+// A writer publishes a new snapshot every 10 ms in the second round of every reader count.
+struct TestShareKey
+{
+	uint64_t m_data[3];
+	bool operator==(const TestShareKey& p_key) const
+	{
+		return memcmp(m_data, p_key.m_data, sizeof(m_data)) == 0;
+	}
+};
+struct TestShareKeyHash
+{
+	size_t operator()(const TestShareKey& p_key) const
+	{
+		return size_t(p_key.m_data[0]);
+	}
+};
+typedef boost::unordered_map<TestShareKey, int64_t, TestShareKeyHash> TestShareIndex;
+typedef std::shared_ptr<const TestShareIndex> TestShareIndexPtr;
+
+static TestShareIndexPtr g_test_share_snapshot;
+static std::atomic<uint32_t> g_test_share_version(0);
+static CriticalSection g_test_share_cs;
+static TestShareIndex g_test_share_locked;
+
+static const TestShareIndex* test_thread_snapshot()
+{
+	static thread_local TestShareIndexPtr g_snapshot;
+	static thread_local uint32_t g_version = 0;
+	const uint32_t l_version = g_test_share_version.load(std::memory_order_acquire);
+	if (g_version != l_version)
+	{
+		g_snapshot = std::atomic_load(&g_test_share_snapshot);
+		g_version = l_version;
+	}
+	return g_snapshot.get();
+}
+
+static TestShareKey test_share_key(uint64_t p_index)
+{
+	TestShareKey l_key;
+	l_key.m_data[0] = p_index * 0x9E3779B97F4A7C15ULL;
+	l_key.m_data[1] = p_index;
+	l_key.m_data[2] = ~p_index;
+	return l_key;
+}
+
+template<class Lookup>
+static double test_share_lookups(size_t p_readers, bool p_is_writer, size_t p_entries, bool& p_is_valid, Lookup p_lookup)
+{
+	const unsigned l_count = 2 * 1000 * 1000;
+	std::atomic<bool> l_stop(false);
+	std::thread l_writer;
+	if (p_is_writer)
+	{
+		l_writer = std::thread([&]()
+		{
+			while (!l_stop)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				TestShareIndexPtr l_copy = std::make_shared<TestShareIndex>(*std::atomic_load(&g_test_share_snapshot));
+				{
+					CFlyLock(g_test_share_cs);
+					std::atomic_store(&g_test_share_snapshot, l_copy);
+					g_test_share_version.fetch_add(1, std::memory_order_release);
+				}
+				CFlyLock(g_test_share_cs);
+				g_test_share_locked[test_share_key(0)] = 1; // the same work for the locked map
+			}
+		});
+	}
+	std::atomic<size_t> l_found(0);
+	performance::timer l_timer;
+	l_timer.start();
+	std::vector<std::thread> l_readers;
+	for (size_t i = 0; i < p_readers; ++i)
+	{
+		l_readers.push_back(std::thread([&, i]()
+		{
+			size_t l_local = 0;
+			for (unsigned j = 0; j < l_count; ++j)
+				l_local += p_lookup(test_share_key((j * 7919 + i) % (p_entries * 2))); // half of the keys are missing
+			l_found += l_local;
+		}));
+	}
+	for (auto i = l_readers.begin(); i != l_readers.end(); ++i)
+		i->join();
+	const double l_time = l_timer.finish();
+	l_stop = true;
+	if (l_writer.joinable())
+		l_writer.join();
+	// the published snapshots never lose a key: every reader finds exactly the keys below p_entries
+	size_t l_expected = 0;
+	for (size_t i = 0; i < p_readers; ++i)
+		for (unsigned j = 0; j < l_count; ++j)
+			l_expected += (j * 7919 + i) % (p_entries * 2) < p_entries;
+	p_is_valid &= l_found == l_expected;
+	return double(l_count) * p_readers / l_time / 1000000;
+}
+
+void test_share_snapshot()
+{
+	const size_t l_entries = 500 * 1000;
+	TestShareIndex l_index;
+	for (size_t i = 0; i < l_entries; ++i)
+		l_index[test_share_key(i)] = int64_t(i);
+	g_test_share_locked = l_index;
+	std::atomic_store(&g_test_share_snapshot, TestShareIndexPtr(std::make_shared<TestShareIndex>(l_index)));
+	++g_test_share_version;
+	
+	const size_t l_readers[] = { 1, 2, 4, 8 };
+	bool l_is_valid = true;
+	for (size_t i = 0; i < _countof(l_readers); ++i)
+	{
+		for (int l_is_writer = 0; l_is_writer < 2; ++l_is_writer)
+		{
+			const double l_locked = test_share_lookups(l_readers[i], l_is_writer != 0, l_entries, l_is_valid, [](const TestShareKey & p_key) -> size_t
+			{
+				CFlyLock(g_test_share_cs);
+				return g_test_share_locked.count(p_key);
+			});
+			const double l_atomic = test_share_lookups(l_readers[i], l_is_writer != 0, l_entries, l_is_valid, [](const TestShareKey & p_key) -> size_t
+			{
+				const TestShareIndexPtr l_snapshot = std::atomic_load(&g_test_share_snapshot);
+				return l_snapshot->count(p_key);
+			});
+			const double l_cached = test_share_lookups(l_readers[i], l_is_writer != 0, l_entries, l_is_valid, [](const TestShareKey & p_key) -> size_t
+			{
+				return test_thread_snapshot()->count(p_key);
+			});
+			std::cout << "readers = " << l_readers[i] << (l_is_writer ? ", writer" : ", no writer")
+			          << ": locked map = " << l_locked << " M/s, atomic_load = " << l_atomic
+			          << " M/s, thread cache = " << l_cached << " M/s" << std::endl;
+		}
+	}
+	std::cout << "Share snapshot: found keys check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+}
+
+// Segment simulator: sources with different speeds download one file, every source asks for the next segment
+// like getNextSegmentL (chunk size shrinking near the end) and sizes it with CFlySegmentSize, the former
+// step-wise updateChunkSize is run on the same scenarios for comparison
+static int64_t test_old_chunk_size(int64_t p_chunk_size, int64_t& p_speed, int64_t p_leaf_size, int64_t p_last_chunk, uint64_t p_ticks)
+{
+	const int64_t l_segment_time = 120 * 1000;
+	const int64_t l_min_chunk_size = 64 * 1024;
+	p_speed = p_ticks ? int64_t(1000. * p_last_chunk / p_ticks) : 0;
+	if (p_chunk_size == 0)
+		return std::max(l_min_chunk_size, std::min(p_last_chunk, (int64_t)1024 * 1024));
+	if (p_ticks <= 10)
+		return p_chunk_size * 2;
+	const double l_last_speed = (1000. * p_last_chunk) / p_ticks;
+	int64_t l_target_size = p_chunk_size;
+	const double l_msecs = 1000 * double(l_target_size) / l_last_speed;
+	if (l_msecs < l_segment_time / 4)
+		l_target_size *= 2;
+	else if (l_msecs < l_segment_time / 1.25)
+		l_target_size += p_leaf_size;
+	else if (l_msecs < l_segment_time * 1.25)
+		;
+	else if (l_msecs < l_segment_time * 4)
+		l_target_size = std::max(l_min_chunk_size, l_target_size - p_chunk_size);
+	else
+		l_target_size = std::max(l_min_chunk_size, l_target_size / 2);
+	return l_target_size;
+}
+
+struct TestSegmentScenario
+{
+	const char* m_name;
+	int64_t m_speeds[4]; // bytes/s, 0 - no source
+	int m_stall_percent; // chance of a segment at 1/10 of the speed
+};
+
+template<class ChunkSize>
+static void test_simulate_segments(const TestSegmentScenario& p_scenario, const char* p_name, ChunkSize p_chunk_size)
+{
+	const int64_t l_file_size = 4LL * 1024 * 1024 * 1024;
+	const int64_t l_block_size = 8 * 1024 * 1024; // TigerTree::getMaxBlockSize of 4 GiB
+	const uint64_t l_request_ms = 300; // $ADCGET round trip and the new segment in the queue
+	struct Source
+	{
+		int64_t m_chunk_size;
+		int64_t m_speed_estimation;
+		uint64_t m_free_at; // ms
+	};
+	std::vector<Source> l_sources;
+	for (size_t i = 0; i < _countof(p_scenario.m_speeds) && p_scenario.m_speeds[i]; ++i)
+	{
+		const Source l_source = { 0, 0, 0 };
+		l_sources.push_back(l_source);
+	}
+	srand(1);
+	int64_t l_pos = 0;
+	uint64_t l_end_time = 0;
+	size_t l_segments = 0;
+	size_t l_short_segments = 0; // less than 10 s - the request overhead is noticeable
+	uint64_t l_total_segment_ms = 0;
+	int64_t l_max_chunk = 0;
+	while (l_pos < l_file_size)
+	{
+		// the source which is free first takes the next segment
+		size_t l_index = 0;
+		for (size_t i = 1; i < l_sources.size(); ++i)
+		{
+			if (l_sources[i].m_free_at < l_sources[l_index].m_free_at)
+				l_index = i;
+		}
+		Source& l_source = l_sources[l_index];
+		const double l_done = double(l_pos) / l_file_size;
+		int64_t l_size = static_cast<int64_t>(double(l_source.m_chunk_size) * std::max(0.25, 1. - l_done * l_done));
+		l_size = l_size > l_block_size ? l_size - l_size % l_block_size : l_block_size;
+		l_size = std::min(l_size, l_file_size - l_pos);
+		
+		int64_t l_speed = p_scenario.m_speeds[l_index] / 2 + rand() % p_scenario.m_speeds[l_index]; // +-50%
+		if (rand() % 100 < p_scenario.m_stall_percent)
+			l_speed /= 10;
+		const uint64_t l_ticks = uint64_t(1000. * l_size / l_speed);
+		l_source.m_free_at += l_request_ms + l_ticks;
+		l_end_time = std::max(l_end_time, l_source.m_free_at);
+		l_source.m_chunk_size = p_chunk_size(l_source.m_chunk_size, l_source.m_speed_estimation, l_block_size, l_size, l_ticks);
+		l_max_chunk = std::max(l_max_chunk, l_source.m_chunk_size);
+		l_pos += l_size;
+		++l_segments;
+		l_total_segment_ms += l_ticks;
+		if (l_ticks < 10 * 1000)
+			++l_short_segments;
+	}
+	std::cout << p_scenario.m_name << ", " << p_name << ": time = " << l_end_time / 1000 << " s, segments = " << l_segments
+	          << " (shorter than 10 s = " << l_short_segments << "), average = " << l_total_segment_ms / l_segments / 1000
+	          << " s, max chunk = " << l_max_chunk / 1024 / 1024 << " MiB" << std::endl;
+}
+
+void test_segment_size()
+{
+	// the first update must be limited too: 1 MiB first segment at 100 MB/s
+	int64_t l_speed = 0;
+	const int64_t l_first = CFlySegmentSize::next(0, l_speed, 1024 * 1024, 1024 * 1024, 11);
+	if (l_first > 4 * 1024 * 1024)
+		std::cout << "CFlySegmentSize: the first segment grew " << l_first / (1024 * 1024) << "x" << std::endl;
+		
+	const TestSegmentScenario l_scenarios[] =
+	{
+		{ "LAN 10 MB/s", { 10 * 1024 * 1024 }, 0 },
+		{ "DSL 200 KB/s", { 200 * 1024 }, 0 },
+		{ "mixed 50 KB/s - 8 MB/s", { 50 * 1024, 500 * 1024, 2 * 1024 * 1024, 8 * 1024 * 1024 }, 0 },
+		{ "unstable 1 MB/s x 2, 20% stalls", { 1024 * 1024, 1024 * 1024 }, 20 },
+	};
+	for (size_t i = 0; i < _countof(l_scenarios); ++i)
+	{
+		test_simulate_segments(l_scenarios[i], "step-wise", &test_old_chunk_size);
+		test_simulate_segments(l_scenarios[i], "EWMA", &CFlySegmentSize::next);
+	}
+}
+
+// BufferedSocket::threadRead MODE_LINE framing: the former find + erase of every command vs CFlyLineFramer (the offset
+// walk the product uses, one erase per read, no copy of the command). The stream is fed in 64 KiB reads;
+// nmdc-capture.txt / adc-capture.txt (raw hub traffic) are used if they exist, 20k synthesized $MyINFO / BINF commands otherwise.
+static size_t test_frame_old(const std::string& p_stream, char p_separator, size_t p_read_size, size_t& p_count)
+{
+	std::string l_line; // the incomplete command of the previous read
+	size_t l_sum = 0;
+	p_count = 0;
+	for (size_t l_bufpos = 0; l_bufpos < p_stream.size(); l_bufpos += p_read_size)
+	{
+		std::string l = l_line + p_stream.substr(l_bufpos, p_read_size);
+		std::string::size_type l_pos;
+		while ((l_pos = l.find(p_separator)) != std::string::npos)
+		{
+			if (l_pos > 0)
+			{
+				const std::string l_command = l.substr(0, l_pos);
+				l_sum += l_command.size() + uint8_t(l_command[0]);
+				++p_count;
+			}
+			l.erase(0, l_pos + 1);
+		}
+		l_line = l;
+	}
+	return l_sum;
+}
+
+static size_t test_frame_new(const std::string& p_stream, char p_separator, size_t p_read_size, size_t& p_count)
+{
+	std::string l_line;
+	std::string l;
+	size_t l_sum = 0;
+	p_count = 0;
+	for (size_t l_bufpos = 0; l_bufpos < p_stream.size(); l_bufpos += p_read_size)
+	{
+		l.swap(l_line);
+		l.append(p_stream, l_bufpos, p_read_size);
+		std::string::size_type l_line_start = 0;
+		CFlyLineFramer::split(l, p_separator, l_line_start, [&](std::string::size_type p_start, std::string::size_type p_len) -> bool
+		{
+			l_sum += p_len + uint8_t(l[p_start]);
+			++p_count;
+			return true;
+		});
+		l.erase(0, l_line_start);
+		l_line.swap(l);
+	}
+	return l_sum;
+}
+
+static bool test_line_framer_stream(const char* p_name, const std::string& p_stream, char p_separator)
+{
+	const size_t l_read_size = 64 * 1024;
+	size_t l_old_count = 0;
+	size_t l_new_count = 0;
+	performance::timer l_timer;
+	l_timer.start();
+	const size_t l_old_sum = test_frame_old(p_stream, p_separator, l_read_size, l_old_count);
+	const double l_old_time = l_timer.finish();
+	l_timer.start();
+	const size_t l_new_sum = test_frame_new(p_stream, p_separator, l_read_size, l_new_count);
+	const double l_new_time = l_timer.finish();
+	bool l_is_valid = l_old_sum == l_new_sum && l_old_count == l_new_count && l_new_count != 0;
+	std::cout << p_name << ": " << p_stream.size() << " bytes, " << l_new_count << " commands, erase per command = " << l_old_time * 1000
+	          << " ms, offset walk = " << l_new_time * 1000 << " ms" << std::endl;
+	// a whole ZPIPE block arrives as one buffer
+	l_timer.start();
+	const size_t l_old_block_sum = test_frame_old(p_stream, p_separator, p_stream.size(), l_old_count);
+	const double l_old_block_time = l_timer.finish();
+	l_timer.start();
+	const size_t l_new_block_sum = test_frame_new(p_stream, p_separator, p_stream.size(), l_new_count);
+	const double l_new_block_time = l_timer.finish();
+	l_is_valid = l_is_valid && l_old_block_sum == l_new_block_sum && l_old_count == l_new_count && l_new_block_sum == l_new_sum;
+	std::cout << p_name << " as one block: erase per command = " << l_old_block_time * 1000
+	          << " ms, offset walk = " << l_new_block_time * 1000 << " ms" << std::endl;
+	std::cout << p_name << ": same commands check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+	return l_is_valid;
+}
+
+// Exact commands, the remainder and the stop of CFlyLineFramer::split with every read size
+static bool test_line_framer_exact()
+{
+	const std::string l_stream = "|$Hello a|b||$Search x|\nzzz|$SP tail";
+	const char* l_expected[] = { "$Hello a", "b", "$Search x", "\nzzz" };
+	bool l_is_valid = true;
+	for (size_t l_read_size = 1; l_read_size <= l_stream.size(); ++l_read_size)
+	{
+		std::vector<std::string> l_commands;
+		std::string l;
+		for (size_t l_bufpos = 0; l_bufpos < l_stream.size(); l_bufpos += l_read_size)
+		{
+			l.append(l_stream, l_bufpos, l_read_size);
+			std::string::size_type l_line_start = 0;
+			CFlyLineFramer::split(l, '|', l_line_start, [&](std::string::size_type p_start, std::string::size_type p_len) -> bool
+			{
+				l_is_valid = l_is_valid && l[p_start + p_len] == '|';
+				l_commands.push_back(l.substr(p_start, p_len));
+				return true;
+			});
+			l.erase(0, l_line_start);
+		}
+		l_is_valid = l_is_valid && l == "$SP tail" && l_commands.size() == _countof(l_expected);
+		for (size_t i = 0; l_is_valid && i < l_commands.size(); ++i)
+		{
+			l_is_valid = l_commands[i] == l_expected[i];
+		}
+	}
+	// the socket leaves the line mode after "b": the walk stops right after its separator
+	std::string::size_type l_offset = 0;
+	size_t l_count = 0;
+	const bool l_is_all = CFlyLineFramer::split(l_stream, '|', l_offset, [&](std::string::size_type p_start, std::string::size_type p_len) -> bool
+	{
+		++l_count;
+		return l_stream.compare(p_start, p_len, "b") != 0;
+	});
+	l_is_valid = l_is_valid && !l_is_all && l_count == 2 && l_stream.compare(l_offset, 3, "|$S") == 0;
+	std::cout << "Line framer: exact commands check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+	return l_is_valid;
+}
+
+void test_line_framer()
+{
+	std::string l_nmdc = read_file(_T("nmdc-capture.txt"));
+	if (l_nmdc.empty())
+	{
+		for (int i = 0; i < 20000; ++i)
+		{
+			l_nmdc += "$MyINFO $ALL User" + std::to_string(i) + " description of the user<FlylinkDC++ V:r600,M:A,H:1/0/2,S:3>$ $100\x01$mail@example.com$" +
+			          std::to_string(int64_t(i) * 1234567) + "$|";
+		}
+	}
+	std::string l_adc = read_file(_T("adc-capture.txt"));
+	if (l_adc.empty())
+	{
+		for (int i = 0; i < 20000; ++i)
+		{
+			l_adc += std::string(g_test_adc_lines[0]) + std::to_string(i) + '\n';
+		}
+	}
+	bool l_is_valid = test_line_framer_exact();
+	l_is_valid = test_line_framer_stream("NMDC", l_nmdc, '|') && l_is_valid;
+	l_is_valid = test_line_framer_stream("ADC", l_adc, '\n') && l_is_valid;
+	std::cout << "Line framer: check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+}
+
+// Encoder Base32: the block codec against the former bit-by-bit one (bitzi bitcollider code).
+// Round trips of every 1- and 2-byte value, random lengths with damaged strings and the 24-byte TTH / CID case.
+static const char g_test_base32_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+static std::string test_old_to_base32(const uint8_t* p_src, size_t p_len)
+{
+	std::string l_dst;
+	uint8_t l_word;
+	for (size_t i = 0, l_index = 0; i < p_len;)
+	{
+		if (l_index > 3)
+		{
+			l_word = uint8_t(p_src[i] & (0xFF >> l_index));
+			l_index = (l_index + 5) % 8;
+			l_word <<= l_index;
+			if (i + 1 < p_len)
+				l_word |= p_src[i + 1] >> (8 - l_index);
+			i++;
+		}
+		else
+		{
+			l_word = uint8_t(p_src[i] >> (8 - (l_index + 5))) & 0x1F;
+			l_index = (l_index + 5) % 8;
+			if (l_index == 0)
+				i++;
+		}
+		l_dst += g_test_base32_alphabet[l_word];
+	}
+	return l_dst;
+}
+
+static int test_old_base32_value(char p_char)
+{
+	if (p_char >= 'A' && p_char <= 'Z')
+		return p_char - 'A';
+	if (p_char >= 'a' && p_char <= 'z')
+		return p_char - 'a';
+	if (p_char >= '2' && p_char <= '7')
+		return p_char - '2' + 26;
+	return -1;
+}
+
+static void test_old_from_base32(const char* p_src, uint8_t* p_dst, size_t p_len)
+{
+	memset(p_dst, 0, p_len);
+	for (size_t i = 0, l_index = 0, l_offset = 0; p_src[i]; i++)
+	{
+		const int l_tmp = test_old_base32_value(p_src[i]);
+		if (l_tmp == -1)
+			continue;
+		if (l_index <= 3)
+		{
+			l_index = (l_index + 5) % 8;
+			if (l_index == 0)
+			{
+				p_dst[l_offset] |= l_tmp;
+				if (++l_offset == p_len)
+					break;
+			}
+			else
+			{
+				p_dst[l_offset] |= l_tmp << (8 - l_index);
+			}
+		}
+		else
+		{
+			l_index = (l_index + 5) % 8;
+			p_dst[l_offset] |= l_tmp >> l_index;
+			if (++l_offset == p_len)
+				break;
+			p_dst[l_offset] |= l_tmp << (8 - l_index);
+		}
+	}
+}
+
+// @return number of the mismatches
+static size_t test_base32_check(const std::vector<uint8_t>& p_data, const std::string& p_text)
+{
+	size_t l_errors = 0;
+	const std::string l_encoded = Encoder::toBase32(p_data.data(), p_data.size());
+	if (l_encoded != test_old_to_base32(p_data.data(), p_data.size()))
+		++l_errors;
+	std::vector<uint8_t> l_decoded(p_data.size() + 1, 0xCC);
+	Encoder::fromBase32(l_encoded.c_str(), l_decoded.data(), p_data.size());
+	if (!std::equal(p_data.begin(), p_data.end(), l_decoded.begin()) || l_decoded.back() != 0xCC)
+		++l_errors;
+	// damaged or foreign text must be decoded as before
+	std::vector<uint8_t> l_old(p_data.size() + 1, 0xCC);
+	Encoder::fromBase32(p_text.c_str(), l_decoded.data(), p_data.size());
+	test_old_from_base32(p_text.c_str(), l_old.data(), p_data.size());
+	if (l_decoded != l_old)
+		++l_errors;
+	return l_errors;
+}
+
+void test_base32()
+{
+	size_t l_errors = 0;
+	std::vector<uint8_t> l_data;
+	for (unsigned i = 0; i < 256; ++i)
+	{
+		l_data.assign(1, uint8_t(i));
+		l_errors += test_base32_check(l_data, test_old_to_base32(l_data.data(), l_data.size()));
+	}
+	for (unsigned i = 0; i < 65536; ++i)
+	{
+		l_data.assign(1, uint8_t(i >> 8));
+		l_data.push_back(uint8_t(i));
+		l_errors += test_base32_check(l_data, test_old_to_base32(l_data.data(), l_data.size()));
+	}
+	std::cout << "Base32: every 1- and 2-byte value - " << l_errors << " errors" << std::endl;
+	
+	l_errors = 0;
+	srand(1);
+	for (int i = 0; i < 400000; ++i)
+	{
+		l_data.resize(1 + rand() % 69); // the former decoder writes past the end with len == 0
+		for (auto j = l_data.begin(); j != l_data.end(); ++j)
+			*j = uint8_t(rand());
+		std::string l_text = test_old_to_base32(l_data.data(), l_data.size());
+		switch (i % 5)
+		{
+			case 1: // lower case
+				boost::algorithm::to_lower(l_text);
+				break;
+			case 2: // truncated
+				l_text.resize(l_text.size() / 2);
+				break;
+			case 3: // characters to skip: padding, separators, bytes >= 0x80
+				if (!l_text.empty())
+					l_text.insert(rand() % l_text.size(), 1, "=-:\xC0\xFF 18"[rand() % 8]);
+				break;
+			case 4: // longer than needed
+				l_text += "ABCDEFGH";
+				break;
+		}
+		l_errors += test_base32_check(l_data, l_text);
+	}
+	std::cout << "Base32: 400000 random values of 1..69 bytes with damaged strings - " << l_errors << " errors" << std::endl;
+	
+	// TTH / CID: 24 bytes <-> 39 characters
+	const int l_iterations = 3000000;
+	uint8_t l_tth[24];
+	for (size_t i = 0; i < sizeof(l_tth); ++i)
+		l_tth[i] = uint8_t(rand());
+	size_t l_sum = 0;
+	performance::timer l_timer;
+	l_timer.start();
+	for (int i = 0; i < l_iterations; ++i)
+	{
+		l_tth[i % sizeof(l_tth)]++;
+		const std::string l_text = test_old_to_base32(l_tth, sizeof(l_tth));
+		test_old_from_base32(l_text.c_str(), l_tth, sizeof(l_tth));
+		l_sum += l_tth[0];
+	}
+	const double l_old_time = l_timer.finish();
+	size_t l_new_sum = 0;
+	l_timer.start();
+	for (int i = 0; i < l_iterations; ++i)
+	{
+		l_tth[i % sizeof(l_tth)]--;
+		std::string l_text;
+		Encoder::toBase32(l_tth, sizeof(l_tth), l_text);
+		Encoder::fromBase32(l_text.c_str(), l_tth, sizeof(l_tth));
+		l_new_sum += l_tth[0];
+	}
+	const double l_new_time = l_timer.finish();
+	std::cout << "Base32: " << l_iterations << " x encode + decode of 24 bytes: bit-by-bit = " << l_old_time * 1000
+	          << " ms, 5-byte blocks = " << l_new_time * 1000 << " ms (" << l_sum + l_new_sum << ")" << std::endl;
+}
+
+// Util.cpp is not compiled into the test - the empty strings of Text.cpp and AdcCommand.h
+const string Util::emptyString;
+const wstring Util::emptyStringW;
+volatile bool g_isBeforeShutdown = false; // CommandHandler::dispatch
+const tstring Util::emptyStringT;
+
+// Text::toLower(UTF-8): the BMP table with the ASCII word path vs the former CharLowerW call per character.
+// Every BMP character is compared, then file names from tolower-latin.txt / tolower-cyrillic.txt (one per line, UTF-8)
+// are lowercased 20 times, 100k synthesized names are used if a file does not exist.
+static char* test_wc_to_utf8(wchar_t p_char, char* p_out)
+{
+	if (p_char >= 0x0800)
+	{
+		*p_out++ = char(0xE0 | (p_char >> 12));
+		*p_out++ = char(0x80 | ((p_char >> 6) & 0x3F));
+		*p_out++ = char(0x80 | (p_char & 0x3F));
+	}
+	else if (p_char >= 0x0080)
+	{
+		*p_out++ = char(0xC0 | (p_char >> 6));
+		*p_out++ = char(0x80 | (p_char & 0x3F));
+	}
+	else
+	{
+		*p_out++ = char(p_char);
+	}
+	return p_out;
+}
+
+static const std::string& test_old_to_lower(const std::string& p_str, std::string& p_tmp)
+{
+	p_tmp.clear();
+	p_tmp.reserve(p_str.length() + 1);
+	const char* l_end = p_str.c_str() + p_str.length();
+	for (const char* p = p_str.c_str(); p < l_end;)
+	{
+		wchar_t c = 0;
+		const int n = Text::utf8ToWc(p, c);
+		if (n < 0)
+		{
+			p_tmp += '_';
+			p += abs(n);
+		}
+		else
+		{
+			p += n;
+			char l_buf[3];
+			p_tmp.append(l_buf, test_wc_to_utf8(static_cast<wchar_t>(reinterpret_cast<ptrdiff_t>(CharLowerW((LPWSTR)c))), l_buf));
+		}
+	}
+	return p_tmp;
+}
+
+static std::vector<std::string> test_to_lower_corpus(LPCTSTR p_file, wchar_t p_first, wchar_t p_last)
+{
+	std::vector<std::string> l_names;
+	const std::string l_data = read_file(p_file);
+	boost::algorithm::split(l_names, l_data, boost::is_any_of("\r\n"), boost::token_compress_on);
+	l_names.erase(std::remove(l_names.begin(), l_names.end(), std::string()), l_names.end());
+	if (l_names.empty())
+	{
+		srand(1);
+		for (int i = 0; i < 100000; ++i)
+		{
+			std::string l_name;
+			char l_buf[3];
+			const size_t l_len = 10 + rand() % 50;
+			for (size_t j = 0; j < l_len; ++j)
+			{
+				const wchar_t c = j % 12 == 11 ? L' ' : wchar_t(p_first + rand() % (p_last - p_first + 1));
+				l_name.append(l_buf, test_wc_to_utf8(c, l_buf));
+			}
+			l_names.push_back(l_name + ".2016.1080p.MKV");
+		}
+	}
+	return l_names;
+}
+
+static void test_to_lower_corpus_speed(const char* p_name, const std::vector<std::string>& p_names)
+{
+	size_t l_bytes = 0;
+	size_t l_errors = 0;
+	std::string l_old;
+	std::string l_new;
+	for (auto i = p_names.cbegin(); i != p_names.cend(); ++i)
+	{
+		l_bytes += i->size();
+		if (test_old_to_lower(*i, l_old) != Text::toLower(*i, l_new))
+			++l_errors;
+	}
+	const int l_rounds = 20;
+	size_t l_sum = 0;
+	performance::timer l_timer;
+	l_timer.start();
+	for (int r = 0; r < l_rounds; ++r)
+		for (auto i = p_names.cbegin(); i != p_names.cend(); ++i)
+			l_sum += test_old_to_lower(*i, l_old).size();
+	const double l_old_time = l_timer.finish();
+	l_timer.start();
+	for (int r = 0; r < l_rounds; ++r)
+		for (auto i = p_names.cbegin(); i != p_names.cend(); ++i)
+			l_sum -= Text::toLower(*i, l_new).size();
+	const double l_new_time = l_timer.finish();
+	const double l_mb = double(l_bytes) * l_rounds / 1024 / 1024;
+	std::cout << p_name << ": " << p_names.size() << " names, " << l_errors << " errors, CharLowerW = " << l_mb / l_old_time
+	          << " MB/s, table = " << l_mb / l_new_time << " MB/s" << (l_sum ? " - MISMATCH" : "") << std::endl;
+}
+
+void test_to_lower()
+{
+	Text::initialize();
+	size_t l_errors = 0;
+	std::string l_old;
+	std::string l_new;
+	for (uint32_t c = 1; c < 0x10000; ++c)
+	{
+		if (c >= 0xD800 && c < 0xE000) // surrogates are not valid in UTF-8
+			continue;
+		if (Text::toLower(wchar_t(c)) != static_cast<wchar_t>(reinterpret_cast<ptrdiff_t>(CharLowerW((LPWSTR)c))))
+			++l_errors;
+		char l_buf[4];
+		const std::string l_str(l_buf, test_wc_to_utf8(wchar_t(c), l_buf));
+		if (test_old_to_lower(l_str, l_old) != Text::toLower(l_str, l_new))
+			++l_errors;
+	}
+	std::cout << "toLower: every BMP character - " << l_errors << " errors" << std::endl;
+	test_to_lower_corpus_speed("Latin", test_to_lower_corpus(_T("tolower-latin.txt"), L'A', L'z'));
+	test_to_lower_corpus_speed("Cyrillic", test_to_lower_corpus(_T("tolower-cyrillic.txt"), 0x0410, 0x044F));
+}
+
+// CFlySearchResultAggregator under a flood of search results: 10 own searches, every result comes from 3 hubs,
+// 4 of 5 results carry a token we never sent (other clients, spoofed UDP). The former code created the token state
+// for any token - emulated by addToken before every add. The deltas are flushed every 100k results as the timer does.
+static bool test_search_flood_pass(const char* p_name, bool p_is_any_token, unsigned p_count)
+{
+	const uint32_t l_own_tokens = 10;
+	const size_t l_private_bytes = test_private_bytes();
+	CFlySearchResultAggregator l_aggregator;
+	for (uint32_t i = 1; i <= l_own_tokens; ++i)
+		l_aggregator.addToken(i, 0);
+	uint8_t l_tth_data[TTHValue::BYTES] = { 0 };
+	uint8_t l_cid_data[CID::SIZE] = { 0 };
+	std::string l_file;
+	unsigned l_passed = 0;
+	size_t l_delta_groups = 0;
+	size_t l_max_delta = 0;
+	srand(1);
+	performance::timer l_timer;
+	l_timer.start();
+	for (unsigned i = 0; i < p_count; ++i)
+	{
+		const unsigned l_result = i / 3; // the same result from 3 hubs
+		const bool l_is_own = l_result % 5 == 0;
+		const uint32_t l_token = l_is_own ? 1 + (l_result / 5) % l_own_tokens : uint32_t(rand()) << 16 ^ uint32_t(rand());
+		const unsigned l_tth = l_result % 200000; // several users share the same file
+		memcpy(l_tth_data, &l_tth, sizeof(l_tth));
+		memcpy(l_cid_data, &l_result, sizeof(l_result));
+		l_file = "Share\\Video\\Some.Movie." + std::to_string(l_tth % 1000) + ".1080p.mkv";
+		if (p_is_any_token)
+			l_aggregator.addToken(l_token, 0);
+		if (l_aggregator.add(l_token, TTHValue(l_tth_data), CID(l_cid_data), l_file, 1000000 + l_tth, l_result % 3, 0))
+			++l_passed;
+		if (i % 100000 == 99999)
+		{
+			CFlySearchResultAggregator::DeltaList l_deltas;
+			l_aggregator.flush(0, l_deltas);
+			for (auto j = l_deltas.cbegin(); j != l_deltas.cend(); ++j)
+			{
+				l_delta_groups += j->second.size();
+				l_max_delta = std::max(l_max_delta, j->second.size());
+			}
+		}
+	}
+	const double l_time = l_timer.finish();
+	std::cout << p_name << ": " << p_count / l_time / 1000 << "k results/s, " << l_passed << " passed, " << l_aggregator.getTokenCount()
+	          << " token states, " << l_delta_groups << " groups in the deltas, +" << (test_private_bytes() - l_private_bytes) / 1024 << " KiB" << std::endl;
+	return l_max_delta <= CFlySearchResultAggregator::MAX_GROUPS && (p_is_any_token || l_aggregator.getTokenCount() == l_own_tokens);
+}
+
+// The top list against the groups counted by the test itself: random results of 3000 TTHs, then the full sort
+static bool test_search_top()
+{
+	CFlySearchResultAggregator l_aggregator;
+	l_aggregator.addToken(7, 0);
+	std::map<unsigned, uint64_t> l_scores;
+	uint8_t l_tth_data[TTHValue::BYTES] = { 0 };
+	uint8_t l_cid_data[CID::SIZE] = { 0 };
+	srand(2);
+	for (unsigned i = 0; i < 100000; ++i)
+	{
+		const unsigned l_tth = ((rand() & 0x7FFF) * (rand() & 0x7FFF)) % 3000; // skewed - a few popular files
+		const unsigned l_user = rand() & 0x7FFF;
+		const uint32_t l_free_slots = l_user % 4;
+		memcpy(l_tth_data, &l_tth, sizeof(l_tth));
+		memcpy(l_cid_data, &l_user, sizeof(l_user));
+		if (l_aggregator.add(7, TTHValue(l_tth_data), CID(l_cid_data), "Files\\" + std::to_string(l_tth) + ".avi", l_tth, l_free_slots, 0))
+		{
+			l_scores[l_tth] += (uint64_t(1) << 32) + l_free_slots;
+		}
+	}
+	std::vector<uint64_t> l_expected;
+	for (auto i = l_scores.cbegin(); i != l_scores.cend(); ++i)
+		l_expected.push_back(i->second);
+	std::sort(l_expected.begin(), l_expected.end(), std::greater<uint64_t>());
+	l_expected.resize(CFlySearchResultAggregator::TOP_COUNT);
+	SearchResultGroupList l_top;
+	l_aggregator.getTopGroups(7, l_top);
+	bool l_is_valid = l_top.size() == l_expected.size();
+	for (size_t i = 0; l_is_valid && i < l_top.size(); ++i)
+	{
+		unsigned l_tth = 0;
+		memcpy(&l_tth, l_top[i].m_tth.data, sizeof(l_tth));
+		l_is_valid = CFlySearchResultAggregator::getScore(l_top[i]) == l_expected[i] && l_scores[l_tth] == l_expected[i] &&
+		             l_top[i].m_file_name == std::to_string(l_tth) + ".avi" && l_top[i].m_size == l_tth;
+	}
+	return l_is_valid;
+}
+
+void test_search_flood()
+{
+	// the full path is the key: the same TTH and user with another path is another source, the same path is a duplicate
+	CFlySearchResultAggregator l_aggregator;
+	l_aggregator.addToken(1, 0);
+	const TTHValue l_tth(std::string("ABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFG"));
+	const TTHValue l_tth2(std::string("BBCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFG"));
+	const CID l_cid(std::string("ABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFH"));
+	const CID l_cid2(std::string("BBCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFH"));
+	bool l_is_valid = l_aggregator.add(1, l_tth, l_cid, "Video\\a.mkv", 100, 1, 0) && l_aggregator.add(1, l_tth, l_cid, "Backup\\a.mkv", 100, 1, 0) &&
+	                  !l_aggregator.add(1, l_tth, l_cid, "Video\\a.mkv", 100, 1, 0) && l_aggregator.add(2, l_tth, l_cid, "Video\\a.mkv", 100, 1, 0) &&
+	                  l_aggregator.add(2, l_tth, l_cid, "Video\\a.mkv", 100, 1, 0) && l_aggregator.getTokenCount() == 1;
+	std::cout << "Search results: path / token check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+	
+	// groups and deltas: a group comes once per flush however many sources it got, nothing without new sources
+	l_aggregator.add(1, l_tth2, l_cid2, "b.mkv", 200, 0, 0);
+	CFlySearchResultAggregator::DeltaList l_deltas;
+	l_aggregator.flush(0, l_deltas);
+	bool l_is_groups = l_deltas.size() == 1 && l_deltas[0].first == 1 && l_deltas[0].second.size() == 2;
+	for (size_t i = 0; l_is_groups && i < l_deltas[0].second.size(); ++i)
+	{
+		const SearchResultGroup& l_group = l_deltas[0].second[i];
+		l_is_groups = l_group.m_tth == l_tth ? l_group.m_sources == 2 && l_group.m_free_slots == 2 && l_group.m_file_name == "a.mkv" && l_group.m_size == 100 :
+		              l_group.m_sources == 1 && l_group.m_free_slots == 0 && l_group.m_file_name == "b.mkv" && l_group.m_size == 200;
+	}
+	l_deltas.clear();
+	l_aggregator.flush(0, l_deltas);
+	l_is_groups = l_is_groups && l_deltas.empty();
+	l_aggregator.add(1, l_tth2, l_cid, "b.mkv", 200, 5, 0);
+	l_aggregator.add(1, l_tth2, l_cid2, "c.mkv", 200, 5, 0);
+	l_aggregator.flush(0, l_deltas);
+	l_is_groups = l_is_groups && l_deltas.size() == 1 && l_deltas[0].second.size() == 1 && l_deltas[0].second[0].m_sources == 3;
+	SearchResultGroupList l_top;
+	l_aggregator.getTopGroups(1, l_top);
+	l_is_groups = l_is_groups && l_top.size() == 2 && l_top[0].m_tth == l_tth2 && l_top[1].m_tth == l_tth;
+	l_is_groups = l_is_groups && test_search_top();
+	std::cout << "Search results: groups / top / deltas check " << (l_is_groups ? "OK" : "FAILED") << std::endl;
+	
+	// a token with more TTHs than MAX_GROUPS: the groups stop there, the results are still filtered
+	l_aggregator.addToken(3, 0);
+	uint8_t l_tth_data[TTHValue::BYTES] = { 0 };
+	bool l_is_bounded = true;
+	for (unsigned i = 0; i < CFlySearchResultAggregator::MAX_GROUPS + 1000; ++i)
+	{
+		memcpy(l_tth_data, &i, sizeof(i));
+		l_is_bounded = l_aggregator.add(3, TTHValue(l_tth_data), l_cid, "x", 1, 0, 0) && l_is_bounded;
+	}
+	// the last one has no group but is still a known source
+	l_is_bounded = !l_aggregator.add(3, TTHValue(l_tth_data), l_cid, "x", 1, 0, 0) && l_is_bounded;
+	l_deltas.clear();
+	l_aggregator.flush(0, l_deltas);
+	l_is_bounded = l_is_bounded && l_deltas.size() == 1 && l_deltas[0].first == 3 && l_deltas[0].second.size() == CFlySearchResultAggregator::MAX_GROUPS;
+	l_is_bounded = test_search_flood_pass("State for any token", true, 1500000) && l_is_bounded;
+	l_is_bounded = test_search_flood_pass("Own tokens only", false, 1500000) && l_is_bounded;
+	std::cout << "Search results: bounds check " << (l_is_bounded ? "OK" : "FAILED") << std::endl;
+	
+	l_aggregator.flush(CFlySearchResultAggregator::EXPIRE_TIME + 1, l_deltas);
+	if (l_aggregator.getTokenCount() != 0)
+		std::cout << "Search results: the token did not expire" << std::endl;
+}
+
+// MD5Calc: the builtin code vs OpenSSL. The RFC 1321 test suite, a random buffer fed in uneven parts,
+// then MB/s on a 4 GiB + 64 MiB stream (the 32-bit bit count of the builtin code carries over).
+// At the end the table of CFlyHashBackend (MD5, Tiger, SHA-1), the same one /hashbench prints in the client.
+static std::string test_md5(bool p_is_openssl, const unsigned char* p_data, const std::vector<unsigned>& p_parts)
+{
+	MD5Calc l_md5;
+	l_md5.MD5Init(p_is_openssl);
+	for (auto i = p_parts.cbegin(); i != p_parts.cend(); ++i)
+	{
+		l_md5.MD5Update(const_cast<unsigned char*>(p_data), *i);
+		p_data += *i;
+	}
+	return l_md5.MD5FinalToString();
+}
+
+void test_hash_bench()
+{
+	const bool l_is_backend_valid = CFlyHashBackend::init();
+	std::cout << "Hash backends: self-test " << (l_is_backend_valid ? "OK" : "FAILED") << std::endl;
+	
+	static const char* g_rfc1321[][2] =
+	{
+		{ "", "D41D8CD98F00B204E9800998ECF8427E" },
+		{ "a", "0CC175B9C0F1B6A831C399E269772661" },
+		{ "abc", "900150983CD24FB0D6963F7D28E17F72" },
+		{ "message digest", "F96B697D7CB7938D525A2F31AAF161D0" },
+		{ "abcdefghijklmnopqrstuvwxyz", "C3FCD3D76192E4007DFB496CCA67E13B" },
+		{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", "D174AB98D277D9F5A5611C2C9F419D9F" },
+		{ "12345678901234567890123456789012345678901234567890123456789012345678901234567890", "57EDF4A22BE3C955AC49DA2E2107B67A" },
+	};
+	bool l_is_valid = true;
+	for (size_t i = 0; i < _countof(g_rfc1321); ++i)
+	{
+		const std::vector<unsigned> l_parts(1, unsigned(strlen(g_rfc1321[i][0])));
+		for (int l_is_openssl = 0; l_is_openssl < 2; ++l_is_openssl)
+		{
+			if (test_md5(l_is_openssl != 0, (const unsigned char*)g_rfc1321[i][0], l_parts) != g_rfc1321[i][1])
+			{
+				std::cout << "MD5 " << (l_is_openssl ? "openssl" : "builtin") << ": wrong digest of \"" << g_rfc1321[i][0] << '"' << std::endl;
+				l_is_valid = false;
+			}
+		}
+	}
+	
+	const unsigned l_size = 64 * 1024 * 1024;
+	std::vector<unsigned char> l_data(l_size);
+	srand(1);
+	for (unsigned i = 0; i < l_size; ++i)
+		l_data[i] = static_cast<unsigned char>(rand());
+	for (int l_pass = 0; l_pass < 100; ++l_pass)
+	{
+		std::vector<unsigned> l_parts;
+		unsigned l_rest = 1 + (unsigned(rand()) << 8 ^ unsigned(rand())) % (1024 * 1024);
+		const unsigned l_len = l_rest;
+		while (l_rest)
+		{
+			const unsigned l_part = std::min<unsigned>(l_rest, rand() % 200);
+			l_parts.push_back(l_part);
+			l_rest -= l_part;
+		}
+		const unsigned char* l_begin = l_data.data() + (l_size - l_len) * (l_pass & 1);
+		if (test_md5(false, l_begin, l_parts) != test_md5(true, l_begin, l_parts))
+		{
+			std::cout << "MD5: builtin and openssl differ on " << l_len << " bytes in " << l_parts.size() << " parts" << std::endl;
+			l_is_valid = false;
+			break;
+		}
+	}
+	std::cout << "MD5: bit-exact check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+	
+	const int l_count = 65;
+	std::string l_digest[2];
+	for (int l_is_openssl = 0; l_is_openssl < 2; ++l_is_openssl)
+	{
+		MD5Calc l_md5;
+		l_md5.MD5Init(l_is_openssl != 0);
+		performance::timer l_timer;
+		l_timer.start();
+		for (int i = 0; i < l_count; ++i)
+			l_md5.MD5Update(l_data.data(), l_size);
+		const double l_time = l_timer.finish();
+		l_digest[l_is_openssl] = l_md5.MD5FinalToString();
+		std::cout << "MD5 " << (l_is_openssl ? "openssl" : "builtin") << ": " << double(l_size) * l_count / 1024 / 1024 / l_time << " MB/s, "
+		          << l_digest[l_is_openssl] << std::endl;
+	}
+	if (l_digest[0] != l_digest[1])
+		std::cout << "MD5: the digests of " << l_count * 64 << " MiB differ" << std::endl;
+	
+	MD5Calc l_md5;
+	l_md5.MD5Init();
+	l_md5.MD5Update((unsigned char*)"abc", 3);
+	const bool l_is_selected = l_md5.MD5FinalToString() == "900150983CD24FB0D6963F7D28E17F72" && (CFlyHashBackend::isOpenSSLMD5() || !l_is_backend_valid);
+	const std::string l_table = CFlyHashBackend::benchmark(l_size);
+	std::cout << l_table;
+	std::cout << "Hash backends: selection check " << (l_is_selected && l_table.find("differs") == std::string::npos ? "OK" : "FAILED") << std::endl;
+}
+
+// CFlyFairQueue: the grant order of the upload slot queue (UPLOAD_QUEUE_POLICY=1 is the default).
+static bool test_upload_queue_order(CFlyFairQueue<int>& p_queue, const std::vector<int>& p_order)
+{
+	std::vector<int> l_order;
+	for (size_t i = 0; i < p_order.size(); ++i)
+	{
+		if (p_queue.getPosition(p_order[i]) != i + 1)
+			return false;
+	}
+	while (!p_queue.empty())
+	{
+		l_order.push_back(p_queue.front());
+		p_queue.erase(p_queue.front());
+	}
+	return l_order == p_order;
+}
+
+void test_upload_queue()
+{
+	bool l_is_valid = true;
+	{
+		// FIFO: arrival order whatever was served
+		CFlyFairQueue<int> l_queue;
+		l_queue.addServedBytes(1, 1000);
+		for (int i = 1; i <= 3; ++i)
+			l_queue.push(i, 0, false);
+		l_is_valid &= test_upload_queue_order(l_queue, { 1, 2, 3 });
+	}
+	{
+		// fair: the fast lane first, then the least served, arrival breaks ties
+		CFlyFairQueue<int> l_queue;
+		l_queue.addServedBytes(1, 5000);
+		l_queue.addServedBytes(2, 1000);
+		l_queue.push(1, 1, true);
+		l_queue.push(2, 1, true);
+		l_queue.push(3, 1, true);
+		l_queue.push(4, 0, true);
+		l_queue.push(5, 1, true);
+		l_is_valid &= test_upload_queue_order(l_queue, { 4, 3, 5, 2, 1 });
+	}
+	{
+		// the order follows the bytes served while the users are queued
+		CFlyFairQueue<int> l_queue;
+		l_queue.push(1, 1, true);
+		l_queue.push(2, 1, true);
+		l_is_valid &= l_queue.front() == 1;
+		l_queue.addServedBytes(1, 4000);
+		l_is_valid &= l_queue.front() == 2;
+		l_queue.addServedBytes(2, 3000);
+		l_is_valid &= l_queue.front() == 2;
+		l_queue.decayServedBytes(); // 2000 / 1500
+		l_queue.addServedBytes(2, 1000);
+		l_is_valid &= l_queue.front() == 1 && l_queue.getServedBytes(2) == 2500;
+		// a mini-slot request overtakes, the arrival number survives update()
+		l_queue.update(1, 0, true);
+		l_is_valid &= l_queue.front() == 1;
+		l_queue.update(1, 1, true);
+		l_is_valid &= test_upload_queue_order(l_queue, { 1, 2 });
+	}
+	std::cout << "Upload queue: order check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+	
+	const int l_count = 20000;
+	CFlyFairQueue<int> l_queue;
+	srand(1);
+	performance::timer l_timer;
+	l_timer.start();
+	for (int i = 0; i < l_count; ++i)
+	{
+		l_queue.addServedBytes(i, int64_t(rand()) * 1000);
+		l_queue.push(i, rand() % 4 == 0 ? 0 : 1, true);
+	}
+	int l_grants = 0;
+	for (; !l_queue.empty(); ++l_grants)
+	{
+		const int l_user = l_queue.front();
+		l_queue.erase(l_user);
+		if (l_grants % 10 == 0)
+			l_queue.addServedBytes(rand() % l_count, 1024 * 1024);
+	}
+	std::cout << "Upload queue: " << l_count << " users pushed and granted in " << l_timer.finish() * 1000 << " ms" << std::endl;
+}
+
+// CFlyFloodGuard / CFlyRepeatCounter: a flood of distinct targets and searches saturates the sketch,
+// nothing but the real flood target and the real duplicate may be blocked
+void test_flood_guard()
+{
+	const uint32_t l_limit = 20;
+	const uint64_t l_window = 60 * 1000;
+	CFlyFloodGuard l_guard(1024, 4096);
+	CFlyRepeatCounter l_duplicates(32 * 1024);
+	bool l_is_valid = true;
+	unsigned l_false_bans = 0;
+	unsigned l_false_duplicates = 0;
+	uint64_t l_tick = 1;
+	performance::timer l_timer;
+	l_timer.start();
+	for (unsigned i = 0; i < 200000; ++i, ++l_tick)
+	{
+		const std::string l_target = "10." + std::to_string(i % 50000 / 256) + '.' + std::to_string(i % 256) + ".1 0";
+		l_guard.add(l_target, l_tick, l_window, l_limit, l_window * 10);
+		if (i % 50000 < 10000 && l_guard.isBanned(l_target, l_tick))
+			++l_false_bans;
+		const std::string l_search = "$Search Hub:nick F?T?0?9?TTH:" + std::to_string(i);
+		if (l_duplicates.add(CFlyWindowSketch::getHash(l_search), l_tick, l_window) > 1)
+			++l_false_duplicates;
+		if (i % 100 == 0)
+			l_guard.add("192.168.1.1:411 0", l_tick, l_window, l_limit, l_window * 10);
+	}
+	const double l_time = l_timer.finish();
+	// 4 distinct targets per 1000 ticks never reach 20 connects a minute
+	l_is_valid &= l_false_bans == 0 && l_false_duplicates == 0;
+	// the real target: 2000 connects, 600 of them in every minute
+	l_is_valid &= l_guard.isBanned("192.168.1.1:411 0", l_tick);
+	l_is_valid &= l_duplicates.add(CFlyWindowSketch::getHash("$Search Hub:nick F?T?0?9?TTH:199999"), l_tick, l_window) == 2;
+	l_is_valid &= l_duplicates.add(CFlyWindowSketch::getHash("$Search Hub:nick F?T?0?9?TTH:199999"), l_tick + l_window, l_window) == 1;
+	std::cout << "Flood guard: false bans = " << l_false_bans << ", false duplicates = " << l_false_duplicates
+	          << ", 400k checks in " << l_time * 1000 << " ms, check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+}
+
+// GeoIP: CFlyIPRangeIndex vs the former CFlylinkDBManager lookup - the per-IP cache, the linear walk over
+// the ranges found so far and, on a miss, the "start_ip <= ? order by start_ip desc limit 1" query under m_cs.
+// The query is replaced with a std::map lookup here, so the old path is timed optimistically.
+class TestOldGeoLookup
+{
+	public:
+		typedef std::map<uint32_t, std::pair<uint32_t, uint32_t> > Table; // start -> (stop, value)
+		explicit TestOldGeoLookup(const Table& p_table) : m_table(p_table)
+		{
+		}
+		uint32_t find(uint32_t p_ip)
+		{
+			FastLock l(m_cs);
+			const auto l_cache = m_ip_cache.find(p_ip);
+			if (l_cache != m_ip_cache.end())
+				return l_cache->second;
+			for (auto i = m_ranges.cbegin(); i != m_ranges.cend(); ++i)
+			{
+				if (p_ip >= i->m_start && p_ip < i->m_stop)
+					return m_ip_cache[p_ip] = i->m_value;
+			}
+			uint32_t l_value = 0;
+			auto l_range = m_table.upper_bound(p_ip);
+			if (l_range != m_table.begin() && (--l_range)->second.first >= p_ip)
+			{
+				l_value = l_range->second.second;
+				const Range l_item = { l_range->first, l_range->second.first, l_value };
+				m_ranges.push_back(l_item);
+			}
+			return m_ip_cache[p_ip] = l_value;
+		}
+	private:
+		struct Range
+		{
+			uint32_t m_start;
+			uint32_t m_stop;
+			uint32_t m_value;
+		};
+		const Table& m_table;
+		std::vector<Range> m_ranges;
+		boost::unordered_map<uint32_t, uint32_t> m_ip_cache;
+		FastCriticalSection m_cs;
+};
+
+void test_geo_ip()
+{
+	srand(1);
+	// ~200k country-sized ranges with gaps, like fly_country_ip
+	TestOldGeoLookup::Table l_table;
+	CFlyIPRangeIndex l_index;
+	uint32_t l_ip = 0x01000000;
+	for (uint32_t l_value = 1; l_value <= 200000; ++l_value)
+	{
+		const uint32_t l_stop = l_ip + 256 + rand() % 16000;
+		l_table[l_ip] = std::make_pair(l_stop, l_value % 250 + 1);
+		l_index.add(l_ip, l_stop, l_value % 250 + 1);
+		l_ip = l_stop + 1 + (rand() % 4 == 0 ? rand() % 4096 : 0);
+	}
+	l_index.build();
+	// the users of a few big hubs: 20k addresses, every one is looked up many times
+	std::vector<uint32_t> l_users(20000);
+	for (auto i = l_users.begin(); i != l_users.end(); ++i)
+		*i = 0x01000000 + uint32_t((uint64_t(rand() & 0x7FFF) << 15 | (rand() & 0x7FFF)) * (l_ip - 0x01000000) >> 30);
+	const unsigned l_count = 2 * 1000 * 1000;
+	std::vector<uint32_t> l_lookups(l_count);
+	for (auto i = l_lookups.begin(); i != l_lookups.end(); ++i)
+		*i = l_users[(unsigned(rand() & 0x7FFF) << 15 | (rand() & 0x7FFF)) % l_users.size()];
+		
+	TestOldGeoLookup l_old(l_table);
+	uint64_t l_old_sum = 0;
+	performance::timer l_timer;
+	l_timer.start();
+	for (auto i = l_lookups.cbegin(); i != l_lookups.cend(); ++i)
+		l_old_sum += l_old.find(*i);
+	const double l_old_time = l_timer.finish();
+	uint64_t l_new_sum = 0;
+	l_timer.start();
+	for (auto i = l_lookups.cbegin(); i != l_lookups.cend(); ++i)
+		l_new_sum += l_index.find(*i);
+	const double l_new_time = l_timer.finish();
+	// every address of the table: the first and the last address of each range and the gaps between them
+	bool l_is_valid = l_old_sum == l_new_sum;
+	uint32_t l_prev_stop = 0;
+	for (auto i = l_table.cbegin(); i != l_table.cend() && l_is_valid; ++i)
+	{
+		l_is_valid &= l_index.find(i->first) == i->second.second && l_index.find(i->second.first) == i->second.second;
+		if (i->first > l_prev_stop + 1)
+			l_is_valid &= l_index.find(i->first - 1) == 0;
+		l_prev_stop = i->second.first;
+	}
+	l_is_valid &= l_index.find(0) == 0 && l_index.find(0xFFFFFFFF) == 0;
+	std::cout << "GeoIP " << l_index.size() << " ranges, " << l_count << " lookups: cache + linear walk + query = "
+	          << l_count / l_old_time << " lookups/s, CFlyIPRangeIndex = " << l_count / l_new_time
+	          << " lookups/s, check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+}
+
+// File list loading (DirectoryListing): status of every TTH of a synthetic 1M-file listing.
+// The former way - one point lookup per file with the decimal value parsed from a string - vs
+// CFlyLevelDB::get_values: CFlyTTHFilter drops the unknown TTHs, the rest is read in one sorted pass.
+// A sorted std::map stands in for LevelDB (Get = find, Iterator::Seek = lower_bound).
+void test_tth_filter()
+{
+	typedef std::map<std::string, std::string> TestLevelDB;
+	const size_t l_db_count = 300 * 1000;
+	const size_t l_list_count = 1000 * 1000;
+	srand(1);
+	std::vector<std::string> l_db_keys(l_db_count);
+	TestLevelDB l_db;
+	CFlyTTHFilter l_filter;
+	l_filter.init(l_db_count);
+	for (auto i = l_db_keys.begin(); i != l_db_keys.end(); ++i)
+	{
+		i->resize(24);
+		for (auto j = i->begin(); j != i->end(); ++j)
+			*j = char(rand());
+		l_db[*i] = std::to_string(1 + rand() % 7);
+		l_filter.add(reinterpret_cast<const uint8_t*>(i->data()));
+	}
+	// 5% of the listing is known: downloaded before, shared before or a known virus
+	std::vector<std::string> l_list(l_list_count);
+	for (auto i = l_list.begin(); i != l_list.end(); ++i)
+	{
+		if (rand() % 20 == 0)
+		{
+			*i = l_db_keys[(unsigned(rand() & 0x7FFF) << 15 | (rand() & 0x7FFF)) % l_db_count];
+		}
+		else
+		{
+			i->resize(24);
+			for (auto j = i->begin(); j != i->end(); ++j)
+				*j = char(rand());
+		}
+	}
+	
+	std::vector<uint8_t> l_old(l_list_count);
+	performance::timer l_timer;
+	l_timer.start();
+	for (size_t i = 0; i < l_list_count; ++i)
+	{
+		const auto l_value = l_db.find(l_list[i]);
+		if (l_value != l_db.end())
+			l_old[i] = uint8_t(atoi(l_value->second.c_str()));
+	}
+	const double l_old_time = l_timer.finish();
+	
+	std::vector<uint8_t> l_new(l_list_count);
+	l_timer.start();
+	std::vector<uint32_t> l_candidates;
+	for (uint32_t i = 0; i < l_list_count; ++i)
+	{
+		if (l_filter.contains(reinterpret_cast<const uint8_t*>(l_list[i].data())))
+			l_candidates.push_back(i);
+	}
+	std::sort(l_candidates.begin(), l_candidates.end(), [&l_list](uint32_t a, uint32_t b)
+	{
+		return l_list[a] < l_list[b];
+	});
+	auto l_it = l_db.cbegin();
+	for (auto i = l_candidates.cbegin(); i != l_candidates.cend() && l_it != l_db.cend(); ++i)
+	{
+		l_it = l_db.lower_bound(l_list[*i]);
+		if (l_it != l_db.cend() && l_it->first == l_list[*i])
+		{
+			uint32_t l_status = 0;
+			for (auto j = l_it->second.cbegin(); j != l_it->second.cend() && *j >= '0' && *j <= '9'; ++j)
+				l_status = l_status * 10 + (*j - '0');
+			l_new[*i] = uint8_t(l_status);
+		}
+	}
+	const double l_new_time = l_timer.finish();
+	
+	size_t l_known = 0;
+	for (auto i = l_old.cbegin(); i != l_old.cend(); ++i)
+		l_known += *i != 0;
+	const size_t l_false_positives = l_candidates.size() - l_known;
+	const bool l_is_valid = l_old == l_new && l_known > l_list_count / 25 && l_false_positives < l_list_count / 100;
+	std::cout << "TTH status of " << l_list_count << " files (" << l_db_count << " in the database): point lookups = "
+	          << l_old_time * 1000 << " ms, filter + sorted pass = " << l_new_time * 1000 << " ms, known = " << l_known
+	          << ", false positives = " << l_false_positives << ", filter = " << l_filter.getByteSize() / 1024 << " KiB, check "
+	          << (l_is_valid ? "OK" : "FAILED") << std::endl;
+}
+
+// ThrottleManager::rebalance: CFlyBandwidthSplit over a grid of budgets, weights and speeds. The limits must not add up
+// to more than the budget, a side at its share keeps it and an idle side lends to a busy one
+void test_throttle_split()
+{
+	const int64_t l_min = CFlyBandwidthSplit::MIN_LIMIT;
+	const int64_t l_budgets[] = { 1, 1500, 2048, 100 * 1024, 10 * 1024 * 1024 };
+	const int l_weights[] = { 0, 10, 50, 90, 100 };
+	bool l_is_valid = true;
+	size_t l_count = 0;
+	for (size_t b = 0; b < _countof(l_budgets); ++b)
+	{
+		const int64_t l_budget = l_budgets[b];
+		for (size_t w = 0; w < _countof(l_weights); ++w)
+		{
+			const int64_t l_torrent_share = l_budget * l_weights[w] / 100;
+			const int64_t l_dc_share = l_budget - l_torrent_share;
+			for (int d = 0; d <= 10; ++d)
+			{
+				for (int t = 0; t <= 10; ++t)
+				{
+					const int64_t l_dc_speed = l_budget * d / 10;
+					const int64_t l_torrent_speed = l_budget * t / 10;
+					int64_t l_dc_limit = -1;
+					int64_t l_torrent_limit = -1;
+					CFlyBandwidthSplit::split(l_budget, l_weights[w], l_dc_speed, l_torrent_speed, l_dc_limit, l_torrent_limit);
+					++l_count;
+					bool l_is_ok = l_dc_limit >= l_min && l_torrent_limit >= l_min &&
+					               l_dc_limit + l_torrent_limit <= std::max(l_budget, 2 * l_min);
+					if (l_budget >= 4 * l_min)
+					{
+						if (l_dc_speed >= l_dc_share)
+							l_is_ok = l_is_ok && l_dc_limit >= std::min(l_dc_share, l_budget - l_min);
+						if (l_torrent_speed >= l_torrent_share)
+							l_is_ok = l_is_ok && l_torrent_limit >= std::min(l_torrent_share, l_budget - l_min);
+						if (l_torrent_speed == 0 && l_dc_speed >= l_dc_share && l_torrent_share >= 4 * l_min)
+							l_is_ok = l_is_ok && l_dc_limit > l_dc_share;
+						if (l_dc_speed == 0 && l_torrent_speed >= l_torrent_share && l_dc_share >= 4 * l_min)
+							l_is_ok = l_is_ok && l_torrent_limit > l_torrent_share;
+					}
+					if (!l_is_ok)
+					{
+						std::cout << "budget = " << l_budget << " weight = " << l_weights[w] << " speeds = " << l_dc_speed << "/" << l_torrent_speed
+						          << " -> limits = " << l_dc_limit << "/" << l_torrent_limit << std::endl;
+						l_is_valid = false;
+					}
+				}
+			}
+		}
+	}
+	int64_t l_dc_limit = -1;
+	int64_t l_torrent_limit = -1;
+	CFlyBandwidthSplit::split(0, 50, 100, 100, l_dc_limit, l_torrent_limit);
+	l_is_valid = l_is_valid && l_dc_limit == 0 && l_torrent_limit == 0;
+	std::cout << "Throttle split: " << l_count << " cases, budget check " << (l_is_valid ? "OK" : "FAILED") << std::endl;
+}
+
+typedef void (*TestFunction)();
+static const struct
+{
+	const TCHAR* m_name;
+	TestFunction m_test;
+} g_named_tests[] =
+{
+	{ _T("bounded-queue"), &test_bounded_queue },
+	{ _T("adc-command"), &test_adc_command },
+	{ _T("packed-string-map"), &test_packed_string_map },
+	{ _T("share-scan"), &test_share_scan },
+	{ _T("share-snapshot"), &test_share_snapshot },
+	{ _T("segment-size"), &test_segment_size },
+	{ _T("line-framer"), &test_line_framer },
+	{ _T("base32"), &test_base32 },
+	{ _T("to-lower"), &test_to_lower },
+	{ _T("search-flood"), &test_search_flood },
+	{ _T("hash-bench"), &test_hash_bench },
+	{ _T("upload-queue"), &test_upload_queue },
+	{ _T("flood-guard"), &test_flood_guard },
+	{ _T("geo-ip"), &test_geo_ip },
+	{ _T("tth-filter"), &test_tth_filter },
+	{ _T("throttle-split"), &test_throttle_split },
+};
+
+static int run_named_test(const TCHAR* p_name)
+{
+	for (size_t i = 0; i < _countof(g_named_tests); ++i)
+	{
+		if (_tcscmp(g_named_tests[i].m_name, p_name) == 0)
+		{
+			g_named_tests[i].m_test();
+			return 0;
+		}
+	}
+	std::cout << "Unknown test. Available tests:" << std::endl;
+	for (size_t i = 0; i < _countof(g_named_tests); ++i)
+		std::wcout << g_named_tests[i].m_name << std::endl;
+	return 1;
+}
+
 int _tmain(int argc, _TCHAR* argv[])
 {
+	if (argc > 1)
+	{
+		return run_named_test(argv[1]);
+	}
 	/*
 	//std::vector<unique_ptr<A>> l_set;
 	    std::vector<A> l_set;
@@ -72,6 +72,7 @@ AdvancedPage::ListItem AdvancedPage::listItems[] =
 	{ SettingsManager::SQLITE_USE_JOURNAL_MEMORY, ResourceManager::SQLITE_USE_JOURNAL_MEMORY },// [+] IRainman
 	{ SettingsManager::USE_MAGNETS_IN_PLAYERS_SPAM, ResourceManager::USE_MAGNETS_IN_PLAYERS_SPAM }, // [+] SSA
 	{ SettingsManager::USE_BITRATE_FIX_FOR_SPAM, ResourceManager::USE_BITRATE_FIX_FOR_SPAM}, // [+] SSA
+	{ SettingsManager::MD5_USE_OPENSSL, ResourceManager::SETTINGS_MD5_USE_OPENSSL },
 	{ 0, ResourceManager::SETTINGS_AUTO_AWAY }
 };
 
@@ -872,9 +872,11 @@ void BaseChatFrame::appendLogToChat(const string& path, const size_t linesCount)
 {
 	static const int64_t LOG_SIZE_TO_READ = 64 * 1024;
 	string buf;
+	LogManager::flush_all_log(100); // the queued lines are written by the log thread - the UI waits for them only briefly
 	try
 	{
-		File f(path, File::READ, File::OPEN);
+		// the log thread keeps the file open for writing
+		File f(path, File::READ, File::OPEN | File::SHARED);
 		const int64_t size = f.getSize();
 		if (size > LOG_SIZE_TO_READ)
 		{
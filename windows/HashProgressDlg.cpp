@@ -3,6 +3,7 @@
 #include "WinUtil.h"
 #include "HashProgressDlg.h"
 #include "../client/ShareManager.h"
+#include "../FlyFeatures/flyServer.h"
 
 // #include "../client/version.h"
 // TODO         !
@@ -146,10 +147,6 @@ void HashProgressDlg::updateStats()
 			SetDlgItemText(IDC_TIME_LEFT, (Util::formatSecondsW((int64_t)(fs + ss) / 2) + _T(' ') + TSTRING(LEFT)).c_str());
 		}
 	}
-#ifdef FLYLINKDC_USE_MEDIAINFO_SERVER
-	extern string g_cur_mediainfo_file_tth;
-	extern string g_cur_mediainfo_file;
-#endif // FLYLINKDC_USE_MEDIAINFO_SERVER
 	if (files == 0)
 	{
 		SetDlgItemText(IDC_CURRENT_FILE, CTSTRING(DONE));
@@ -159,13 +156,14 @@ void HashProgressDlg::updateStats()
 		SetDlgItemText(IDC_CURRENT_FILE, Text::toT(Text::toLabel(file)).c_str());
 	}
 #ifdef FLYLINKDC_USE_MEDIAINFO_SERVER
-	if (g_cur_mediainfo_file_tth.empty())
+	const string l_cur_mediainfo_tth = getCurMediainfoTTH();
+	if (l_cur_mediainfo_tth.empty())
 	{
 		SetDlgItemText(IDC_CURRENT_TTH, _T(""));
 	}
 	else
 	{
-		SetDlgItemText(IDC_CURRENT_TTH, Text::toT("TTH: " + g_cur_mediainfo_file_tth + " (mediainfo)").c_str());
+		SetDlgItemText(IDC_CURRENT_TTH, Text::toT("TTH: " + l_cur_mediainfo_tth + " (mediainfo)").c_str());
 	}
 #endif // FLYLINKDC_USE_MEDIAINFO_SERVER    
 	progress.SetPos(HashManager::getInstance()->GetProgressValue());
@@ -31,6 +31,7 @@ PropPage::TextItem LimitPage::texts[] =
 	{ IDC_CZDC_MIN_FILE_SIZE, ResourceManager::SETCZDC_MIN_FILE_SIZE },
 	{ IDC_SETTINGS_MB, ResourceManager::MB },
 	{ IDC_REMOVE_IF, ResourceManager::NEW_DISCONNECT },
+	{ IDC_SETTINGS_TORRENT_WEIGHT, ResourceManager::SETTINGS_THROTTLE_TORRENT_WEIGHT },
 	{ 0, ResourceManager::SETTINGS_AUTO_AWAY }
 };
 
@@ -45,6 +46,7 @@ PropPage::Item LimitPage::items[] =
 	{ IDC_BW_START_TIME, SettingsManager::BANDWIDTH_LIMIT_START, PropPage::T_INT },
 	{ IDC_BW_END_TIME, SettingsManager::BANDWIDTH_LIMIT_END, PropPage::T_INT },
 	{ IDC_THROTTLE_ENABLE, SettingsManager::THROTTLE_ENABLE, PropPage::T_BOOL },
+	{ IDC_THROTTLE_TORRENT_WEIGHT, SettingsManager::THROTTLE_TORRENT_WEIGHT, PropPage::T_INT },
 	{ IDC_I_DOWN_SPEED, SettingsManager::DISCONNECT_SPEED, PropPage::T_INT },
 	{ IDC_TIME_DOWN, SettingsManager::DISCONNECT_TIME, PropPage::T_INT },
 	{ IDC_H_DOWN_SPEED, SettingsManager::DISCONNECT_FILE_SPEED, PropPage::T_INT },
@@ -88,6 +90,9 @@ LRESULT LimitPage::onInitDialog(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lPara
 	spin.Attach(GetDlgItem(IDC_REMOVE_SPIN));
 	spin.SetRange32(0, 99999);
 	spin.Detach();
+	spin.Attach(GetDlgItem(IDC_THROTTLE_TORRENT_WEIGHT_SPIN));
+	spin.SetRange32(0, 100);
+	spin.Detach();
 	
 	// [+] InfinitySky.     .
 	timeCtrlBegin.Attach(GetDlgItem(IDC_BW_START_TIME));
@@ -143,6 +148,8 @@ void LimitPage::fixControls()
 	::EnableWindow(GetDlgItem(IDC_MX_DW_SP_LMT_NORMAL), true);
 	::EnableWindow(GetDlgItem(IDC_DOWNLOADSPEEDSPIN), true);
 	::EnableWindow(GetDlgItem(IDC_TIME_LIMITING), state);
+	::EnableWindow(GetDlgItem(IDC_THROTTLE_TORRENT_WEIGHT), state);
+	::EnableWindow(GetDlgItem(IDC_THROTTLE_TORRENT_WEIGHT_SPIN), state);
 	
 	state = ((IsDlgButtonChecked(IDC_THROTTLE_ENABLE) != 0) && (IsDlgButtonChecked(IDC_TIME_LIMITING) != 0));
 	::EnableWindow(GetDlgItem(IDC_BW_START_TIME), state);
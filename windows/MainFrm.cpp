@@ -992,11 +992,18 @@ LRESULT MainFrame::onTimer(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/,
 			Stats->push_back(TSTRING(D) + _T(' ') + Util::formatBytesW(l_CurrentDown));
 			Stats->push_back(TSTRING(U) + _T(' ') + Util::formatBytesW(l_CurrentUp));
 			const bool l_ThrottleEnable = BOOLSETTING(THROTTLE_ENABLE);
+			// BitTorrent part of the speed, ThrottleManager splits the limits between DC and BitTorrent by it
+			const auto l_traffic = ThrottleManager::getInstance()->getTrafficStat();
+			const auto l_torrent_speed = [](int64_t p_speed) -> tstring
+			{
+				return p_speed ? _T(" (BT ") + Util::formatBytesW(p_speed) + _T('/') + TSTRING(S) + _T(')') : Util::emptyStringT;
+			};
 			Stats->push_back(TSTRING(D) + _T(" [") + Util::toStringW(DownloadManager::getDownloadCount()) + _T("][")
 			                 + ((!l_ThrottleEnable || ThrottleManager::getInstance()->getDownloadLimitInKBytes() == 0) ?
 			                    TSTRING(N) : Util::toStringW((int)ThrottleManager::getInstance()->getDownloadLimitInKBytes()) + TSTRING(KILO)) + _T("] ")
-			                 + l_dlstr + _T('/') + TSTRING(S));
-			Stats->push_back(TSTRING(U) + _T(" [") + Util::toStringW(UploadManager::getUploadCount()) + _T("][") + ((!l_ThrottleEnable || ThrottleManager::getInstance()->getUploadLimitInKBytes() == 0) ? TSTRING(N) : Util::toStringW((int)ThrottleManager::getInstance()->getUploadLimitInKBytes()) + TSTRING(KILO)) + _T("] ") + l_ulstr + _T('/') + TSTRING(S));
+			                 + l_dlstr + _T('/') + TSTRING(S) + l_torrent_speed(l_traffic.m_torrent_download));
+			Stats->push_back(TSTRING(U) + _T(" [") + Util::toStringW(UploadManager::getUploadCount()) + _T("][") + ((!l_ThrottleEnable || ThrottleManager::getInstance()->getUploadLimitInKBytes() == 0) ? TSTRING(N) : Util::toStringW((int)ThrottleManager::getInstance()->getUploadLimitInKBytes()) + TSTRING(KILO)) + _T("] ") + l_ulstr + _T('/') + TSTRING(S)
+			                 + l_torrent_speed(l_traffic.m_torrent_upload));
 			g_CountSTATS++;
 			if (!PostMessage(WM_SPEAKER, MAIN_STATS, (LPARAM)Stats))
 			{
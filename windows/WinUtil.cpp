@@ -45,6 +45,7 @@
 #include "../client/HashManager.h"
 #include "../client/File.h"
 #include "../client/DownloadManager.h"
+#include "../client/CFlyHashBackend.h"
 #include "MagnetDlg.h"
 // AirDC++
 #include "winamp.h"
@@ -1442,6 +1443,7 @@ tstring WinUtil::getCommandsList()
 	       _T("\n/dsp, /dsp pub \t\t\t\t") + TSTRING(DISK_SPACE) +
 	       _T("\n/disks, /disks pub \t\t\t\t") + TSTRING(DISKS_INFO) +
 	       _T("\n/cpu, /cpu pub \t\t\t\t") + TSTRING(CPU_INFO) +
+	       _T("\n/hashbench \t\t\t\t") + TSTRING(CMD_HASHBENCH) +
 	       // AirDC++
 	       _T("\n/stats \t\t\t\t\t") + TSTRING(CMD_STATS) +
 	       _T("\n/stats pub\t\t\t\t") + TSTRING(CMD_PUBLIC_STATS) +
@@ -1477,6 +1479,23 @@ tstring WinUtil::getCommandsList()
 	       _T("\n------------------------------------------------------------------------------------------------------------------------------------------------------------\n")
 	       ;
 }
+
+// /hashbench hashes 64 MB with every backend - not in the UI thread, the result goes to the system log
+class HashBenchThread : public Thread
+{
+	public:
+		static std::atomic<bool> g_is_running;
+	private:
+		int run()
+		{
+			LogManager::message("Hash backends:\r\n" + CFlyHashBackend::benchmark(64 * 1024 * 1024));
+			g_is_running = false;
+			delete this;
+			return 0;
+		}
+};
+std::atomic<bool> HashBenchThread::g_is_running(false);
+
 bool WinUtil::checkCommand(tstring& cmd, tstring& param, tstring& message, tstring& status, tstring& local_message)
 {
 	string::size_type i = cmd.find(' ');
@@ -1640,6 +1659,26 @@ bool WinUtil::checkCommand(tstring& cmd, tstring& param, tstring& message, tstri
 			local_message = tmp;
 		}
 	}
+	else if ((stricmp(cmd.c_str(), _T("hashbench")) == 0))
+	{
+		if (HashBenchThread::g_is_running.exchange(true))
+		{
+			local_message = _T("/hashbench is already running");
+		}
+		else
+		{
+			try
+			{
+				(new HashBenchThread())->start(0);
+				local_message = _T("/hashbench started, the result will be in the system log");
+			}
+			catch (const ThreadException& e)
+			{
+				HashBenchThread::g_is_running = false;
+				local_message = Text::toT(e.getError());
+			}
+		}
+	}
 	else if ((stricmp(cmd.c_str(), _T("dsp")) == 0))
 	{
 		tstring tmp = _T("My Disk Space: ") + Text::toT(CompatibilityManager::DiskSpaceInfo());
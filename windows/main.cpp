@@ -802,7 +802,7 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lp
 	_Module.Term();
 	::CoUninitialize();
 	DestroySplash();
-	LogManager::flush_all_log();
+	LogManager::shutdown();
 	leveldb::LevelDBDestoyModule();
 	return nRet;
 }
@@ -1628,6 +1628,9 @@
 #define IDC_COPY_TORRENT_PAGE           2532
 #define IDC_PAUSE_TORRENT               2533
 #define IDC_RESUME_TORRENT              2534
+#define IDC_THROTTLE_TORRENT_WEIGHT     2535
+#define IDC_THROTTLE_TORRENT_WEIGHT_SPIN 2536
+#define IDC_SETTINGS_TORRENT_WEIGHT     2537
 #define IDC_DOWNLOAD_TARGET_DIR         3000
 #define IDC_SELECT_WINDOW               3500
 #define IDC_USER_COMMAND                4000